@@ -3,6 +3,14 @@
 #include "symboltable.h"
 
 #include "builtins.h"
+#include "optimize.h"
+#include "jit.h"
+#include "port.h"
+#include "csv.h"
+#include "regexp.h"
+#include "persistent.h"
+#include "rope.h"
+#include <stdint.h>
 
 typedef struct AllocNode_S {
     struct AllocNode_S *next;
@@ -11,34 +19,105 @@ typedef struct AllocNode_S {
     size_t size;
 } AllocNode;
 
-#define ALLOC_ROOT_SIZE 1024
-static AllocNode *alloc_root[ALLOC_ROOT_SIZE];
+//the alloc table is a hash table from the address of each allocated object to its node.
+//it grows with the number of objects so the lookups done when scanning the stack stay cheap
+#define ALLOC_ROOT_INITIAL_SIZE 1024
+static AllocNode **alloc_root = NULL;
+static size_t alloc_root_size = 0;
+static size_t nallocs = 0;
 static size_t total_memory_use = 0;
 
+//memory use that triggers the next automatic collection
+static size_t gc_threshold = GC_MIN_THRESHOLD;
+static bool automatic_gc = false;
+static char *stack_base = NULL;
+
+//extra root arrays, see gc_add_roots
+typedef struct {
+    LispObject **objects;
+    int n;
+} RootArray;
+static RootArray *roots = NULL;
+static int nroots = 0;
+
+static size_t alloc_hash(void *value, size_t size) {
+    return (((uintptr_t)value) >> 4) % size;
+}
+
 //initialize the allocation system
-void init_alloc_system() {
-    int i;
-    for(i = 0; i < ALLOC_ROOT_SIZE; i++)
-        alloc_root[i] = NULL;
+//stack_base is an address in the stack frame of main, or the closest function to it that
+//can be got at, which is where the stack is scanned to (see collect_garbage)
+void init_alloc_system(void *stack) {
+    alloc_root_size = ALLOC_ROOT_INITIAL_SIZE;
+    alloc_root = calloc(alloc_root_size, sizeof(*alloc_root));
+    stack_base = stack;
+}
+
+//turns collections during allocation on or off. they're off while compiling to C,
+//where objects are held in memory the collector doesn't look at, and while loading
+//an image. what was allocated while they were off is taken to be live, so the next
+//collection waits until memory use has doubled
+void set_automatic_gc(bool on) {
+    if(on && !automatic_gc && 2 * total_memory_use > gc_threshold)
+        gc_threshold = 2 * total_memory_use;
+    automatic_gc = on;
+}
+
+//makes the n objects at objects roots for the collector, for objects held in static storage
+//elements may be NULL
+void gc_add_roots(LispObject **objects, int n) {
+    roots = realloc(roots, (nroots + 1) * sizeof(*roots));
+    roots[nroots].objects = objects;
+    roots[nroots].n = n;
+    nroots++;
 }
 
-//allocate a new block of memory of size size
+//doubles the size of the alloc table
+static void grow_alloc_table() {
+    size_t new_size = alloc_root_size * 2;
+    AllocNode **new_root = calloc(new_size, sizeof(*new_root));
+    for(size_t i = 0; i < alloc_root_size; i++) {
+        AllocNode *node = alloc_root[i];
+        while(node != NULL) {
+            AllocNode *next = node->next;
+            size_t j = alloc_hash(node->value, new_size);
+            node->next = new_root[j];
+            new_root[j] = node;
+            node = next;
+        }
+    }
+    free(alloc_root);
+    alloc_root = new_root;
+    alloc_root_size = new_size;
+}
+
+//allocate a new block of memory of size size, zeroed so the collector can look at it
+//before it's filled in. may collect garbage first
 void *alloc(size_t size) {
-    void *value = malloc(size);
+    if(automatic_gc && total_memory_use > gc_threshold) {
+        collect_garbage();
+        gc_threshold = 2 * total_memory_use > GC_MIN_THRESHOLD ? 2 * total_memory_use : GC_MIN_THRESHOLD;
+    }
+    if(nallocs >= 2 * alloc_root_size)
+        grow_alloc_table();
+
+    void *value = calloc(1, size);
     AllocNode *node = malloc(sizeof(AllocNode));
     node->value = value;
     node->size = size;
-    int i = ((int)value) % ALLOC_ROOT_SIZE;
+    node->marked = false;
+    size_t i = alloc_hash(value, alloc_root_size);
     node->next = alloc_root[i];
     alloc_root[i] = node;
     total_memory_use += size + sizeof(AllocNode);
+    nallocs++;
     return value;
 }
 
 //find the alloc node holding the memory pointer value
 //the node before it is put into prev_out, or NULL if there is none
 static AllocNode *find_alloc_node(void *value, AllocNode **prev_out) {
-    int i = ((int)value) % ALLOC_ROOT_SIZE;
+    size_t i = alloc_hash(value, alloc_root_size);
     AllocNode *prev = NULL;
     AllocNode *node = alloc_root[i];
     while(node != NULL) {
@@ -55,8 +134,7 @@ static AllocNode *find_alloc_node(void *value, AllocNode **prev_out) {
 //calculates the amount of memory in the alloc table
 size_t memory_in_alloc_table() {
     size_t out = 0;
-    int i;
-    for(i = 0; i < ALLOC_ROOT_SIZE; i++) {
+    for(size_t i = 0; i < alloc_root_size; i++) {
         AllocNode *node = alloc_root[i];
         while(node != NULL) {
             out += node->size + sizeof(AllocNode);
@@ -66,48 +144,151 @@ size_t memory_in_alloc_table() {
     return out;
 }
 
+//returns true if the allocated memory at value was marked live by the last gc_mark pass
+static bool is_marked(void *value) {
+    AllocNode *an = find_alloc_node(value, NULL);
+    return an == NULL || an->marked;
+}
+
 //marks an object and all it's referenced objects (currently hard-coded code) as being live
+//the cdrs of lists and the forced values of lazy sequences are followed in a loop,
+//so long lists don't use up the C stack
 static void gc_mark(LispObject *obj) {
-    AllocNode *an = find_alloc_node(obj, NULL);
-    if(an == NULL) {
-        if(obj->type != &SymbolType && obj != (LispObject*)nil)
-            fprintf(stderr,
-                    "Rather horrid error, object at %p of type %s not in alloc_table\n",
-                    obj,
-                    obj->type->name);
+    while(obj != NULL) {
+        AllocNode *an = find_alloc_node(obj, NULL);
+        if(an == NULL) {
+            if(obj->type != &SymbolType && obj != (LispObject*)nil && obj != tee && !is_small_int(obj))
+                fprintf(stderr,
+                        "Rather horrid error, object at %p of type %s not in alloc_table\n",
+                        obj,
+                        obj->type->name);
+            return;
+        }
+        if(an->marked)
+            return;
+        an->marked = true;
+
+        //objects still being built have no type yet
+        if(obj->type == NULL)
+            return;
+        if(obj->type == &ConsCellType) {
+            ConsCell *con = (ConsCell*)obj;
+            gc_mark(con->car);
+            obj = con->cdr;
+            continue;
+        }
+        if(obj->type == &LazySeqType) {
+            LazySeq *seq = (LazySeq*)obj;
+            gc_mark(seq->fn);
+            gc_mark(seq->source);
+            obj = seq->value;
+            continue;
+        }
+
+        if(obj->type == &MacroType) {
+            Macro *mac = (Macro*)obj;
+            gc_mark((LispObject*)mac->args);
+            gc_mark((LispObject*)mac->body);
+            gc_mark((LispObject*)mac->context);
+        } else if(obj->type == &NodeType) {
+            gc_mark(((Node*)obj)->source);
+        } else if(obj->type == &RegexType) {
+            gc_mark((LispObject*)((Regex*)obj)->pattern);
+        } else if(obj->type == &VectorType) {
+            Vector *v = (Vector*)obj;
+            if(v->base != NULL) {
+                obj = (LispObject*)v->base;
+                continue;
+            }
+            for(int i = 0; i < v->size; i++)
+                gc_mark(v->array[(v->start + i) & (v->array_size - 1)]);
+        } else if(obj->type == &MemoType) {
+            Memo *m = (Memo*)obj;
+            gc_mark(m->function);
+            for(MemoEntry *e = m->newest; e != NULL; e = e->older) {
+                for(int i = 0; i < e->argc; i++)
+                    gc_mark(e->argv[i]);
+                gc_mark(e->value);
+            }
+        } else if(obj->type == &DictType) {
+            Dict *d = (Dict*)obj;
+            for(int i = 0; i < d->array_size; i++)
+                if(d->slots[i].key != NULL) {
+                    gc_mark(d->slots[i].key);
+                    gc_mark(d->slots[i].value);
+                }
+        } else if(obj->type == &PMapType || obj->type == &TransientMapType) {
+            gc_mark((LispObject*)((PMap*)obj)->root);
+        } else if(obj->type == &HamtNodeType) {
+            HamtNode *node = (HamtNode*)obj;
+            int length = hamt_node_length(node);
+            for(int i = 0; i < length; i++)
+                gc_mark(node->array[i]);
+        } else if(obj->type == &PVectorType || obj->type == &TransientVectorType) {
+            gc_mark((LispObject*)((PVector*)obj)->root);
+            gc_mark((LispObject*)((PVector*)obj)->tail);
+        } else if(obj->type == &PVecNodeType) {
+            for(int i = 0; i < TRIE_WIDTH; i++)
+                gc_mark(((PVecNode*)obj)->array[i]);
+        } else if(obj->type == &RopeType) {
+            Rope *r = (Rope*)obj;
+            gc_mark((LispObject*)r->str);
+            gc_mark((LispObject*)r->left);
+            obj = (LispObject*)r->right;
+            continue;
+        }
         return;
     }
-    if(an->marked)
+}
+
+//marks everything that a word on the C stack, or in a callee saved register, points to.
+//C code keeps objects in local variables all the time, so anything that looks like a
+//pointer to an object is taken to be one. this reads past the ends of other functions'
+//variables, so it's kept out of address sanitizer builds' checks
+__attribute__((no_sanitize_address)) static void mark_stack() {
+    if(stack_base == NULL)
         return;
-    an->marked = true;
-    
-    if(obj->type == &ConsCellType) {
-        ConsCell *con = (ConsCell*)obj;
-        gc_mark(con->car);
-        gc_mark(con->cdr);
-    } else if(obj->type == &MacroType) {
-        Macro *mac = (Macro*)obj;
-        gc_mark((LispObject*)mac->args);
-        gc_mark((LispObject*)mac->body);
-        gc_mark((LispObject*)mac->context);
-    } else if(obj->type == &VectorType) {
-        Vector *v = (Vector*)obj;
-        for(int i = 0; i < v->size; i++)
-            gc_mark(vector_getitem(v, i));
-    } else if(obj->type == &DictType) {
-        Dict *d = (Dict*)obj;
-        for(int i = 0; i < d->array_size; i++)
-            if(d->keys[i] != NULL) {
-                gc_mark(d->keys[i]);
-                gc_mark(d->values[i]);
-            }
+    __builtin_unwind_init(); //spills the callee saved registers into this frame
+    void *here = &here;
+    for(void **p = (void**)(((uintptr_t)&here) & ~(uintptr_t)(sizeof(void*) - 1));
+        (char*)p < stack_base;
+        p++) {
+        if(*p != NULL && find_alloc_node(*p, NULL) != NULL)
+            gc_mark(*p);
+    }
+}
+
+//frees memory an object owns apart from its own block
+static void release_object(LispObject *obj) {
+    if(obj->type == &StrType)
+        free(((Str*)obj)->array);
+    else if(obj->type == &VectorType)
+        free(((Vector*)obj)->array);
+    else if(obj->type == &DictType)
+        free(((Dict*)obj)->slots);
+    else if(obj->type == &MacroType)
+        jit_discard((Macro*)obj);
+    else if(obj->type == &MemoType)
+        free_memo_entries((Memo*)obj);
+    else if(obj->type == &PortType)
+        port_close((Port*)obj);
+    else if(obj->type == &RegexType)
+        free_regex((Regex*)obj);
+    else if(obj->type == &StrBuilderType)
+        free(((StrBuilder*)obj)->array);
+    else if(obj->type == &IntColumnType)
+        free(((IntColumn*)obj)->array);
+    else if(obj->type == &StrColumnType) {
+        free(((StrColumn*)obj)->chars);
+        free(((StrColumn*)obj)->offsets);
     }
 }
 
 //deallocates dead objects and removes their entries from the alloc table
+//objects are live if they can be reached from the symbol table, the call stack,
+//the roots added with gc_add_roots or anything on the C stack
 void collect_garbage() {
-    int i;
-    for(i = 0; i < ALLOC_ROOT_SIZE; i++) {
+    for(size_t i = 0; i < alloc_root_size; i++) {
         AllocNode *node = alloc_root[i];
         while(node != NULL) {
             node->marked = false;
@@ -119,20 +300,31 @@ void collect_garbage() {
 
     gc_mark((LispObject*)call_stack);
 
-    for(i = 0; i < ALLOC_ROOT_SIZE; i++) {
+    gc_mark((LispObject*)quote_builtin);
+
+    for(int i = 0; i < nroots; i++)
+        for(int j = 0; j < roots[i].n; j++)
+            gc_mark(roots[i].objects[j]);
+
+    mark_stack();
+
+    prune_resolved_heads(is_marked);
+
+    for(size_t i = 0; i < alloc_root_size; i++) {
         AllocNode *prev = NULL;
         AllocNode *node = alloc_root[i];
         AllocNode *tmp;
         while(node != NULL) {
             if(!node->marked) {
+                LispObject *obj = node->value;
                 if(ALLOC_VERBOSE) {
                     printf("garbage collecting object of type %s at %p \n",
-                           ((LispObject*)node->value)->type->name,
+                           obj->type ? obj->type->name : "none",
                            node->value);
                     printf("total mem: %d, amt in alloc table: %d, difference: %d\n",
-                           total_memory_use,
-                           memory_in_alloc_table(),
-                           total_memory_use - memory_in_alloc_table());
+                           (int)total_memory_use,
+                           (int)memory_in_alloc_table(),
+                           (int)(total_memory_use - memory_in_alloc_table()));
                 }
   
                 if(prev == NULL)
@@ -141,8 +333,11 @@ void collect_garbage() {
                     prev->next = node->next;
 
                 total_memory_use -= node->size + sizeof(AllocNode);
+                nallocs--;
 
                 tmp = node->next;
+                if(obj->type != NULL)
+                    release_object(obj);
                 free(node->value);
                 free(node);
                 node = tmp;
@@ -3,9 +3,17 @@
 
 #include "common.h"
 #include "symboltable.h"
+#include "lisptype.h"
 #include <stdlib.h>
 
-void init_alloc_system();
+//memory use below which garbage is never collected automatically
+#ifndef GC_MIN_THRESHOLD
+#define GC_MIN_THRESHOLD (8 * 1024 * 1024)
+#endif
+
+void init_alloc_system(void *stack_base);
+void set_automatic_gc(bool on);
+void gc_add_roots(LispObject **objects, int n);
 void *alloc(size_t size);
 size_t memory_in_alloc_table();
 void collect_garbage();
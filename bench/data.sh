@@ -0,0 +1,24 @@
+#!/bin/bash
+#measures how fast read-data parses a generated data file, in MB/s
+#usage: ./bench/data.sh [lisp binary] [records]
+
+lisp=${1:-./lisp}
+records=${2:-200000}
+runs=${RUNS:-5}
+data=$(mktemp)
+program=$(mktemp)
+trap 'rm -f "$data" "$program"' EXIT
+
+awk -v n="$records" 'BEGIN {
+    for(i = 0; i < n; i++)
+        printf("(record %d (name \"user number %d\") (tags alpha beta gamma) (scores %d %d %d)\n  \"a longer free text field with an \\\"escaped\\\" quote\")\n",
+               i, i, i % 97, i % 1009, i * 7)
+}' > "$data"
+echo "(read-data \"$data\")" > "$program"
+
+bytes=$(wc -c < "$data")
+TIMEFORMAT=%R
+best=$(for i in $(seq $runs); do
+           { time "$lisp" -f "$program" > /dev/null; } 2>&1 | tail -n 1
+       done | sort -n | head -n 1)
+awk -v b="$bytes" -v t="$best" 'BEGIN { printf("%d bytes in %ss, %.1f MB/s\n", b, t, b / t / 1000000) }'
@@ -0,0 +1,23 @@
+#!/bin/bash
+#times each benchmark with each of the given lisp binaries, taking the best of a few runs
+#extra flags for the binaries go after --, e.g. ./bench/run.sh ./lisp -- --no-jit --fuel 1000000000
+#usage: ./bench/run.sh [lisp binary]... [-- flags...]
+
+binaries=()
+while [ $# -gt 0 ] && [ "$1" != "--" ]; do
+    binaries+=("$1")
+    shift
+done
+[ "$1" == "--" ] && shift
+[ ${#binaries[@]} -eq 0 ] && binaries=(./lisp)
+runs=${RUNS:-5}
+
+TIMEFORMAT=%U
+for bench in bench/*.l; do
+    for lisp in "${binaries[@]}"; do
+        best=$(for i in $(seq $runs); do
+                   { time "$lisp" "$@" -f "$bench" > /dev/null; } 2>&1 | tail -n 1
+               done | sort -n | head -n 1)
+        echo "$bench $lisp $best"
+    done
+done
@@ -0,0 +1,40 @@
+#!/bin/bash
+#measures how fast the str search builtins scan a large str, in GB/s
+#usage: ./bench/strings.sh [lisp binary] [megabytes] [extra lisp flags]
+
+lisp=${1:-./lisp}
+megabytes=${2:-64}
+flags=$3
+passes=${PASSES:-10}
+runs=${RUNS:-3}
+data=$(mktemp)
+program=$(mktemp)
+trap 'rm -f "$data" "$program"' EXIT
+
+awk -v n="$megabytes" 'BEGIN {
+    line = "lorem ipsum dolor sit amet, consectetur adipiscing elit, sed do eiusmod tempor\n"
+    for(i = 0; i < n * 1000000 / length(line); i++)
+        printf("%s", line)
+}' > "$data"
+bytes=$(wc -c < "$data")
+
+#best time of a run of the program with the form repeated passes times
+best_time() {
+    {
+        echo "(def text (read-bytes (open-input \"$data\") $bytes))"
+        echo "(def i 0)"
+        echo "(while (not (= i $passes)) (do $1 (set i (+ i 1))))"
+    } > "$program"
+    TIMEFORMAT=%R
+    for i in $(seq $runs); do
+        { time "$lisp" $flags -f "$program" > /dev/null; } 2>&1 | tail -n 1
+    done | sort -n | head -n 1
+}
+
+base=$(best_time "nil")
+for form in '(str-find text "not in the text")' '(str-count text "tempor")' \
+            '(str-index-of-any text "!?;")'; do
+    t=$(best_time "$form")
+    awk -v f="$form" -v b="$bytes" -v p="$passes" -v t="$t" -v base="$base" \
+        'BEGIN { printf("%-36s %.2f GB/s\n", f, b * p / (t - base) / 1000000000) }'
+done
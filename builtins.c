@@ -1,18 +1,34 @@
 #include "builtins.h"
 #include "symboltable.h"
 #include "error.h"
+#include "optimize.h"
+#include "jit.h"
+#include "safepoint.h"
+#include "reader.h"
+#include "printer.h"
+#include "port.h"
+#include "csv.h"
+#include "regexp.h"
+#include "strops.h"
+#include "persistent.h"
+#include "vecops.h"
+#include "rope.h"
+#include <string.h>
+#include <limits.h>
 
 
 Vector *call_stack;
 
 
-LispObject *eval(ConsCell *args) {
-    //args is a one elem list whose elem is a form that will be evaluated and the result evaluated
-    if(list_length(args) != 1)
-        error("Horrible error, wrong number of arguments to eval\n");
-    return eval_sub(eval_sub(args->car));
+LispObject *eval(int argc, LispObject **argv) {
+    //argv[0] is a form that has been evaluated, the result is evaluated again
+    return eval_sub(argv[0]);
 }
 
+static LispObject *apply_form(ConsCell *form);
+static LispObject *eval_node(Node *node);
+static LispObject *apply_special_form(BuiltinFunction *bf, ConsCell *args, bool counted);
+
 LispObject *eval_sub(LispObject *obj) {
     //obj is the object to be evaluated
     LispObject *out;
@@ -23,24 +39,365 @@ LispObject *eval_sub(LispObject *obj) {
         ConsCell *con = (ConsCell*)obj;
         if(con == nil)
             out = (LispObject*)nil;
-        else
-            out = apply_sub(con->car, (ConsCell*)con->cdr);
-    } else
+        else {
+            SAFEPOINT();
+            out = apply_form(con);
+        }
+    } else if(obj->type == &NodeType)
+        out = eval_node((Node*)obj);
+    else
         out = obj;
     return out;
 }
 
+//evaluates a node outside of the head of a form
+static LispObject *eval_node(Node *node) {
+    if(node->kind != NODE_LOCAL_LOAD)
+        return node->source;
+
+    //the symbol is usually at the same index in the innermost scope every time, since
+    //the scope of a function is built the same way on every call
+    Dict *d = (Dict*)((ConsCell*)vector_getitem(scopes, -1))->car;
+    int i = node->slot;
+    if(i >= 0 && i < d->array_size && d->slots[i].key == node->source && current_expansion == NULL)
+        return d->slots[i].value;
+    node->slot = dict_index_of(d, node->source);
+    return get_var((Symbol*)node->source);
+}
+
+//applies the +, - or = node to the unevaluated args, inline if both are ints
+//the node specializes on the first call and falls back to the builtin for good
+//the first time its arguments aren't both ints
+static LispObject *apply_int_op(Node *node, ConsCell *args) {
+    LispObject *argv[2];
+    argv[0] = eval_sub(args->car);
+    argv[1] = eval_sub(((ConsCell*)args->cdr)->car);
+    bool ints = argv[0]->type == &LispIntType && argv[1]->type == &LispIntType;
+
+    if(node->state == NODE_UNINITIALIZED)
+        node->state = ints ? NODE_INT_INT : NODE_GENERIC;
+    else if(node->state == NODE_INT_INT && !ints) {
+        if(VERBOSE)
+            printf("deoptimizing call to %s\n", ((BuiltinFunction*)node->source)->name);
+        node->state = NODE_GENERIC;
+    }
+    if(node->state == NODE_GENERIC)
+        return apply_values(node->source, 2, argv);
+
+    int a = ((LispInt*)argv[0])->n;
+    int b = ((LispInt*)argv[1])->n;
+    if(node->kind == NODE_ADD)
+        return new_lisp_int(a + b);
+    else if(node->kind == NODE_SUB)
+        return new_lisp_int(a - b);
+    return a == b ? tee : (LispObject*)nil;
+}
+
 LispObject *apply(ConsCell *args) {
     //args is a list whose 1st elem is an expression that will evaluate to the function to be applied
     //and whose 2nd elem is an expression that will evaluate to the arguments to the function
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to apply");
 
     LispObject *function = args->car;
     ConsCell *function_arguments = (ConsCell*)eval_sub(((ConsCell*)args->cdr)->car);
     return apply_sub(function, function_arguments);
 }
 
+//binds the arguments of the macro func to the unevaluated function_arguments
+//in a new scope on top of context, and evaluates its body there
+static LispObject *run_macro_body(Macro *func, ConsCell *function_arguments, LispObject *context) {
+    Dict *new_scope = (Dict*)new_dict();
+    ConsCell *new_scope_context = new_cons_cell((LispObject*)new_scope, context);
+    ConsCell *namecell = func->args;
+    ConsCell *valcell = function_arguments; //check this?
+    while(namecell != nil) {
+        if(valcell == nil)
+            raise_error(ERROR_ARITY, "Horrible error, not enough arguments to function\n");
+        dict_setitem(new_scope, namecell->car, valcell->car); //kinda hacky, this
+        namecell = (ConsCell*)namecell->cdr;
+        valcell = (ConsCell*)valcell->cdr;
+    }
+    if(valcell != nil)
+        raise_error(ERROR_ARITY, "Horrible error, too many arguments to function\n");
+
+    push_scope(new_scope_context);
+    LispObject *out = do_(func->body);
+    pop_scope();
+    return out;
+}
+
+//runs the macro mac on the unevaluated arguments function_arguments and returns the form it expands to
+//if pure is not NULL, it is set to false if the expansion depended on the caller's scope
+//or had side effects, in which case the expansion can't be reused for the next call
+//if globals_read is not NULL, it is set to the globals the expansion read, each followed
+//by the value it got, since the expansion can only be reused while they keep them
+LispObject *expand_macro(Macro *mac, ConsCell *function_arguments, bool *pure, ConsCell **globals_read) {
+    MacroExpansion expansion;
+    MacroExpansion *outer = current_expansion;
+    LispObject *caller_context = vector_getitem(scopes, -1);
+    expansion.caller_context = (ConsCell*)caller_context;
+    expansion.globals_read = nil;
+    expansion.impure = false;
+
+    //an error in the macro body must not leave current_expansion pointing at this frame
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        current_expansion = outer;
+        reraise_error();
+    }
+    current_expansion = &expansion;
+    LispObject *out = run_macro_body(mac, function_arguments, caller_context);
+    current_expansion = outer;
+    pop_exception_point(&ep);
+
+    if(outer != NULL && expansion.impure)
+        outer->impure = true;
+    ConsCell *read = expansion.globals_read;
+    for(; outer != NULL && read != nil; read = (ConsCell*)((ConsCell*)read->cdr)->cdr)
+        note_global_read((Symbol*)read->car, ((ConsCell*)read->cdr)->car);
+    if(pure != NULL && expansion.impure)
+        *pure = false;
+    if(globals_read != NULL)
+        *globals_read = expansion.globals_read;
+    return out;
+}
+
+//marks the macro expansion in progress, if there is one, as having side effects
+static void note_side_effect() {
+    if(current_expansion != NULL)
+        current_expansion->impure = true;
+}
+
+BuiltinFunction *do_builtin;
+BuiltinFunction *quote_builtin;
+
+//replaces the contents of the macro call form with expansion, so the macro is only
+//run once for this call site. atoms are wrapped in a do form since a cons cell
+//can't be overwritten with them
+void splice_expansion(ConsCell *form, LispObject *expansion) {
+    if(expansion->type == &ConsCellType && expansion != (LispObject*)nil && expansion != tee) {
+        ConsCell *con = (ConsCell*)expansion;
+        form->car = con->car;
+        form->cdr = con->cdr;
+    } else {
+        form->car = (LispObject*)do_builtin;
+        form->cdr = (LispObject*)new_cons_cell(expansion, (LispObject*)nil);
+    }
+}
+
+//a macro call whose expansion is cached becomes (node original . globals_read), where
+//node is a NODE_EXPANSION node holding the expansion, original is a copy of the call, and
+//globals_read is what expand_macro returned for it, with the macro's name first
+static void cache_expansion(ConsCell *form, LispObject *expansion, ConsCell *globals_read) {
+    for(ConsCell *read = globals_read; read != nil; read = (ConsCell*)((ConsCell*)read->cdr)->cdr)
+        watch_global((Symbol*)read->car);
+    Node *node = (Node*)new_node(NODE_EXPANSION, expansion);
+    node->state = expansion_rebind_count;
+    ConsCell *original = new_cons_cell(form->car, form->cdr);
+    form->cdr = (LispObject*)new_cons_cell((LispObject*)original, (LispObject*)globals_read);
+    form->car = (LispObject*)node;
+}
+
+//returns the expansion cached in the macro call form if the globals it read still have
+//the values they had, otherwise puts the call back in form and returns NULL
+LispObject *cached_expansion(ConsCell *form) {
+    Node *node = (Node*)form->car;
+    if(node->state == expansion_rebind_count)
+        return node->source;
+    ConsCell *original = (ConsCell*)((ConsCell*)form->cdr)->car;
+    ConsCell *read = (ConsCell*)((ConsCell*)form->cdr)->cdr;
+    for(; read != nil; read = (ConsCell*)((ConsCell*)read->cdr)->cdr) {
+        if(lookup_global_var((Symbol*)read->car) != ((ConsCell*)read->cdr)->car) {
+            if(VERBOSE)
+                printf("%s was rebound, expanding again\n", ((Symbol*)read->car)->name);
+            form->car = original->car;
+            form->cdr = original->cdr;
+            return NULL;
+        }
+    }
+    node->state = expansion_rebind_count;
+    return node->source;
+}
+
+static LispObject *apply_form(ConsCell *form) {
+    //form is a list whose car evaluates to a function or macro, which is applied to the rest
+    //macro calls are expanded the first time they're evaluated if the expansion only depends
+    //on the form itself, globals and the macro being bound globally (see expand_macro), and
+    //the expansion is kept in the form until one of those globals is rebound
+    if(form->car->type == &NodeType) {
+        Node *node = (Node*)form->car;
+        if(node->kind == NODE_EXPANSION) {
+            LispObject *expansion = cached_expansion(form);
+            if(expansion != NULL)
+                return eval_sub(expansion);
+        } else if(node->kind == NODE_FOLDED) {
+            LispObject *value = folded_value(form);
+            if(value != NULL)
+                return value;
+            return apply_form(form);
+        } else if(node->kind == NODE_SPECIAL_FORM)
+            return apply_special_form((BuiltinFunction*)node->source, (ConsCell*)form->cdr, true);
+        else if(node->kind != NODE_LOCAL_LOAD)
+            return apply_int_op(node, (ConsCell*)form->cdr);
+    }
+    LispObject *function = eval_sub(form->car);
+    if(function->type != &MacroType || ((Macro*)function)->is_function)
+        return apply_sub(function, (ConsCell*)form->cdr);
+
+    if(form->cdr->type != &ConsCellType)
+        error("Horrible error, 2nd argument of apply is not a list");
+
+    bool pure = form->car->type != &SymbolType || is_global_var((Symbol*)form->car);
+    ConsCell *globals_read;
+    vector_append(call_stack, function);
+    LispObject *expansion = expand_macro((Macro*)function, (ConsCell*)form->cdr, &pure, &globals_read);
+    vector_remove(call_stack, -1);
+
+    if(!pure)
+        return eval_sub(expansion);
+    if(VERBOSE) {
+        printf("caching expansion of "); obj_print(function); printf("\n");
+    }
+    if(form->car->type == &SymbolType) {
+        ConsCell *rest = new_cons_cell(function, (LispObject*)globals_read);
+        globals_read = new_cons_cell(form->car, (LispObject*)rest);
+    }
+    expansion = optimize(expansion);
+    cache_expansion(form, expansion, globals_read);
+    return eval_sub(expansion);
+}
+
+//raises an exception if argc arguments is the wrong number for the builtin bf
+static void check_arity(BuiltinFunction *bf, int argc) {
+    if(argc < bf->min_args || (bf->max_args != VARIADIC && argc > bf->max_args))
+        raise_error(ERROR_ARITY, "Horrible error, wrong number of arguments to %s\n", bf->name);
+}
+
+//returns the length of the argument list args
+//raises an exception if it is not a proper list
+static int count_args(ConsCell *args) {
+    int out = 0;
+    while(args != nil) {
+        if(args->type != &ConsCellType)
+            error("Horrible error, argument list is not a proper list\n");
+        args = (ConsCell*)args->cdr;
+        out++;
+    }
+    return out;
+}
+
+//calls the function func on the already evaluated arguments argv, through
+//its compiled code if it has been called often enough to be compiled
+static LispObject *apply_function(Macro *func, int argc, LispObject **argv) {
+    if(argc < func->arity)
+        raise_error(ERROR_ARITY, "Horrible error, not enough arguments to function\n");
+    if(argc > func->arity)
+        raise_error(ERROR_ARITY, "Horrible error, too many arguments to function\n");
+    SAFEPOINT();
+    CHECK_STACK();
+
+    if(JIT && func->jit_code == NULL && func->call_count <= JIT_THRESHOLD &&
+       ++func->call_count > JIT_THRESHOLD)
+        jit_compile(func);
+    if(func->jit_code != NULL) {
+        LispObject *out = jit_run(func, argv);
+        if(out != NULL)
+            return out;
+    }
+
+    Dict *new_scope = (Dict*)new_dict();
+    ConsCell *namecell = func->args;
+    for(int i = 0; i < argc; i++) {
+        dict_setitem(new_scope, namecell->car, argv[i]);
+        namecell = (ConsCell*)namecell->cdr;
+    }
+    push_scope(new_cons_cell((LispObject*)new_scope, (LispObject*)func->context));
+    LispObject *out = do_(func->body);
+    pop_scope();
+    return out;
+}
+
+//returns the cached result of the memoized function for argv, calling it if there is none
+static LispObject *apply_memo(Memo *memo, int argc, LispObject **argv) {
+    unsigned int hash = hash_values(argc, argv);
+    LispObject *out = memo_lookup(memo, argc, argv, hash);
+    if(out == NULL) {
+        out = apply_values(memo->function, argc, argv);
+        memo_store(memo, argc, argv, hash, out);
+    }
+    return out;
+}
+
+LispObject *apply_values(LispObject *function, int argc, LispObject **argv) {
+    //function is a builtin that takes evaluated arguments, or a function
+    //argv are the already evaluated arguments it is applied to
+    LispObject *out;
+
+    if(function->type == &BuiltinFunctionType &&
+       (((BuiltinFunction*)function)->flags & (BUILTIN_LEAF | BUILTIN_OWN_FRAME))) {
+        BuiltinFunction *bf = (BuiltinFunction*)function;
+        check_arity(bf, argc);
+        return bf->vfunc(argc, argv);
+    }
+
+    vector_append(call_stack, function);
+    if(function->type == &BuiltinFunctionType) {
+        BuiltinFunction *bf = (BuiltinFunction*)function;
+        if(bf->vfunc == NULL)
+            error("Horrible error, %s can't be applied to evaluated arguments\n", bf->name);
+        check_arity(bf, argc);
+        out = bf->vfunc(argc, argv);
+    } else if(function->type == &MemoType) {
+        out = apply_memo((Memo*)function, argc, argv);
+    } else {
+        Macro *func = safe_cast(function, &MacroType);
+        if(!func->is_function)
+            error("Horrible error, macro can't be applied to evaluated arguments\n");
+        out = apply_function(func, argc, argv);
+    }
+    vector_remove(call_stack, -1);
+    return out;
+}
+
+//calls the special form bf on the unevaluated args, counting them first unless the
+//optimizer already did (see NODE_SPECIAL_FORM)
+static LispObject *apply_special_form(BuiltinFunction *bf, ConsCell *args, bool counted) {
+    vector_append(call_stack, (LispObject*)bf);
+    if(!counted && (bf->min_args > 0 || bf->max_args != VARIADIC))
+        check_arity(bf, count_args(args));
+    LispObject *out = bf->cfunc(args);
+    vector_remove(call_stack, -1);
+    return out;
+}
+
+#define ARGV_STACK_SIZE 8
+
+//evaluates the elements of args into an argv array on the stack and applies
+//function (a builtin that takes evaluated arguments, or a function) to it
+static LispObject *apply_evaluated(LispObject *function, ConsCell *args) {
+    LispObject *argv[ARGV_STACK_SIZE];
+    int argc = 0;
+    while(args != nil && argc < ARGV_STACK_SIZE) {
+        if(args->type != &ConsCellType)
+            error("Horrible error, argument list is not a proper list\n");
+        argv[argc++] = eval_sub(args->car);
+        args = (ConsCell*)args->cdr;
+    }
+    if(args == nil)
+        return apply_values(function, argc, argv);
+
+    //too many to fit, count the rest and use a variable length array
+    int total = argc + count_args(args);
+    LispObject *long_argv[total];
+    for(int i = 0; i < argc; i++)
+        long_argv[i] = argv[i];
+    for(int i = argc; i < total; i++) {
+        long_argv[i] = eval_sub(args->car);
+        args = (ConsCell*)args->cdr;
+    }
+    return apply_values(function, total, long_argv);
+}
+
 LispObject *apply_sub(LispObject *function, ConsCell *function_arguments) {
     //function is an expression that will evaluate to the function to be applied
     //function_arguments is a list of elems that will be passed as arguments to function
@@ -57,47 +414,24 @@ LispObject *apply_sub(LispObject *function, ConsCell *function_arguments) {
         //printf(" to "); obj_print((LispObject*)function_arguments);
     }
 
-    vector_append(call_stack, function);
-
-    //builtin function
-    if(function->type == &BuiltinFunctionType) {
-        BuiltinFunction *bf = (BuiltinFunction*)function;
-        out = bf->cfunc(function_arguments);
+    if((function->type == &BuiltinFunctionType && ((BuiltinFunction*)function)->vfunc != NULL) ||
+       (function->type == &MacroType && ((Macro*)function)->is_function) ||
+       function->type == &MemoType) {
+        //builtin function or function taking evaluated arguments
+        out = apply_evaluated(function, function_arguments);
+    } else if(function->type == &BuiltinFunctionType) {
+        out = apply_special_form((BuiltinFunction*)function, function_arguments, false);
     } else {
-        //macro or function
+        //macro
         Macro *func = safe_cast(function, &MacroType);
-
-        Dict *new_scope = (Dict*)new_dict();
-        LispObject *rest_of_context = func->is_function ?
-            (LispObject*)func->context :
-            vector_getitem(scopes, -1);
-        ConsCell *new_scope_context = new_cons_cell((LispObject*)new_scope, rest_of_context);
-        ConsCell *namecell = func->args;
-        ConsCell *valcell = function_arguments; //check this?
-        while(namecell != nil) {
-            if(valcell == nil)
-                error("Horrible error, not enough arguments to function\n");
-            LispObject *val = func->is_function ? eval_sub(valcell->car) : valcell->car;
-            //new_var((Symbol*)namecell->car, val);
-            dict_setitem(new_scope, namecell->car, val); //kinda hacky, this
-            namecell = (ConsCell*)namecell->cdr;
-            valcell = (ConsCell*)valcell->cdr;
-        }
-        if(valcell != nil)
-            error("Horrible error, too many arguments to function\n");
-
-        push_scope(new_scope_context);
-        out = do_(func->body);
-        pop_scope();
-        if(!func->is_function)
-            out = eval_sub(out);
+        vector_append(call_stack, function);
+        out = eval_sub(expand_macro(func, function_arguments, NULL, NULL));
+        vector_remove(call_stack, -1);
     }
     if(VERBOSE) {
         printf(" and receiving "); obj_print(out); printf("\n");
     }
 
-    vector_remove(call_stack, -1);
-
     return out;
 }
 
@@ -114,33 +448,20 @@ LispObject *do_(ConsCell *args) {
 
 LispObject *quote(ConsCell *args) {
     //args is a one elem list whose elem is returned unevaluated
-    if(list_length(args) != 1)
-        error("Horrible error, wrong number of arguments to quote\n");
     return args->car;
 }
 
-LispObject *cons(ConsCell *args) {
-    //args is a 2-elem list. both elems are evaluated, and a new cons cell is returned with the
-    //1st result as the car and the 2nd as the cdr
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to cons\n");
-    return (LispObject*)new_cons_cell(eval_sub(args->car), eval_sub(((ConsCell*)args->cdr)->car));
+LispObject *cons(int argc, LispObject **argv) {
+    //returns a new cons cell with argv[0] as the car and argv[1] as the cdr
+    return (LispObject*)new_cons_cell(argv[0], argv[1]);
 }
 
-LispObject *list(ConsCell *args) {
-    //args is a list whose elems are evaluated and returned as a new list
-    if(args == nil)
-        return (LispObject*)nil;
-    ConsCell *out = new_cons_cell((LispObject*)nil, (LispObject*)nil);
-    ConsCell *node = out;
-    for(;;) {
-        node->car = eval_sub(args->car);
-        args = (ConsCell*)args->cdr;
-        if(args == nil)
-            return (LispObject*)out;
-        node->cdr = (LispObject*)new_cons_cell((LispObject*)nil, (LispObject*)nil);
-        node = (ConsCell*)node->cdr;
-    }
+LispObject *list(int argc, LispObject **argv) {
+    //returns the args as a new list
+    LispObject *out = (LispObject*)nil;
+    for(int i = argc - 1; i >= 0; i--)
+        out = (LispObject*)new_cons_cell(argv[i], out);
+    return out;
 }
 
 LispObject *macro(ConsCell *args) {
@@ -166,6 +487,15 @@ LispObject *fn(ConsCell *args) {
     if(args->car->type != &ConsCellType)
         error("Horrible error, first argument to fn is not a list\n");
 
+    if(current_expansion != NULL) {
+        //the function would capture the caller's scope
+        ConsCell *node = (ConsCell*)vector_getitem(scopes, -1);
+        while(node != nil) {
+            note_scope_use(node);
+            node = (ConsCell*)node->cdr;
+        }
+    }
+
     Macro *out = new_macro((ConsCell*)args->car,
                            (ConsCell*)args->cdr,
                            (ConsCell*)vector_getitem(scopes, -1),
@@ -177,10 +507,8 @@ LispObject *fn(ConsCell *args) {
 LispObject *def(ConsCell *args) {
     //args is a 2-elem list, the first of which is a symbol, the second is a form which will be
     //evaluated and the first elems entry in the symbol table set to it
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to def\n");
     Symbol *sym = safe_cast(args->car, &SymbolType);
-    LispObject *val = nth_list(args, 1);
+    LispObject *val = ((ConsCell*)args->cdr)->car;
     val = eval_sub(val);
 
     new_var(sym, val);
@@ -194,23 +522,17 @@ LispObject *def(ConsCell *args) {
     return val;
 }
 
-LispObject *car(ConsCell *args) {
-    //args is a one elem list consisting of a form that will be evaluated,
-    //and the result's car returned
-    if(list_length(args) != 1)
-        error("Horrible error, wrong number of arguments to car");
-    ConsCell *obj = (ConsCell*)eval_sub(args->car);
+LispObject *car(int argc, LispObject **argv) {
+    //returns the car of argv[0]
+    ConsCell *obj = (ConsCell*)argv[0];
     if(obj->type != &ConsCellType)
         error("Horrible error, argument to car is not a list");
     return (LispObject*) obj->car;
 }
 
-LispObject *cdr(ConsCell *args) {
-    //args is a one elem list consisting of a form that will be evaluated,
-    //and the result's cdr returned
-    if(list_length(args) != 1)
-        error("Horrible error, wrong number of arguments to cdr");
-    ConsCell *obj = (ConsCell*)eval_sub(args->car);
+LispObject *cdr(int argc, LispObject **argv) {
+    //returns the cdr of argv[0]
+    ConsCell *obj = (ConsCell*)argv[0];
     if(obj->type != &ConsCellType)
         error("Horrible error, argument to cdr is not a list");
     return (LispObject*) obj->cdr;
@@ -219,27 +541,21 @@ LispObject *cdr(ConsCell *args) {
 LispObject *if_(ConsCell *args) {
     //args is a list of 3 elements. the first is evaluated, and if the result is not nil,
     //the second is evaluated and returned, otherwise the third is
-    if(list_length(args) != 3)
-        error("Horrible error, wrong number of arguments to if");
+    ConsCell *rest = (ConsCell*)args->cdr;
     if(eval_sub(args->car) != (LispObject*)nil)
-        return eval_sub(nth_list(args, 1));
+        return eval_sub(rest->car);
     else
-        return eval_sub(nth_list(args, 2));
+        return eval_sub(((ConsCell*)rest->cdr)->car);
 }
 
-LispObject *equals(ConsCell *args) {
-    //args is a list of 2 elements which are evaluated, and if they are equal
-    //t is returned, else nil
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to =");
-    return equals_sub(nth_list(args, 0), nth_list(args, 1));
+LispObject *equals(int argc, LispObject **argv) {
+    //returns t if the 2 args are equal, else nil
+    return equals_sub(argv[0], argv[1]);
 }
 
 LispObject *equals_sub(LispObject *a, LispObject *b) {
     //if a and b are equal (ints representing the same number or the same object)
     //t is returned, else nil
-    a = eval_sub(a);
-    b = eval_sub(b);
     if(a->type != b->type)
         return (LispObject*)nil;
     else if(a->type == &LispIntType)
@@ -248,154 +564,454 @@ LispObject *equals_sub(LispObject *a, LispObject *b) {
         return a == b ? tee : (LispObject*)nil; //reference equality i guess?
 }
 
-LispObject *plus(ConsCell *args) {
-    //all the elements in args are evaluated, and their sums returned
-    //if args is empty, 0 is returned
-    //raises an exception if any element does not evaluate to an int
+LispObject *plus(int argc, LispObject **argv) {
+    //returns the sum of the args, or 0 if there are none
+    //raises an exception if any arg is not an int
     int out = 0;
-    while(args != nil) {
-        LispObject *val = eval_sub(args->car);
-        out += lisp_int_to_int(val);
-        args = (ConsCell*)args->cdr;
-    }
+    for(int i = 0; i < argc; i++)
+        out += lisp_int_to_int(argv[i]);
     return new_lisp_int(out);
 }
 
-LispObject *minus(ConsCell *args) {
-    //all the elements in args are evaluated
-    //if args is empty, 0 is returned. if args has only 1 element, its negation is returned
-    //else, the first element minus the sum of the rest is returned
-    //raises an exception if any element does not evaluate to an int
-    int out = 0;
-    int first = true;
-    int morethanone = false;
-    while(args != nil) {
-        int val = lisp_int_to_int(eval_sub(args->car));
-        if(first) {
-            out = val;
-            first = false;
-        } else {
-            out -= val;
-            morethanone = true;
-        }
-        args = (ConsCell*)args->cdr;
-    }
-    if(!morethanone)
-        out = -out;
+LispObject *minus(int argc, LispObject **argv) {
+    //if there are no args, 0 is returned. if there is only 1, its negation is returned
+    //else, the first arg minus the sum of the rest is returned
+    //raises an exception if any arg is not an int
+    if(argc == 0)
+        return new_lisp_int(0);
+    int out = lisp_int_to_int(argv[0]);
+    if(argc == 1)
+        return new_lisp_int(-out);
+    for(int i = 1; i < argc; i++)
+        out -= lisp_int_to_int(argv[i]);
     return new_lisp_int(out);
 }
 
 LispObject *print(ConsCell *args) {
     //all the elements of args are evaluated, and their representation (as defined by
-    //their str methods) are printed to stdout
+    //their print methods) are printed to stdout, which is flushed once at the end
+    note_side_effect();
     LispObject *obj = (LispObject*)nil;
     while(args != nil) {
         obj = eval_sub(args->car);
-        obj_print(obj);
-        printf(" ");
+        print_object(stdout_printer, obj);
+        printer_write(stdout_printer, " ", 1);
         args = (ConsCell*)args->cdr;
     }
-    printf("\n");
+    printer_write(stdout_printer, "\n", 1);
+    printer_flush(stdout_printer);
     return obj;
 }
 
+LispObject *to_str(int argc, LispObject **argv) {
+    //returns the representation of argv[0] that print would print, as a str
+    Printer p;
+    printer_init_string(&p);
+    print_object(&p, argv[0]);
+    return (LispObject*)printer_to_str(&p);
+}
+
 LispObject *while_(ConsCell *args) {
     //the first element of args is evaluated, and then the rest in a do block.
     //continues in a loop until the first element evaluates to nil
     LispObject *out = (LispObject*)nil;
-    while(eval_sub(args->car) != (LispObject*)nil)
+    while(eval_sub(args->car) != (LispObject*)nil) {
+        SAFEPOINT();
         out = do_((ConsCell*)args->cdr);
+    }
     return out;
 }
 
 LispObject *set(ConsCell *args) {
     //the first element of args is a symbol with a value in the current symbol table
     //the second element is evaluated and the result put into the symbol table
-    //raises an exception if the first element is not a symbol, if it does not have
-    //an entry in the symbol table, or if there are not exactly 2 arguments
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to set\n");
-    LispObject* val = nth_list(args, 1);
+    //raises an exception if the first element is not a symbol or if it does not have
+    //an entry in the symbol table
+    LispObject* val = ((ConsCell*)args->cdr)->car;
     val = eval_sub(val);
     set_var((Symbol*)safe_cast(args->car, &SymbolType), val);
     return val;
 }
 
+//puts the limits outer back in force after evaluating something under the limits
+//inner, taking away the fuel that was used
+static void restore_limits(EvalLimits *outer, EvalLimits *inner) {
+    if(outer->has_fuel) {
+        EvalLimits current;
+        get_limits(&current);
+        outer->fuel -= inner->fuel - current.fuel;
+        if(outer->fuel < 0)
+            outer->fuel = 0;
+    }
+    set_limits(outer);
+}
+
 LispObject *try_catch(ConsCell *args) {
     //the first element of args is evaluated, and if an exception is raised during evaluation
     //the second element is evaluated and execution continues normally
-    //raises an exception if there is not exactly 2 arguments
-    if(list_length(args) != 2)
-        error("Horrible error, wrong number of arguments to try-catch");
 
     int my_nscopes = scopes->size;
     int my_call_stack_size = call_stack->size;
-    nexception_points++;
-    if(setjmp(exception_points[nexception_points - 1]) == 0) {
-        return eval_sub(args->car);
-        nexception_points--;
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        LispObject *out = eval_sub(args->car);
+        pop_exception_point(&ep);
+        return out;
     } else {
         if(VERBOSE)
-            printf("exception point number %d being called\n", nexception_points - 1);
-        nexception_points--;
+            printf("exception point being called\n");
         while(scopes->size > my_nscopes)
             pop_scope();
         while(call_stack->size > my_call_stack_size)
             vector_remove(call_stack, -1);
-        return eval_sub(nth_list(args, 1));
+        return eval_sub(((ConsCell*)args->cdr)->car);
+    }
+}
+
+LispObject *with_limits(ConsCell *args) {
+    //the first two elements of args are evaluated to the most evaluation steps and
+    //milliseconds (or nil for no limit) the third may take, which is then evaluated.
+    //limits already in force still apply, and the steps it takes count towards them.
+    //raises an exception if it goes over the limits
+    LispObject *fuel = eval_sub(args->car);
+    LispObject *millis = eval_sub(nth_list(args, 1));
+
+    EvalLimits outer, inner;
+    get_limits(&outer);
+    limit_evaluation(fuel == (LispObject*)nil ? -1 : ((LispInt*)safe_cast(fuel, &LispIntType))->n,
+                     millis == (LispObject*)nil ? -1 : ((LispInt*)safe_cast(millis, &LispIntType))->n / 1000.0);
+    get_limits(&inner);
+
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        LispObject *out = eval_sub(nth_list(args, 2));
+        pop_exception_point(&ep);
+        restore_limits(&outer, &inner);
+        return out;
+    } else {
+        restore_limits(&outer, &inner);
+        reraise_error();
+        return NULL;
     }
 }
 
-LispObject *show_symbol_table(ConsCell *args) {
+LispObject *memoize(int argc, LispObject **argv) {
+    //argv[0] is a function, returns a function that calls it and caches the result for each
+    //list of arguments, compared by value. argv[1] is an optional bound on the number of results
+    //cached, past which the least recently used one is dropped
+    LispObject *func = argv[0];
+    bool takes_values = func->type == &BuiltinFunctionType ?
+        ((BuiltinFunction*)func)->vfunc != NULL : ((Macro*)safe_cast(func, &MacroType))->is_function;
+    if(!takes_values)
+        error("Horrible error, can only memoize functions\n");
+    int max_size = argc > 1 ? lisp_int_to_int(argv[1]) : 0;
+    if(max_size < 0)
+        error("Horrible error, negative size for memoize\n");
+    return new_memo(func, max_size);
+}
+
+//=lazy sequences=
+
+//returns obj as something force_seq takes: a list, or a lazy sequence
+//raises an exception if it isn't a list, vector or lazy sequence
+static LispObject *as_seq(LispObject *obj) {
+    if(obj->type == &VectorType)
+        return (LispObject*)new_lazy_seq(LAZY_VECTOR, NULL, obj, 0, 0, 0);
+    if((obj->type != &ConsCellType || obj == tee) && obj->type != &LazySeqType)
+        error("Horrible error, %s is not a sequence\n", obj->type->name);
+    return obj;
+}
+
+static LispObject *apply_1(LispObject *fn, LispObject *arg) {
+    return apply_values(fn, 1, &arg);
+}
+
+//returns nil if the sequence seq (a list or lazy sequence) is empty, or else a cons
+//of its first element and the rest of it
+static LispObject *force_seq(LispObject *seq) {
+    if(seq->type != &LazySeqType)
+        return (LispObject*)safe_cast(seq, &ConsCellType);
+    LazySeq *lazy = (LazySeq*)seq;
+    if(lazy->forced)
+        return lazy->value;
+
+    LispObject *out = (LispObject*)nil;
+    LispObject *rest;
+    switch(lazy->kind) {
+    case LAZY_RANGE:
+        if(lazy->step > 0 ? lazy->start < lazy->end : lazy->start > lazy->end) {
+            rest = (LispObject*)new_lazy_seq(LAZY_RANGE, NULL, NULL, lazy->start + lazy->step,
+                                             lazy->end, lazy->step);
+            out = (LispObject*)new_cons_cell(new_lisp_int(lazy->start), rest);
+        }
+        break;
+    case LAZY_VECTOR: {
+        Vector *v = (Vector*)lazy->source;
+        if(lazy->start < v->size) {
+            rest = (LispObject*)new_lazy_seq(LAZY_VECTOR, NULL, lazy->source, lazy->start + 1, 0, 0);
+            out = (LispObject*)new_cons_cell(vector_getitem(v, lazy->start), rest);
+        }
+        break;
+    }
+    case LAZY_ITERATE: {
+        LispObject *x = lazy->start ? apply_1(lazy->fn, lazy->source) : lazy->source;
+        rest = (LispObject*)new_lazy_seq(LAZY_ITERATE, lazy->fn, x, 1, 0, 0);
+        out = (LispObject*)new_cons_cell(x, rest);
+        break;
+    }
+    case LAZY_MAP: {
+        ConsCell *c = (ConsCell*)force_seq(lazy->source);
+        if(c != nil) {
+            LispObject *x = apply_1(lazy->fn, c->car);
+            rest = (LispObject*)new_lazy_seq(LAZY_MAP, lazy->fn, c->cdr, 0, 0, 0);
+            out = (LispObject*)new_cons_cell(x, rest);
+        }
+        break;
+    }
+    case LAZY_FILTER: {
+        LispObject *source = lazy->source;
+        for(;;) {
+            SAFEPOINT();
+            ConsCell *c = (ConsCell*)force_seq(source);
+            if(c == nil)
+                break;
+            if(apply_1(lazy->fn, c->car) != (LispObject*)nil) {
+                rest = (LispObject*)new_lazy_seq(LAZY_FILTER, lazy->fn, c->cdr, 0, 0, 0);
+                out = (LispObject*)new_cons_cell(c->car, rest);
+                break;
+            }
+            source = c->cdr;
+        }
+        break;
+    }
+    case LAZY_TAKE:
+        if(lazy->start > 0) {
+            ConsCell *c = (ConsCell*)force_seq(lazy->source);
+            if(c != nil) {
+                rest = (LispObject*)new_lazy_seq(LAZY_TAKE, NULL, c->cdr, lazy->start - 1, 0, 0);
+                out = (LispObject*)new_cons_cell(c->car, rest);
+            }
+        }
+        break;
+    }
+
+    lazy->value = out;
+    lazy->forced = true;
+    lazy->fn = NULL;
+    lazy->source = NULL;
+    return out;
+}
+
+LispObject *range(int argc, LispObject **argv) {
+    //returns a lazy sequence of the ints from argv[0] up to argv[1] (exclusive), by argv[2]
+    //with one argument the ints from 0 up to argv[0], the step defaults to 1
+    int start = argc > 1 ? lisp_int_to_int(argv[0]) : 0;
+    int end = lisp_int_to_int(argv[argc > 1 ? 1 : 0]);
+    int step = argc > 2 ? lisp_int_to_int(argv[2]) : 1;
+    if(step == 0)
+        error("Horrible error, range with a step of 0\n");
+    return (LispObject*)new_lazy_seq(LAZY_RANGE, NULL, NULL, start, end, step);
+}
+
+LispObject *iterate(int argc, LispObject **argv) {
+    //returns the endless lazy sequence argv[1], (argv[0] argv[1]), (argv[0] (argv[0] argv[1]))...
+    return (LispObject*)new_lazy_seq(LAZY_ITERATE, argv[0], argv[1], 0, 0, 0);
+}
+
+LispObject *lazy_map(int argc, LispObject **argv) {
+    //returns a lazy sequence of the function argv[0] applied to each element of the
+    //sequence argv[1] (a list, vector or lazy sequence)
+    return (LispObject*)new_lazy_seq(LAZY_MAP, argv[0], as_seq(argv[1]), 0, 0, 0);
+}
+
+LispObject *lazy_filter(int argc, LispObject **argv) {
+    //returns a lazy sequence of the elements of the sequence argv[1] that the function
+    //argv[0] returns non-nil for
+    return (LispObject*)new_lazy_seq(LAZY_FILTER, argv[0], as_seq(argv[1]), 0, 0, 0);
+}
+
+LispObject *take(int argc, LispObject **argv) {
+    //returns a lazy sequence of the first argv[0] elements of the sequence argv[1]
+    return (LispObject*)new_lazy_seq(LAZY_TAKE, NULL, as_seq(argv[1]), lisp_int_to_int(argv[0]), 0, 0);
+}
+
+LispObject *reduce(int argc, LispObject **argv) {
+    //applies the function argv[0] to argv[1] and the first element of the sequence argv[2],
+    //then to that result and the second element, and so on, returning the last result.
+    //the sequence is let go of as it's consumed, so the parts already used can be collected
+    LispObject *seq = as_seq(argv[2]);
+    argv[2] = (LispObject*)nil;
+    LispObject *fn_argv[2];
+    fn_argv[0] = argv[1];
+    for(;;) {
+        SAFEPOINT();
+        ConsCell *c = (ConsCell*)force_seq(seq);
+        if(c == nil)
+            break;
+        fn_argv[1] = c->car;
+        fn_argv[0] = apply_values(argv[0], 2, fn_argv);
+        seq = c->cdr;
+    }
+    return fn_argv[0];
+}
+
+LispObject *realize(int argc, LispObject **argv) {
+    //returns a list of all the elements of the sequence argv[0]
+    LispObject *seq = as_seq(argv[0]);
+    ConsCell *head = nil;
+    ConsCell *tail = nil;
+    for(;;) {
+        SAFEPOINT();
+        ConsCell *c = (ConsCell*)force_seq(seq);
+        if(c == nil)
+            break;
+        ConsCell *cell = new_cons_cell(c->car, (LispObject*)nil);
+        if(head == nil)
+            head = cell;
+        else
+            tail->cdr = (LispObject*)cell;
+        tail = cell;
+        seq = c->cdr;
+    }
+    return (LispObject*)head;
+}
+
+LispObject *show_symbol_table(int argc, LispObject **argv) {
     //prints the current contents of the symbol table to stdout
+    note_side_effect();
     print_symbol_table();
     return (LispObject*)nil;
 }
 
-LispObject *vector(ConsCell *args) {
-    //args is a list whose elems are evaluated and put into the vector
+LispObject *vector(int argc, LispObject **argv) {
+    //returns a new vector holding the args
     Vector *out = (Vector*)new_vector();
-    while(args != nil) {
-        vector_append(out, eval_sub(args->car));
-        args = (ConsCell*)args->cdr;
-    }
+    vector_reserve(out, argc);
+    for(int i = 0; i < argc; i++)
+        vector_append(out, argv[i]);
     return (LispObject*)out;
 }
 
-LispObject *nth(ConsCell *args) {
-    //1st elem evaluates to a vector, 2nd to int
-    Vector *v = safe_cast(eval_sub(args->car), &VectorType);
-    int i = lisp_int_to_int(eval_sub(nth_list(args, 1)));
-    return vector_getitem(v, i);
+LispObject *nth(int argc, LispObject **argv) {
+    //argv[0] is a vector, pvector or column, argv[1] an int index into it
+    if(argv[0]->type == &IntColumnType || argv[0]->type == &StrColumnType)
+        return column_getitem(argv[0], lisp_int_to_int(argv[1]));
+    if(argv[0]->type == &PVectorType || argv[0]->type == &TransientVectorType)
+        return pvector_nth((PVector*)argv[0], lisp_int_to_int(argv[1]));
+    Vector *v = safe_cast(argv[0], &VectorType);
+    return vector_getitem(v, lisp_int_to_int(argv[1]));
+}
+
+LispObject *insert(int argc, LispObject **argv) {
+    //argv[0] is a vector, argv[1] an int, argv[2] any object which is inserted at that index
+    note_side_effect();
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_insert(v, lisp_int_to_int(argv[1]), argv[2]);
+    return (LispObject*)v;
+}
+
+LispObject *append(int argc, LispObject **argv) {
+    //argv[0] is a vector, argv[1] is appended to it
+    note_side_effect();
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_append(v, argv[1]);
+    return (LispObject*)v;
+}
+
+LispObject *vector_reserve_(int argc, LispObject **argv) {
+    //argv[0] is a vector, made to have room for argv[1] items without being resized
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_reserve(v, lisp_int_to_int(argv[1]));
+    return (LispObject*)v;
 }
 
-LispObject *insert(ConsCell *args) {
-    //1st evaluates to a vector, 2nd to int, 3rd to any object
-    Vector *v = safe_cast(eval_sub(args->car), &VectorType);
-    int i = lisp_int_to_int(eval_sub(nth_list(args, 1)));
-    LispObject *obj = eval_sub(nth_list(args, 2));
-    vector_insert(v, i, obj);
+LispObject *vector_shrink_(int argc, LispObject **argv) {
+    //argv[0] is a vector, moved to the smallest array its items fit in
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_shrink(v);
     return (LispObject*)v;
 }
 
-LispObject *append(ConsCell *args) {
-    //1st evaluates to a vector, 2nd to obj which is appended to 1st
-    Vector *v = safe_cast(eval_sub(args->car), &VectorType);
-    vector_append(v, eval_sub(nth_list(args, 1)));
+LispObject *vector_capacity(int argc, LispObject **argv) {
+    //returns the number of items the vector argv[0] has room for without being resized
+    Vector *v = safe_cast(argv[0], &VectorType);
+    return new_lisp_int(v->base == NULL ? v->array_size : v->size);
+}
+
+LispObject *vector_slice_(int argc, LispObject **argv) {
+    //returns a vector viewing items argv[1] up to argv[2] of the vector argv[0], or up
+    //to its end if there's no argv[2]. it shares them, so setting items in either sets
+    //them in both, but its size can't be changed
+    Vector *v = safe_cast(argv[0], &VectorType);
+    int to = argc == 3 ? lisp_int_to_int(argv[2]) : v->size;
+    return vector_slice(v, lisp_int_to_int(argv[1]), to);
+}
+
+LispObject *sort_now(int argc, LispObject **argv) {
+    //sorts the vector argv[0] in place, with argv[1] if given, a function of two items
+    //returning non-nil if the first goes before the second. otherwise it has to hold
+    //only ints or only strs, which are sorted by value
+    note_side_effect();
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_sort(v, argc == 2 ? argv[1] : NULL, false);
+    return (LispObject*)v;
+}
+
+LispObject *stable_sort_now(int argc, LispObject **argv) {
+    //the same as sort!, but items that are equal keep the order they were in
+    note_side_effect();
+    Vector *v = safe_cast(argv[0], &VectorType);
+    vector_sort(v, argc == 2 ? argv[1] : NULL, true);
+    return (LispObject*)v;
+}
+
+LispObject *binary_search(int argc, LispObject **argv) {
+    //returns the index of an item equal to argv[1] in the vector argv[0], sorted as
+    //sort! would with the function argv[2] if given, or if there isn't one, -1 - the
+    //index argv[1] would be inserted at to keep it sorted
+    Vector *v = safe_cast(argv[0], &VectorType);
+    return new_lisp_int(vector_binary_search(v, argv[1], argc == 3 ? argv[2] : NULL));
+}
+
+LispObject *vector_map_(int argc, LispObject **argv) {
+    //returns a new vector of the function argv[0] applied to each item of the vector argv[1]
+    return vector_map(argv[0], safe_cast(argv[1], &VectorType));
+}
+
+LispObject *vector_filter_(int argc, LispObject **argv) {
+    //returns a new vector of the items of the vector argv[1] the function argv[0]
+    //returns non-nil for
+    return vector_filter(argv[0], safe_cast(argv[1], &VectorType));
+}
+
+LispObject *vector_reduce_(int argc, LispObject **argv) {
+    //applies the function argv[0] to argv[1] and the first item of the vector argv[2],
+    //then to that result and the second item, and so on, returning the last result
+    return vector_reduce(argv[0], argv[1], safe_cast(argv[2], &VectorType));
+}
+
+LispObject *vector_fill_(int argc, LispObject **argv) {
+    //sets the items of the vector argv[0] to argv[1], or only those from index argv[2]
+    //up to argv[3], or to the end if there's no argv[3]
+    note_side_effect();
+    Vector *v = safe_cast(argv[0], &VectorType);
+    int from = argc > 2 ? lisp_int_to_int(argv[2]) : 0;
+    int to = argc > 3 ? lisp_int_to_int(argv[3]) : v->size;
+    vector_fill(v, argv[1], from, to);
     return (LispObject*)v;
 }
 
-LispObject *dict(ConsCell *args) {
+LispObject *dict(int argc, LispObject **argv) {
     //creates a new dict, empty if no args
-    //otherwise takes as arguments two elements which are evaluated
-    //one is a list of keys and the other a list of corresponding values
-    //raises an exception if there are not exactly 0 or 2 arguments, if either
-    //argument is not a proper list, or if the lists are not of the same length
+    //otherwise takes as arguments a list of keys and a list of corresponding values
+    //raises an exception if there is only 1 argument, if either argument is not a
+    //proper list, or if the lists are not of the same length
     Dict *out = (Dict*)new_dict();
-    int len = list_length(args);
-    if(len == 2) {
-        ConsCell *keys = safe_cast(eval_sub(nth_list(args, 0)), &ConsCellType);
-        ConsCell *values = safe_cast(eval_sub(nth_list(args, 1)), &ConsCellType);
+    if(argc == 2) {
+        ConsCell *keys = safe_cast(argv[0], &ConsCellType);
+        ConsCell *values = safe_cast(argv[1], &ConsCellType);
 
         while(keys != nil) {
             if(values == nil)
@@ -406,82 +1022,505 @@ LispObject *dict(ConsCell *args) {
         }
         if(values != nil)
             error("mismatch in length of argument lists to dict\n");
-    } else if(len != 0)
+    } else if(argc != 0)
         error("wrong number of arguments to dict\n");
     return (LispObject*)out;
 }
 
-LispObject *getitem(ConsCell *args) {
-    //1st is evaluated to be a dict, 2nd to key, value of key in dict is returned
-    //raises exception if 1st doesn't evaluate to dict
-    LispObject *out = dict_getitem(safe_cast(eval_sub(nth_list(args, 0)), &DictType),
-                                   eval_sub(nth_list(args, 1)));
+LispObject *getitem(int argc, LispObject **argv) {
+    //argv[0] is a dict or hash-map, the value of key argv[1] in it is returned
+    //raises exception if argv[0] isn't a dict or hash-map or doesn't contain the key
+    LispObject *out;
+    if(argv[0]->type == &PMapType || argv[0]->type == &TransientMapType)
+        out = pmap_get((PMap*)argv[0], argv[1]);
+    else
+        out = dict_getitem(safe_cast(argv[0], &DictType), argv[1]);
     if(out == NULL)
         error("item not found in dict\n");
     return out;
 }
 
-LispObject *setitem(ConsCell *args) {
-    //1st is evaluated to be a dict, 2nd to key, third to value
-    //raises exception if 1st doesn't evaluate to dict
+LispObject *setitem(int argc, LispObject **argv) {
+    //argv[0] is a dict, the value for key argv[1] in it is set to argv[2]
+    //or a vector, the item at int index argv[1] in it is set to argv[2]
+    //raises exception if argv[0] isn't a dict or vector
+    //returns modified dict or vector
+    note_side_effect();
+    if(argv[0]->type == &VectorType) {
+        vector_setitem((Vector*)argv[0], lisp_int_to_int(argv[1]), argv[2]);
+        return argv[0];
+    }
+    Dict *out = safe_cast(argv[0], &DictType);
+    dict_setitem(out, argv[1], argv[2]);
+    return (LispObject*)out;
+}
+
+LispObject *delitem(int argc, LispObject **argv) {
+    //argv[0] is a dict, key argv[1] and its value are removed from it
+    //raises exception if argv[0] isn't a dict or doesn't contain the key
     //returns modified dict
-    Dict *out = safe_cast(eval_sub(nth_list(args, 0)), &DictType);
-    LispObject *key = eval_sub(nth_list(args, 1));
-    LispObject *value = eval_sub(nth_list(args, 2));
-    dict_setitem(out, key, value);
+    note_side_effect();
+    Dict *out = safe_cast(argv[0], &DictType);
+    if(!dict_delitem(out, argv[1]))
+        error("item not found in dict\n");
     return (LispObject*)out;
 }
 
-LispObject *exit_(ConsCell *args) {
-    //exits program with status code of evaluation of 1st argument, defaults to 0 if no arguments
+LispObject *exit_(int argc, LispObject **argv) {
+    //exits program with status code argv[0], defaults to 0 if no arguments
+    note_side_effect();
     int status = 0;
-    if(args != nil)
-        status = lisp_int_to_int(eval_sub(args->car));
+    if(argc > 0)
+        status = lisp_int_to_int(argv[0]);
     exit(status);
 }
 
-LispObject *slice(ConsCell *args) {
-    Str *s = safe_cast(eval_sub(nth_list(args, 0)), &StrType);
-    int start = lisp_int_to_int(eval_sub(nth_list(args, 1)));
-    int len = lisp_int_to_int(eval_sub(nth_list(args, 2)));
+LispObject *slice(int argc, LispObject **argv) {
+    //returns the substring of str argv[0] starting at argv[1] with length argv[2]
+    Str *s = safe_cast(argv[0], &StrType);
+    int start = lisp_int_to_int(argv[1]);
+    int len = lisp_int_to_int(argv[2]);
     return (LispObject*)str_slice(s, start, len);
 }
 
-LispObject *concat(ConsCell *args) {
-    int len = list_length(args);
-    if(len == 0)
-        return new_str();
-    else if(len == 1)
-        return safe_cast(eval_sub(nth_list(args, 0)), &StrType);
-    else {
-        Str *out = safe_cast(eval_sub(nth_list(args, 0)), &StrType);
-        for(int i = 1; i < len; i++)
-            out = str_concat(out, safe_cast(eval_sub(nth_list(args, i)), &StrType));
-        return (LispObject*)out;
+LispObject *concat(int argc, LispObject **argv) {
+    //returns the concatenation of the str args, copied once into a new str
+    //or if any of the args are ropes, a rope sharing the chars of all of them
+    int size = 0;
+    for(int i = 0; i < argc; i++) {
+        if(argv[i]->type == &RopeType)
+            return new_rope(argc, argv);
+        Str *s = safe_cast(argv[i], &StrType);
+        if(s->size > INT_MAX - 1 - size)
+            error("Horrible error, concat would make a str that's too long\n");
+        size += s->size;
+    }
+    Str *out = new_str_with_size(size + 1);
+    out->size = 0;
+    for(int i = 0; i < argc; i++) {
+        memcpy(out->array + out->size, ((Str*)argv[i])->array, ((Str*)argv[i])->size);
+        out->size += ((Str*)argv[i])->size;
     }
+    out->array[size] = '\0';
+    return (LispObject*)out;
 }
 
+LispObject *string_builder(int argc, LispObject **argv) {
+    //returns a new, empty string builder, with room for argv[0] chars if given
+    return new_str_builder(argc > 0 ? lisp_int_to_int(argv[0]) : 0);
+}
+
+LispObject *builder_append_now(int argc, LispObject **argv) {
+    //appends the chars of the strs and ropes argv[1] onwards to the string builder argv[0]
+    note_side_effect();
+    StrBuilder *b = safe_cast(argv[0], &StrBuilderType);
+    for(int i = 1; i < argc; i++)
+        str_builder_append(b, argv[i]);
+    return (LispObject*)b;
+}
+
+LispObject *build(int argc, LispObject **argv) {
+    //returns a new str of the chars of the string builder or rope argv[0], or argv[0]
+    //itself if it's a str
+    if(argv[0]->type == &StrBuilderType)
+        return (LispObject*)str_builder_build((StrBuilder*)argv[0]);
+    if(argv[0]->type == &RopeType)
+        return (LispObject*)rope_build((Rope*)argv[0]);
+    return (LispObject*)safe_cast(argv[0], &StrType);
+}
+
+LispObject *rope(int argc, LispObject **argv) {
+    //returns a rope of the chars of the str and rope args, sharing them
+    return new_rope(argc, argv);
+}
+
+LispObject *rope_slice_(int argc, LispObject **argv) {
+    //returns a rope of the argv[2] chars of the rope argv[0] from index argv[1]
+    Rope *r = safe_cast(argv[0], &RopeType);
+    return rope_slice(r, lisp_int_to_int(argv[1]), lisp_int_to_int(argv[2]));
+}
+
+LispObject *rope_splice_(int argc, LispObject **argv) {
+    //returns a rope of the rope argv[0] with the argv[2] chars from index argv[1]
+    //replaced by the str or rope argv[3], or removed if there's no argv[3]
+    Rope *r = safe_cast(argv[0], &RopeType);
+    return rope_splice(r, lisp_int_to_int(argv[1]), lisp_int_to_int(argv[2]),
+                       argc > 3 ? argv[3] : NULL);
+}
+
+LispObject *str_find_(int argc, LispObject **argv) {
+    //returns the index of the first occurrence of the str argv[1] in the str argv[0],
+    //starting from the index argv[2] if given, or nil if there's none
+    Str *s = safe_cast(argv[0], &StrType);
+    int start = argc > 2 ? lisp_int_to_int(argv[2]) : 0;
+    int out = str_find(s, safe_cast(argv[1], &StrType), start);
+    return out < 0 ? (LispObject*)nil : new_lisp_int(out);
+}
+
+LispObject *str_count_(int argc, LispObject **argv) {
+    //returns the number of occurrences of the str argv[1] in the str argv[0] that don't overlap
+    return new_lisp_int(str_count(safe_cast(argv[0], &StrType), safe_cast(argv[1], &StrType)));
+}
+
+LispObject *str_split_(int argc, LispObject **argv) {
+    //returns a list of the parts of the str argv[0] between occurrences of the str argv[1]
+    return str_split(safe_cast(argv[0], &StrType), safe_cast(argv[1], &StrType));
+}
+
+LispObject *str_replace_(int argc, LispObject **argv) {
+    //returns a copy of the str argv[0] with the occurrences of the str argv[1] replaced by argv[2]
+    return (LispObject*)str_replace(safe_cast(argv[0], &StrType), safe_cast(argv[1], &StrType),
+                                    safe_cast(argv[2], &StrType));
+}
+
+LispObject *str_index_of_any(int argc, LispObject **argv) {
+    //returns the index of the first char of the str argv[0] that's one of the chars of the
+    //str argv[1], starting from the index argv[2] if given, or nil if there's none
+    Str *s = safe_cast(argv[0], &StrType);
+    int start = argc > 2 ? lisp_int_to_int(argv[2]) : 0;
+    int out = str_find_any(s, safe_cast(argv[1], &StrType), start);
+    return out < 0 ? (LispObject*)nil : new_lisp_int(out);
+}
+
+LispObject *read_all_(int argc, LispObject **argv) {
+    //returns a list of the forms in the str argv[0], which are read but not evaluated
+    Str *s = safe_cast(argv[0], &StrType);
+    return read_all(s->array, s->size);
+}
+
+LispObject *read_data(int argc, LispObject **argv) {
+    //returns a list of the forms in the file named by the str argv[0], "-" is stdin
+    note_side_effect();
+    char *filename = ((Str*)safe_cast(argv[0], &StrType))->array;
+    FILE *f = (!strcmp(filename, "-")) ? stdin : fopen(filename, "r");
+    if(f == NULL)
+        error("File %s does not exist", filename);
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        if(f != stdin)
+            fclose(f);
+        reraise_error();
+    }
+    LispObject *out = read_all_file(f);
+    pop_exception_point(&ep);
+    if(f != stdin)
+        fclose(f);
+    return out;
+}
+
+LispObject *read_csv_(int argc, LispObject **argv) {
+    //returns a dict from the column names in the header of the csv file named by the str
+    //argv[0], as symbols, to int columns for columns of ints and str columns for the rest
+    //argv[1], if given, is a dict from column names to the symbols int or str, fixing their types
+    note_side_effect();
+    char *filename = ((Str*)safe_cast(argv[0], &StrType))->array;
+    Dict *hints = argc > 1 ? safe_cast(argv[1], &DictType) : NULL;
+    FILE *f = (!strcmp(filename, "-")) ? stdin : fopen(filename, "r");
+    if(f == NULL)
+        error("File %s does not exist", filename);
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        if(f != stdin)
+            fclose(f);
+        reraise_error();
+    }
+    LispObject *out = read_csv(f, hints);
+    pop_exception_point(&ep);
+    if(f != stdin)
+        fclose(f);
+    return out;
+}
+
+LispObject *size(int argc, LispObject **argv) {
+    //returns the number of items in the vector, str, column, dict, hash-map or pvector
+    //argv[0], or of chars in the rope or string builder argv[0]
+    //raises an exception if argv[0] is anything else
+    if(argv[0]->type == &VectorType)
+        return new_lisp_int(((Vector*)argv[0])->size);
+    if(argv[0]->type == &StrType)
+        return new_lisp_int(((Str*)argv[0])->size);
+    if(argv[0]->type == &RopeType)
+        return new_lisp_int(((Rope*)argv[0])->size);
+    if(argv[0]->type == &StrBuilderType)
+        return new_lisp_int(((StrBuilder*)argv[0])->size);
+    if(argv[0]->type == &PMapType || argv[0]->type == &TransientMapType)
+        return new_lisp_int(((PMap*)argv[0])->size);
+    if(argv[0]->type == &PVectorType || argv[0]->type == &TransientVectorType)
+        return new_lisp_int(((PVector*)argv[0])->size);
+    if(argv[0]->type == &DictType)
+        return new_lisp_int(((Dict*)argv[0])->size);
+    if(argv[0]->type == &IntColumnType || argv[0]->type == &StrColumnType)
+        return new_lisp_int(column_size(argv[0]));
+    raise_error(ERROR_TYPE, "Horrible error, can't take the size of a %s, only of a vector, str, "
+                "column, dict, hash-map, pvector, rope or string builder\n", argv[0]->type->name);
+    return NULL;
+}
+
+LispObject *hash_map(int argc, LispObject **argv) {
+    //returns a new persistent hash-map, the args are its keys each followed by its value
+    //raises exception if a key has no value
+    if(argc % 2 != 0)
+        error("hash-map needs a value for each key\n");
+    LispObject *out = transient(new_pmap());
+    for(int i = 0; i < argc; i += 2)
+        pmap_assoc((PMap*)out, argv[i], argv[i + 1]);
+    return persistent(out);
+}
+
+LispObject *pvector(int argc, LispObject **argv) {
+    //returns a new persistent pvector holding the args
+    LispObject *out = transient(new_pvector());
+    for(int i = 0; i < argc; i++)
+        pvector_conj((PVector*)out, argv[i]);
+    return persistent(out);
+}
+
+LispObject *assoc(int argc, LispObject **argv) {
+    //argv[0] is a hash-map or pvector, a copy with key or index argv[1] set to argv[2] is
+    //returned. the index may be the size of the pvector, which appends argv[2]
+    if(argv[0]->type == &PMapType)
+        return pmap_assoc((PMap*)argv[0], argv[1], argv[2]);
+    PVector *v = safe_cast(argv[0], &PVectorType);
+    return pvector_assoc(v, lisp_int_to_int(argv[1]), argv[2]);
+}
+
+LispObject *dissoc(int argc, LispObject **argv) {
+    //argv[0] is a hash-map, a copy without key argv[1] is returned
+    return pmap_dissoc(safe_cast(argv[0], &PMapType), argv[1]);
+}
+
+LispObject *conj_(int argc, LispObject **argv) {
+    //argv[0] is a pvector, a copy with argv[1] appended is returned
+    return pvector_conj(safe_cast(argv[0], &PVectorType), argv[1]);
+}
+
+LispObject *transient_(int argc, LispObject **argv) {
+    //returns a transient version of the hash-map or pvector argv[0], which assoc!, dissoc!
+    //and conj! change in place, for building one up quickly. argv[0] isn't changed
+    return transient(argv[0]);
+}
+
+LispObject *persistent_(int argc, LispObject **argv) {
+    //returns the transient argv[0] made persistent. the transient can't be used after
+    return persistent(argv[0]);
+}
+
+LispObject *assoc_now(int argc, LispObject **argv) {
+    //the same as assoc on a transient hash-map or pvector, which is changed and returned
+    note_side_effect();
+    if(argv[0]->type == &TransientMapType)
+        return pmap_assoc((PMap*)argv[0], argv[1], argv[2]);
+    PVector *v = safe_cast(argv[0], &TransientVectorType);
+    return pvector_assoc(v, lisp_int_to_int(argv[1]), argv[2]);
+}
+
+LispObject *dissoc_now(int argc, LispObject **argv) {
+    //the same as dissoc on a transient hash-map, which is changed and returned
+    note_side_effect();
+    return pmap_dissoc(safe_cast(argv[0], &TransientMapType), argv[1]);
+}
+
+LispObject *conj_now(int argc, LispObject **argv) {
+    //the same as conj on a transient pvector, which is changed and returned
+    note_side_effect();
+    return pvector_conj(safe_cast(argv[0], &TransientVectorType), argv[1]);
+}
+
+LispObject *regex(int argc, LispObject **argv) {
+    //returns the str argv[0] compiled into a regex
+    //the other regex builtins also take patterns as strs, and cache what they compile
+    return new_regex(safe_cast(argv[0], &StrType));
+}
+
+LispObject *regex_match_(int argc, LispObject **argv) {
+    //returns t if the regex argv[0] matches all of the str argv[1], nil otherwise
+    Str *s = safe_cast(argv[1], &StrType);
+    return regex_match(cached_regex(argv[0]), s->array, s->size) ? tee : (LispObject*)nil;
+}
+
+LispObject *regex_search_(int argc, LispObject **argv) {
+    //returns the leftmost longest match of the regex argv[0] in the str argv[1] as a str,
+    //or nil if there's none
+    Str *s = safe_cast(argv[1], &StrType);
+    int start, end;
+    if(!regex_search(cached_regex(argv[0]), s->array, s->size, &start, &end))
+        return (LispObject*)nil;
+    return (LispObject*)new_str_from(s->array + start, end - start);
+}
+
+LispObject *regex_find_all_(int argc, LispObject **argv) {
+    //returns a list of the matches of the regex argv[0] in the str argv[1] as strs,
+    //each the leftmost longest one after the last
+    return regex_find_all(cached_regex(argv[0]), safe_cast(argv[1], &StrType));
+}
+
+LispObject *open_input(int argc, LispObject **argv) {
+    //returns a port reading from the file named by the str argv[0], "-" is stdin
+    note_side_effect();
+    return open_port(((Str*)safe_cast(argv[0], &StrType))->array, false, false);
+}
+
+LispObject *open_output(int argc, LispObject **argv) {
+    //returns a port writing to the file named by the str argv[0], "-" is stdout
+    //the file is emptied first, unless argv[1] is given and isn't nil
+    note_side_effect();
+    bool append = argc > 1 && argv[1] != (LispObject*)nil;
+    return open_port(((Str*)safe_cast(argv[0], &StrType))->array, true, append);
+}
+
+LispObject *read_line(int argc, LispObject **argv) {
+    //returns the next line of the input port argv[0] as a str without its newline,
+    //or nil at the end of the file
+    note_side_effect();
+    return port_read_line(safe_cast(argv[0], &PortType));
+}
+
+LispObject *read_bytes(int argc, LispObject **argv) {
+    //returns a str of the next argv[1] bytes of the input port argv[0], which is shorter
+    //at the end of the file, or nil if there's nothing left
+    note_side_effect();
+    return port_read_bytes(safe_cast(argv[0], &PortType), lisp_int_to_int(argv[1]));
+}
+
+LispObject *write_(int argc, LispObject **argv) {
+    //writes the rest of the args to the output port argv[0], strs as they are and
+    //everything else as print would print it, and returns the port
+    note_side_effect();
+    Port *port = safe_cast(argv[0], &PortType);
+    for(int i = 1; i < argc; i++) {
+        if(argv[i]->type == &StrType) {
+            Str *s = (Str*)argv[i];
+            port_write(port, s->array, s->size);
+        } else {
+            Printer p;
+            printer_init_string(&p);
+            print_object(&p, argv[i]);
+            port_write(port, p.buf, p.len);
+            free(p.buf);
+        }
+    }
+    return (LispObject*)port;
+}
+
+LispObject *close_(int argc, LispObject **argv) {
+    //flushes and closes the port argv[0], ports are also closed when garbage collected
+    note_side_effect();
+    port_close(safe_cast(argv[0], &PortType));
+    return (LispObject*)nil;
+}
+
+static BuiltinSpec builtin_specs[] = {
+    //name, unevaluated args func, evaluated args func, min args, max args, flags
+    {"eval", NULL, eval, 1, 1, BUILTIN_DYNAMIC},
+    {"apply", apply, NULL, 2, 2, BUILTIN_DYNAMIC},
+    {"do", do_, NULL, 0, VARIADIC, 0},
+    {"quote", quote, NULL, 1, 1, 0},
+    {"cons", NULL, cons, 2, 2, BUILTIN_LEAF},
+    {"list", NULL, list, 0, VARIADIC, BUILTIN_LEAF},
+    {"macro", macro, NULL, 1, VARIADIC, BUILTIN_DYNAMIC},
+    {"fn", fn, NULL, 1, VARIADIC, BUILTIN_DYNAMIC},
+    {"def", def, NULL, 2, 2, BUILTIN_DYNAMIC},
+    {"car", NULL, car, 1, 1, BUILTIN_PURE},
+    {"cdr", NULL, cdr, 1, 1, BUILTIN_PURE},
+    {"if", if_, NULL, 3, 3, 0},
+    {"=", NULL, equals, 2, 2, BUILTIN_PURE | BUILTIN_LEAF},
+    {"+", NULL, plus, 0, VARIADIC, BUILTIN_PURE},
+    {"-", NULL, minus, 0, VARIADIC, BUILTIN_PURE},
+    {"print", print, NULL, 0, VARIADIC, 0},
+    {"to-str", NULL, to_str, 1, 1, BUILTIN_LEAF},
+    {"while", while_, NULL, 1, VARIADIC, 0},
+    {"set", set, NULL, 2, 2, BUILTIN_DYNAMIC},
+    {"try-catch", try_catch, NULL, 2, 2, 0},
+    {"with-limits", with_limits, NULL, 3, 3, 0},
+    {"show-symbol-table", NULL, show_symbol_table, 0, 0, BUILTIN_LEAF | BUILTIN_DYNAMIC},
+    {"vector", NULL, vector, 0, VARIADIC, BUILTIN_LEAF},
+    {"nth", NULL, nth, 2, 2, 0},
+    {"insert", NULL, insert, 3, 3, 0},
+    {"append", NULL, append, 2, 2, 0},
+    {"vector-reserve", NULL, vector_reserve_, 2, 2, 0},
+    {"vector-shrink", NULL, vector_shrink_, 1, 1, 0},
+    {"vector-capacity", NULL, vector_capacity, 1, 1, 0},
+    {"vector-slice", NULL, vector_slice_, 2, 3, 0},
+    {"sort!", NULL, sort_now, 1, 2, 0},
+    {"stable-sort!", NULL, stable_sort_now, 1, 2, 0},
+    {"binary-search", NULL, binary_search, 2, 3, 0},
+    {"vector-map", NULL, vector_map_, 2, 2, 0},
+    {"vector-filter", NULL, vector_filter_, 2, 2, 0},
+    {"vector-reduce", NULL, vector_reduce_, 3, 3, 0},
+    {"vector-fill", NULL, vector_fill_, 2, 4, 0},
+    {"dict", NULL, dict, 0, 2, 0},
+    {"getitem", NULL, getitem, 2, 2, 0},
+    {"setitem", NULL, setitem, 3, 3, 0},
+    {"delitem", NULL, delitem, 2, 2, 0},
+    {"exit", NULL, exit_, 0, 1, 0},
+    {"slice", NULL, slice, 3, 3, BUILTIN_PURE},
+    {"concat", NULL, concat, 0, VARIADIC, BUILTIN_PURE},
+    {"string-builder", NULL, string_builder, 0, 1, 0},
+    {"builder-append!", NULL, builder_append_now, 1, VARIADIC, 0},
+    {"build", NULL, build, 1, 1, 0},
+    {"rope", NULL, rope, 0, VARIADIC, 0},
+    {"rope-slice", NULL, rope_slice_, 3, 3, 0},
+    {"rope-splice", NULL, rope_splice_, 3, 4, 0},
+    {"memoize", NULL, memoize, 1, 2, 0},
+    {"range", NULL, range, 1, 3, 0},
+    {"iterate", NULL, iterate, 2, 2, 0},
+    {"lazy-map", NULL, lazy_map, 2, 2, 0},
+    {"lazy-filter", NULL, lazy_filter, 2, 2, 0},
+    {"take", NULL, take, 2, 2, 0},
+    {"reduce", NULL, reduce, 3, 3, 0},
+    {"realize", NULL, realize, 1, 1, 0},
+    {"str-find", NULL, str_find_, 2, 3, BUILTIN_PURE},
+    {"str-count", NULL, str_count_, 2, 2, BUILTIN_PURE},
+    {"str-split", NULL, str_split_, 2, 2, 0},
+    {"str-replace", NULL, str_replace_, 3, 3, BUILTIN_PURE},
+    {"str-index-of-any", NULL, str_index_of_any, 2, 3, BUILTIN_PURE},
+    {"read-all", NULL, read_all_, 1, 1, 0},
+    {"read-data", NULL, read_data, 1, 1, 0},
+    {"read-csv", NULL, read_csv_, 1, 2, 0},
+    {"size", NULL, size, 1, 1, 0},
+    {"hash-map", NULL, hash_map, 0, VARIADIC, 0},
+    {"pvector", NULL, pvector, 0, VARIADIC, BUILTIN_LEAF},
+    {"assoc", NULL, assoc, 3, 3, 0},
+    {"dissoc", NULL, dissoc, 2, 2, 0},
+    {"conj", NULL, conj_, 2, 2, 0},
+    {"transient", NULL, transient_, 1, 1, 0},
+    {"persistent!", NULL, persistent_, 1, 1, 0},
+    {"assoc!", NULL, assoc_now, 3, 3, 0},
+    {"dissoc!", NULL, dissoc_now, 2, 2, 0},
+    {"conj!", NULL, conj_now, 2, 2, 0},
+    {"regex", NULL, regex, 1, 1, 0},
+    {"regex-match", NULL, regex_match_, 2, 2, 0},
+    {"regex-search", NULL, regex_search_, 2, 2, 0},
+    {"regex-find-all", NULL, regex_find_all_, 2, 2, 0},
+    {"open-input", NULL, open_input, 1, 1, 0},
+    {"open-output", NULL, open_output, 1, 2, 0},
+    {"read-line", NULL, read_line, 1, 1, 0},
+    {"read-bytes", NULL, read_bytes, 2, 2, 0},
+    {"write", NULL, write_, 1, VARIADIC, 0},
+    {"close", NULL, close_, 1, 1, 0},
+    {NULL, NULL, NULL, 0, 0, 0}
+};
 
 void register_builtin_functions() {
     //creates the builtin function objects and puts them into the symbol table
-    #define NBUILTINS 30
-    char *names[NBUILTINS] = {"eval", "apply", "do", "quote", "cons", "list", "macro",
-                              "fn", "def", "car", "cdr", "if", "=", "+", "-",
-                              "print", "while", "set", "try-catch", "show-symbol-table",
-                              "vector", "nth", "insert", "append",
-                              "dict", "getitem", "setitem",
-                              "exit",
-                              "slice", "concat"};
-    LispObject *(*funcs[NBUILTINS])(ConsCell *) = {eval, apply, do_, quote, cons, list, macro,
-                                                   fn, def, car, cdr, if_, equals, plus, minus,
-                                                   print, while_, set, try_catch, show_symbol_table,
-                                                   vector, nth, insert, append,
-                                                   dict, getitem, setitem,
-                                                   exit_,
-                                                   slice, concat};
-    int i;
-    for(i = 0; i < NBUILTINS; i++)
-        new_var(new_symbol(names[i]), new_builtin_function(names[i], funcs[i]));
+    for(BuiltinSpec *spec = builtin_specs; spec->name != NULL; spec++)
+        new_var(new_symbol(spec->name),
+                new_builtin_function(spec->name, spec->cfunc, spec->vfunc,
+                                     spec->min_args, spec->max_args, spec->flags));
+    do_builtin = (BuiltinFunction*)get_var(new_symbol("do"));
+    quote_builtin = (BuiltinFunction*)get_var(new_symbol("quote"));
 
     call_stack = (Vector*)new_vector();
 }
+
+//returns a new function object for the builtin named name, or NULL if there isn't one
+//images refer to builtins by name, since the functions can move between builds
+LispObject *new_builtin_named(char *name) {
+    for(BuiltinSpec *spec = builtin_specs; spec->name != NULL; spec++)
+        if(!strcmp(spec->name, name))
+            return new_builtin_function(spec->name, spec->cfunc, spec->vfunc,
+                                        spec->min_args, spec->max_args, spec->flags);
+    return NULL;
+}
@@ -6,29 +6,49 @@
 
 extern Vector *call_stack;
 
-LispObject *eval(ConsCell *args);
+//describes a builtin function for register_builtin_functions
+//builtins with a cfunc get their argument list unevaluated (special forms),
+//builtins with a vfunc get the evaluated arguments in an array
+typedef struct {
+    char *name;
+    LispObject *(*cfunc)(ConsCell *);
+    LispObject *(*vfunc)(int, LispObject **);
+    int min_args;
+    int max_args;
+    int flags;
+} BuiltinSpec;
+
+LispObject *eval(int argc, LispObject **argv);
 LispObject *eval_sub(LispObject *obj);
 LispObject *apply(ConsCell *args);
 LispObject *apply_sub(LispObject *function, ConsCell *function_arguments);
+LispObject *apply_values(LispObject *function, int argc, LispObject **argv);
+LispObject *expand_macro(Macro *mac, ConsCell *function_arguments, bool *pure, ConsCell **globals_read);
+void splice_expansion(ConsCell *form, LispObject *expansion);
+LispObject *cached_expansion(ConsCell *form);
 LispObject *do_(ConsCell *args);
 LispObject *quote(ConsCell *args);
-LispObject *cons(ConsCell *args);
-LispObject *list(ConsCell *args);
+LispObject *cons(int argc, LispObject **argv);
+LispObject *list(int argc, LispObject **argv);
 LispObject *macro(ConsCell *args);
 LispObject *fn(ConsCell *args);
 LispObject *def(ConsCell *args);
-LispObject *car(ConsCell *args);
-LispObject *cdr(ConsCell *args);
+LispObject *car(int argc, LispObject **argv);
+LispObject *cdr(int argc, LispObject **argv);
 LispObject *if_(ConsCell *args);
-LispObject *equals(ConsCell *args);
+LispObject *equals(int argc, LispObject **argv);
 LispObject *equals_sub(LispObject *a, LispObject *b);
-LispObject *plus(ConsCell *args);
-LispObject *minus(ConsCell *args);
+LispObject *plus(int argc, LispObject **argv);
+LispObject *minus(int argc, LispObject **argv);
 LispObject *print(ConsCell *args);
 LispObject *while_(ConsCell *args);
 LispObject *set(ConsCell *args);
-LispObject *show_symbol_table(ConsCell *args);
+LispObject *show_symbol_table(int argc, LispObject **argv);
 LispObject *try_catch(ConsCell *args);
+LispObject *with_limits(ConsCell *args);
+extern BuiltinFunction *do_builtin;
+extern BuiltinFunction *quote_builtin;
 void register_builtin_functions();
+LispObject *new_builtin_named(char *name);
 
 #endif
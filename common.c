@@ -3,6 +3,10 @@
 
 int VERBOSE = false;
 int ALLOC_VERBOSE = false;
+int OPTIMIZE = true;
+int JIT = true;
+int FASL = true;
+int SIMD = true;
 
 int sncprintf(char *s, int n, char *fmt, ...) {
     va_list args;
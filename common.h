@@ -9,6 +9,10 @@ typedef int bool;
 #define true (!0)
 extern int VERBOSE;
 extern int ALLOC_VERBOSE;
+extern int OPTIMIZE;
+extern int JIT;
+extern int FASL;
+extern int SIMD;
 int sncprintf(char *s, int n, char *fmt, ...);
 
 #endif
@@ -0,0 +1,804 @@
+#include "compiler.h"
+#include "builtins.h"
+#include "symboltable.h"
+#include "optimize.h"
+#include "reader.h"
+#include "error.h"
+#include <ctype.h>
+#include <stdarg.h>
+#include <string.h>
+
+//the compiler translates a program into a C file that is linked against the runtime library.
+//every top level form becomes a C function, and they are run in order when the program
+//starts. top level defs of fns become C functions registered as builtins, other forms
+//become straight line C code calling the runtime. forms using something the compiler
+//doesn't handle (closures, try-catch, macros whose expansion depends on the caller, fns
+//calling eval...) are kept as data and given to the interpreter when the program runs.
+//pure macro calls (see expand_macro) are expanded at compile time, so top level macro
+//definitions are evaluated by the compiler as it goes.
+//compiled code assumes no builtin is ever rebound, and no global a macro expansion done at
+//compile time read either, and falls back on the interpreter if one is.
+//compiled code records the same calls on the call stack as the interpreter, so stack
+//traces of errors are the same.
+
+//=text=
+
+typedef struct {
+    char *text;
+    int size;
+    int capacity;
+} Text;
+
+static void text_init(Text *t) {
+    t->capacity = 256;
+    t->text = malloc(t->capacity);
+    t->text[0] = '\0';
+    t->size = 0;
+}
+
+//appends the printf style fmt, args to t
+static void text_vprintf(Text *t, char *fmt, va_list args) {
+    for(;;) {
+        va_list copy;
+        va_copy(copy, args);
+        int n = vsnprintf(t->text + t->size, t->capacity - t->size, fmt, copy);
+        va_end(copy);
+        if(n < t->capacity - t->size) {
+            t->size += n;
+            return;
+        }
+        t->capacity = 2 * t->capacity + n;
+        t->text = realloc(t->text, t->capacity);
+    }
+}
+
+static void text_printf(Text *t, char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    text_vprintf(t, fmt, args);
+    va_end(args);
+}
+
+//appends the chars of s as the body of a C string literal
+static void text_c_string(Text *t, char *s, int len) {
+    for(int i = 0; i < len; i++) {
+        unsigned char ch = s[i];
+        if(isprint(ch) && ch != '"' && ch != '\\' && ch != '?')
+            text_printf(t, "%c", ch);
+        else
+            text_printf(t, "\\%03o", ch);
+    }
+}
+
+//=compiler state=
+
+typedef struct {
+    Symbol *name;
+    int id;
+    int arity;
+} CompiledFn;
+
+typedef struct {
+    Text declarations;
+    Text functions;
+    Text constants;     //the body of init_constants, which fills in k
+    Dict *constant_ids; //constants that are shared rather than built once per use
+    Dict *watched;      //the globals read by expansions done at compile time
+    int nconstants;
+    int nforms;
+    CompiledFn *fns;
+    int nfns;
+    int fns_capacity;
+} Compiler;
+
+//code generation state for the body of a function or top level form
+typedef struct {
+    Compiler *c;
+    Text code;
+    ConsCell *params;
+    bool *param_used;
+    int ntemps;
+    int depth;
+    bool toplevel;
+    bool failed;
+} Gen;
+
+//returns the index in k of a constant that holds obj once init_constants has run,
+//or -1 if obj can't be written out (functions, vectors, dicts)
+static int constant(Compiler *c, LispObject *obj) {
+    LispObject *known = dict_getitem(c->constant_ids, obj);
+    if(known != NULL)
+        return lisp_int_to_int(known);
+
+    int id;
+    if(obj->type == &LispIntType) {
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = new_lisp_int(%d);\n", id, ((LispInt*)obj)->n);
+        return id;
+    } else if(obj->type == &StrType) {
+        Str *s = (Str*)obj;
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = (LispObject*)new_str_from(\"", id);
+        text_c_string(&c->constants, s->array, s->size);
+        text_printf(&c->constants, "\", %d);\n", s->size);
+        return id;
+    } else if(obj->type == &SymbolType) {
+        Symbol *sym = (Symbol*)obj;
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = (LispObject*)new_symbol(\"", id);
+        text_c_string(&c->constants, sym->name, strlen(sym->name));
+        text_printf(&c->constants, "\");\n");
+    } else if(obj->type == &BuiltinFunctionType) {
+        BuiltinFunction *bf = (BuiltinFunction*)obj;
+        if(lookup_global_var(new_symbol(bf->name)) != obj)
+            return -1;
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = get_global_var(new_symbol(\"", id);
+        text_c_string(&c->constants, bf->name, strlen(bf->name));
+        text_printf(&c->constants, "\"));\n");
+    } else if(obj == (LispObject*)nil) {
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = (LispObject*)nil;\n", id);
+    } else if(obj == tee) {
+        id = c->nconstants++;
+        text_printf(&c->constants, "    k[%d] = tee;\n", id);
+    } else if(obj->type == &ConsCellType) {
+        //the list is built from the end, so long lists don't recurse deeply
+        int length = 0;
+        LispObject *tail = obj;
+        while(tail->type == &ConsCellType && tail != (LispObject*)nil && tail != tee &&
+              dict_getitem(c->constant_ids, tail) == NULL) {
+            length++;
+            tail = ((ConsCell*)tail)->cdr;
+        }
+        ConsCell *cells[length];
+        tail = obj;
+        for(int i = 0; i < length; i++, tail = ((ConsCell*)tail)->cdr)
+            cells[i] = (ConsCell*)tail;
+        int rest = constant(c, tail);
+        for(int i = length - 1; i >= 0 && rest >= 0; i--) {
+            int first = constant(c, cells[i]->car);
+            if(first < 0)
+                return -1;
+            id = c->nconstants++;
+            text_printf(&c->constants, "    k[%d] = (LispObject*)new_cons_cell(k[%d], k[%d]);\n",
+                        id, first, rest);
+            dict_setitem(c->constant_ids, (LispObject*)cells[i], new_lisp_int(id));
+            rest = id;
+        }
+        return rest;
+    } else
+        return -1;
+    dict_setitem(c->constant_ids, obj, new_lisp_int(id));
+    return id;
+}
+
+//returns the compiled fn bound to the global name, or NULL if there is none
+static CompiledFn *find_compiled_fn(Compiler *c, Symbol *name) {
+    for(int i = c->nfns - 1; i >= 0; i--)
+        if(c->fns[i].name == name)
+            return &c->fns[i];
+    return NULL;
+}
+
+//=helpers=
+
+//returns a copy of the list structure of obj, so it can be rewritten while the
+//original is kept to be written out for the interpreter
+static LispObject *copy_tree(LispObject *obj) {
+    if(obj->type != &ConsCellType || obj == (LispObject*)nil || obj == tee)
+        return obj;
+    ConsCell *con = (ConsCell*)obj;
+    ConsCell *out = new_cons_cell(copy_tree(con->car), (LispObject*)nil);
+    ConsCell *node = out;
+    obj = con->cdr;
+    while(obj->type == &ConsCellType && obj != (LispObject*)nil && obj != tee) {
+        con = (ConsCell*)obj;
+        node->cdr = (LispObject*)new_cons_cell(copy_tree(con->car), (LispObject*)nil);
+        node = (ConsCell*)node->cdr;
+        obj = con->cdr;
+    }
+    node->cdr = obj;
+    return (LispObject*)out;
+}
+
+//returns true if con is a proper list
+static bool is_proper_list(ConsCell *con) {
+    while(con != nil) {
+        if(con->type != &ConsCellType || (LispObject*)con == tee)
+            return false;
+        con = (ConsCell*)con->cdr;
+    }
+    return true;
+}
+
+//returns what the head of a form refers to at compile time, or NULL if it isn't
+//a builtin or a macro
+static LispObject *resolve_head(LispObject *head) {
+    head = node_source(head);
+    if(head->type == &SymbolType)
+        head = lookup_global_var((Symbol*)head);
+    if(head == NULL)
+        return NULL;
+    if(head->type == &BuiltinFunctionType)
+        return head;
+    if(head->type == &MacroType && !((Macro*)head)->is_function)
+        return head;
+    return NULL;
+}
+
+//returns true if form is a call to the special form with the C function cfunc
+static bool is_special_form(LispObject *form, LispObject *(*cfunc)(ConsCell*)) {
+    if(form->type != &ConsCellType || form == (LispObject*)nil || form == tee)
+        return false;
+    LispObject *head = resolve_head(((ConsCell*)form)->car);
+    return head != NULL && head->type == &BuiltinFunctionType &&
+        ((BuiltinFunction*)head)->cfunc == cfunc && is_proper_list((ConsCell*)form);
+}
+
+//expands the macro call mac with args args, returns NULL if an error was raised
+static LispObject *try_expand(Macro *mac, ConsCell *args, bool *pure, ConsCell **globals_read) {
+    int my_nscopes = scopes->size;
+    int my_call_stack_size = call_stack->size;
+    LispObject *out;
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        out = expand_macro(mac, args, pure, globals_read);
+        pop_exception_point(&ep);
+    } else {
+        out = NULL;
+        while(scopes->size > my_nscopes)
+            pop_scope();
+        while(call_stack->size > my_call_stack_size)
+            vector_remove(call_stack, -1);
+    }
+    return out;
+}
+
+//evaluates form, ignoring any error it raises
+static void try_eval(LispObject *form) {
+    int my_call_stack_size = call_stack->size;
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        eval_sub(form);
+        pop_exception_point(&ep);
+    } else {
+        while(scopes->size > 1)
+            pop_scope();
+        while(call_stack->size > my_call_stack_size)
+            vector_remove(call_stack, -1);
+    }
+}
+
+//makes the compiled program watch the global sym, see watch_global
+static void watch(Compiler *c, Symbol *sym) {
+    if(dict_getitem(c->watched, (LispObject*)sym) != NULL)
+        return;
+    dict_setitem(c->watched, (LispObject*)sym, tee);
+    text_printf(&c->constants, "    watch_global((Symbol*)k[%d]);\n", constant(c, (LispObject*)sym));
+}
+
+//expands form in place while it is a pure macro call and returns whether it's one afterwards
+static bool expand_pure_macros(Compiler *c, LispObject *form) {
+    while(form->type == &ConsCellType && form != (LispObject*)nil && form != tee) {
+        ConsCell *con = (ConsCell*)form;
+        LispObject *head = resolve_head(con->car);
+        if(head == NULL || head->type != &MacroType)
+            return false;
+        bool pure = true;
+        ConsCell *read;
+        LispObject *expansion = try_expand((Macro*)head, (ConsCell*)con->cdr, &pure, &read);
+        if(expansion == NULL || !pure)
+            return true;
+        if(node_source(con->car)->type == &SymbolType)
+            watch(c, (Symbol*)node_source(con->car));
+        for(; read != nil; read = (ConsCell*)((ConsCell*)read->cdr)->cdr)
+            watch(c, (Symbol*)read->car);
+        splice_expansion(con, expansion);
+    }
+    return false;
+}
+
+//=code generation=
+
+//writes a line of code at the current indentation
+static void emit(Gen *g, char *fmt, ...) {
+    va_list args;
+    text_printf(&g->code, "%*s", 4 * g->depth + 4, "");
+    va_start(args, fmt);
+    text_vprintf(&g->code, fmt, args);
+    va_end(args);
+    text_printf(&g->code, "\n");
+}
+
+//declares a new temporary holding the value of the C expression fmt and returns its number
+static int emit_temp(Gen *g, char *fmt, ...) {
+    va_list args;
+    int t = g->ntemps++;
+    text_printf(&g->code, "%*sLispObject *t%d = ", 4 * g->depth + 4, "", t);
+    va_start(args, fmt);
+    text_vprintf(&g->code, fmt, args);
+    va_end(args);
+    text_printf(&g->code, ";\n");
+    return t;
+}
+
+//records a call to the builtin k[id] on the call stack, like apply_values
+static void emit_push_frame(Gen *g, int id) {
+    emit(g, "PUSH_FRAME(k[%d]);", id);
+}
+
+static void emit_pop_frame(Gen *g) {
+    emit(g, "POP_FRAME();");
+}
+
+static int fail(Gen *g) {
+    g->failed = true;
+    return 0;
+}
+
+static int gen_form(Gen *g, LispObject *form);
+
+//returns the index of sym in the parameters of the function being compiled, or -1
+static int param_index(Gen *g, Symbol *sym) {
+    int i = 0;
+    for(ConsCell *p = g->params; p != nil; p = (ConsCell*)p->cdr, i++)
+        if(p->car == (LispObject*)sym)
+            return i;
+    return -1;
+}
+
+static int gen_constant(Gen *g, LispObject *obj) {
+    int id = constant(g->c, obj);
+    if(id < 0)
+        return fail(g);
+    return emit_temp(g, "k[%d]", id);
+}
+
+//evaluates each of forms, the temporary holding the last value is returned
+static int gen_sequence(Gen *g, ConsCell *forms) {
+    if(forms == nil)
+        return emit_temp(g, "(LispObject*)nil");
+    int t = gen_form(g, forms->car);
+    for(forms = (ConsCell*)forms->cdr; forms != nil; forms = (ConsCell*)forms->cdr) {
+        emit(g, "(void)t%d;", t);
+        t = gen_form(g, forms->car);
+    }
+    return t;
+}
+
+//evaluates args into temporaries and declares an array a<n> holding them
+//writes the C expression for the array into argv
+static void gen_argv(Gen *g, ConsCell *args, int argc, char *argv) {
+    int temps[argc + 1];
+    for(int i = 0; i < argc; i++, args = (ConsCell*)args->cdr)
+        temps[i] = gen_form(g, args->car);
+    if(argc == 0) {
+        strcpy(argv, "NULL");
+        return;
+    }
+    int a = g->ntemps++;
+    text_printf(&g->code, "%*sLispObject *a%d[] = {", 4 * g->depth + 4, "", a);
+    for(int i = 0; i < argc; i++)
+        text_printf(&g->code, i == 0 ? "t%d" : ", t%d", temps[i]);
+    text_printf(&g->code, "};\n");
+    sprintf(argv, "a%d", a);
+}
+
+static int gen_if(Gen *g, ConsCell *args) {
+    ConsCell *rest = (ConsCell*)args->cdr;
+    int cond = gen_form(g, args->car);
+    int out = g->ntemps++;
+    emit(g, "LispObject *t%d;", out);
+    emit(g, "if(t%d != (LispObject*)nil) {", cond);
+    g->depth++;
+    emit(g, "t%d = t%d;", out, gen_form(g, rest->car));
+    g->depth--;
+    emit(g, "} else {");
+    g->depth++;
+    emit(g, "t%d = t%d;", out, gen_form(g, ((ConsCell*)rest->cdr)->car));
+    g->depth--;
+    emit(g, "}");
+    return out;
+}
+
+static int gen_while(Gen *g, ConsCell *args) {
+    int out = emit_temp(g, "(LispObject*)nil");
+    emit(g, "for(;;) {");
+    g->depth++;
+    emit(g, "SAFEPOINT();");
+    int cond = gen_form(g, args->car);
+    emit(g, "if(t%d == (LispObject*)nil)", cond);
+    emit(g, "    break;");
+    emit(g, "t%d = t%d;", out, gen_sequence(g, (ConsCell*)args->cdr));
+    g->depth--;
+    emit(g, "}");
+    return out;
+}
+
+static int gen_set(Gen *g, ConsCell *args) {
+    if(args->car->type != &SymbolType)
+        return fail(g);
+    Symbol *sym = (Symbol*)args->car;
+    int val = gen_form(g, ((ConsCell*)args->cdr)->car);
+    int i = param_index(g, sym);
+    if(i >= 0) {
+        g->param_used[i] = true;
+        emit(g, "p%d = t%d;", i, val);
+    } else {
+        int id = constant(g->c, (LispObject*)sym);
+        emit(g, "set_global_var((Symbol*)k[%d], t%d);", id, val);
+    }
+    return val;
+}
+
+static int gen_def(Gen *g, ConsCell *args) {
+    //only top level defs are compiled, they go into the global scope
+    if(!g->toplevel || args->car->type != &SymbolType)
+        return fail(g);
+    int id = constant(g->c, args->car);
+    int val = gen_form(g, ((ConsCell*)args->cdr)->car);
+    emit(g, "new_var((Symbol*)k[%d], t%d);", id, val);
+    emit(g, "if(t%d->type == &MacroType && ((Macro*)t%d)->macro_name == NULL)", val, val);
+    emit(g, "    ((Macro*)t%d)->macro_name = (Symbol*)k[%d];", val, id);
+    return val;
+}
+
+static int gen_print(Gen *g, ConsCell *args) {
+    int out = emit_temp(g, "(LispObject*)nil");
+    for(; args != nil; args = (ConsCell*)args->cdr) {
+        int t = gen_form(g, args->car);
+        emit(g, "print_object(stdout_printer, t%d);", t);
+        emit(g, "printer_write(stdout_printer, \" \", 1);");
+        emit(g, "t%d = t%d;", out, t);
+    }
+    emit(g, "printer_write(stdout_printer, \"\\n\", 1);");
+    emit(g, "printer_flush(stdout_printer);");
+    return out;
+}
+
+//calls to 2 argument +, - and = work on ints directly
+static int gen_int_op(Gen *g, BuiltinFunction *bf, int id, ConsCell *args) {
+    int a = gen_form(g, args->car);
+    int b = gen_form(g, ((ConsCell*)args->cdr)->car);
+    int out = g->ntemps++;
+    emit(g, "LispObject *t%d;", out);
+    emit(g, "if(t%d->type == &LispIntType && t%d->type == &LispIntType)", a, b);
+    if(bf->vfunc == equals)
+        emit(g, "    t%d = ((LispInt*)t%d)->n == ((LispInt*)t%d)->n ? tee : (LispObject*)nil;",
+             out, a, b);
+    else
+        emit(g, "    t%d = new_lisp_int(((LispInt*)t%d)->n %c ((LispInt*)t%d)->n);",
+             out, a, bf->vfunc == plus ? '+' : '-', b);
+    emit(g, "else {");
+    emit(g, "    LispObject *a%d[] = {t%d, t%d};", out, a, b);
+    emit(g, "    t%d = apply_values(k[%d], 2, a%d);", out, id, out);
+    emit(g, "}");
+    return out;
+}
+
+static int gen_builtin_call(Gen *g, BuiltinFunction *bf, ConsCell *args) {
+    int argc = list_length(args);
+    if(argc < bf->min_args || (bf->max_args != VARIADIC && argc > bf->max_args))
+        return fail(g); //let the interpreter raise the error
+    //compiled fns keep their parameters in C locals, so a builtin looking in the caller's
+    //scope wouldn't see them. set is fine, gen_set knows about the parameters
+    if(!g->toplevel && (bf->flags & BUILTIN_DYNAMIC) && bf->cfunc != set)
+        return fail(g);
+    if(bf->vfunc != NULL) {
+        int id = constant(g->c, (LispObject*)bf);
+        if(id < 0)
+            return fail(g);
+        if(argc == 2 && (bf->vfunc == plus || bf->vfunc == minus || bf->vfunc == equals))
+            return gen_int_op(g, bf, id, args);
+        char argv[16];
+        gen_argv(g, args, argc, argv);
+        if(bf->flags & BUILTIN_LEAF)
+            return emit_temp(g, "((BuiltinFunction*)k[%d])->vfunc(%d, %s)", id, argc, argv);
+        emit_push_frame(g, id);
+        int out = emit_temp(g, "((BuiltinFunction*)k[%d])->vfunc(%d, %s)", id, argc, argv);
+        emit_pop_frame(g);
+        return out;
+    }
+    //quote can't raise an error, so its frame would never be seen
+    if(bf->cfunc == quote)
+        return gen_constant(g, args->car);
+    int id = constant(g->c, (LispObject*)bf);
+    if(id < 0)
+        return fail(g);
+    emit_push_frame(g, id);
+    int out;
+    if(bf->cfunc == do_)
+        out = gen_sequence(g, args);
+    else if(bf->cfunc == if_)
+        out = gen_if(g, args);
+    else if(bf->cfunc == while_)
+        out = gen_while(g, args);
+    else if(bf->cfunc == set)
+        out = gen_set(g, args);
+    else if(bf->cfunc == def)
+        out = gen_def(g, args);
+    else if(bf->cfunc == print)
+        out = gen_print(g, args);
+    else
+        return fail(g);
+    emit_pop_frame(g);
+    return out;
+}
+
+//calls the function bound to the global name, directly if it's still the compiled fn
+static int gen_global_call(Gen *g, Symbol *name, ConsCell *args) {
+    int argc = list_length(args);
+    int id = constant(g->c, (LispObject*)name);
+    int f = emit_temp(g, "get_global_var((Symbol*)k[%d])", id);
+    char argv[16];
+    gen_argv(g, args, argc, argv);
+    CompiledFn *fn = find_compiled_fn(g->c, name);
+    if(fn != NULL && fn->arity == argc)
+        return emit_temp(g, "t%d == fn_obj_%d ? fn_%d(%d, %s) : apply_values(t%d, %d, %s)",
+                         f, fn->id, fn->id, argc, argv, f, argc, argv);
+    return emit_temp(g, "apply_values(t%d, %d, %s)", f, argc, argv);
+}
+
+//writes code evaluating form, and returns the temporary holding its value
+static int gen_form(Gen *g, LispObject *form) {
+    if(g->failed)
+        return 0;
+    form = node_source(form);
+    if(form->type == &SymbolType) {
+        int i = param_index(g, (Symbol*)form);
+        if(i >= 0) {
+            g->param_used[i] = true;
+            return emit_temp(g, "p%d", i);
+        }
+        return emit_temp(g, "get_global_var((Symbol*)k[%d])", constant(g->c, form));
+    }
+    if(form->type != &ConsCellType || form == (LispObject*)nil || form == tee)
+        return gen_constant(g, form);
+
+    ConsCell *con = (ConsCell*)form;
+    LispObject *value = folded_value(con);
+    if(value != NULL)
+        return gen_constant(g, value);
+    if(!is_proper_list(con))
+        return fail(g);
+    LispObject *head = node_source(con->car);
+    if(head->type == &SymbolType) {
+        if(param_index(g, (Symbol*)head) >= 0)
+            return fail(g);
+        head = resolve_head(head);
+        if(head == NULL)
+            return gen_global_call(g, (Symbol*)node_source(con->car), (ConsCell*)con->cdr);
+    }
+    if(head->type == &BuiltinFunctionType)
+        return gen_builtin_call(g, (BuiltinFunction*)head, (ConsCell*)con->cdr);
+    if(head->type == &MacroType && !((Macro*)head)->is_function) {
+        if(expand_pure_macros(g->c, form))
+            return fail(g);
+        return gen_form(g, form);
+    }
+    return fail(g);
+}
+
+static void gen_init(Gen *g, Compiler *c, ConsCell *params, bool toplevel) {
+    g->c = c;
+    text_init(&g->code);
+    g->params = params;
+    g->param_used = calloc(list_length(params) + 1, sizeof(bool));
+    g->ntemps = 0;
+    g->depth = 0;
+    g->toplevel = toplevel;
+    g->failed = false;
+}
+
+static void gen_free(Gen *g) {
+    free(g->code.text);
+    free(g->param_used);
+}
+
+//=top level=
+
+//writes a top level form that hands orig to the interpreter
+static void compile_interpreted(Compiler *c, LispObject *orig) {
+    int id = constant(c, orig);
+    if(id < 0)
+        error("Horrible error, can't compile a form holding unprintable data\n");
+    text_printf(&c->functions, "static void form_%d() {\n", c->nforms++);
+    text_printf(&c->functions, "    eval_sub(optimize(k[%d]));\n}\n\n", id);
+}
+
+//the start of a compiled top level form, which is interpreted if a builtin or watched global
+//has been rebound
+static void begin_form(Compiler *c, int orig_id) {
+    text_printf(&c->functions, "static void form_%d() {\n", c->nforms++);
+    text_printf(&c->functions, "    if(builtin_rebind_count != 0 || expansion_rebind_count != 0) {\n");
+    text_printf(&c->functions, "        eval_sub(optimize(k[%d]));\n", orig_id);
+    text_printf(&c->functions, "        return;\n    }\n");
+}
+
+//compiles (def name (fn ...)) into a C function, returns false if it can't be
+static bool compile_fn_def(Compiler *c, LispObject *work, LispObject *orig, LispObject *fn_form) {
+    ConsCell *args = (ConsCell*)((ConsCell*)work)->cdr;
+    Symbol *name = (Symbol*)args->car;
+    ConsCell *fn_args = (ConsCell*)((ConsCell*)((ConsCell*)args->cdr)->car)->cdr;
+    if(fn_args == nil || fn_args->car->type != &ConsCellType)
+        return false;
+    ConsCell *params = (ConsCell*)fn_args->car;
+    if(!is_proper_list(params))
+        return false;
+    for(ConsCell *p = params; p != nil; p = (ConsCell*)p->cdr)
+        if(p->car->type != &SymbolType)
+            return false;
+
+    //registered before the body is compiled so recursive calls are direct
+    if(c->nfns == c->fns_capacity) {
+        c->fns_capacity = 2 * c->fns_capacity + 8;
+        c->fns = realloc(c->fns, c->fns_capacity * sizeof(CompiledFn));
+    }
+    CompiledFn *fn = &c->fns[c->nfns++];
+    fn->name = name;
+    fn->id = c->nforms;
+    fn->arity = list_length(params);
+
+    Gen g;
+    gen_init(&g, c, params, false);
+    int out = gen_sequence(&g, (ConsCell*)fn_args->cdr);
+    int fn_id = constant(c, fn_form);
+    int orig_id = constant(c, orig);
+    int name_id = constant(c, (LispObject*)name);
+    if(g.failed || fn_id < 0 || orig_id < 0) {
+        c->nfns--;
+        gen_free(&g);
+        return false;
+    }
+
+    int id = fn->id;
+    text_printf(&c->declarations, "static LispObject *fn_%d(int argc, LispObject **argv);\n", id);
+    text_printf(&c->declarations, "static LispObject *fn_obj_%d;\n", id);
+    text_printf(&c->declarations, "static LispObject *fn_interpreted_%d;\n", id);
+
+    text_printf(&c->functions, "//%s\n", name->name);
+    text_printf(&c->functions, "static LispObject *fn_%d(int argc, LispObject **argv) {\n", id);
+    text_printf(&c->functions, "    if(builtin_rebind_count != 0 || expansion_rebind_count != 0)\n");
+    text_printf(&c->functions, "        return apply_values(global_function(&fn_interpreted_%d, k[%d]), argc, argv);\n",
+                id, fn_id);
+    text_printf(&c->functions, "    SAFEPOINT();\n    CHECK_STACK();\n");
+    text_printf(&c->functions, "    PUSH_FRAME(fn_interpreted_%d);\n", id);
+    for(int i = 0; i < fn->arity; i++)
+        if(g.param_used[i])
+            text_printf(&c->functions, "    LispObject *p%d = argv[%d];\n", i, i);
+    text_printf(&c->functions, "%s    POP_FRAME();\n    return t%d;\n}\n\n", g.code.text, out);
+    gen_free(&g);
+
+    begin_form(c, orig_id);
+    text_printf(&c->functions, "    gc_add_roots(&fn_obj_%d, 1);\n", id);
+    text_printf(&c->functions, "    gc_add_roots(&fn_interpreted_%d, 1);\n", id);
+    text_printf(&c->functions, "    fn_obj_%d = new_builtin_function(\"", id);
+    text_c_string(&c->functions, name->name, strlen(name->name));
+    text_printf(&c->functions, "\", NULL, fn_%d, %d, %d, BUILTIN_OWN_FRAME);\n", id, fn->arity, fn->arity);
+    //the function the interpreter would have made stands for the compiled one on the call stack
+    text_printf(&c->functions, "    ((Macro*)global_function(&fn_interpreted_%d, k[%d]))->macro_name = (Symbol*)k[%d];\n",
+                id, fn_id, name_id);
+    text_printf(&c->functions, "    new_var((Symbol*)k[%d], fn_obj_%d);\n}\n\n", name_id, id);
+    return true;
+}
+
+//compiles a top level form into straight line code, returns false if it can't be
+static bool compile_form(Compiler *c, LispObject *work, LispObject *orig) {
+    Gen g;
+    gen_init(&g, c, nil, true);
+    g.depth = 0;
+    int out = gen_form(&g, work);
+    int orig_id = constant(c, orig);
+    if(g.failed || orig_id < 0) {
+        gen_free(&g);
+        return false;
+    }
+    begin_form(c, orig_id);
+    text_printf(&c->functions, "%s    (void)t%d;\n}\n\n", g.code.text, out);
+    gen_free(&g);
+    return true;
+}
+
+//writes a top level form that runs the C statement stmt
+static void compile_statement(Compiler *c, char *stmt) {
+    text_printf(&c->functions, "static void form_%d() {\n    %s\n}\n\n", c->nforms++, stmt);
+}
+
+static void compile_toplevel(Compiler *c, LispObject *orig) {
+    if(is_special_form(orig, do_)) {
+        //the forms are compiled one by one, inside the frame the interpreter would push for the do
+        char push[64];
+        sprintf(push, "PUSH_FRAME(k[%d]);", constant(c, (LispObject*)do_builtin));
+        compile_statement(c, push);
+        for(ConsCell *forms = (ConsCell*)((ConsCell*)orig)->cdr; forms != nil; forms = (ConsCell*)forms->cdr)
+            compile_toplevel(c, forms->car);
+        compile_statement(c, "POP_FRAME();");
+        return;
+    }
+
+    LispObject *work = copy_tree(orig);
+    if(expand_pure_macros(c, work)) {
+        compile_interpreted(c, orig);
+        return;
+    }
+
+    if(is_special_form(work, def) && list_length((ConsCell*)work) == 3) {
+        LispObject *val = nth_list((ConsCell*)work, 2);
+        if(is_special_form(val, macro)) {
+            //macros are needed to expand the rest of the program
+            try_eval(copy_tree(work));
+        } else if(((ConsCell*)work)->cdr->type == &ConsCellType &&
+                  ((ConsCell*)((ConsCell*)work)->cdr)->car->type == &SymbolType &&
+                  is_special_form(val, fn)) {
+            LispObject *fn_form = copy_tree(val);
+            optimize(work);
+            if(compile_fn_def(c, work, orig, fn_form))
+                return;
+        }
+    }
+    if(compile_form(c, optimize(work), orig))
+        return;
+    compile_interpreted(c, orig);
+}
+
+static void write_output(Compiler *c, FILE *out) {
+    fprintf(out, "//generated by lisp --compile-c, link with the runtime library\n");
+    fprintf(out, "#include \"lisptype.h\"\n");
+    fprintf(out, "#include \"builtins.h\"\n");
+    fprintf(out, "#include \"symboltable.h\"\n");
+    fprintf(out, "#include \"optimize.h\"\n");
+    fprintf(out, "#include \"safepoint.h\"\n");
+    fprintf(out, "#include \"alloc.h\"\n");
+    fprintf(out, "#include \"printer.h\"\n");
+    fprintf(out, "#include \"runtime.h\"\n\n");
+    fprintf(out, "static LispObject *k[%d];\n", c->nconstants + 1);
+    fprintf(out, "%s\n", c->declarations.text);
+    fprintf(out, "%s", c->functions.text);
+    fprintf(out, "static void init_constants() {\n    gc_add_roots(k, %d);\n%s}\n\n",
+            c->nconstants + 1, c->constants.text);
+    fprintf(out, "static void (*forms[])() = {\n");
+    for(int i = 0; i < c->nforms; i++)
+        fprintf(out, "    form_%d,\n", i);
+    fprintf(out, "    NULL\n};\n\n");
+    fprintf(out, "int main(int argc, char **argv) {\n");
+    fprintf(out, "    run_compiled_program(init_constants, forms);\n");
+    fprintf(out, "    return 0;\n}\n");
+}
+
+//compiles the forms in the files filenames, in order, into a C program written to out
+void compile_to_c(char **filenames, int nfiles, FILE *out) {
+    Compiler c;
+    text_init(&c.declarations);
+    text_init(&c.functions);
+    text_init(&c.constants);
+    c.constant_ids = (Dict*)new_dict();
+    c.watched = (Dict*)new_dict();
+    c.nconstants = 0;
+    c.nforms = 0;
+    c.fns = NULL;
+    c.nfns = 0;
+    c.fns_capacity = 0;
+
+    for(int i = 0; i < nfiles; i++) {
+        FILE *f = (!strcmp(filenames[i], "-")) ? stdin : fopen(filenames[i], "r");
+        if(f == NULL)
+            error("File %s does not exist", filenames[i]);
+        Reader r;
+        reader_from_file(&r, f);
+        LispObject *form;
+        while((form = read_form(&r)) != NULL)
+            compile_toplevel(&c, form);
+        reader_close(&r);
+        if(f != stdin)
+            fclose(f);
+    }
+    write_output(&c, out);
+
+    free(c.declarations.text);
+    free(c.functions.text);
+    free(c.constants.text);
+    free(c.fns);
+}
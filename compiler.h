@@ -0,0 +1,9 @@
+#ifndef _COMPILER_H_
+#define _COMPILER_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+void compile_to_c(char **filenames, int nfiles, FILE *out);
+
+#endif
@@ -0,0 +1,440 @@
+#include "csv.h"
+#include "alloc.h"
+#include "error.h"
+#include "printer.h"
+#include <string.h>
+#include <limits.h>
+
+//=columns=
+
+LispType IntColumnType = {&TypeType, "int-column", int_column_print, sizeof(IntColumn)};
+LispType StrColumnType = {&TypeType, "str-column", str_column_print, sizeof(StrColumn)};
+
+//returns the item at index i in an int or str column, negative indices count from the end
+//raises an exception if i is out of range
+LispObject *column_getitem(LispObject *column, int i) {
+    int size = column_size(column);
+    if(i >= size || -i > size)
+        error("getitem: index %d out of range in column of size %d\n", i, size);
+    if(i < 0)
+        i += size;
+    if(column->type == &IntColumnType)
+        return new_lisp_int(((IntColumn*)column)->array[i]);
+    StrColumn *c = (StrColumn*)column;
+    return (LispObject*)new_str_from(c->chars + c->offsets[i], c->offsets[i + 1] - c->offsets[i]);
+}
+
+//returns the number of items in an int or str column
+//raises an exception if column is neither
+int column_size(LispObject *column) {
+    if(column->type == &IntColumnType)
+        return ((IntColumn*)column)->size;
+    return ((StrColumn*)safe_cast(column, &StrColumnType))->size;
+}
+
+//print method for int columns, which print like vectors
+void int_column_print(LispObject *obj, Printer *p) {
+    IntColumn *c = (IntColumn*)obj;
+    printer_write(p, "[", 1);
+    for(int i = 0; i < c->size; i++) {
+        printer_int(p, c->array[i]);
+        printer_write(p, ", ", 2);
+    }
+    printer_write(p, "]", 1);
+}
+
+//print method for str columns, which print like vectors
+void str_column_print(LispObject *obj, Printer *p) {
+    StrColumn *c = (StrColumn*)obj;
+    printer_write(p, "[", 1);
+    for(int i = 0; i < c->size; i++) {
+        printer_write(p, "\"", 1);
+        printer_write(p, c->chars + c->offsets[i], c->offsets[i + 1] - c->offsets[i]);
+        printer_write(p, "\", ", 3);
+    }
+    printer_write(p, "]", 1);
+}
+
+//=parsing=
+
+//column kinds, columns without a type hint start out as ints and become strs
+//at the first field that isn't one
+#define CSV_INT 0
+#define CSV_STR 1
+
+//a column being read. int columns fill ints, str columns chars and offsets
+typedef struct {
+    Symbol *name;
+    int kind;
+    bool hinted;
+    int *ints;
+    char *chars;
+    size_t chars_len;
+    size_t chars_size;
+    size_t *offsets;
+    int size;
+    int array_size;
+} ColumnBuilder;
+
+//a field of the record being read, pointing into the chunk
+typedef struct {
+    char *start;
+    int len;
+    bool quoted; //doubled quotes in it still need undoubling
+} Field;
+
+typedef struct {
+    FILE *file;
+    char *buf;
+    size_t len;
+    size_t size;
+    bool eof;
+    ColumnBuilder *columns;
+    int ncolumns;
+    Field *fields;
+    int fields_size;
+    int row; //for error messages
+} CsvReader;
+
+//reads more of the file after the len chars already in the buffer, growing it if it's full
+//returns false at the end of the file
+static bool csv_fill(CsvReader *r) {
+    if(r->eof)
+        return false;
+    if(r->len == r->size) {
+        r->size *= 2;
+        r->buf = realloc(r->buf, r->size);
+    }
+    size_t n = fread(r->buf + r->len, 1, r->size - r->len, r->file);
+    if(n == 0) {
+        if(ferror(r->file))
+            error("Horrible error, reading csv file failed\n");
+        r->eof = true;
+        return false;
+    }
+    r->len += n;
+    return true;
+}
+
+static void add_field(CsvReader *r, int n, char *start, int len, bool quoted) {
+    if(n == r->fields_size) {
+        r->fields_size *= 2;
+        r->fields = realloc(r->fields, r->fields_size * sizeof(Field));
+    }
+    r->fields[n].start = start;
+    r->fields[n].len = len;
+    r->fields[n].quoted = quoted;
+}
+
+//splits the record starting at *pos into r->fields and moves *pos past it
+//returns the number of fields, 0 for blank lines, or -1 if the record runs past the end
+//of the chunk before the end of the file
+static int split_record(CsvReader *r, size_t *pos) {
+    char *p = r->buf + *pos;
+    char *end = r->buf + r->len;
+    int n = 0;
+    if(p == end)
+        return r->eof ? 0 : -1;
+    if(*p == '\n' || *p == '\r') {
+        while(p < end && (*p == '\n' || *p == '\r'))
+            p++;
+        *pos = p - r->buf;
+        return 0;
+    }
+    for(;;) {
+        char *start = p;
+        if(p < end && *p == '"') {
+            //quoted fields end at a quote that isn't doubled
+            start = ++p;
+            bool doubled = false;
+            for(;;) {
+                char *quote = memchr(p, '"', end - p);
+                if(quote == NULL || quote + 1 == end) {
+                    if(!r->eof)
+                        return -1;
+                    if(quote == NULL)
+                        error("Horrible error, unterminated quoted field in csv row %d\n", r->row + 1);
+                    p = quote;
+                    break;
+                }
+                if(quote[1] != '"') {
+                    p = quote;
+                    break;
+                }
+                doubled = true;
+                p = quote + 2;
+            }
+            add_field(r, n++, start, p - start, doubled);
+            p++;
+            if(p < end && *p == '\r')
+                p++;
+            if(p < end && *p != ',' && *p != '\n')
+                error("Horrible error, unexpected character after quoted field in csv row %d\n",
+                      r->row + 1);
+        } else {
+            while(p < end && *p != ',' && *p != '\n')
+                p++;
+            int len = p - start;
+            if(p < end || r->eof) {
+                if(len > 0 && start[len - 1] == '\r')
+                    len--;
+            }
+            add_field(r, n++, start, len, false);
+        }
+        if(p == end) {
+            if(!r->eof)
+                return -1;
+            *pos = p - r->buf;
+            return n;
+        }
+        if(*p == '\n') {
+            *pos = p + 1 - r->buf;
+            return n;
+        }
+        p++; //the comma
+    }
+}
+
+//parses the len chars at s as an int. if canonical is set it has to be written the way
+//ints print, so that turning a guessed int column into strs later gives back the same text
+static bool parse_int(char *s, int len, bool canonical, int *out) {
+    char *end = s + len;
+    bool negative = s < end && *s == '-';
+    if(negative)
+        s++;
+    if(canonical && s < end && *s == '0' && (end - s > 1 || negative))
+        return false;
+    while(!canonical && end - s > 1 && *s == '0')
+        s++;
+    if(s == end || end - s > 10)
+        return false;
+    long long n = 0;
+    for(; s < end; s++) {
+        if(*s < '0' || *s > '9')
+            return false;
+        n = 10 * n + (*s - '0');
+    }
+    if(negative)
+        n = -n;
+    if(n > INT_MAX || n < INT_MIN)
+        return false;
+    *out = n;
+    return true;
+}
+
+static void append_chars(ColumnBuilder *c, char *s, int len) {
+    if(c->chars_len + len > c->chars_size) {
+        while(c->chars_len + len > c->chars_size)
+            c->chars_size *= 2;
+        c->chars = realloc(c->chars, c->chars_size);
+    }
+    memcpy(c->chars + c->chars_len, s, len);
+    c->chars_len += len;
+}
+
+static void grow_column(ColumnBuilder *c) {
+    c->array_size *= 2;
+    if(c->kind == CSV_INT)
+        c->ints = realloc(c->ints, c->array_size * sizeof(int));
+    else
+        c->offsets = realloc(c->offsets, (c->array_size + 1) * sizeof(size_t));
+}
+
+//turns an int column that met a field that isn't an int into a str column
+static void make_str_column(ColumnBuilder *c) {
+    c->kind = CSV_STR;
+    c->chars_size = 16 * c->array_size;
+    c->chars = malloc(c->chars_size);
+    c->chars_len = 0;
+    c->offsets = malloc((c->array_size + 1) * sizeof(size_t));
+    char digits[16];
+    for(int i = 0; i < c->size; i++) {
+        c->offsets[i] = c->chars_len;
+        append_chars(c, digits, sprintf(digits, "%d", c->ints[i]));
+    }
+    c->offsets[c->size] = c->chars_len;
+    free(c->ints);
+    c->ints = NULL;
+}
+
+static void add_to_column(CsvReader *r, ColumnBuilder *c, Field *f) {
+    if(c->size == c->array_size)
+        grow_column(c);
+    if(c->kind == CSV_INT) {
+        if(!f->quoted && parse_int(f->start, f->len, !c->hinted, &c->ints[c->size])) {
+            c->size++;
+            return;
+        }
+        if(c->hinted)
+            error("Horrible error, column %s of csv row %d isn't an int\n", c->name->name, r->row);
+        make_str_column(c);
+    }
+    if(f->quoted) {
+        //copies the field a run at a time, leaving out the first quote of each pair
+        char *s = f->start;
+        char *end = s + f->len;
+        while(s < end) {
+            char *quote = memchr(s, '"', end - s);
+            if(quote == NULL)
+                quote = end - 1;
+            append_chars(c, s, quote + 1 - s);
+            s = quote + 2;
+        }
+    } else
+        append_chars(c, f->start, f->len);
+    c->size++;
+    c->offsets[c->size] = c->chars_len;
+}
+
+static void free_builders(CsvReader *r) {
+    for(int i = 0; i < r->ncolumns; i++) {
+        free(r->columns[i].ints);
+        free(r->columns[i].chars);
+        free(r->columns[i].offsets);
+    }
+    free(r->columns);
+    r->columns = NULL;
+    r->ncolumns = 0;
+}
+
+//sets up a column for each field of the header, with the kind given for its name in hints
+static void read_header(CsvReader *r, Dict *hints) {
+    size_t pos = 0;
+    int n;
+    while((n = split_record(r, &pos)) <= 0) {
+        if(n == 0 && pos < r->len)
+            continue;
+        if(r->eof)
+            error("Horrible error, csv file has no header\n");
+        csv_fill(r);
+    }
+    r->columns = calloc(n, sizeof(ColumnBuilder));
+    r->ncolumns = n;
+    Symbol *int_symbol = new_symbol("int");
+    Symbol *str_symbol = new_symbol("str");
+    for(int i = 0; i < n; i++) {
+        ColumnBuilder *c = &r->columns[i];
+        Field *f = &r->fields[i];
+        char name[MAX_SYMBOL_LEN];
+        if(f->quoted || f->len >= MAX_SYMBOL_LEN)
+            error("Horrible error, csv column names can have at most %d characters "
+                  "and no quotes\n", MAX_SYMBOL_LEN - 1);
+        memcpy(name, f->start, f->len);
+        name[f->len] = '\0';
+        c->name = new_symbol(name);
+        c->kind = CSV_INT;
+        if(hints != NULL) {
+            LispObject *hint = dict_getitem(hints, (LispObject*)c->name);
+            if(hint == (LispObject*)str_symbol)
+                c->kind = CSV_STR;
+            else if(hint != NULL && hint != (LispObject*)int_symbol)
+                error("Horrible error, csv column types are int or str\n");
+            c->hinted = hint != NULL;
+        }
+        c->array_size = 1024;
+        if(c->kind == CSV_INT)
+            c->ints = malloc(c->array_size * sizeof(int));
+        else {
+            c->chars_size = 16 * c->array_size;
+            c->chars = malloc(c->chars_size);
+            c->offsets = malloc((c->array_size + 1) * sizeof(size_t));
+            c->offsets[0] = 0;
+        }
+    }
+    memmove(r->buf, r->buf + pos, r->len - pos);
+    r->len -= pos;
+}
+
+//reads every row of the file into the column builders, a chunk at a time
+static void read_rows(CsvReader *r, Dict *hints) {
+    read_header(r, hints);
+    for(;;) {
+        size_t pos = 0;
+        for(;;) {
+            size_t record = pos;
+            int n = split_record(r, &pos);
+            if(n < 0) {
+                pos = record;
+                break;
+            }
+            if(n == 0) {
+                if(pos == r->len)
+                    break;
+                continue;
+            }
+            r->row++;
+            if(n != r->ncolumns)
+                error("Horrible error, csv row %d has %d fields instead of %d\n",
+                      r->row, n, r->ncolumns);
+            for(int i = 0; i < n; i++)
+                add_to_column(r, &r->columns[i], &r->fields[i]);
+        }
+        //the rest of the chunk is the start of a record, which the next chunk finishes
+        memmove(r->buf, r->buf + pos, r->len - pos);
+        r->len -= pos;
+        if(!csv_fill(r) && r->len == 0)
+            return;
+    }
+}
+
+//turns the column builders into a dict from column name to column, handing their arrays over
+static LispObject *make_columns(CsvReader *r) {
+    Dict *out = (Dict*)new_dict();
+    for(int i = 0; i < r->ncolumns; i++) {
+        ColumnBuilder *c = &r->columns[i];
+        LispObject *column;
+        if(c->kind == CSV_INT) {
+            IntColumn *ints = alloc(sizeof(IntColumn));
+            ints->type = &IntColumnType;
+            ints->array = realloc(c->ints, (c->size + 1) * sizeof(int));
+            ints->size = c->size;
+            c->ints = NULL;
+            column = (LispObject*)ints;
+        } else {
+            StrColumn *strs = alloc(sizeof(StrColumn));
+            strs->type = &StrColumnType;
+            strs->chars = realloc(c->chars, c->chars_len + 1);
+            strs->offsets = realloc(c->offsets, (c->size + 1) * sizeof(size_t));
+            strs->size = c->size;
+            c->chars = NULL;
+            c->offsets = NULL;
+            column = (LispObject*)strs;
+        }
+        dict_setitem(out, (LispObject*)c->name, column);
+    }
+    return (LispObject*)out;
+}
+
+//reads the csv file f into a dict from the names in its header, as symbols, to columns
+//columns of ints are int columns, and the rest str columns. hints, if not NULL, maps
+//column names to the symbols int or str, which fixes the type of those columns
+LispObject *read_csv(FILE *f, Dict *hints) {
+    CsvReader r;
+    r.file = f;
+    r.size = CSV_CHUNK_SIZE;
+    r.buf = malloc(r.size);
+    r.len = 0;
+    r.eof = false;
+    r.columns = NULL;
+    r.ncolumns = 0;
+    r.fields_size = 16;
+    r.fields = malloc(r.fields_size * sizeof(Field));
+    r.row = 0;
+
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        free_builders(&r);
+        free(r.buf);
+        free(r.fields);
+        reraise_error();
+    }
+    csv_fill(&r);
+    read_rows(&r, hints);
+    LispObject *out = make_columns(&r);
+    pop_exception_point(&ep);
+    free_builders(&r);
+    free(r.buf);
+    free(r.fields);
+    return out;
+}
@@ -0,0 +1,35 @@
+#ifndef _CSV_H_
+#define _CSV_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//size of the chunks csv files are read in
+#define CSV_CHUNK_SIZE (1024 * 1024)
+
+//a column of ints, stored unboxed
+typedef struct {
+    LISP_OBJECT_HEADER
+    int *array;
+    int size;
+} IntColumn;
+
+//a column of strs, stored one after the other in chars without terminators
+//item i runs from offsets[i] to offsets[i + 1]
+typedef struct {
+    LISP_OBJECT_HEADER
+    char *chars;
+    size_t *offsets;
+    int size;
+} StrColumn;
+
+LispObject *read_csv(FILE *f, Dict *hints);
+LispObject *column_getitem(LispObject *column, int i);
+int column_size(LispObject *column);
+void int_column_print(LispObject *obj, Printer *p);
+void str_column_print(LispObject *obj, Printer *p);
+
+extern LispType IntColumnType;
+extern LispType StrColumnType;
+
+#endif
@@ -1,20 +1,169 @@
 #include "error.h"
 #include <stdarg.h>
+#include <string.h>
+
+ExceptionPoint *exception_point = NULL;
+LispError last_error;
+
+#define ERROR_STRING_LEN 256
+static char error_string[ERROR_STRING_LEN];
+static bool error_string_valid = false;
+//copies of the %s arguments of the last error, which last_error points into
+static char error_arg_text[ERROR_STRING_LEN];
+
+//makes ep the innermost exception point, the caller then has to setjmp(ep->jmp)
+void push_exception_point(ExceptionPoint *ep) {
+    ep->prev = exception_point;
+    exception_point = ep;
+}
+
+//removes the exception point ep after the code it protected finished without an error
+void pop_exception_point(ExceptionPoint *ep) {
+    exception_point = ep->prev;
+}
+
+//argument types for printf conversions
+enum {ARG_INT, ARG_LONG, ARG_LONG_LONG, ARG_DOUBLE, ARG_STRING, ARG_POINTER, ARG_NONE};
+
+//returns the type of the argument of the conversion starting after the % at fmt,
+//and puts the position just after it into end_out
+static int conversion_type(char *fmt, char **end_out) {
+    int longs = 0;
+    char *c = fmt;
+    while(*c != '\0' && strchr("-+ #0123456789.hzjt", *c))
+        c++;
+    while(*c == 'l') {
+        longs++;
+        c++;
+    }
+    *end_out = *c == '\0' ? c : c + 1;
+    switch(*c) {
+    case 'd': case 'i': case 'o': case 'u': case 'x': case 'X': case 'c':
+        return longs == 0 ? ARG_INT : longs == 1 ? ARG_LONG : ARG_LONG_LONG;
+    case 'f': case 'e': case 'E': case 'g': case 'G':
+        return ARG_DOUBLE;
+    case 's':
+        return ARG_STRING;
+    case 'p':
+        return ARG_POINTER;
+    }
+    return ARG_NONE;
+}
+
+//the strings of %s arguments are copied, as they may be in the frames the error unwinds
+//or in objects freed before the message is asked for. they're copied to text first and
+//only then to error_arg_text, in case one is the text of the error being handled
+static void raise_error_va(int kind, char *fmt, va_list args) {
+    char text[ERROR_STRING_LEN];
+    int text_used = 0;
+    last_error.kind = kind;
+    last_error.fmt = fmt;
+    last_error.nargs = 0;
+    error_string_valid = false;
+    for(char *c = strchr(fmt, '%'); c != NULL && last_error.nargs < ERROR_MAX_ARGS; c = strchr(c, '%')) {
+        ErrorArg *arg = &last_error.args[last_error.nargs];
+        switch(conversion_type(c + 1, &c)) {
+        case ARG_INT: arg->i = va_arg(args, int); break;
+        case ARG_LONG: arg->l = va_arg(args, long); break;
+        case ARG_LONG_LONG: arg->ll = va_arg(args, long long); break;
+        case ARG_DOUBLE: arg->d = va_arg(args, double); break;
+        case ARG_POINTER: arg->p = va_arg(args, void *); break;
+        case ARG_STRING: {
+            char *str = va_arg(args, char *);
+            arg->p = str == NULL ? NULL : "";
+            if(str != NULL && text_used < ERROR_STRING_LEN) {
+                arg->p = error_arg_text + text_used;
+                while(*str != '\0' && text_used < ERROR_STRING_LEN - 1)
+                    text[text_used++] = *str++;
+                text[text_used++] = '\0';
+            }
+            break;
+        }
+        default: continue;
+        }
+        last_error.nargs++;
+    }
+    memcpy(error_arg_text, text, text_used);
+
+    reraise_error();
+}
+
+//raises last_error again at the innermost exception point, for code that only needs to
+//clean up after an error on its way out
+void reraise_error() {
+    if(exception_point == NULL) {
+        fprintf(stderr, "%s", error_message());
+        fprintf(stderr, "No exception point defined, exiting\n");
+        exit(2);
+    }
+    ExceptionPoint *ep = exception_point;
+    exception_point = ep->prev;
+    longjmp(ep->jmp, 1);
+}
+
+//raises an exception of kind kind, whose message is defined by the printf-style fmt, ... arguments
+void raise_error(int kind, char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    raise_error_va(kind, fmt, args);
+    va_end(args);
+}
 
 //raises an exception with the error string defined by the printf-style fmt, ... arguments
 void error(char *fmt, ...) {
     va_list args;
-
     va_start(args, fmt);
-    vsnprintf(error_string, ERROR_STRING_LEN, fmt, args);
+    raise_error_va(ERROR_GENERIC, fmt, args);
     va_end(args);
-    if(nexception_points <= 0) {
-        fprintf(stderr, "No exception point defined, exiting\n");
-        exit(2);
-    }
-    longjmp(exception_points[nexception_points - 1], 1);
 }
 
-jmp_buf exception_points[MAX_EXCEPTION_POINTS];
-int nexception_points = 0;
-char error_string[ERROR_STRING_LEN];
+//returns the message of the last error, formatting it the first time it's asked for
+char *error_message() {
+    if(error_string_valid)
+        return error_string;
+
+    //each conversion is formatted on its own with the literal text before it
+    int used = 0;
+    int argi = 0;
+    char *c = last_error.fmt;
+    while(*c != '\0' && used < ERROR_STRING_LEN - 1) {
+        char *next = strchr(c, '%');
+        if(next == NULL)
+            next = c + strlen(c);
+        else {
+            char *end;
+            int type = conversion_type(next + 1, &end);
+            if(next[1] == '%' || type == ARG_NONE || argi >= last_error.nargs)
+                next = end;
+            else {
+                char piece[ERROR_STRING_LEN];
+                int len = end - c < ERROR_STRING_LEN ? end - c : ERROR_STRING_LEN - 1;
+                memcpy(piece, c, len);
+                piece[len] = '\0';
+                ErrorArg *arg = &last_error.args[argi++];
+                char *out = error_string + used;
+                int room = ERROR_STRING_LEN - used;
+                switch(type) {
+                case ARG_INT: used += sncprintf(out, room, piece, arg->i); break;
+                case ARG_LONG: used += sncprintf(out, room, piece, arg->l); break;
+                case ARG_LONG_LONG: used += sncprintf(out, room, piece, arg->ll); break;
+                case ARG_DOUBLE: used += sncprintf(out, room, piece, arg->d); break;
+                case ARG_STRING:
+                case ARG_POINTER: used += sncprintf(out, room, piece, arg->p); break;
+                }
+                c = end;
+                continue;
+            }
+        }
+        //text without conversions, %% is copied through printf to collapse it
+        char piece[ERROR_STRING_LEN];
+        int len = next - c < ERROR_STRING_LEN ? next - c : ERROR_STRING_LEN - 1;
+        memcpy(piece, c, len);
+        piece[len] = '\0';
+        used += sncprintf(error_string + used, ERROR_STRING_LEN - used, strchr(piece, '%') ? piece : "%s", piece);
+        c = next;
+    }
+    error_string[used < ERROR_STRING_LEN ? used : ERROR_STRING_LEN - 1] = '\0';
+    error_string_valid = true;
+    return error_string;
+}
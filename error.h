@@ -5,12 +5,51 @@
 
 #include <setjmp.h>
 
-#define MAX_EXCEPTION_POINTS 256 
-extern jmp_buf exception_points[MAX_EXCEPTION_POINTS];
-extern int nexception_points;
-#define ERROR_STRING_LEN 256
-extern char error_string[ERROR_STRING_LEN];
+//a place to jump back to when an error is raised. they are kept on the C stack of the
+//function that catches errors, linked from the innermost one outwards, so there is no
+//limit on how deeply they nest. error() removes the innermost one before jumping to it,
+//code that finishes without an error has to remove it with pop_exception_point
+typedef struct ExceptionPoint_S {
+    jmp_buf jmp;
+    struct ExceptionPoint_S *prev;
+} ExceptionPoint;
+
+extern ExceptionPoint *exception_point;
+
+void push_exception_point(ExceptionPoint *ep);
+void pop_exception_point(ExceptionPoint *ep);
+
+//kinds of errors
+#define ERROR_GENERIC 0
+#define ERROR_TYPE 1    //an object of the wrong type was passed
+#define ERROR_ARITY 2   //a function was called with the wrong number of arguments
+#define ERROR_UNBOUND 3 //a symbol has no value
+#define ERROR_LIMIT 4   //evaluation ran out of fuel or time
+
+//the last error raised. the arguments for its printf style fmt are kept as they were
+//passed, but for %s ones which point to copies of their strings, and the message is
+//only formatted if someone asks for it with error_message
+#define ERROR_MAX_ARGS 6
+typedef union {
+    int i;
+    long l;
+    long long ll;
+    double d;
+    void *p;
+} ErrorArg;
+
+typedef struct {
+    int kind;
+    char *fmt;
+    int nargs;
+    ErrorArg args[ERROR_MAX_ARGS];
+} LispError;
+
+extern LispError last_error;
 
 void error(char *fmt, ...);
+void raise_error(int kind, char *fmt, ...);
+void reraise_error();
+char *error_message();
  
 #endif
@@ -0,0 +1,502 @@
+#define _DEFAULT_SOURCE
+#include "fasl.h"
+#include "error.h"
+#include "safepoint.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//the file is a FaslHeader, the forms, then the names of the symbols used, each a length
+//byte followed by the name and its null terminator. each form is a tag byte then:
+//  FASL_INT: the int
+//  FASL_SYMBOL: the index of the symbol in the names
+//  FASL_STR: the length, then the chars
+//  FASL_LIST: the number of elements, the elements, then the final cdr
+//  FASL_VECTOR: the number of elements, then the elements
+//  FASL_DICT: the number of entries, then each key followed by its value
+//numbers are varints, see fasl_read_int. the header is in the byte order of the machine that
+//wrote the file
+#define FASL_NIL 0
+#define FASL_INT 1
+#define FASL_SYMBOL 2
+#define FASL_STR 3
+#define FASL_LIST 4
+#define FASL_VECTOR 5
+#define FASL_DICT 6
+
+#define FASL_MAGIC "LFASL\r\n"
+
+typedef struct {
+    char magic[8];
+    int version;
+    int byte_order; //1 as written by this machine
+    //the source the file was made from, it's only used if they still match
+    long long source_size;
+    long long source_mtime_sec;
+    long long source_mtime_nsec;
+    int nsymbols;
+    int nforms;
+    long long symbols_offset; //where the names start
+} FaslHeader;
+
+//returns the name of the fasl file for source, .l is replaced with .lfasl and
+//anything else has .lfasl added. the result must be freed
+char *fasl_filename(char *source) {
+    int len = strlen(source);
+    if(len >= 2 && !strcmp(source + len - 2, ".l"))
+        len -= 2;
+    char *out = malloc(len + 7);
+    memcpy(out, source, len);
+    strcpy(out + len, ".lfasl");
+    return out;
+}
+
+//fills in the fields of header that describe the source file st is the status of
+static bool stamp(FaslHeader *header, struct stat *st) {
+    if(!S_ISREG(st->st_mode))
+        return false;
+    header->source_size = st->st_size;
+    header->source_mtime_sec = st->st_mtim.tv_sec;
+    header->source_mtime_nsec = st->st_mtim.tv_nsec;
+    return true;
+}
+
+//fills in the fields of header that describe the file source
+static bool stamp_source(FaslHeader *header, char *source) {
+    struct stat st;
+    return stat(source, &st) == 0 && stamp(header, &st);
+}
+
+//=primitives=
+
+//raised when a fasl or image file doesn't decode
+void fasl_corrupt() {
+    error("Horrible error, corrupt fasl or image file, delete it to have it remade\n");
+}
+
+//numbers are zigzag encoded varints, 7 bits to a byte with the top bit set on all but the last
+int fasl_read_int(FaslReader *r) {
+    unsigned int n = 0;
+    for(int shift = 0; ; shift += 7) {
+        if(r->pos >= r->end || shift > 28)
+            fasl_corrupt();
+        unsigned char byte = *r->pos++;
+        n |= (unsigned int)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+            break;
+    }
+    return (int)(n >> 1) ^ -(int)(n & 1);
+}
+
+//reads a count of things that each take at least a byte
+int fasl_read_count(FaslReader *r) {
+    int n = fasl_read_int(r);
+    if(n < 0 || n > r->end - r->pos)
+        fasl_corrupt();
+    return n;
+}
+
+//interns the nsymbols names at the position of r, which become r->symbols
+//the names are null terminated where they lie, so they're interned straight from the buffer
+bool fasl_read_symbols(FaslReader *r, int nsymbols) {
+    r->nsymbols = nsymbols;
+    r->symbols = malloc((nsymbols + 1) * sizeof(*r->symbols));
+    for(int i = 0; i < nsymbols; i++) {
+        if(r->pos >= r->end)
+            return false;
+        int len = (unsigned char)*r->pos++;
+        if(len >= MAX_SYMBOL_LEN || r->end - r->pos < len + 1 || r->pos[len] != '\0')
+            return false;
+        r->symbols[i] = new_symbol(r->pos);
+        r->pos += len + 1;
+    }
+    return true;
+}
+
+//reads a symbol index
+Symbol *fasl_read_symbol(FaslReader *r) {
+    int i = fasl_read_int(r);
+    if(i < 0 || i >= r->nsymbols)
+        fasl_corrupt();
+    return r->symbols[i];
+}
+
+//=reading=
+
+//opens the fasl file for source, returns false if there's none or it's out of date,
+//in which case r doesn't need closing. the file is mapped rather than read, so only the
+//pages holding the forms not read yet take up memory
+bool fasl_open(FaslReader *r, char *source) {
+    FaslHeader expected;
+    if(!stamp_source(&expected, source))
+        return false;
+    char *filename = fasl_filename(source);
+    int fd = open(filename, O_RDONLY);
+    free(filename);
+    if(fd < 0)
+        return false;
+    struct stat st;
+    char *map = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && st.st_size >= sizeof(FaslHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(map == MAP_FAILED)
+        return false;
+
+    FaslHeader header;
+    memcpy(&header, map, sizeof(header));
+    r->buf = map;
+    r->map_size = st.st_size;
+    r->released = map;
+    r->symbols = NULL;
+    r->forms_left = header.nforms;
+    if(memcmp(header.magic, FASL_MAGIC, sizeof(header.magic)) ||
+       header.version != FASL_VERSION || header.byte_order != 1 ||
+       header.source_size != expected.source_size ||
+       header.source_mtime_sec != expected.source_mtime_sec ||
+       header.source_mtime_nsec != expected.source_mtime_nsec ||
+       header.symbols_offset < sizeof(header) || header.symbols_offset > st.st_size ||
+       header.nsymbols < 0 || header.nsymbols > st.st_size - header.symbols_offset) {
+        fasl_close(r);
+        return false;
+    }
+
+    //the names after the forms are interned first, then the forms are read up to them
+    r->pos = map + header.symbols_offset;
+    r->end = map + st.st_size;
+    if(!fasl_read_symbols(r, header.nsymbols)) {
+        fasl_close(r);
+        return false;
+    }
+    r->pos = map + sizeof(header);
+    r->end = map + header.symbols_offset;
+    return true;
+}
+
+static LispObject *decode(FaslReader *r) {
+    CHECK_STACK();
+    if(r->pos >= r->end)
+        fasl_corrupt();
+    int tag = *r->pos++;
+    if(tag == FASL_NIL)
+        return (LispObject*)nil;
+    if(tag == FASL_INT)
+        return new_lisp_int(fasl_read_int(r));
+    if(tag == FASL_SYMBOL)
+        return (LispObject*)fasl_read_symbol(r);
+    if(tag == FASL_STR) {
+        int len = fasl_read_count(r);
+        Str *out = new_str_from(r->pos, len);
+        r->pos += len;
+        return (LispObject*)out;
+    }
+    if(tag == FASL_LIST) {
+        int n = fasl_read_count(r);
+        ConsCell *out = nil;
+        ConsCell *node = nil;
+        for(int i = 0; i < n; i++) {
+            ConsCell *cell = new_cons_cell(decode(r), (LispObject*)nil);
+            if(out == nil)
+                out = cell;
+            else
+                node->cdr = (LispObject*)cell;
+            node = cell;
+        }
+        LispObject *tail = decode(r);
+        if(node == nil)
+            fasl_corrupt();
+        node->cdr = tail;
+        return (LispObject*)out;
+    }
+    if(tag == FASL_VECTOR) {
+        int n = fasl_read_count(r);
+        Vector *out = (Vector*)new_vector();
+        for(int i = 0; i < n; i++)
+            vector_append(out, decode(r));
+        return (LispObject*)out;
+    }
+    if(tag == FASL_DICT) {
+        int n = fasl_read_count(r);
+        Dict *out = (Dict*)new_dict();
+        for(int i = 0; i < n; i++) {
+            LispObject *key = decode(r);
+            dict_setitem(out, key, decode(r));
+        }
+        return (LispObject*)out;
+    }
+    fasl_corrupt();
+    return NULL;
+}
+
+//gives back the pages of the forms r has read, once there are FASL_RELEASE_SIZE bytes
+//of them. nothing points into them, the forms are copied out as they're decoded
+static void release_read_pages(FaslReader *r) {
+    if(r->map_size == 0 || r->pos - r->released < FASL_RELEASE_SIZE)
+        return;
+    long page = sysconf(_SC_PAGESIZE);
+    char *to = r->buf + (r->pos - r->buf) / page * page;
+    madvise(r->released, to - r->released, MADV_DONTNEED);
+    r->released = to;
+}
+
+//returns the next form in r, or NULL when there are no more
+LispObject *fasl_read_form(FaslReader *r) {
+    if(r->forms_left == 0)
+        return NULL;
+    r->forms_left--;
+    LispObject *form = decode(r);
+    release_read_pages(r);
+    return form;
+}
+
+void fasl_close(FaslReader *r) {
+    if(r->map_size > 0)
+        munmap(r->buf, r->map_size);
+    free(r->symbols);
+    r->buf = NULL;
+    r->symbols = NULL;
+}
+
+//=writing=
+
+//the writers with temp files, which are removed if lisp exits while they're open
+static FaslWriter *open_writers = NULL;
+
+static void remove_open_temps() {
+    for(FaslWriter *w = open_writers; w != NULL; w = w->next_open)
+        remove(w->temp);
+}
+
+//sets up w to collect everything in memory
+void fasl_writer_init(FaslWriter *w) {
+    w->size = 4096;
+    w->buf = malloc(w->size);
+    w->len = 0;
+    w->file = NULL;
+    w->temp = NULL;
+    w->symbol_indices = (Dict*)new_dict();
+    w->symbols = (Vector*)new_vector();
+    w->nforms = 0;
+    w->failed = false;
+}
+
+//sets up w to write the fasl file for source, which has been opened as source_file but
+//not read from yet. the forms go to a temp file next to it as they're added, which
+//fasl_writer_finish renames. returns false if it can't be made
+bool fasl_writer_open(FaslWriter *w, char *source, FILE *source_file) {
+    static bool registered = false;
+    //the source is stamped as it is before it's read, so if it changes while it's being
+    //read, the fasl file is out of date right away
+    struct stat st;
+    FaslHeader header;
+    memset(&header, 0, sizeof(header));
+    if(fstat(fileno(source_file), &st) != 0 || !stamp(&header, &st))
+        return false;
+    fasl_writer_init(w);
+    w->source_size = header.source_size;
+    w->source_mtime_sec = header.source_mtime_sec;
+    w->source_mtime_nsec = header.source_mtime_nsec;
+    char *filename = fasl_filename(source);
+    w->temp = malloc(strlen(filename) + 8);
+    sprintf(w->temp, "%s.XXXXXX", filename);
+    free(filename);
+    int fd = mkstemp(w->temp);
+    if(fd >= 0 && (w->file = fdopen(fd, "wb")) == NULL) {
+        close(fd);
+        remove(w->temp);
+    }
+    if(w->file == NULL) {
+        fasl_writer_discard(w);
+        return false;
+    }
+    //mkstemp makes files only the owner can read, the fasl file gets the usual permissions
+    mode_t mask = umask(0);
+    umask(mask);
+    fchmod(fd, 0666 & ~mask);
+
+    //the header is written over once the forms are done
+    if(fwrite(&header, sizeof(header), 1, w->file) != 1)
+        w->failed = true;
+    w->next_open = open_writers;
+    open_writers = w;
+    if(!registered) {
+        atexit(remove_open_temps);
+        registered = true;
+    }
+    return true;
+}
+
+static void flush_buf(FaslWriter *w) {
+    if(w->len > 0 && fwrite(w->buf, 1, w->len, w->file) != w->len)
+        w->failed = true;
+    w->len = 0;
+}
+
+void fasl_write_bytes(FaslWriter *w, void *bytes, int n) {
+    if(w->len + n > w->size) {
+        if(w->file != NULL) {
+            flush_buf(w);
+            if(n > w->size) {
+                if(fwrite(bytes, 1, n, w->file) != n)
+                    w->failed = true;
+                return;
+            }
+        } else {
+            while(w->len + n > w->size)
+                w->size *= 2;
+            w->buf = realloc(w->buf, w->size);
+        }
+    }
+    memcpy(w->buf + w->len, bytes, n);
+    w->len += n;
+}
+
+//returns the index of sym in the names written by fasl_write_symbols, adding it if it's new
+int fasl_symbol_index(FaslWriter *w, Symbol *sym) {
+    LispObject *index = dict_getitem(w->symbol_indices, (LispObject*)sym);
+    if(index == NULL) {
+        index = new_lisp_int(w->symbols->size);
+        dict_setitem(w->symbol_indices, (LispObject*)sym, index);
+        vector_append(w->symbols, (LispObject*)sym);
+    }
+    return lisp_int_to_int(index);
+}
+
+//writes the names of the symbols used so far to f
+bool fasl_write_symbols(FaslWriter *w, FILE *f) {
+    for(int i = 0; i < w->symbols->size; i++) {
+        Symbol *sym = (Symbol*)vector_getitem(w->symbols, i);
+        unsigned char len = strlen(sym->name);
+        if(fwrite(&len, 1, 1, f) != 1 || fwrite(sym->name, 1, len + 1, f) != len + 1)
+            return false;
+    }
+    return true;
+}
+
+static void write_tag(FaslWriter *w, char tag) {
+    fasl_write_bytes(w, &tag, 1);
+}
+
+void fasl_write_int(FaslWriter *w, int n) {
+    unsigned int zigzag = ((unsigned int)n << 1) ^ (unsigned int)(n >> 31);
+    char bytes[5];
+    int len = 0;
+    while(zigzag >= 0x80) {
+        bytes[len++] = (zigzag & 0x7f) | 0x80;
+        zigzag >>= 7;
+    }
+    bytes[len++] = zigzag;
+    fasl_write_bytes(w, bytes, len);
+}
+
+static void encode(FaslWriter *w, LispObject *obj) {
+    CHECK_STACK();
+    if(obj == (LispObject*)nil) {
+        write_tag(w, FASL_NIL);
+    } else if(obj->type == &LispIntType) {
+        write_tag(w, FASL_INT);
+        fasl_write_int(w, lisp_int_to_int(obj));
+    } else if(obj->type == &SymbolType) {
+        write_tag(w, FASL_SYMBOL);
+        fasl_write_int(w, fasl_symbol_index(w, (Symbol*)obj));
+    } else if(obj->type == &StrType) {
+        Str *s = (Str*)obj;
+        write_tag(w, FASL_STR);
+        fasl_write_int(w, s->size);
+        fasl_write_bytes(w, s->array, s->size);
+    } else if(obj->type == &ConsCellType && obj != tee) {
+        int n = 0;
+        for(LispObject *o = obj; o->type == &ConsCellType && o != (LispObject*)nil && o != tee;
+            o = ((ConsCell*)o)->cdr)
+            n++;
+        write_tag(w, FASL_LIST);
+        fasl_write_int(w, n);
+        for(int i = 0; i < n; i++) {
+            encode(w, ((ConsCell*)obj)->car);
+            obj = ((ConsCell*)obj)->cdr;
+        }
+        encode(w, obj);
+    } else if(obj->type == &VectorType) {
+        Vector *v = (Vector*)obj;
+        write_tag(w, FASL_VECTOR);
+        fasl_write_int(w, v->size);
+        for(int i = 0; i < v->size; i++)
+            encode(w, vector_getitem(v, i));
+    } else if(obj->type == &DictType) {
+        Dict *d = (Dict*)obj;
+        write_tag(w, FASL_DICT);
+        fasl_write_int(w, d->size);
+        for(int i = 0; i < d->array_size; i++)
+            if(d->slots[i].key != NULL) {
+                encode(w, d->slots[i].key);
+                encode(w, d->slots[i].value);
+            }
+    } else
+        w->failed = true;
+}
+
+//adds form to the file, it has to be written before it's evaluated since evaluation
+//can change it
+void fasl_write_form(FaslWriter *w, LispObject *form) {
+    if(w->failed)
+        return;
+    encode(w, form);
+    w->nforms++;
+}
+
+//closes the temp file of w, returning false if that failed
+static bool close_file(FaslWriter *w) {
+    FaslWriter **prev = &open_writers;
+    while(*prev != w)
+        prev = &(*prev)->next_open;
+    *prev = w->next_open;
+    bool ok = fclose(w->file) == 0;
+    w->file = NULL;
+    return ok;
+}
+
+//writes the fasl file for source, opened with fasl_writer_open, and frees w. the temp
+//file the forms went to is only renamed to it once it's complete, so a reader never sees
+//half a file. failing to write it isn't an error, the source just gets read again next time
+void fasl_writer_finish(FaslWriter *w, char *source) {
+    if(w->file == NULL || w->failed) {
+        fasl_writer_discard(w);
+        return;
+    }
+    FaslHeader header;
+    memset(&header, 0, sizeof(header));
+    header.source_size = w->source_size;
+    header.source_mtime_sec = w->source_mtime_sec;
+    header.source_mtime_nsec = w->source_mtime_nsec;
+    memcpy(header.magic, FASL_MAGIC, sizeof(header.magic));
+    header.version = FASL_VERSION;
+    header.byte_order = 1;
+    header.nsymbols = w->symbols->size;
+    header.nforms = w->nforms;
+
+    flush_buf(w);
+    header.symbols_offset = ftell(w->file);
+    bool ok = !w->failed && header.symbols_offset > 0 && fasl_write_symbols(w, w->file) &&
+              fseek(w->file, 0, SEEK_SET) == 0 &&
+              fwrite(&header, sizeof(header), 1, w->file) == 1;
+    ok = close_file(w) && ok;
+    char *filename = fasl_filename(source);
+    if(!ok || rename(w->temp, filename) != 0)
+        remove(w->temp);
+    free(filename);
+    fasl_writer_discard(w);
+}
+
+//frees w without writing anything
+void fasl_writer_discard(FaslWriter *w) {
+    if(w->file != NULL) {
+        close_file(w);
+        remove(w->temp);
+    }
+    free(w->temp);
+    free(w->buf);
+    w->temp = NULL;
+    w->buf = NULL;
+}
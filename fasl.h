@@ -0,0 +1,70 @@
+#ifndef _FASL_H_
+#define _FASL_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//bump when the format changes so old files are ignored
+#define FASL_VERSION 2
+
+//a fasl file holds the read forms of a source file in a binary form that's quicker to
+//load than the text. it's kept next to the source, see fasl_filename
+
+//the forms of a fasl file are read from a mapping of it, the pages of the forms
+//already read are given back every FASL_RELEASE_SIZE bytes
+#define FASL_RELEASE_SIZE (1 << 20)
+
+//reads the forms back out of a fasl file mapped at buf
+typedef struct {
+    char *buf;
+    size_t map_size; //0 if buf is mapped by someone else
+    char *released;  //the pages before this were given back
+    char *pos;
+    char *end;
+    Symbol **symbols;
+    int nsymbols;
+    int forms_left;
+} FaslReader;
+
+//collects forms to write to a fasl file. forms are encoded into buf as they're added,
+//and with a file, written out to it whenever buf fills up. the symbol table, which
+//only is complete once all the forms are, goes after them
+typedef struct FaslWriter_S {
+    char *buf;
+    int len;
+    int size;
+    FILE *file;   //NULL if everything is kept in buf
+    char *temp;   //the name of file, which is renamed to the fasl file when it's done
+    struct FaslWriter_S *next_open; //the other writers with files, removed at exit
+    Dict *symbol_indices;
+    Vector *symbols;
+    int nforms;
+    bool failed; //a form couldn't be encoded or written, nothing is written
+    //the stamp of the source, see fasl_writer_open
+    long long source_size;
+    long long source_mtime_sec;
+    long long source_mtime_nsec;
+} FaslWriter;
+
+char *fasl_filename(char *source);
+bool fasl_open(FaslReader *r, char *source);
+LispObject *fasl_read_form(FaslReader *r);
+void fasl_close(FaslReader *r);
+void fasl_writer_init(FaslWriter *w);
+bool fasl_writer_open(FaslWriter *w, char *source, FILE *source_file);
+void fasl_write_form(FaslWriter *w, LispObject *form);
+void fasl_writer_finish(FaslWriter *w, char *source);
+void fasl_writer_discard(FaslWriter *w);
+
+//the building blocks of fasl files, which images are also made of (see image.c)
+void fasl_corrupt();
+int fasl_read_int(FaslReader *r);
+int fasl_read_count(FaslReader *r);
+bool fasl_read_symbols(FaslReader *r, int nsymbols);
+Symbol *fasl_read_symbol(FaslReader *r);
+void fasl_write_bytes(FaslWriter *w, void *bytes, int n);
+void fasl_write_int(FaslWriter *w, int n);
+int fasl_symbol_index(FaslWriter *w, Symbol *sym);
+bool fasl_write_symbols(FaslWriter *w, FILE *f);
+
+#endif
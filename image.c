@@ -0,0 +1,766 @@
+#define _POSIX_C_SOURCE 200809L
+#include "image.h"
+#include "fasl.h"
+#include "alloc.h"
+#include "builtins.h"
+#include "symboltable.h"
+#include "optimize.h"
+#include "persistent.h"
+#include "regexp.h"
+#include "rope.h"
+#include "csv.h"
+#include "error.h"
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//an image is everything reachable from the symbol table and the interpreter's other roots,
+//saved so a later run can start from it instead of registering the builtins and loading
+//the prelude and libraries again. it's built out of the same pieces as fasl files:
+//  the ImageHeader
+//  the names of the symbols used
+//  a byte for the type of each object (IMAGE_CONS etc.)
+//  the contents of each object other than dicts, memos and hash-maps, in order
+//  the contents of the dicts, memos and hash-maps, which hash what's in them so are filled
+//  in last. hash-maps are saved as their keys and values and their tries built again, so
+//  hamt nodes aren't objects in the image and maps don't share them after loading
+//  the roots: scopes, call_stack, do_builtin, quote_builtin, builtin_rebind_count, the
+//  forms whose heads the optimizer resolved (see add_resolved_head), expansion_rebind_count
+//  and the globals cached macro expansions read (see watch_global)
+//objects refer to each other with refs, ints with the kind of thing referred to in the
+//low 2 bits. builtins are saved by name, and jit compiled code and the call counts that
+//lead to it aren't saved at all. the nodes of persistent vectors are shared as they were,
+//but no transient owns them after loading, so the first change to one copies it.
+//regexes are saved as their patterns and compiled again
+
+#define IMAGE_MAGIC "LIMAGE\n"
+
+typedef struct {
+    char magic[8];
+    int version;
+    int byte_order; //1 as written by this machine
+    int nsymbols;
+    int nobjects;
+} ImageHeader;
+
+//types of objects
+#define IMAGE_CONS 0
+#define IMAGE_INT 1
+#define IMAGE_STR 2
+#define IMAGE_VECTOR 3
+#define IMAGE_DICT 4
+#define IMAGE_MACRO 5
+#define IMAGE_NODE 6
+#define IMAGE_BUILTIN 7
+#define IMAGE_MEMO 8
+#define IMAGE_LAZY_SEQ 9
+#define IMAGE_PMAP 10
+#define IMAGE_TRANSIENT_MAP 11
+#define IMAGE_PVECTOR 12
+#define IMAGE_TRANSIENT_VECTOR 13
+#define IMAGE_PVEC_NODE 14
+#define IMAGE_REGEX 15
+#define IMAGE_STR_BUILDER 16
+#define IMAGE_ROPE 17
+#define IMAGE_INT_COLUMN 18
+#define IMAGE_STR_COLUMN 19
+
+//kinds of refs
+#define REF_SPECIAL 0   //NULL, nil or tee, in that order
+#define REF_SYMBOL 1    //index of the symbol name
+#define REF_OBJECT 2    //index of the object
+#define REF_SMALL_INT 3 //the int minus SMALL_INT_MIN
+
+//returns the IMAGE_ type of obj, or -1 if it can't be saved
+static int image_type(LispObject *obj) {
+    LispType *types[] = {&ConsCellType, &LispIntType, &StrType, &VectorType, &DictType,
+                         &MacroType, &NodeType, &BuiltinFunctionType, &MemoType, &LazySeqType,
+                         &PMapType, &TransientMapType, &PVectorType, &TransientVectorType,
+                         &PVecNodeType, &RegexType, &StrBuilderType, &RopeType,
+                         &IntColumnType, &StrColumnType};
+    for(int i = 0; i < sizeof(types) / sizeof(*types); i++)
+        if(obj->type == types[i])
+            return i;
+    return -1;
+}
+
+//=saving=
+
+typedef struct {
+    FaslWriter objects; //the symbols and the objects other than dicts, memos and hash-maps
+    FaslWriter hashed;  //dicts, memos, hash-maps and the roots
+    //open addressing table from the address of each object found to its index
+    LispObject **keys;
+    int *indices;
+    int table_size;
+    LispObject **found; //the objects in the order they were found
+    int nfound;
+    int nheads; //resolved heads in the image
+    int nwatched; //watched globals in the image
+} ImageWriter;
+
+static unsigned int address_hash(LispObject *obj, int size) {
+    return (((unsigned long)obj) >> 4) % size;
+}
+
+static void grow_table(ImageWriter *iw) {
+    LispObject **old_keys = iw->keys;
+    int *old_indices = iw->indices;
+    int old_size = iw->table_size;
+    iw->table_size = old_size * 2;
+    iw->keys = calloc(iw->table_size, sizeof(*iw->keys));
+    iw->indices = malloc(iw->table_size * sizeof(*iw->indices));
+    iw->found = realloc(iw->found, iw->table_size * sizeof(*iw->found));
+    for(int i = 0; i < old_size; i++) {
+        if(old_keys[i] == NULL)
+            continue;
+        unsigned int j = address_hash(old_keys[i], iw->table_size);
+        while(iw->keys[j] != NULL)
+            j = (j + 1) % iw->table_size;
+        iw->keys[j] = old_keys[i];
+        iw->indices[j] = old_indices[i];
+    }
+    free(old_keys);
+    free(old_indices);
+}
+
+//returns the index of obj, adding it to the objects to write if it's new
+static int object_index(ImageWriter *iw, LispObject *obj) {
+    unsigned int i = address_hash(obj, iw->table_size);
+    while(iw->keys[i] != NULL) {
+        if(iw->keys[i] == obj)
+            return iw->indices[i];
+        i = (i + 1) % iw->table_size;
+    }
+    if(image_type(obj) < 0)
+        error("Horrible error, can't save objects of type %s in an image\n", obj->type->name);
+    iw->keys[i] = obj;
+    iw->indices[i] = iw->nfound;
+    iw->found[iw->nfound] = obj;
+    iw->nfound++;
+    if(iw->nfound * 2 >= iw->table_size)
+        grow_table(iw);
+    return iw->nfound - 1;
+}
+
+//returns the index of obj if it was found, otherwise -1
+static int found_index(ImageWriter *iw, LispObject *obj) {
+    unsigned int i = address_hash(obj, iw->table_size);
+    while(iw->keys[i] != NULL) {
+        if(iw->keys[i] == obj)
+            return iw->indices[i];
+        i = (i + 1) % iw->table_size;
+    }
+    return -1;
+}
+
+static void write_ref(ImageWriter *iw, FaslWriter *w, LispObject *obj) {
+    int ref;
+    if(obj == NULL)
+        ref = REF_SPECIAL;
+    else if(obj == (LispObject*)nil)
+        ref = (1 << 2) | REF_SPECIAL;
+    else if(obj == tee)
+        ref = (2 << 2) | REF_SPECIAL;
+    else if(obj->type == &SymbolType)
+        ref = (fasl_symbol_index(&iw->objects, (Symbol*)obj) << 2) | REF_SYMBOL;
+    else if(is_small_int(obj))
+        ref = ((((LispInt*)obj)->n - SMALL_INT_MIN) << 2) | REF_SMALL_INT;
+    else
+        ref = (object_index(iw, obj) << 2) | REF_OBJECT;
+    fasl_write_int(w, ref);
+}
+
+//writes the keys and values in the trie under node
+static void write_hamt_items(ImageWriter *iw, HamtNode *node) {
+    int ndata = node->collision ? node->count : __builtin_popcount(node->datamap);
+    for(int i = 0; i < 2 * ndata; i++)
+        write_ref(iw, &iw->hashed, node->array[i]);
+    int length = hamt_node_length(node);
+    for(int i = 2 * ndata; i < length; i++)
+        write_hamt_items(iw, (HamtNode*)node->array[i]);
+}
+
+//writes the contents of obj, the objects it refers to are added to the ones to write
+static void write_object(ImageWriter *iw, LispObject *obj) {
+    FaslWriter *w = &iw->objects;
+    switch(image_type(obj)) {
+    case IMAGE_CONS:
+        write_ref(iw, w, ((ConsCell*)obj)->car);
+        write_ref(iw, w, ((ConsCell*)obj)->cdr);
+        break;
+    case IMAGE_INT:
+        fasl_write_int(w, ((LispInt*)obj)->n);
+        break;
+    case IMAGE_STR:
+        fasl_write_int(w, ((Str*)obj)->size);
+        fasl_write_bytes(w, ((Str*)obj)->array, ((Str*)obj)->size);
+        break;
+    case IMAGE_VECTOR: {
+        Vector *v = (Vector*)obj;
+        fasl_write_int(w, v->size);
+        for(int i = 0; i < v->size; i++)
+            write_ref(iw, w, vector_getitem(v, i));
+        break;
+    }
+    case IMAGE_DICT: {
+        Dict *d = (Dict*)obj;
+        fasl_write_int(&iw->hashed, d->size);
+        for(int i = 0; i < d->array_size; i++)
+            if(d->slots[i].key != NULL) {
+                write_ref(iw, &iw->hashed, d->slots[i].key);
+                write_ref(iw, &iw->hashed, d->slots[i].value);
+            }
+        break;
+    }
+    case IMAGE_MACRO: {
+        Macro *mac = (Macro*)obj;
+        write_ref(iw, w, (LispObject*)mac->args);
+        write_ref(iw, w, (LispObject*)mac->body);
+        write_ref(iw, w, (LispObject*)mac->context);
+        write_ref(iw, w, (LispObject*)mac->macro_name);
+        fasl_write_int(w, mac->is_function);
+        fasl_write_int(w, mac->arity);
+        break;
+    }
+    case IMAGE_NODE: {
+        Node *node = (Node*)obj;
+        fasl_write_int(w, node->kind);
+        fasl_write_int(w, node->state);
+        write_ref(iw, w, node->source);
+        break;
+    }
+    case IMAGE_BUILTIN: {
+        char *name = ((BuiltinFunction*)obj)->name;
+        fasl_write_int(w, strlen(name));
+        fasl_write_bytes(w, name, strlen(name));
+        break;
+    }
+    case IMAGE_MEMO: {
+        //the cached results go in from the oldest, so the order of use is kept
+        Memo *m = (Memo*)obj;
+        write_ref(iw, w, m->function);
+        fasl_write_int(w, m->max_size);
+        fasl_write_int(&iw->hashed, m->size);
+        for(MemoEntry *e = m->oldest; e != NULL; e = e->newer) {
+            fasl_write_int(&iw->hashed, e->argc);
+            for(int i = 0; i < e->argc; i++)
+                write_ref(iw, &iw->hashed, e->argv[i]);
+            write_ref(iw, &iw->hashed, e->value);
+        }
+        break;
+    }
+    case IMAGE_LAZY_SEQ: {
+        LazySeq *seq = (LazySeq*)obj;
+        fasl_write_int(w, seq->kind);
+        fasl_write_int(w, seq->forced);
+        write_ref(iw, w, seq->value);
+        write_ref(iw, w, seq->fn);
+        write_ref(iw, w, seq->source);
+        fasl_write_int(w, seq->start);
+        fasl_write_int(w, seq->end);
+        fasl_write_int(w, seq->step);
+        break;
+    }
+    case IMAGE_PMAP:
+    case IMAGE_TRANSIENT_MAP: {
+        //whether a transient can still be changed, then the keys and values
+        PMap *m = (PMap*)obj;
+        fasl_write_int(w, m->edit != 0);
+        fasl_write_int(&iw->hashed, m->size);
+        if(m->root != NULL)
+            write_hamt_items(iw, m->root);
+        break;
+    }
+    case IMAGE_PVECTOR:
+    case IMAGE_TRANSIENT_VECTOR: {
+        PVector *v = (PVector*)obj;
+        fasl_write_int(w, v->edit != 0);
+        fasl_write_int(w, v->size);
+        fasl_write_int(w, v->shift);
+        write_ref(iw, w, (LispObject*)v->root);
+        write_ref(iw, w, (LispObject*)v->tail);
+        break;
+    }
+    case IMAGE_PVEC_NODE:
+        for(int i = 0; i < TRIE_WIDTH; i++)
+            write_ref(iw, w, ((PVecNode*)obj)->array[i]);
+        break;
+    case IMAGE_REGEX:
+        write_ref(iw, w, (LispObject*)((Regex*)obj)->pattern);
+        break;
+    case IMAGE_STR_BUILDER:
+        fasl_write_int(w, ((StrBuilder*)obj)->size);
+        fasl_write_bytes(w, ((StrBuilder*)obj)->array, ((StrBuilder*)obj)->size);
+        break;
+    case IMAGE_ROPE: {
+        Rope *rope = (Rope*)obj;
+        write_ref(iw, w, (LispObject*)rope->left);
+        write_ref(iw, w, (LispObject*)rope->right);
+        write_ref(iw, w, (LispObject*)rope->str);
+        fasl_write_int(w, rope->offset);
+        fasl_write_int(w, rope->size);
+        fasl_write_int(w, rope->depth);
+        break;
+    }
+    case IMAGE_INT_COLUMN: {
+        IntColumn *c = (IntColumn*)obj;
+        fasl_write_int(w, c->size);
+        for(int i = 0; i < c->size; i++)
+            fasl_write_int(w, c->array[i]);
+        break;
+    }
+    case IMAGE_STR_COLUMN: {
+        //all the chars, then the length of each item
+        StrColumn *c = (StrColumn*)obj;
+        fasl_write_int(w, c->size);
+        fasl_write_int(w, c->offsets[c->size]);
+        fasl_write_bytes(w, c->chars, c->offsets[c->size]);
+        for(int i = 0; i < c->size; i++)
+            fasl_write_int(w, c->offsets[i + 1] - c->offsets[i]);
+        break;
+    }
+    }
+}
+
+//collects the resolved heads that are in the image, see each_resolved_head
+static void collect_resolved_head(Symbol *sym, ConsCell *form, void *data) {
+    ImageWriter *iw = data;
+    int i = found_index(iw, (LispObject*)form);
+    if(i < 0)
+        return;
+    fasl_write_int(&iw->hashed, fasl_symbol_index(&iw->objects, sym));
+    fasl_write_int(&iw->hashed, i);
+}
+
+static void count_resolved_head(Symbol *sym, ConsCell *form, void *data) {
+    ImageWriter *iw = data;
+    if(found_index(iw, (LispObject*)form) >= 0)
+        iw->nheads++;
+}
+
+static void write_watched_global(Symbol *sym, void *data) {
+    ImageWriter *iw = data;
+    fasl_write_int(&iw->hashed, fasl_symbol_index(&iw->objects, sym));
+}
+
+static void count_watched_global(Symbol *sym, void *data) {
+    ((ImageWriter*)data)->nwatched++;
+}
+
+//writes everything reachable from the interpreter's roots to the file filename
+//has to be called at the top level, with nothing but the global scope in scopes
+void save_image(char *filename) {
+    ImageWriter iw;
+    fasl_writer_init(&iw.objects);
+    fasl_writer_init(&iw.hashed);
+    iw.table_size = 1024;
+    iw.keys = calloc(iw.table_size, sizeof(*iw.keys));
+    iw.indices = malloc(iw.table_size * sizeof(*iw.indices));
+    iw.found = malloc(iw.table_size * sizeof(*iw.found));
+    iw.nfound = 0;
+
+    //the roots are the first objects, so they're found again by index
+    LispObject *roots[] = {(LispObject*)scopes, (LispObject*)call_stack,
+                           (LispObject*)do_builtin, (LispObject*)quote_builtin};
+    for(int i = 0; i < sizeof(roots) / sizeof(*roots); i++)
+        object_index(&iw, roots[i]);
+    //writing an object can find more, which are written in turn
+    for(int i = 0; i < iw.nfound; i++)
+        write_object(&iw, iw.found[i]);
+
+    fasl_write_int(&iw.hashed, builtin_rebind_count);
+    iw.nheads = 0;
+    each_resolved_head(count_resolved_head, &iw);
+    fasl_write_int(&iw.hashed, iw.nheads);
+    each_resolved_head(collect_resolved_head, &iw);
+    fasl_write_int(&iw.hashed, expansion_rebind_count);
+    iw.nwatched = 0;
+    each_watched_global(count_watched_global, &iw);
+    fasl_write_int(&iw.hashed, iw.nwatched);
+    each_watched_global(write_watched_global, &iw);
+
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = IMAGE_VERSION;
+    header.byte_order = 1;
+    header.nsymbols = iw.objects.symbols->size;
+    header.nobjects = iw.nfound;
+
+    FILE *f = fopen(filename, "wb");
+    bool ok = f != NULL && fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fasl_write_symbols(&iw.objects, f);
+    for(int i = 0; ok && i < iw.nfound; i++)
+        ok = fputc(image_type(iw.found[i]), f) != EOF;
+    ok = ok && fwrite(iw.objects.buf, 1, iw.objects.len, f) == iw.objects.len;
+    ok = ok && fwrite(iw.hashed.buf, 1, iw.hashed.len, f) == iw.hashed.len;
+    if(f != NULL)
+        ok = fclose(f) == 0 && ok;
+
+    fasl_writer_discard(&iw.objects);
+    fasl_writer_discard(&iw.hashed);
+    free(iw.keys);
+    free(iw.indices);
+    free(iw.found);
+    if(!ok)
+        error("Horrible error, couldn't write image %s\n", filename);
+}
+
+//=loading=
+
+typedef struct {
+    FaslReader r;
+    LispObject **objects;
+    int nobjects;
+} ImageReader;
+
+static LispObject *read_ref(ImageReader *ir) {
+    unsigned int ref = fasl_read_int(&ir->r);
+    unsigned int i = ref >> 2;
+    switch(ref & 3) {
+    case REF_SPECIAL:
+        if(i > 2)
+            fasl_corrupt();
+        return i == 0 ? NULL : i == 1 ? (LispObject*)nil : tee;
+    case REF_SYMBOL:
+        if(i >= ir->r.nsymbols)
+            fasl_corrupt();
+        return (LispObject*)ir->r.symbols[i];
+    case REF_OBJECT:
+        if(i >= ir->nobjects)
+            fasl_corrupt();
+        return ir->objects[i];
+    default:
+        if(i > SMALL_INT_MAX - SMALL_INT_MIN)
+            fasl_corrupt();
+        return new_lisp_int((int)i + SMALL_INT_MIN);
+    }
+}
+
+//returns an empty object of the IMAGE_ type type, to be filled in by read_object
+static LispObject *new_empty_object(int type) {
+    switch(type) {
+    case IMAGE_CONS:
+        return (LispObject*)new_cons_cell((LispObject*)nil, (LispObject*)nil);
+    case IMAGE_INT: {
+        LispInt *out = alloc(sizeof(LispInt));
+        out->type = &LispIntType;
+        return (LispObject*)out;
+    }
+    case IMAGE_STR:
+        return (LispObject*)new_str();
+    case IMAGE_VECTOR:
+        return new_vector();
+    case IMAGE_DICT:
+        return new_dict();
+    case IMAGE_MACRO:
+        return (LispObject*)new_macro(nil, nil, nil, false);
+    case IMAGE_NODE:
+        return new_node(0, NULL);
+    case IMAGE_BUILTIN: {
+        BuiltinFunction *out = alloc(sizeof(BuiltinFunction));
+        out->type = &BuiltinFunctionType;
+        return (LispObject*)out;
+    }
+    case IMAGE_MEMO:
+        return new_memo(NULL, 0);
+    case IMAGE_LAZY_SEQ:
+        return (LispObject*)new_lazy_seq(0, NULL, NULL, 0, 0, 0);
+    case IMAGE_PMAP:
+        return new_pmap();
+    case IMAGE_TRANSIENT_MAP:
+        return transient(new_pmap());
+    case IMAGE_PVECTOR:
+        return new_pvector();
+    case IMAGE_TRANSIENT_VECTOR:
+        return transient(new_pvector());
+    case IMAGE_PVEC_NODE: {
+        PVecNode *out = alloc(sizeof(PVecNode));
+        out->type = &PVecNodeType;
+        out->edit = 0;
+        return (LispObject*)out;
+    }
+    case IMAGE_REGEX:
+        return new_empty_regex();
+    case IMAGE_STR_BUILDER:
+        return new_str_builder(0);
+    case IMAGE_ROPE: {
+        Rope *out = alloc(sizeof(Rope));
+        out->type = &RopeType;
+        return (LispObject*)out;
+    }
+    case IMAGE_INT_COLUMN: {
+        IntColumn *out = alloc(sizeof(IntColumn));
+        out->type = &IntColumnType;
+        return (LispObject*)out;
+    }
+    case IMAGE_STR_COLUMN: {
+        StrColumn *out = alloc(sizeof(StrColumn));
+        out->type = &StrColumnType;
+        return (LispObject*)out;
+    }
+    }
+    fasl_corrupt();
+    return NULL;
+}
+
+//fills in the contents of obj written by write_object, other than the ones of dicts, memos
+//and hash-maps
+static void read_object(ImageReader *ir, LispObject *obj, int type) {
+    FaslReader *r = &ir->r;
+    switch(type) {
+    case IMAGE_CONS:
+        ((ConsCell*)obj)->car = read_ref(ir);
+        ((ConsCell*)obj)->cdr = read_ref(ir);
+        break;
+    case IMAGE_INT:
+        ((LispInt*)obj)->n = fasl_read_int(r);
+        break;
+    case IMAGE_STR: {
+        int len = fasl_read_count(r);
+        str_append_chars((Str*)obj, r->pos, len);
+        r->pos += len;
+        break;
+    }
+    case IMAGE_VECTOR: {
+        int n = fasl_read_count(r);
+        for(int i = 0; i < n; i++)
+            vector_append((Vector*)obj, read_ref(ir));
+        break;
+    }
+    case IMAGE_MACRO: {
+        Macro *mac = (Macro*)obj;
+        mac->args = (ConsCell*)read_ref(ir);
+        mac->body = (ConsCell*)read_ref(ir);
+        mac->context = (ConsCell*)read_ref(ir);
+        mac->macro_name = (Symbol*)read_ref(ir);
+        mac->is_function = fasl_read_int(r);
+        mac->arity = fasl_read_int(r);
+        break;
+    }
+    case IMAGE_NODE: {
+        Node *node = (Node*)obj;
+        node->kind = fasl_read_int(r);
+        node->state = fasl_read_int(r);
+        node->source = read_ref(ir);
+        break;
+    }
+    case IMAGE_BUILTIN: {
+        int len = fasl_read_count(r);
+        char name[MAX_SYMBOL_LEN];
+        if(len >= MAX_SYMBOL_LEN)
+            fasl_corrupt();
+        memcpy(name, r->pos, len);
+        name[len] = '\0';
+        r->pos += len;
+        BuiltinFunction *bf = (BuiltinFunction*)new_builtin_named(name);
+        if(bf == NULL)
+            error("Horrible error, the image uses a builtin named %s that doesn't exist\n", name);
+        *(BuiltinFunction*)obj = *bf;
+        break;
+    }
+    case IMAGE_MEMO:
+        ((Memo*)obj)->function = read_ref(ir);
+        ((Memo*)obj)->max_size = fasl_read_int(r);
+        break;
+    case IMAGE_LAZY_SEQ: {
+        LazySeq *seq = (LazySeq*)obj;
+        seq->kind = fasl_read_int(r);
+        seq->forced = fasl_read_int(r);
+        seq->value = read_ref(ir);
+        seq->fn = read_ref(ir);
+        seq->source = read_ref(ir);
+        seq->start = fasl_read_int(r);
+        seq->end = fasl_read_int(r);
+        seq->step = fasl_read_int(r);
+        break;
+    }
+    case IMAGE_PMAP:
+    case IMAGE_TRANSIENT_MAP:
+        //a transient that was made persistent stays unusable, see read_hashed_object
+        if(!fasl_read_int(r))
+            ((PMap*)obj)->edit = 0;
+        break;
+    case IMAGE_PVECTOR:
+    case IMAGE_TRANSIENT_VECTOR: {
+        //a transient keeps the edit it was made with here, which owns none of the nodes
+        PVector *v = (PVector*)obj;
+        if(!fasl_read_int(r))
+            v->edit = 0;
+        v->size = fasl_read_int(r);
+        v->shift = fasl_read_int(r);
+        v->root = (PVecNode*)read_ref(ir);
+        v->tail = (PVecNode*)read_ref(ir);
+        if(v->size < 0 || v->shift < TRIE_BITS || v->shift % TRIE_BITS != 0)
+            fasl_corrupt();
+        break;
+    }
+    case IMAGE_PVEC_NODE:
+        for(int i = 0; i < TRIE_WIDTH; i++)
+            ((PVecNode*)obj)->array[i] = read_ref(ir);
+        break;
+    case IMAGE_REGEX: {
+        //compiled once the pattern is filled in, see load_image
+        LispObject *pattern = read_ref(ir);
+        if(pattern == NULL || pattern->type != &StrType)
+            fasl_corrupt();
+        ((Regex*)obj)->pattern = (Str*)pattern;
+        break;
+    }
+    case IMAGE_STR_BUILDER: {
+        int len = fasl_read_count(r);
+        str_builder_append_chars((StrBuilder*)obj, r->pos, len);
+        r->pos += len;
+        break;
+    }
+    case IMAGE_ROPE: {
+        Rope *rope = (Rope*)obj;
+        rope->left = (Rope*)read_ref(ir);
+        rope->right = (Rope*)read_ref(ir);
+        rope->str = (Str*)read_ref(ir);
+        rope->offset = fasl_read_int(r);
+        rope->size = fasl_read_int(r);
+        rope->depth = fasl_read_int(r);
+        break;
+    }
+    case IMAGE_INT_COLUMN: {
+        IntColumn *c = (IntColumn*)obj;
+        int n = fasl_read_count(r);
+        c->array = malloc((n + 1) * sizeof(int));
+        for(int i = 0; i < n; i++)
+            c->array[i] = fasl_read_int(r);
+        c->size = n;
+        break;
+    }
+    case IMAGE_STR_COLUMN: {
+        StrColumn *c = (StrColumn*)obj;
+        int n = fasl_read_count(r);
+        int len = fasl_read_count(r);
+        c->chars = malloc(len + 1);
+        memcpy(c->chars, r->pos, len);
+        r->pos += len;
+        c->offsets = malloc((n + 1) * sizeof(size_t));
+        c->offsets[0] = 0;
+        for(int i = 0; i < n; i++) {
+            c->offsets[i + 1] = c->offsets[i] + fasl_read_count(r);
+            if(c->offsets[i + 1] > len)
+                fasl_corrupt();
+        }
+        c->size = n;
+        break;
+    }
+    }
+}
+
+//fills in the contents of a dict, memo or hash-map, once everything they hash is filled in
+static void read_hashed_object(ImageReader *ir, LispObject *obj, int type) {
+    int n = fasl_read_count(&ir->r);
+    if(type == IMAGE_PMAP || type == IMAGE_TRANSIENT_MAP) {
+        //the trie is built by a transient of its own, whose edit a live transient takes over
+        PMap *m = (PMap*)obj;
+        PMap *t = (PMap*)transient(new_pmap());
+        for(int i = 0; i < n; i++) {
+            LispObject *key = read_ref(ir);
+            LispObject *value = read_ref(ir);
+            if(key == NULL || value == NULL)
+                fasl_corrupt();
+            pmap_assoc(t, key, value);
+        }
+        m->root = t->root;
+        m->size = t->size;
+        if(m->edit != 0)
+            m->edit = t->edit;
+        return;
+    }
+    for(int i = 0; i < n; i++) {
+        if(type == IMAGE_DICT) {
+            LispObject *key = read_ref(ir);
+            LispObject *value = read_ref(ir);
+            if(key == NULL || value == NULL)
+                fasl_corrupt();
+            dict_setitem((Dict*)obj, key, value);
+        } else {
+            int argc = fasl_read_count(&ir->r);
+            LispObject *argv[argc + 1];
+            for(int j = 0; j < argc; j++)
+                argv[j] = read_ref(ir);
+            LispObject *value = read_ref(ir);
+            memo_store((Memo*)obj, argc, argv, hash_values(argc, argv), value);
+        }
+    }
+}
+
+//replaces the symbol table and the interpreter's other roots with the ones in the image
+//filename. the image is mapped into memory and its objects are rebuilt from it.
+//collections have to be off while this runs, the objects are only held by ir.objects
+void load_image(char *filename) {
+    int fd = open(filename, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st) != 0)
+        error("Horrible error, can't open image %s\n", filename);
+    char *map = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    close(fd);
+    if(map == MAP_FAILED)
+        error("Horrible error, can't read image %s\n", filename);
+
+    ImageHeader header;
+    if(st.st_size < sizeof(header))
+        fasl_corrupt();
+    memcpy(&header, map, sizeof(header));
+    if(memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) ||
+       header.version != IMAGE_VERSION || header.byte_order != 1)
+        error("Horrible error, %s isn't an image made by this version of lisp\n", filename);
+
+    ImageReader ir;
+    ir.r.buf = map;
+    ir.r.pos = map + sizeof(header);
+    ir.r.end = map + st.st_size;
+    ir.r.symbols = NULL;
+    if(!fasl_read_symbols(&ir.r, header.nsymbols) || header.nobjects < 4 ||
+       header.nobjects > ir.r.end - ir.r.pos)
+        fasl_corrupt();
+    ir.nobjects = header.nobjects;
+    unsigned char *types = (unsigned char*)ir.r.pos;
+    ir.r.pos += ir.nobjects;
+
+    ir.objects = malloc(ir.nobjects * sizeof(*ir.objects));
+    for(int i = 0; i < ir.nobjects; i++)
+        ir.objects[i] = new_empty_object(types[i]);
+    for(int i = 0; i < ir.nobjects; i++)
+        read_object(&ir, ir.objects[i], types[i]);
+    for(int i = 0; i < ir.nobjects; i++)
+        if(types[i] == IMAGE_REGEX)
+            regex_init((Regex*)ir.objects[i], ((Regex*)ir.objects[i])->pattern);
+    for(int i = 0; i < ir.nobjects; i++)
+        if(types[i] == IMAGE_DICT || types[i] == IMAGE_MEMO ||
+           types[i] == IMAGE_PMAP || types[i] == IMAGE_TRANSIENT_MAP)
+            read_hashed_object(&ir, ir.objects[i], types[i]);
+
+    if(types[0] != IMAGE_VECTOR || types[1] != IMAGE_VECTOR ||
+       types[2] != IMAGE_BUILTIN || types[3] != IMAGE_BUILTIN)
+        fasl_corrupt();
+    scopes = (Vector*)ir.objects[0];
+    call_stack = (Vector*)ir.objects[1];
+    do_builtin = (BuiltinFunction*)ir.objects[2];
+    quote_builtin = (BuiltinFunction*)ir.objects[3];
+    builtin_rebind_count = fasl_read_int(&ir.r);
+    int nheads = fasl_read_count(&ir.r);
+    for(int i = 0; i < nheads; i++) {
+        Symbol *sym = fasl_read_symbol(&ir.r);
+        int form = fasl_read_int(&ir.r);
+        if(form < 0 || form >= ir.nobjects || types[form] != IMAGE_CONS)
+            fasl_corrupt();
+        add_resolved_head(sym, (ConsCell*)ir.objects[form]);
+    }
+    expansion_rebind_count = fasl_read_int(&ir.r);
+    int nwatched = fasl_read_count(&ir.r);
+    for(int i = 0; i < nwatched; i++)
+        watch_global(fasl_read_symbol(&ir.r));
+
+    free(ir.objects);
+    free(ir.r.symbols);
+    munmap(map, st.st_size);
+}
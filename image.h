@@ -0,0 +1,13 @@
+#ifndef _IMAGE_H_
+#define _IMAGE_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//bump when the format changes so old images are refused
+#define IMAGE_VERSION 2
+
+void save_image(char *filename);
+void load_image(char *filename);
+
+#endif
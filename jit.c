@@ -0,0 +1,473 @@
+#define _DEFAULT_SOURCE
+#include "jit.h"
+#include "builtins.h"
+#include "symboltable.h"
+#include "error.h"
+#include "optimize.h"
+#include <string.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//a baseline compiler from function bodies to x86-64 machine code.
+//each form is compiled to code that leaves its value in rax. ints are still boxed, but
+//+, - and = on two ints, if, do and quote are done inline, builtins and global functions
+//are called directly with their evaluated arguments in the stack frame, and arguments
+//are read straight from the argv array the function was called with.
+//functions whose body contains anything else still get compiled, but with a real scope
+//pushed (JIT_NEEDS_SCOPE) and those forms handed to eval_sub.
+//only functions defined in the global scope are compiled, so any symbol that isn't an
+//argument refers to a global.
+//cached macro expansions are compiled in place of the calls, so the code is thrown away
+//when a global they were expanded from is rebound, just like when a builtin is.
+
+#if defined(__x86_64__) && (defined(__linux__) || defined(__APPLE__) || defined(__FreeBSD__))
+#define JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+#ifdef JIT_SUPPORTED
+
+//=runtime helpers called from compiled code=
+
+//applies the function bound to sym in the global scope to the evaluated arguments argv
+static LispObject *jit_call_global(Symbol *sym, int argc, LispObject **argv) {
+    return apply_values(get_global_var(sym), argc, argv);
+}
+
+//=code buffer=
+
+typedef struct {
+    unsigned char *code;
+    int size;
+    int capacity;
+    Macro *func;
+    bool needs_scope;
+    int nslots;
+} Jit;
+
+enum {RAX, RCX, RDX, RSI, RDI, R11};
+
+static void emit(Jit *j, int byte) {
+    if(j->size >= j->capacity) {
+        j->capacity *= 2;
+        j->code = realloc(j->code, j->capacity);
+        if(j->code == NULL)
+            error("out of memory\n");
+    }
+    j->code[j->size++] = byte;
+}
+
+static void emit_bytes(Jit *j, const char *bytes, int n) {
+    for(int i = 0; i < n; i++)
+        emit(j, (unsigned char)bytes[i]);
+}
+
+static void emit_u32(Jit *j, uint32_t x) {
+    for(int i = 0; i < 4; i++)
+        emit(j, (x >> (8 * i)) & 0xff);
+}
+
+static void emit_u64(Jit *j, uint64_t x) {
+    for(int i = 0; i < 8; i++)
+        emit(j, (x >> (8 * i)) & 0xff);
+}
+
+//mov reg, imm64
+static void emit_load_imm(Jit *j, int reg, const void *value) {
+    static const char *opcodes[] = {"\x48\xb8", "\x48\xb9", "\x48\xba", "\x48\xbe", "\x48\xbf", "\x49\xbb"};
+    emit_bytes(j, opcodes[reg], 2);
+    emit_u64(j, (uintptr_t)value);
+}
+
+//calls the C function f, whose arguments must already be in rdi, rsi, rdx
+static void emit_call(Jit *j, void *f) {
+    emit_load_imm(j, R11, f);
+    emit_bytes(j, "\x41\xff\xd3", 3); //call r11
+}
+
+#define SLOT_OFFSET(slot) ((uint32_t)(8 * (slot)))
+
+//mov [rsp + 8 * slot], rax
+static void emit_store_slot(Jit *j, int slot) {
+    if(slot + 1 > j->nslots)
+        j->nslots = slot + 1;
+    emit_bytes(j, "\x48\x89\x84\x24", 4);
+    emit_u32(j, SLOT_OFFSET(slot));
+}
+
+//mov reg, [rsp + 8 * slot]
+static void emit_load_slot(Jit *j, int reg, int slot) {
+    static const char *opcodes[] = {"\x48\x8b\x84\x24", "\x48\x8b\x8c\x24", "\x48\x8b\x94\x24",
+                                    "\x48\x8b\xb4\x24", "\x48\x8b\xbc\x24"};
+    emit_bytes(j, opcodes[reg], 4);
+    emit_u32(j, SLOT_OFFSET(slot));
+}
+
+//lea reg, [rsp + 8 * slot]
+static void emit_slot_address(Jit *j, int reg, int slot) {
+    static const char *opcodes[] = {"\x48\x8d\x84\x24", "\x48\x8d\x8c\x24", "\x48\x8d\x94\x24",
+                                    "\x48\x8d\xb4\x24", "\x48\x8d\xbc\x24"};
+    emit_bytes(j, opcodes[reg], 4);
+    emit_u32(j, SLOT_OFFSET(slot));
+}
+
+//mov reg32, imm32
+static void emit_load_int(Jit *j, int reg, int value) {
+    static const char opcodes[] = {'\xb8', '\xb9', '\xba', '\xbe', '\xbf'};
+    emit(j, (unsigned char)opcodes[reg]);
+    emit_u32(j, (uint32_t)value);
+}
+
+//emits a jump with opcode bytes and a placeholder offset, returns where the offset is
+static int emit_jump(Jit *j, const char *opcode, int n) {
+    emit_bytes(j, opcode, n);
+    emit_u32(j, 0);
+    return j->size - 4;
+}
+
+//makes the jump whose offset is at position land at the current end of the code
+static void patch_jump(Jit *j, int position) {
+    uint32_t rel = j->size - (position + 4);
+    memcpy(j->code + position, &rel, 4);
+}
+
+//=compiler=
+
+//returns the index of sym in the argument list of the function being compiled, or -1
+static int arg_index(Jit *j, LispObject *sym) {
+    int i = 0;
+    for(ConsCell *node = j->func->args; node != nil; node = (ConsCell*)node->cdr, i++)
+        if(node->car == sym)
+            return i;
+    return -1;
+}
+
+static bool is_proper_list(LispObject *obj) {
+    while(obj != (LispObject*)nil) {
+        if(obj->type != &ConsCellType || obj == tee)
+            return false;
+        obj = ((ConsCell*)obj)->cdr;
+    }
+    return true;
+}
+
+//returns the builtin the head of a form refers to, or NULL
+static BuiltinFunction *head_builtin(Jit *j, LispObject *head) {
+    head = node_source(head);
+    if(head->type == &BuiltinFunctionType)
+        return (BuiltinFunction*)head;
+    if(head->type != &SymbolType || arg_index(j, head) >= 0)
+        return NULL;
+    LispObject *val = lookup_global_var((Symbol*)head);
+    if(val == NULL || val->type != &BuiltinFunctionType)
+        return NULL;
+    return (BuiltinFunction*)val;
+}
+
+//returns true if the head of a form is a symbol naming a global function
+static bool head_is_global_function(Jit *j, LispObject *head) {
+    if(head->type != &SymbolType || arg_index(j, head) >= 0)
+        return false;
+    LispObject *val = lookup_global_var((Symbol*)head);
+    return val != NULL && val->type == &MacroType && ((Macro*)val)->is_function;
+}
+
+//returns true if the operation of the call form con itself can be compiled
+//(its arguments might still need eval_sub). builtins that look in the caller's scope
+//can't be, so the function gets a scope and they're handed to eval_sub
+static bool is_compilable_call(Jit *j, ConsCell *con) {
+    if(!is_proper_list((LispObject*)con))
+        return false;
+    int argc = list_length((ConsCell*)con->cdr);
+    BuiltinFunction *bf = head_builtin(j, con->car);
+    if(bf != NULL) {
+        if(bf->cfunc == quote)
+            return argc == 1;
+        if((bf->cfunc == if_ && argc == 3) || bf->cfunc == do_)
+            return true;
+        return bf->vfunc != NULL && !(bf->flags & BUILTIN_DYNAMIC) && argc >= bf->min_args &&
+            (bf->max_args == VARIADIC || argc <= bf->max_args);
+    }
+    return head_is_global_function(j, con->car);
+}
+
+//returns the expansion cached in the macro call con, or NULL if there isn't an up to date one
+static LispObject *expansion_of(ConsCell *con) {
+    if(con->car->type != &NodeType || ((Node*)con->car)->kind != NODE_EXPANSION)
+        return NULL;
+    return cached_expansion(con);
+}
+
+//the code compiled for a function is good while this stays the same
+static int code_version() {
+    //both only ever go up, so the sum changes whenever either does
+    return builtin_rebind_count + expansion_rebind_count;
+}
+
+static bool all_native(Jit *j, ConsCell *forms);
+
+//returns true if form can be compiled without handing any part of it to eval_sub
+static bool is_native(Jit *j, LispObject *form) {
+    if(form == tee)
+        return false;
+    if(form->type != &ConsCellType || form == (LispObject*)nil)
+        return true;
+    ConsCell *con = (ConsCell*)form;
+    if(folded_value(con) != NULL)
+        return true;
+    LispObject *expansion = expansion_of(con);
+    if(expansion != NULL)
+        return is_native(j, expansion);
+    if(!is_compilable_call(j, con))
+        return false;
+    return head_builtin(j, con->car) == quote_builtin || all_native(j, (ConsCell*)con->cdr);
+}
+
+static bool all_native(Jit *j, ConsCell *forms) {
+    for(; forms != nil; forms = (ConsCell*)forms->cdr)
+        if(!is_native(j, forms->car))
+            return false;
+    return true;
+}
+
+static void compile_form(Jit *j, LispObject *form, int depth);
+
+//compiles each element of args, leaving the values in consecutive slots starting at depth
+static void compile_args(Jit *j, ConsCell *args, int depth) {
+    for(int i = 0; args != nil; args = (ConsCell*)args->cdr, i++) {
+        compile_form(j, args->car, depth + i);
+        emit_store_slot(j, depth + i);
+    }
+}
+
+//compiles (+ a b), (- a b) or (= a b) with an inline path for two ints
+static void compile_int_op(Jit *j, BuiltinFunction *bf, ConsCell *args, int depth) {
+    compile_args(j, args, depth);
+    emit_load_slot(j, RCX, depth);
+    emit_load_imm(j, R11, &LispIntType);
+    emit_bytes(j, "\x4c\x39\x19", 3);                 //cmp [rcx], r11
+    int not_int_a = emit_jump(j, "\x0f\x85", 2);      //jne slow
+    emit_bytes(j, "\x4c\x39\x18", 3);                 //cmp [rax], r11
+    int not_int_b = emit_jump(j, "\x0f\x85", 2);      //jne slow
+
+    char n_offset = offsetof(LispInt, n);
+    if(bf->vfunc == equals) {
+        emit_bytes(j, "\x8b\x51", 2); emit(j, n_offset); //mov edx, [rcx + n]
+        emit_bytes(j, "\x3b\x50", 2); emit(j, n_offset); //cmp edx, [rax + n]
+        emit_load_imm(j, RAX, nil);
+        emit_load_imm(j, RDX, tee);
+        emit_bytes(j, "\x48\x0f\x44\xc2", 4);            //cmove rax, rdx
+    } else {
+        emit_bytes(j, "\x8b\x79", 2); emit(j, n_offset); //mov edi, [rcx + n]
+        if(bf->vfunc == plus)
+            emit_bytes(j, "\x03\x78", 2);                //add edi, [rax + n]
+        else
+            emit_bytes(j, "\x2b\x78", 2);                //sub edi, [rax + n]
+        emit(j, n_offset);
+        emit_call(j, new_lisp_int);
+    }
+    int done = emit_jump(j, "\xe9", 1);
+
+    //slow path, let the builtin deal with it (and raise the type error)
+    patch_jump(j, not_int_a);
+    patch_jump(j, not_int_b);
+    emit_load_int(j, RDI, 2);
+    emit_slot_address(j, RSI, depth);
+    emit_call(j, bf->vfunc);
+    patch_jump(j, done);
+}
+
+//compiles form so that its value is in rax, using stack slots from depth upwards for temporaries
+static void compile_form(Jit *j, LispObject *form, int depth) {
+    form = node_source(form);
+    if(form->type == &SymbolType) {
+        int i = arg_index(j, form);
+        if(i >= 0 && !j->needs_scope) {
+            emit_bytes(j, "\x49\x8b\x84\x24", 4); //mov rax, [r12 + 8 * i]
+            emit_u32(j, 8 * i);
+        } else {
+            emit_load_imm(j, RDI, form);
+            emit_call(j, j->needs_scope ? (void*)get_var : (void*)get_global_var);
+        }
+        return;
+    }
+    if(form->type != &ConsCellType || form == (LispObject*)nil) {
+        emit_load_imm(j, RAX, form);
+        return;
+    }
+    LispObject *value = form == tee ? NULL : folded_value((ConsCell*)form);
+    if(value != NULL) {
+        emit_load_imm(j, RAX, value);
+        return;
+    }
+    LispObject *expansion = form == tee ? NULL : expansion_of((ConsCell*)form);
+    if(expansion != NULL) {
+        compile_form(j, expansion, depth);
+        return;
+    }
+    if(form == tee || !is_compilable_call(j, (ConsCell*)form)) {
+        emit_load_imm(j, RDI, form);
+        emit_call(j, eval_sub);
+        return;
+    }
+
+    ConsCell *con = (ConsCell*)form;
+    ConsCell *args = (ConsCell*)con->cdr;
+    int argc = list_length(args);
+    BuiltinFunction *bf = head_builtin(j, con->car);
+
+    if(bf == NULL) {
+        //global function
+        compile_args(j, args, depth);
+        emit_load_imm(j, RDI, con->car);
+        emit_load_int(j, RSI, argc);
+        emit_slot_address(j, RDX, depth);
+        emit_call(j, jit_call_global);
+    } else if(bf->cfunc == quote) {
+        emit_load_imm(j, RAX, args->car);
+    } else if(bf->cfunc == do_) {
+        if(args == nil)
+            emit_load_imm(j, RAX, nil);
+        for(; args != nil; args = (ConsCell*)args->cdr)
+            compile_form(j, args->car, depth);
+    } else if(bf->cfunc == if_) {
+        compile_form(j, args->car, depth);
+        emit_load_imm(j, R11, nil);
+        emit_bytes(j, "\x4c\x39\xd8", 3);               //cmp rax, r11
+        int to_else = emit_jump(j, "\x0f\x84", 2);      //je else
+        compile_form(j, nth_list(args, 1), depth);
+        int to_end = emit_jump(j, "\xe9", 1);           //jmp end
+        patch_jump(j, to_else);
+        compile_form(j, nth_list(args, 2), depth);
+        patch_jump(j, to_end);
+    } else if(argc == 2 && (bf->vfunc == plus || bf->vfunc == minus || bf->vfunc == equals)) {
+        compile_int_op(j, bf, args, depth);
+    } else {
+        compile_args(j, args, depth);
+        emit_load_int(j, RDI, argc);
+        emit_slot_address(j, RSI, depth);
+        emit_call(j, bf->vfunc);
+    }
+}
+
+//copies the compiled code into executable memory, returns NULL on failure
+//the size of the mapping is kept in front of the code so it can be unmapped
+static void *install_code(Jit *j) {
+    size_t size = j->size + 16;
+    unsigned char *mem = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(mem == MAP_FAILED)
+        return NULL;
+    memcpy(mem, &size, sizeof(size));
+    memcpy(mem + 16, j->code, j->size);
+    if(mprotect(mem, size, PROT_READ | PROT_EXEC) != 0) {
+        munmap(mem, size);
+        return NULL;
+    }
+    return mem + 16;
+}
+
+//throws away the compiled code of func, if it has any
+void jit_discard(Macro *func) {
+    if(func->jit_code == NULL)
+        return;
+    unsigned char *mem = (unsigned char*)func->jit_code - 16;
+    size_t size;
+    memcpy(&size, mem, sizeof(size));
+    munmap(mem, size);
+    func->jit_code = NULL;
+}
+
+//compiles the body of the function func to machine code, if possible
+void jit_compile(Macro *func) {
+    if(func->jit_flags & JIT_FAILED)
+        return;
+    if(func->context->cdr != (LispObject*)nil || !is_proper_list((LispObject*)func->body)) {
+        func->jit_flags |= JIT_FAILED;
+        return;
+    }
+
+    Jit j;
+    j.capacity = 256;
+    j.size = 0;
+    j.code = malloc(j.capacity);
+    j.func = func;
+    j.nslots = 0;
+    j.needs_scope = !all_native(&j, func->body);
+
+    emit_bytes(&j, "\x55", 1);                          //push rbp
+    emit_bytes(&j, "\x48\x89\xe5", 3);                  //mov rbp, rsp
+    emit_bytes(&j, "\x41\x54\x41\x55", 4);              //push r12; push r13
+    emit_bytes(&j, "\x48\x81\xec", 3);                  //sub rsp, frame size
+    int frame_size_at = j.size;
+    emit_u32(&j, 0);
+    emit_bytes(&j, "\x49\x89\xfc", 3);                  //mov r12, rdi
+
+    if(func->body == nil)
+        emit_load_imm(&j, RAX, nil);
+    for(ConsCell *node = func->body; node != nil; node = (ConsCell*)node->cdr)
+        compile_form(&j, node->car, 0);
+
+    uint32_t frame_size = (8 * j.nslots + 15) & ~15;
+    memcpy(j.code + frame_size_at, &frame_size, 4);
+    emit_bytes(&j, "\x48\x81\xc4", 3);                  //add rsp, frame size
+    emit_u32(&j, frame_size);
+    emit_bytes(&j, "\x41\x5d\x41\x5c\x5d\xc3", 6);      //pop r13; pop r12; pop rbp; ret
+
+    func->jit_code = install_code(&j);
+    if(func->jit_code == NULL)
+        func->jit_flags |= JIT_FAILED;
+    else {
+        func->jit_version = code_version();
+        if(j.needs_scope)
+            func->jit_flags |= JIT_NEEDS_SCOPE;
+        else
+            func->jit_flags &= ~JIT_NEEDS_SCOPE;
+    }
+    if(VERBOSE) {
+        printf("compiled "); obj_print((LispObject*)func);
+        printf(" into %d bytes%s\n", j.size, j.needs_scope ? " (with scope)" : "");
+    }
+    free(j.code);
+}
+
+//runs the compiled code of func on the evaluated arguments argv
+//returns NULL if the code had to be thrown away since a builtin it uses, or a global an
+//expansion in it was made from, was rebound
+LispObject *jit_run(Macro *func, LispObject **argv) {
+    if(func->jit_version != code_version()) {
+        jit_discard(func);
+        func->call_count = 0;
+        return NULL;
+    }
+
+    LispObject *(*code)(LispObject **) = (LispObject *(*)(LispObject **))func->jit_code;
+    if(!(func->jit_flags & JIT_NEEDS_SCOPE))
+        return code(argv);
+
+    Dict *new_scope = (Dict*)new_dict();
+    ConsCell *namecell = func->args;
+    for(int i = 0; namecell != nil; i++) {
+        dict_setitem(new_scope, namecell->car, argv[i]);
+        namecell = (ConsCell*)namecell->cdr;
+    }
+    push_scope(new_cons_cell((LispObject*)new_scope, (LispObject*)func->context));
+    LispObject *out = code(argv);
+    pop_scope();
+    return out;
+}
+
+#else
+
+//no code generator for this platform, functions are always interpreted
+void jit_compile(Macro *func) {
+    func->jit_flags |= JIT_FAILED;
+}
+
+LispObject *jit_run(Macro *func, LispObject **argv) {
+    return NULL;
+}
+
+void jit_discard(Macro *func) {
+}
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef _JIT_H_
+#define _JIT_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//number of calls before a function is compiled
+#define JIT_THRESHOLD 50
+
+//jit_flags for functions
+#define JIT_FAILED 1      //the function can't be compiled, don't try again
+#define JIT_NEEDS_SCOPE 2 //the compiled code evaluates some forms through eval_sub
+
+void jit_compile(Macro *func);
+LispObject *jit_run(Macro *func, LispObject **argv);
+void jit_discard(Macro *func);
+
+#endif
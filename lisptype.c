@@ -1,20 +1,23 @@
 #include "lisptype.h"
 #include "alloc.h"
 #include "error.h"
+#include "printer.h"
 #include <string.h>
+#include <stdint.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
-//print the LispObject obj to stdout as represented by it's str method
+//print the LispObject obj to stdout as represented by it's print method
 void obj_print(LispObject *obj) {
-    const int bufsize = 4000;
-    char x[bufsize];
-    obj->type->str(obj, x, bufsize);
-    printf("%s", x);
+    print_object(stdout_printer, obj);
+    printer_flush(stdout_printer);
 }
 
 //returns obj if it is of type type, otherwise raises an exception
 void *safe_cast(LispObject *obj, LispType *type) {
     if(obj->type != type)
-        error("found object of type %s where %s was expected\n", obj->type->name, type->name);
+        raise_error(ERROR_TYPE, "found object of type %s where %s was expected\n", obj->type->name, type->name);
     return obj;
 }
 
@@ -26,45 +29,90 @@ void *safe_cast(LispObject *obj, LispType *type) {
 
 //=type=
 
-//str method for types
-int type_to_string(LispObject *obj, char *s, int n) {
-    LispType *type = (LispType*)obj;
-    return sncprintf(s, n, "Type %s", type->name);
+//print method for types
+void type_print(LispObject *obj, Printer *p) {
+    printer_printf(p, "Type %s", ((LispType*)obj)->name);
 }
 
-LispType TypeType = {NULL, "TypeType", type_to_string, sizeof(LispType)};
+LispType TypeType = {NULL, "TypeType", type_print, sizeof(LispType)};
 
 
 //=symbol=
 
-LispType SymbolType = {&TypeType, "Symbol", symbol_to_string, sizeof(Symbol)};
+LispType SymbolType = {&TypeType, "Symbol", symbol_print, sizeof(Symbol)};
 
-#define MAX_SYMBOLS 256
-static Symbol symbol_cache[MAX_SYMBOLS];
+//symbols are never freed, and are allocated in blocks so pointers to them stay valid
+//they're found by name through an open addressing hash table of pointers
+#define SYMBOL_BLOCK_SIZE 256
+static Symbol *symbol_block = NULL;
+static int symbol_block_used = SYMBOL_BLOCK_SIZE;
+static Symbol **symbol_table = NULL;
+static int symbol_table_size = 0;
 static int nsymbols = 0;
 
+static unsigned int symbol_hash(char *name) {
+    unsigned int h = 2166136261u;
+    for(; *name != '\0'; name++)
+        h = (h ^ (unsigned char)*name) * 16777619u;
+    return h;
+}
+
+//doubles the size of the symbol table
+static void grow_symbol_table() {
+    int new_size = symbol_table_size == 0 ? 512 : 2 * symbol_table_size;
+    Symbol **new_table = calloc(new_size, sizeof(*new_table));
+    for(int i = 0; i < symbol_table_size; i++) {
+        Symbol *sym = symbol_table[i];
+        if(sym == NULL)
+            continue;
+        unsigned int j = symbol_hash(sym->name) & (new_size - 1);
+        while(new_table[j] != NULL)
+            j = (j + 1) & (new_size - 1);
+        new_table[j] = sym;
+    }
+    free(symbol_table);
+    symbol_table = new_table;
+    symbol_table_size = new_size;
+}
+
 //creates a new symbol represented by name, or returns the preexisting one
 //in the symbol table if there is one
+//raises an exception if name is MAX_SYMBOL_LEN characters or longer
 Symbol *new_symbol(char *name) {
-    int i;
-    for(i = 0; i < nsymbols; i++)
-        if(!strcmp(symbol_cache[i].name, name))
-            return &symbol_cache[i];
-    symbol_cache[nsymbols].type = &SymbolType;
-    strncpy(symbol_cache[nsymbols].name, name, MAX_SYMBOL_LEN);
+    if(strlen(name) >= MAX_SYMBOL_LEN)
+        error("Horrible error, symbol names can have at most %d characters\n", MAX_SYMBOL_LEN - 1);
+    if(2 * (nsymbols + 1) > symbol_table_size)
+        grow_symbol_table();
+
+    unsigned int i = symbol_hash(name) & (symbol_table_size - 1);
+    while(symbol_table[i] != NULL) {
+        if(!strcmp(symbol_table[i]->name, name))
+            return symbol_table[i];
+        i = (i + 1) & (symbol_table_size - 1);
+    }
+
+    if(symbol_block_used == SYMBOL_BLOCK_SIZE) {
+        symbol_block = malloc(SYMBOL_BLOCK_SIZE * sizeof(Symbol));
+        symbol_block_used = 0;
+    }
+    Symbol *sym = &symbol_block[symbol_block_used++];
+    sym->type = &SymbolType;
+    strcpy(sym->name, name);
+    sym->watched = false;
+    symbol_table[i] = sym;
     nsymbols++;
-    return &symbol_cache[nsymbols - 1];
+    return sym;
 }
 
-//str method for symbols
-int symbol_to_string(LispObject *obj, char *s, int n) {
+//print method for symbols
+void symbol_print(LispObject *obj, Printer *p) {
     Symbol *sym = (Symbol*)obj;
-    return sncprintf(s, n, "Symbol named %s at %p", sym->name, sym);
+    printer_printf(p, "Symbol named %s at %p", sym->name, sym);
 }
 
 //=cons=
 
-LispType ConsCellType = {&TypeType, "ConsCell", cons_to_string, sizeof(ConsCell)};
+LispType ConsCellType = {&TypeType, "ConsCell", cons_print, sizeof(ConsCell)};
 
 //creats a new cons cell with car and cdr as the car and cdr
 ConsCell *new_cons_cell(LispObject *car, LispObject *cdr) {
@@ -81,23 +129,27 @@ ConsCell *nil = &_the_real_nil;
 static ConsCell _the_real_tee = {&ConsCellType, NULL, NULL};
 LispObject *tee = (LispObject*)&_the_real_tee;
 
-//str method for conscells
-int cons_to_string(LispObject *obj, char *s, int n) {
-    ConsCell *con = (ConsCell*)obj;
+//print method for conscells
+//the cdrs are followed in a loop and the close parens all printed at the end,
+//so long lists don't use up the C stack
+void cons_print(LispObject *obj, Printer *p) {
+    int depth = 0;
+    while(obj->type == &ConsCellType && obj != tee && obj != (LispObject*)nil) {
+        ConsCell *con = (ConsCell*)obj;
+        printer_write(p, "(", 1);
+        print_object(p, con->car);
+        printer_write(p, " . ", 3);
+        obj = con->cdr;
+        depth++;
+    }
     if(obj == tee)
-        return sncprintf(s, n, "t");
-    else if(con == nil)
-        return sncprintf(s, n, "nil");
-
-    int used = 0;
-    s[0] = '(';
-    used = 1;
-    used += con->car->type->str(con->car, s + used, n - used);
-    used += sncprintf(s + used, n - used, " . ");
-    used += con->cdr->type->str(con->cdr, s + used, n - used);
-    used += sncprintf(s + used, n - used, ")");
-    //printf("conscell str, used = %d, n = %d, strlen = %d, n - used = %d\n", used, n, strlen(s), n - used);
-    return used;
+        printer_write(p, "t", 1);
+    else if(obj == (LispObject*)nil)
+        printer_write(p, "nil", 3);
+    else
+        print_object(p, obj);
+    for(; depth > 0; depth--)
+        printer_write(p, ")", 1);
 }
 
 //returns the length of the list starting at con
@@ -124,7 +176,7 @@ LispObject *nth_list(ConsCell *con, int n) {
 
 //=macro=
 
-LispType MacroType = {&TypeType, "Macro", macro_to_string, sizeof(Macro)};
+LispType MacroType = {&TypeType, "Macro", macro_print, sizeof(Macro)};
 
 //creates a new macro or function
 //args is a list of symbols that defines the names of the function arguments
@@ -150,37 +202,55 @@ Macro *new_macro(ConsCell *args, ConsCell *body, ConsCell *scope_context, int is
     out->body = body;
     out->is_function = is_function;
     out->macro_name = NULL;
+    out->call_count = 0;
+    out->jit_code = NULL;
+    out->jit_flags = 0;
+    out->jit_version = 0;
     return out;
 }
 
-//str method for functions and macros
-int macro_to_string(LispObject *obj, char *s, int n) {
+//print method for functions and macros
+void macro_print(LispObject *obj, Printer *p) {
     Macro *mac = (Macro*)obj;
-    int used;
     if(mac->macro_name != NULL)
-        used = sncprintf(s, n, "%s %s",
-                         mac->is_function ? "function" : "macro",
-                         mac->macro_name->name);
+        printer_printf(p, "%s %s",
+                       mac->is_function ? "function" : "macro",
+                       mac->macro_name->name);
     else
-        used = sncprintf(s, n, "Anonymous function at %p", mac);
-    return used;
+        printer_printf(p, "Anonymous function at %p", mac);
 }
 
 //=int=
 
-LispType LispIntType = {&TypeType, "int", lisp_int_to_string, sizeof(LispInt)};
+LispType LispIntType = {&TypeType, "int", lisp_int_print, sizeof(LispInt)};
+
+//ints are immutable, so the small ones are preallocated and shared
+static LispInt small_ints[SMALL_INT_MAX - SMALL_INT_MIN + 1];
+
+//returns true if obj is one of the preallocated small ints, which aren't in the alloc table
+bool is_small_int(LispObject *obj) {
+    return (LispInt*)obj >= small_ints && (LispInt*)obj <= &small_ints[SMALL_INT_MAX - SMALL_INT_MIN];
+}
 
 //creates a new lisp int representing n
 LispObject *new_lisp_int(int n) {
+    if(n >= SMALL_INT_MIN && n <= SMALL_INT_MAX) {
+        LispInt *out = &small_ints[n - SMALL_INT_MIN];
+        if(out->type == NULL) {
+            out->type = &LispIntType;
+            out->n = n;
+        }
+        return (LispObject*)out;
+    }
     LispInt *out = alloc(sizeof(LispInt));
     out->type = &LispIntType;
     out->n = n;
     return (LispObject*)out;
 }
 
-//str method for ints
-int lisp_int_to_string(LispObject *obj, char *s, int n) {
-    return sncprintf(s, n, "%d", ((LispInt*)obj)->n);
+//print method for ints
+void lisp_int_print(LispObject *obj, Printer *p) {
+    printer_int(p, ((LispInt*)obj)->n);
 }
 
 //returns the C int represented by the lispint obj
@@ -190,50 +260,105 @@ int lisp_int_to_int(LispObject *obj) {
     return i->n;
 }
 
+//=node=
+
+LispType NodeType = {&TypeType, "Node", node_print, sizeof(Node)};
+
+//creates a new node of kind kind standing in for the symbol or builtin source
+LispObject *new_node(int kind, LispObject *source) {
+    Node *out = alloc(sizeof(Node));
+    out->type = &NodeType;
+    out->kind = kind;
+    out->state = NODE_UNINITIALIZED;
+    out->source = source;
+    out->slot = -1;
+    return (LispObject*)out;
+}
+
+//print method for nodes, which print as what they stand in for
+void node_print(LispObject *obj, Printer *p) {
+    print_object(p, ((Node*)obj)->source);
+}
+
+//returns the symbol or builtin obj stands in for if it's a node, otherwise obj
+//(folded calls' heads stand in for the result of the whole call, so they're left alone)
+LispObject *node_source(LispObject *obj) {
+    if(obj->type == &NodeType && ((Node*)obj)->kind != NODE_FOLDED)
+        return ((Node*)obj)->source;
+    return obj;
+}
+
 //=builtin-function=
 
-LispType BuiltinFunctionType = {&TypeType, "Builtin Function", builtin_function_to_string, sizeof(BuiltinFunction)};
+LispType BuiltinFunctionType = {&TypeType, "Builtin Function", builtin_function_print, sizeof(BuiltinFunction)};
 
-//creates a new builtin function named name, with the C function cfunc
-LispObject *new_builtin_function(char *name, LispObject*(*cfunc)(ConsCell*)) {
+//creates a new builtin function named name, with the C function cfunc or vfunc
+//that takes between min_args and max_args arguments
+LispObject *new_builtin_function(char *name,
+                                 LispObject*(*cfunc)(ConsCell*),
+                                 LispObject*(*vfunc)(int, LispObject**),
+                                 int min_args, int max_args, int flags) {
     BuiltinFunction *out = alloc(sizeof(BuiltinFunction));
     out->type = &BuiltinFunctionType;
     out->name = name;
     out->cfunc = cfunc;
+    out->vfunc = vfunc;
+    out->min_args = min_args;
+    out->max_args = max_args;
+    out->flags = flags;
     return (LispObject*)out;
 }
 
-//str method for builtin functions
-int builtin_function_to_string(LispObject *obj, char *s, int n) {
-    BuiltinFunction *bf = (BuiltinFunction*)obj;
-    return sncprintf(s, n, "Builtin function %s", bf->name);
+//print method for builtin functions
+void builtin_function_print(LispObject *obj, Printer *p) {
+    printer_printf(p, "Builtin function %s", ((BuiltinFunction*)obj)->name);
 }
 
 //=vector=
 
-LispType VectorType = {&TypeType, "vector", vector_to_string, sizeof(Vector)};
+LispType VectorType = {&TypeType, "vector", vector_print, sizeof(Vector)};
 
 //creates a new, empty vector
 LispObject *new_vector() {
-    int start_size = 8;
     Vector *out = alloc(sizeof(*out));
     out->type = &VectorType;
-    out->array = malloc(start_size * sizeof(LispObject*));
-    out->start = start_size;
-    out->end = start_size;
-    out->size = 0;
-    out->array_size = 8;
+    out->array = malloc(VECTOR_MIN_SIZE * sizeof(LispObject*));
+    if(out->array == NULL)
+        error("out of memory\n");
+    out->array_size = VECTOR_MIN_SIZE;
     return (LispObject*)out;
 }
 
+//returns where item i of v is kept, i must be in range
+static inline LispObject **vector_slot(Vector *v, int i) {
+    return &v->array[(v->start + i) & (v->array_size - 1)];
+}
+
+//returns the vector a slice v views, having moved i to be an index into it
+//raises an exception if items were removed from it so the slice runs past its end
+static Vector *slice_base(Vector *v, int *i) {
+    Vector *base = v->base;
+    if(v->offset + v->size > base->size)
+        error("vector slice of %d items at %d runs past the end of a vector of size %d\n",
+              v->size, v->offset, base->size);
+    *i += v->offset;
+    return base;
+}
+
+static void check_not_slice(Vector *v, char *what) {
+    if(v->base != NULL)
+        error("Horrible error, %s can't change the size of a vector slice\n", what);
+}
+
 //returns the item at index i in vector v, raises an exception if i is out of range
 LispObject *vector_getitem(Vector *v, int i) {
     if(i >= v->size || -i > v->size)
         error("getitem: index %d out of range in vector of size %d\n", i, v->size);
     if(i < 0)
         i += v->size;
-    i = (v->start + i) % v->array_size;
-    return v->array[i];
+    if(v->base != NULL)
+        v = slice_base(v, &i);
+    return *vector_slot(v, i);
 }
 
 //sets the item at index i in vector v to obj, raises an exception if i is out of range
@@ -242,8 +367,9 @@ void vector_setitem(Vector *v, int i, LispObject *obj) {
         error("setitem: index %d out of range in vector of size %d\n", i, v->size);
     if(i < 0)
         i += v->size;
-    i = (v->start + i) % v->array_size;
-    v->array[i] = obj;
+    if(v->base != NULL)
+        v = slice_base(v, &i);
+    *vector_slot(v, i) = obj;
 }
 
 //swaps the items at indexes i & j in vector v, raises an exception if either i or j is out of range
@@ -253,182 +379,368 @@ void vector_swap(Vector *v, int i, int j) {
     vector_setitem(v, j, tmp);
 }
 
-//resizes the vector v to have space amt * its current space
-void vector_resize(Vector *v, int amt) {
-    int new_array_size = v->array_size * amt;
-    LispObject **new_array = malloc(new_array_size * sizeof(*new_array));
+//moves v to a new array of array_size, a power of two that its items fit in, copying
+//the two runs they make in the old one and starting them at index 0
+static void vector_resize(Vector *v, int array_size) {
+    LispObject **new_array = malloc(array_size * sizeof(*new_array));
 
     if(VERBOSE)
         printf("resizing vector at %p\n", v);
     if(new_array == NULL)
         error("out of memory\n");
 
-    for(int j = 0; j < v->size; j++)
-        new_array[j] = vector_getitem(v, j);
+    int first = v->array_size - v->start;
+    if(first > v->size)
+        first = v->size;
+    memcpy(new_array, v->array + v->start, first * sizeof(*new_array));
+    memcpy(new_array + first, v->array, (v->size - first) * sizeof(*new_array));
     free(v->array);
     v->array = new_array;
-    v->array_size = new_array_size;
-    v->start = v->array_size;
-    v->end = v->start + v->size;
+    v->array_size = array_size;
+    v->start = 0;
+}
+
+//makes room in v for at least n items without it being resized again
+void vector_reserve(Vector *v, int n) {
+    check_not_slice(v, "vector-reserve");
+    if(n > (1 << 30))
+        error("Horrible error, can't make room for %d items in a vector\n", n);
+    int array_size = v->array_size;
+    while(array_size < n)
+        array_size *= 2;
+    if(array_size != v->array_size)
+        vector_resize(v, array_size);
+}
+
+//resizes v to the smallest array its items fit in
+void vector_shrink(Vector *v) {
+    check_not_slice(v, "vector-shrink");
+    int array_size = VECTOR_MIN_SIZE;
+    while(array_size < v->size)
+        array_size *= 2;
+    if(array_size != v->array_size)
+        vector_resize(v, array_size);
+}
+
+//moves the n items of v from index src to index dst, which may overlap, with a memmove
+//for each run of them that doesn't wrap around the end of the array
+static void vector_move(Vector *v, int src, int dst, int n) {
+    int mask = v->array_size - 1;
+    while(n > 0) {
+        int run;
+        if(dst < src) { //front to back
+            int s = (v->start + src) & mask;
+            int d = (v->start + dst) & mask;
+            run = v->array_size - (s > d ? s : d);
+            if(run > n)
+                run = n;
+            memmove(v->array + d, v->array + s, run * sizeof(LispObject*));
+            src += run;
+            dst += run;
+        } else { //back to front
+            int s = (v->start + src + n - 1) & mask;
+            int d = (v->start + dst + n - 1) & mask;
+            run = (s < d ? s : d) + 1;
+            if(run > n)
+                run = n;
+            memmove(v->array + d - run + 1, v->array + s - run + 1, run * sizeof(LispObject*));
+        }
+        n -= run;
+    }
 }
 
 //inserts obj into a new space at the end of v
 void vector_append(Vector *v, LispObject *obj) {
-    if(v->size >= v->array_size)
-        vector_resize(v, 2);
-    v->array[v->end % v->array_size] = obj;
-    v->end++;
+    if(v->size == v->array_size || v->base != NULL) {
+        check_not_slice(v, "append");
+        vector_resize(v, v->array_size * 2);
+    }
+    *vector_slot(v, v->size) = obj;
     v->size++;
 }
 
-//inserts obj into v so that it has index i, pushing other elements forward
-//raises an exception if i is out of range
+//inserts obj into v so that it has index i, moving whichever of the items before or
+//after it there are fewer of. raises an exception if i is out of range
 void vector_insert(Vector *v, int i, LispObject *obj) {
     if(i >= v->size || -i > v->size)
         error("index %d out of range in vector of size %d\n", i, v->size);
     if(i < 0)
         i += v->size;
+    check_not_slice(v, "insert");
 
-    if(v->size >= v->array_size)
-        vector_resize(v, 2);
+    if(v->size == v->array_size)
+        vector_resize(v, v->array_size * 2);
 
-    if(i < v->size / 2) { //push back
-        v->start--;
-        for(int j = v->start; j < v->start + i; j++)
-            v->array[j % v->array_size] = v->array[(j+1) % v->array_size];
-    } else { //push forward
-        v->end++;
-        for(int j = v->end; j >= v->start + i; j--)
-            v->array[j % v->array_size] = v->array[(j-1) % v->array_size];
+    if(i < v->size / 2) {
+        v->start = (v->start - 1) & (v->array_size - 1);
+        vector_move(v, 1, 0, i);
+    } else {
+        vector_move(v, i, i + 1, v->size - i);
     }
-
     v->size++;
-    vector_setitem(v, i, obj);
+    *vector_slot(v, i) = obj;
 }
 
-//removes the element at index i from v, moving other elements backwards
-//raises an exception if i is out of range
+//removes the element at index i from v, moving whichever of the items before or after
+//it there are fewer of. raises an exception if i is out of range
 void vector_remove(Vector *v, int i) {
     if(i >= v->size || -i > v->size)
         error("index %d out of range in vector of size %d\n", i, v->size);
     if(i < 0)
         i += v->size;
+    check_not_slice(v, "remove");
 
     if(i < v->size / 2) {
-        v->start++;
-        for(int j = v->start + i; j >= v->start; j--)
-            v->array[j % v->array_size] = v->array[(j-1) % v->array_size];
+        vector_move(v, 0, 1, i);
+        v->start = (v->start + 1) & (v->array_size - 1);
     } else {
-        v->end--;
-        for(int j = v->start + i; j < v->end; j++)
-            v->array[j % v->array_size] = v->array[(j+1) % v->array_size];
+        vector_move(v, i + 1, i, v->size - i - 1);
     }
-
     v->size--;
 }
 
-//str method for vectors
-int vector_to_string(LispObject *obj, char *s, int n) {
+//returns the items of v as an array of its size, first moving them to the start of the
+//array they're in if they wrap around its end. it's only valid until v changes size
+LispObject **vector_items(Vector *v) {
+    int i = 0;
+    int size = v->size;
+    if(v->base != NULL)
+        v = slice_base(v, &i);
+    if(((v->start + i) & (v->array_size - 1)) + size > v->array_size)
+        vector_resize(v, v->array_size);
+    return vector_slot(v, i);
+}
+
+//returns a vector viewing items from to to - 1 of v, sharing them with it
+//raises an exception unless 0 <= from <= to <= the size of v
+LispObject *vector_slice(Vector *v, int from, int to) {
+    if(from < 0 || from > to || to > v->size)
+        error("Horrible error, can't slice %d to %d from a vector of size %d\n", from, to, v->size);
+    if(v->base != NULL) {
+        slice_base(v, &from);
+        to += v->offset;
+        v = v->base;
+    }
+    Vector *out = alloc(sizeof(*out));
+    out->type = &VectorType;
+    out->base = v;
+    out->offset = from;
+    out->size = to - from;
+    return (LispObject*)out;
+}
+
+//print method for vectors
+void vector_print(LispObject *obj, Printer *p) {
     Vector *v = (Vector*)obj;
-    int i;
-    int used = 1;
-
-    if(n <= 1) return 0;
-    s[0] = '[';
-    for(i = 0; i < v->size; i++) {
-        LispObject *x = vector_getitem(v, i);
-        used += x->type->str(x, s + used, n - used);
-        if(used >= n - 1)
-            return n - 1;
-        used += sncprintf(s + used, n - used, ", ");
-        if(used >= n - 1)
-            return n - 1;
-    }
-    if(used >= n - 1) return used;
-    s[used] = ']';
-    s[used + 1] = '\0';
-    return used + 1;
+    printer_write(p, "[", 1);
+    for(int i = 0; i < v->size; i++) {
+        print_object(p, vector_getitem(v, i));
+        printer_write(p, ", ", 2);
+    }
+    printer_write(p, "]", 1);
 }
 
 //=dict=
 
-LispType DictType = {&TypeType, "dict", dict_to_string, sizeof(Dict)};
+LispType DictType = {&TypeType, "dict", dict_print, sizeof(Dict)};
 
-static void dict_resize(Dict *d);
-static bool dict_find_index(Dict *d, LispObject *key, int *index);
+//control bytes of slots that aren't full. full ones hold 7 bits of the hash, so their top
+//bit is clear
+#define CTRL_EMPTY 0x80
+#define CTRL_DELETED 0xfe
 
-#define NPRIMES 28
-static const int primes[NPRIMES] = {11, 23, 47, 97, 197, 397, 797, 1597, 3203, 6421, 12853, 25717, 51437, 102877, 205759, 411527, 823117, 1646237, 3292489, 6584983, 13169977, 26339969, 52679969, 105359939, 210719881, 421439783, 842879579, 1685759167};
+//fibonacci hashing, every bit of h affects the top half of the product
+static inline unsigned int mix_hash(uint64_t h) {
+    return (h * 0x9e3779b97f4a7c15ULL) >> 32;
+}
 
-//finds the index of key in the underlying array and puts it into index_out
-//returns false if key is not present in the table, in which case index_out
-//will be the proper index for it to be inserted into, or -1 if the table is full
-static bool dict_find_index(Dict *d, LispObject *key, int *index_out) {
-    int hash = (int)key; //use pointer value for hash value, hacky as hell
+//returns the hash of the len chars at s
+static unsigned int hash_chars(char *s, int len) {
+    uint64_t h = 0x9e3779b97f4a7c15ULL ^ len;
     int i = 0;
-    *index_out = -1;
-    for(;;) {
-        int j = (hash + i * i) % d->array_size;
-        if(i >= d->array_size)
-            return false;
-        if(d->keys[j] == NULL) {
-            *index_out = j;
-            return false;
-        } if(key == d->keys[j]) { //also using reference equality!?
-            *index_out = j;
-            return true;
+    for(; i + 8 <= len; i += 8) {
+        uint64_t word;
+        memcpy(&word, s + i, 8);
+        h = (h ^ word) * 0x100000001b3ULL;
+        h ^= h >> 29;
+    }
+    uint64_t word = 0;
+    memcpy(&word, s + i, len - i);
+    return mix_hash(h ^ word);
+}
+
+//returns the hash of key. ints and strs hash by value, everything else by identity
+unsigned int dict_hash(LispObject *key) {
+    if(key->type == &StrType) {
+        Str *s = (Str*)key;
+        if(s->hash == 0)
+            s->hash = hash_chars(s->array, s->size) | 1;
+        return s->hash;
+    }
+    if(key->type == &LispIntType)
+        return mix_hash(((LispInt*)key)->n);
+    return mix_hash((uintptr_t)key);
+}
+
+//returns whether the keys a and b are the same, which for ints and strs means equal
+bool dict_keys_equal(LispObject *a, LispObject *b) {
+    if(a == b)
+        return true;
+    if(a->type != b->type)
+        return false;
+    if(a->type == &LispIntType)
+        return ((LispInt*)a)->n == ((LispInt*)b)->n;
+    if(a->type == &StrType) {
+        Str *sa = (Str*)a;
+        Str *sb = (Str*)b;
+        return sa->size == sb->size && !memcmp(sa->array, sb->array, sa->size);
+    }
+    return false;
+}
+
+//returns a bitmask of the bytes in the group at ctrl that are equal to c
+static inline unsigned int group_match(unsigned char *ctrl, unsigned char c) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((__m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8(c)));
+#else
+    unsigned int out = 0;
+    for(int i = 0; i < DICT_GROUP_SIZE; i++)
+        out |= (unsigned int)(ctrl[i] == c) << i;
+    return out;
+#endif
+}
+
+//returns a bitmask of the slots in the group at ctrl that are empty or deleted
+static inline unsigned int group_free(unsigned char *ctrl) {
+#ifdef __SSE2__
+    return _mm_movemask_epi8(_mm_loadu_si128((__m128i*)ctrl));
+#else
+    unsigned int out = 0;
+    for(int i = 0; i < DICT_GROUP_SIZE; i++)
+        out |= (unsigned int)(ctrl[i] >> 7) << i;
+    return out;
+#endif
+}
+
+//returns the slot key with hash hash goes in if it's free, its probe sequence starts at
+//the group holding it
+static inline int dict_home_index(Dict *d, unsigned int hash) {
+    return (hash >> 7) & (d->array_size - 1);
+}
+
+//returns the index of the slot of key in d, or -1 if it's not there
+//most keys are in their home slot, which can be checked without waiting for the control
+//bytes. otherwise groups are probed in a triangular sequence, which visits them all, and
+//a group with an empty slot ends the search
+static inline int dict_find_index(Dict *d, LispObject *key, unsigned int hash) {
+    int home = dict_home_index(d, hash);
+    if(d->slots[home].key == key)
+        return home;
+    int groups_mask = d->array_size / DICT_GROUP_SIZE - 1;
+    unsigned char h2 = hash & 0x7f;
+    int g = home / DICT_GROUP_SIZE;
+    for(int step = 1;; step++) {
+        unsigned char *ctrl = d->ctrl + g * DICT_GROUP_SIZE;
+        for(unsigned int m = group_match(ctrl, h2); m != 0; m &= m - 1) {
+            int i = g * DICT_GROUP_SIZE + __builtin_ctz(m);
+            if(dict_keys_equal(d->slots[i].key, key))
+                return i;
         }
-        i++;
+        if(group_match(ctrl, CTRL_EMPTY) != 0)
+            return -1;
+        g = (g + step) & groups_mask;
+    }
+}
+
+//returns the index of the slot to put a new key with hash hash in: its home slot if
+//that's empty or deleted, otherwise the first one on its probe sequence that is
+static int dict_free_index(Dict *d, unsigned int hash) {
+    int home = dict_home_index(d, hash);
+    if(d->ctrl[home] & CTRL_EMPTY)
+        return home;
+    int groups_mask = d->array_size / DICT_GROUP_SIZE - 1;
+    int g = home / DICT_GROUP_SIZE;
+    for(int step = 1;; step++) {
+        unsigned int m = group_free(d->ctrl + g * DICT_GROUP_SIZE);
+        if(m != 0)
+            return g * DICT_GROUP_SIZE + __builtin_ctz(m);
+        g = (g + step) & groups_mask;
     }
 }
 
+//moves the items of d into new arrays of array_size slots, which also clears out
+//deleted slots
+static void dict_rehash(Dict *d, int array_size) {
+    DictSlot *old_slots = d->slots;
+    int old_size = d->array_size;
+
+    //the control bytes go after the slots in the same block
+    d->slots = malloc(array_size * (sizeof(DictSlot) + 1));
+    d->ctrl = (unsigned char*)(d->slots + array_size);
+    memset(d->slots, 0, array_size * sizeof(DictSlot));
+    memset(d->ctrl, CTRL_EMPTY, array_size);
+    d->array_size = array_size;
+    d->deleted = 0;
+    for(int i = 0; i < old_size; i++)
+        if(old_slots[i].key != NULL) {
+            unsigned int hash = dict_hash(old_slots[i].key);
+            int j = dict_free_index(d, hash);
+            d->ctrl[j] = hash & 0x7f;
+            d->slots[j] = old_slots[i];
+        }
+    free(old_slots);
+}
+
 //sets the value for key key to value in d
 void dict_setitem(Dict *d, LispObject *key, LispObject *value) {
-    int i;
-    if(dict_find_index(d, key, &i))
-        d->values[i] = value;
-    else if (i >= 0) {
-        d->keys[i] = key;
-        d->values[i] = value;
-        d->size++;
-        if(d->size > d->array_size / 2)
-            dict_resize(d);
-    } else
-        error("dict full somehow\n");
-}
-
-//returns the value for key in d
+    unsigned int hash = dict_hash(key);
+    int i = dict_find_index(d, key, hash);
+    if(i >= 0) {
+        d->slots[i].value = value;
+        return;
+    }
+    //at most 7/8 of the slots are used, so probes always reach an empty one
+    //if deleted slots take up much of that, clearing them out is enough
+    if((d->size + d->deleted + 1) * 8 > d->array_size * 7)
+        dict_rehash(d, d->size * 16 > d->array_size * 7 ? d->array_size * 2 : d->array_size);
+    i = dict_free_index(d, hash);
+    if(d->ctrl[i] == CTRL_DELETED)
+        d->deleted--;
+    d->ctrl[i] = hash & 0x7f;
+    d->slots[i].key = key;
+    d->slots[i].value = value;
+    d->size++;
+}
+
+//returns the value for key in d, or NULL if it's not there
 LispObject *dict_getitem(Dict *d, LispObject *key) {
-    int i;
-    if(!dict_find_index(d, key, &i))
+    int i = dict_find_index(d, key, dict_hash(key));
+    if(i < 0)
         return NULL;
-    return d->values[i];
+    return d->slots[i].value;
 }
 
-//resizes the dict to be able to hold more elements
-static void dict_resize(Dict *d) {
-    if(d->primei + 1 >= NPRIMES)
-        error("dict is already at maximum size\n");
-
-    int newsize = primes[d->primei + 1];
-    int oldsize = d->array_size;
-    LispObject **old_keys = d->keys;
-    LispObject **old_values = d->values;
-
-    d->keys = malloc(newsize * sizeof(*d->keys));
-    d->values = malloc(newsize * sizeof(*d->values));
-    d->array_size = newsize;
-    d->size = 0;
-    d->primei++;
-    memset(d->keys, 0, newsize * sizeof(*d->keys));
-    memset(d->values, 0, newsize * sizeof(*d->values));
-
-    for(int i = 0; i < oldsize; i++)
-        if(old_keys[i] != NULL)
-            dict_setitem(d, old_keys[i], old_values[i]);
+//removes key from d, returns false if it wasn't there
+//its slot is marked deleted so probes carry on past it, and d shrinks when mostly empty
+bool dict_delitem(Dict *d, LispObject *key) {
+    int i = dict_find_index(d, key, dict_hash(key));
+    if(i < 0)
+        return false;
+    d->ctrl[i] = CTRL_DELETED;
+    d->slots[i].key = NULL;
+    d->slots[i].value = NULL;
+    d->size--;
+    d->deleted++;
+    if(d->array_size > DICT_GROUP_SIZE && d->size < d->array_size / 8)
+        dict_rehash(d, d->array_size / 2);
+    return true;
+}
 
-    free(old_keys);
-    free(old_values);
+//returns the index of key in the slots of d, or -1 if it isn't present
+//the index stays valid until d is resized
+int dict_index_of(Dict *d, LispObject *key) {
+    return dict_find_index(d, key, dict_hash(key));
 }
 
 //creates a new, empty dict
@@ -436,39 +748,32 @@ LispObject *new_dict() {
     Dict *out = alloc(sizeof(*out));
     out->type = &DictType;
     out->array_size = 0;
-    out->primei = -1;
-    out->keys = NULL;
-    out->values = NULL;
-    dict_resize(out);
+    out->size = 0;
+    out->ctrl = NULL;
+    out->slots = NULL;
+    dict_rehash(out, DICT_GROUP_SIZE);
     return (LispObject*)out;
 }
 
-//str method for dicts
-int dict_to_string(LispObject *obj, char *s, int n) {
+//print method for dicts
+void dict_print(LispObject *obj, Printer *p) {
     Dict *d = (Dict*)obj;
-    int used = 0;
-
-    used += sncprintf(s + used, n - used, "{");
+    printer_write(p, "{", 1);
     for(int i = 0; i < d->array_size; i++) {
-        if(d->keys[i] == NULL)
+        if(d->slots[i].key == NULL)
             continue;
-        if(n - used <= 0)
-            return used;
-
-        used += d->keys[i]->type->str(d->keys[i], s + used, n - used);
-        used += sncprintf(s + used, n - used, " : ");
-        used += d->values[i]->type->str(d->values[i], s + used, n - used);
-        used += sncprintf(s + used, n - used, ", ");
+        print_object(p, d->slots[i].key);
+        printer_write(p, " : ", 3);
+        print_object(p, d->slots[i].value);
+        printer_write(p, ", ", 2);
     }
-
-    used += sncprintf(s + used, n - used, "}");
-    return used;
+    printer_write(p, "}", 1);
 }
 
 
 //=str=
 
-LispType StrType = {&TypeType, "str", str_to_string, sizeof(Str)};
+LispType StrType = {&TypeType, "str", str_print, sizeof(Str)};
 
 LispObject *new_str() {
     return (LispObject*)new_str_with_size(8);
@@ -480,12 +785,26 @@ Str *new_str_with_size(int size) {
     out->array = malloc(size * sizeof(char));
     out->array_size = size;
     out->size = 0;
+    out->hash = 0;
     out->array[0] = '\0';
     return out;
 }
 
-int str_to_string(LispObject *obj, char *s, int n) {
-    return sncprintf(s, n, "\"%s\"", ((Str*)obj)->array);
+//print method for strs
+void str_print(LispObject *obj, Printer *p) {
+    Str *s = (Str*)obj;
+    printer_write(p, "\"", 1);
+    printer_write(p, s->array, s->size);
+    printer_write(p, "\"", 1);
+}
+
+//returns a new str holding a copy of the len chars at s
+Str *new_str_from(char *s, int len) {
+    Str *out = new_str_with_size(len + 1);
+    memcpy(out->array, s, len);
+    out->array[len] = '\0';
+    out->size = len;
+    return out;
 }
 
 Str *str_slice(Str *s, int start, int len) {
@@ -496,18 +815,15 @@ Str *str_slice(Str *s, int start, int len) {
     if(start + len > s->size)
         error("index error in str_slice");
 
-    Str *out = (Str*)new_str();
-    for(int i = 0; i < len; i++)
-        str_append(out, s->array[start + i]);
-    return out;
+    return new_str_from(s->array + start, len);
 }
 
 Str *str_concat(Str *a, Str *b) {
-    Str *out = (Str*)new_str();
-    for(int i = 0; i < a->size; i++)
-        str_append(out, a->array[i]);
-    for(int i = 0; i < b->size; i++)
-        str_append(out, b->array[i]);
+    Str *out = new_str_with_size(a->size + b->size + 1);
+    memcpy(out->array, a->array, a->size);
+    memcpy(out->array + a->size, b->array, b->size);
+    out->size = a->size + b->size;
+    out->array[out->size] = '\0';
     return out;
 }
 
@@ -524,4 +840,267 @@ void str_append(Str *s, char c) {
     s->array[s->size] = c;
     s->array[s->size + 1] = '\0';
     s->size++;
+    s->hash = 0;
+}
+
+//appends the len chars at chars to s
+void str_append_chars(Str *s, char *chars, int len) {
+    if(s->size + len >= s->array_size) {
+        int newsize = s->array_size * 2;
+        while(s->size + len >= newsize)
+            newsize *= 2;
+        s->array = realloc(s->array, newsize);
+        s->array_size = newsize;
+    }
+    memcpy(s->array + s->size, chars, len);
+    s->size += len;
+    s->array[s->size] = '\0';
+    s->hash = 0;
+}
+
+//=memo=
+
+LispType MemoType = {&TypeType, "memo", memo_print, sizeof(Memo)};
+
+#define MEMO_INITIAL_BUCKETS 16
+
+//creates a memoized version of function, caching at most max_size results (0 for no bound)
+LispObject *new_memo(LispObject *function, int max_size) {
+    Memo *out = alloc(sizeof(*out));
+    out->type = &MemoType;
+    out->function = function;
+    out->nbuckets = MEMO_INITIAL_BUCKETS;
+    out->buckets = calloc(out->nbuckets, sizeof(*out->buckets));
+    out->size = 0;
+    out->max_size = max_size;
+    out->newest = NULL;
+    out->oldest = NULL;
+    return (LispObject*)out;
+}
+
+//print method for memos
+void memo_print(LispObject *obj, Printer *p) {
+    printer_puts(p, "memoized ");
+    print_object(p, ((Memo*)obj)->function);
+}
+
+//returns the hash of the argument list argv
+unsigned int hash_values(int argc, LispObject **argv) {
+    unsigned int h = argc;
+    for(int i = 0; i < argc; i++)
+        h = h * 31 + obj_hash(argv[i]);
+    return h;
+}
+
+//takes e out of the order of use
+static void memo_unlink(Memo *m, MemoEntry *e) {
+    if(e->newer != NULL)
+        e->newer->older = e->older;
+    else
+        m->newest = e->older;
+    if(e->older != NULL)
+        e->older->newer = e->newer;
+    else
+        m->oldest = e->newer;
+}
+
+//makes e the most recently used entry
+static void memo_push_newest(Memo *m, MemoEntry *e) {
+    e->newer = NULL;
+    e->older = m->newest;
+    if(m->newest != NULL)
+        m->newest->newer = e;
+    else
+        m->oldest = e;
+    m->newest = e;
+}
+
+//returns the cached result for the arguments argv, whose hash_values is hash, or NULL
+LispObject *memo_lookup(Memo *m, int argc, LispObject **argv, unsigned int hash) {
+    for(MemoEntry *e = m->buckets[hash & (m->nbuckets - 1)]; e != NULL; e = e->next) {
+        if(e->hash != hash || e->argc != argc)
+            continue;
+        int i;
+        for(i = 0; i < argc && obj_equal(e->argv[i], argv[i]); i++)
+            ;
+        if(i < argc)
+            continue;
+        if(m->max_size > 0 && e != m->newest) {
+            memo_unlink(m, e);
+            memo_push_newest(m, e);
+        }
+        return e->value;
+    }
+    return NULL;
+}
+
+//removes the least recently used entry of m
+static void memo_evict(Memo *m) {
+    MemoEntry *e = m->oldest;
+    MemoEntry **link = &m->buckets[e->hash & (m->nbuckets - 1)];
+    while(*link != e)
+        link = &(*link)->next;
+    *link = e->next;
+    memo_unlink(m, e);
+    free(e);
+    m->size--;
+}
+
+//doubles the number of buckets of m
+static void memo_grow(Memo *m) {
+    int nbuckets = m->nbuckets * 2;
+    MemoEntry **buckets = calloc(nbuckets, sizeof(*buckets));
+    for(int i = 0; i < m->nbuckets; i++) {
+        MemoEntry *e = m->buckets[i];
+        while(e != NULL) {
+            MemoEntry *next = e->next;
+            e->next = buckets[e->hash & (nbuckets - 1)];
+            buckets[e->hash & (nbuckets - 1)] = e;
+            e = next;
+        }
+    }
+    free(m->buckets);
+    m->buckets = buckets;
+    m->nbuckets = nbuckets;
+}
+
+//caches value as the result for the arguments argv, whose hash_values is hash
+//the arguments are kept by reference, so mutating a list or vector after it was used
+//as an argument makes its entry unreachable
+void memo_store(Memo *m, int argc, LispObject **argv, unsigned int hash, LispObject *value) {
+    if(m->max_size > 0 && m->size >= m->max_size)
+        memo_evict(m);
+    if(m->size >= m->nbuckets)
+        memo_grow(m);
+
+    MemoEntry *e = malloc(sizeof(*e) + argc * sizeof(LispObject*));
+    e->hash = hash;
+    e->value = value;
+    e->argc = argc;
+    memcpy(e->argv, argv, argc * sizeof(LispObject*));
+    MemoEntry **bucket = &m->buckets[hash & (m->nbuckets - 1)];
+    e->next = *bucket;
+    *bucket = e;
+    memo_push_newest(m, e);
+    m->size++;
+}
+
+//frees the cached results of m, when it's garbage collected
+void free_memo_entries(Memo *m) {
+    MemoEntry *e = m->newest;
+    while(e != NULL) {
+        MemoEntry *older = e->older;
+        free(e);
+        e = older;
+    }
+    free(m->buckets);
+}
+
+//=lazy-seq=
+
+LispType LazySeqType = {&TypeType, "lazy sequence", lazy_seq_print, sizeof(LazySeq)};
+
+//creates an unforced lazy sequence, see the LAZY_ kinds for what the fields mean
+LazySeq *new_lazy_seq(int kind, LispObject *fn, LispObject *source, int start, int end, int step) {
+    LazySeq *out = alloc(sizeof(*out));
+    out->type = &LazySeqType;
+    out->kind = kind;
+    out->forced = false;
+    out->value = (LispObject*)nil;
+    out->fn = fn;
+    out->source = source;
+    out->start = start;
+    out->end = end;
+    out->step = step;
+    return out;
+}
+
+//print method for lazy sequences, which doesn't force them
+void lazy_seq_print(LispObject *obj, Printer *p) {
+    printer_printf(p, "lazy sequence at %p", obj);
+}
+
+//=structural-equality=
+
+//nesting depth past which lists and vectors are compared by reference, which also
+//keeps cyclic structures from looping
+#define MAX_HASH_DEPTH 32
+
+static unsigned int obj_hash_sub(LispObject *obj, int depth) {
+    if(obj->type == &LispIntType)
+        return (unsigned int)((LispInt*)obj)->n * 2654435761u;
+    if(obj->type == &StrType) {
+        Str *str = (Str*)obj;
+        unsigned int h = 2166136261u;
+        for(int i = 0; i < str->size; i++)
+            h = (h ^ (unsigned char)str->array[i]) * 16777619u;
+        return h;
+    }
+    if(depth >= MAX_HASH_DEPTH && (obj->type == &ConsCellType || obj->type == &VectorType))
+        return 0;
+    if(obj->type == &ConsCellType && obj != (LispObject*)nil && obj != tee) {
+        unsigned int h = 17;
+        while(obj->type == &ConsCellType && obj != (LispObject*)nil && obj != tee) {
+            h = h * 31 + obj_hash_sub(((ConsCell*)obj)->car, depth + 1);
+            obj = ((ConsCell*)obj)->cdr;
+        }
+        return h * 31 + obj_hash_sub(obj, depth + 1);
+    }
+    if(obj->type == &VectorType) {
+        Vector *v = (Vector*)obj;
+        unsigned int h = 19;
+        for(int i = 0; i < v->size; i++)
+            h = h * 31 + obj_hash_sub(vector_getitem(v, i), depth + 1);
+        return h;
+    }
+    return (unsigned int)(((uintptr_t)obj >> 4) * 2654435761u);
+}
+
+//returns a hash of obj such that objects that are obj_equal have the same hash
+unsigned int obj_hash(LispObject *obj) {
+    return obj_hash_sub(obj, 0);
+}
+
+static bool obj_equal_sub(LispObject *a, LispObject *b, int depth) {
+    if(a == b)
+        return true;
+    if(a->type != b->type)
+        return false;
+    if(a->type == &LispIntType)
+        return ((LispInt*)a)->n == ((LispInt*)b)->n;
+    if(a->type == &StrType) {
+        Str *x = (Str*)a;
+        Str *y = (Str*)b;
+        return x->size == y->size && memcmp(x->array, y->array, x->size) == 0;
+    }
+    if(depth >= MAX_HASH_DEPTH)
+        return false;
+    if(a->type == &ConsCellType) {
+        while(a->type == &ConsCellType && b->type == &ConsCellType && a != b) {
+            if(a == (LispObject*)nil || a == tee || b == (LispObject*)nil || b == tee)
+                return false;
+            if(!obj_equal_sub(((ConsCell*)a)->car, ((ConsCell*)b)->car, depth + 1))
+                return false;
+            a = ((ConsCell*)a)->cdr;
+            b = ((ConsCell*)b)->cdr;
+        }
+        return obj_equal_sub(a, b, depth + 1);
+    }
+    if(a->type == &VectorType) {
+        Vector *x = (Vector*)a;
+        Vector *y = (Vector*)b;
+        if(x->size != y->size)
+            return false;
+        for(int i = 0; i < x->size; i++)
+            if(!obj_equal_sub(vector_getitem(x, i), vector_getitem(y, i), depth + 1))
+                return false;
+        return true;
+    }
+    return false;
+}
+
+//returns true if a and b are the same object, or ints, strings, lists or vectors
+//with the same contents
+bool obj_equal(LispObject *a, LispObject *b) {
+    return obj_equal_sub(a, b, 0);
 }
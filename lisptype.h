@@ -14,7 +14,10 @@ typedef struct {
     LISP_OBJECT_HEADER
 } LispObject;
 
-typedef int (*ToStringFunc)(LispObject *, char *, int);
+//print methods write the representation of an object to a printer, see printer.h
+struct Printer_S;
+typedef struct Printer_S Printer;
+typedef void (*PrintFunc)(LispObject *, Printer *);
 //typedef LispObject *(*NewFunc)(LispType *, ConsCell *);
 //typedef void (*Initializer)(LispObject *, ConsCell *);
 
@@ -23,12 +26,14 @@ typedef int (*ToStringFunc)(LispObject *, char *, int);
 struct LispType_S {
     LISP_OBJECT_HEADER
     char *name;
-    ToStringFunc str;
+    PrintFunc print;
     size_t object_size;
     //NewFunc new;
     //Initializer init;
 };
 
+extern LispType TypeType;
+
 void obj_print(LispObject *obj);
 void *safe_cast(LispObject *obj, LispType *type);
 
@@ -40,9 +45,10 @@ extern LispObject *tee;
 typedef struct Symbol_S {
     LISP_OBJECT_HEADER
     char name[MAX_SYMBOL_LEN];
+    bool watched; //see watch_global in symboltable.c
 } Symbol;
 
-int symbol_to_string(LispObject *obj, char *s, int n);
+void symbol_print(LispObject *obj, Printer *p);
 Symbol *new_symbol(char *name);
 
 extern LispType SymbolType;
@@ -56,7 +62,7 @@ typedef struct {
 } ConsCell;
 
 ConsCell *new_cons_cell(LispObject *car, LispObject *cdr);
-int cons_to_string(LispObject *obj, char *s, int n);
+void cons_print(LispObject *obj, Printer *p);
 int list_length(ConsCell *con);
 LispObject *nth_list(ConsCell *con, int n);
 
@@ -73,10 +79,14 @@ typedef struct {
     Symbol *macro_name;
     int is_function;
     int arity;
+    int call_count;
+    void *jit_code; //machine code for the function body, see jit.c
+    int jit_flags;
+    int jit_version;
 } Macro;
 
 Macro *new_macro(ConsCell *args, ConsCell *body, ConsCell *scope_context, int is_function);
-int macro_to_string(LispObject *obj, char *s, int n);
+void macro_print(LispObject *obj, Printer *p);
 
 extern LispType MacroType;
 
@@ -87,61 +97,144 @@ typedef struct {
     int n;
 } LispInt;
 
+//ints in this range are preallocated, see new_lisp_int
+#define SMALL_INT_MIN -128
+#define SMALL_INT_MAX 1023
+
 LispObject *new_lisp_int(int n);
-int lisp_int_to_string(LispObject *obj, char *s, int n);
+bool is_small_int(LispObject *obj);
+void lisp_int_print(LispObject *obj, Printer *p);
 int lisp_int_to_int(LispObject *obj);
 
 extern LispType LispIntType;
 
+//=node=========================================================================
+
+//nodes replace parts of forms that have been through the optimizer, and rewrite
+//themselves as they run based on what they've seen (see apply_form in builtins.c)
+#define NODE_LOCAL_LOAD 0 //a symbol, remembers where it was found in the innermost scope
+#define NODE_ADD 1        //the head of a 2 argument call to +
+#define NODE_SUB 2        //the head of a 2 argument call to -
+#define NODE_EQUALS 3     //the head of a 2 argument call to =
+#define NODE_EXPANSION 4  //the head of a macro call whose expansion is cached, see apply_form
+#define NODE_SPECIAL_FORM 5 //the head of a call to a special form with the right number of arguments
+#define NODE_FOLDED 6     //the head of a call to a pure builtin folded into its result, see optimize.c
+
+//states for NODE_ADD, NODE_SUB and NODE_EQUALS
+#define NODE_UNINITIALIZED 0 //not run yet
+#define NODE_INT_INT 1       //has only seen two ints, which are handled inline
+#define NODE_GENERIC 2       //has seen something else, calls the builtin
+
+typedef struct {
+    LISP_OBJECT_HEADER
+    int kind;
+    int state;          //for NODE_EXPANSION, expansion_rebind_count when last checked, and
+                        //for NODE_FOLDED, builtin_rebind_count when folded
+    LispObject *source; //the symbol loaded, the builtin called, the expansion or the result
+    int slot;           //index of the symbol in the innermost scope dict when last found there
+} Node;
+
+LispObject *new_node(int kind, LispObject *source);
+void node_print(LispObject *obj, Printer *p);
+LispObject *node_source(LispObject *obj);
+
+extern LispType NodeType;
+
 //=builtin-function-type=======================================================
 
+#define VARIADIC -1
+
+//flags for builtin functions
+#define BUILTIN_PURE 1 //no side effects, result only depends on the arguments. calls with
+                       //constant arguments are folded into one object that every run of the
+                       //call returns, so builtins making new lists aren't pure
+#define BUILTIN_LEAF 2 //not recorded on the call stack, for builtins that can't call back into
+                       //lisp or raise an error, so stack traces don't miss them
+#define BUILTIN_DYNAMIC 4 //reads or evaluates in the caller's scope, so the caller needs one
+#define BUILTIN_OWN_FRAME 8 //records itself on the call stack, for fns compiled with --compile-c
+
+//exactly one of cfunc and vfunc is set. cfunc takes the unevaluated argument list,
+//vfunc takes the evaluated arguments as an array. the number of arguments is checked
+//against min_args and max_args (which may be VARIADIC) before either is called
 typedef struct {
     LISP_OBJECT_HEADER
     LispObject *(*cfunc)(ConsCell *);
+    LispObject *(*vfunc)(int argc, LispObject **argv);
     char *name;
+    int min_args;
+    int max_args;
+    int flags;
 } BuiltinFunction;
 
-LispObject *new_builtin_function(char *name, LispObject*(*cfunc)(ConsCell*));
-int builtin_function_to_string(LispObject *obj, char *s, int n);
+LispObject *new_builtin_function(char *name,
+                                 LispObject*(*cfunc)(ConsCell*),
+                                 LispObject*(*vfunc)(int, LispObject**),
+                                 int min_args, int max_args, int flags);
+void builtin_function_print(LispObject *obj, Printer *p);
 
 extern LispType BuiltinFunctionType;
 
 //=vector=======================================================================
 
-typedef struct {
+//smallest array a vector has, array sizes are powers of two
+#define VECTOR_MIN_SIZE 8
+
+//a ring buffer, item i is at array[(start + i) & (array_size - 1)]
+//a slice has no array of its own and views items offset to offset + size of base, so
+//inserting or removing before them in base changes what it sees
+typedef struct Vector_S {
     LISP_OBJECT_HEADER
     LispObject **array;
     int array_size;
     int start;
-    int end;
     int size;
+    struct Vector_S *base; //NULL unless a slice
+    int offset;
 } Vector;
 
 LispObject *new_vector();
-int vector_to_string(LispObject *obj, char *s, int n);
+void vector_print(LispObject *obj, Printer *p);
 void vector_insert(Vector *v, int i, LispObject *obj);
 LispObject *vector_getitem(Vector *v, int i);
 void vector_setitem(Vector *v, int i, LispObject *obj);
 void vector_append(Vector *v, LispObject *obj);
 void vector_remove(Vector *v, int i);
+void vector_reserve(Vector *v, int n);
+void vector_shrink(Vector *v);
+LispObject *vector_slice(Vector *v, int from, int to);
+LispObject **vector_items(Vector *v);
 
 extern LispType VectorType;
 
 //=dict=========================================================================
 
+//slots are looked up in groups of this many control bytes
+#define DICT_GROUP_SIZE 16
+
+typedef struct {
+    LispObject *key; //NULL if the slot is empty or deleted
+    LispObject *value;
+} DictSlot;
+
+//a swiss table. ctrl has a byte for each slot that says if it's empty or deleted, or holds
+//the low 7 bits of the hash of its key, so whole groups of slots are checked at once
 typedef struct {
     LISP_OBJECT_HEADER;
-    LispObject **keys;
-    LispObject **values;
-    int array_size;
+    unsigned char *ctrl; //points just past the end of slots
+    DictSlot *slots;
+    int array_size; //a power of two, and at least DICT_GROUP_SIZE
     int size;
-    int primei;
+    int deleted;
 } Dict;
 
 LispObject *new_dict();
-int dict_to_string(LispObject *obj, char *s, int n);
+void dict_print(LispObject *obj, Printer *p);
 LispObject *dict_getitem(Dict *d, LispObject *key);
 void dict_setitem(Dict *d, LispObject *key, LispObject *value);
+bool dict_delitem(Dict *d, LispObject *key);
+int dict_index_of(Dict *d, LispObject *key);
+unsigned int dict_hash(LispObject *key);
+bool dict_keys_equal(LispObject *a, LispObject *b);
 
 extern LispType DictType;
 
@@ -152,17 +245,91 @@ typedef struct {
     char *array;
     int array_size;
     int size;
+    unsigned int hash; //0 until worked out, then kept until the str changes
 } Str;
 
 LispObject *new_str();
 Str *new_str_with_size(int size);
-int str_to_string(LispObject *obj, char *s, int n);
+Str *new_str_from(char *s, int len);
+void str_print(LispObject *obj, Printer *p);
 Str *str_slice(Str *s, int start, int len);
 Str *str_concat(Str *a, Str *b);
 void str_append(Str *s, char c);
+void str_append_chars(Str *s, char *chars, int len);
 
 extern LispType StrType;
 
+//=memo=========================================================================
+
+//a cached result of a memoized function, kept in a hash chain and in the order of use
+typedef struct MemoEntry_S {
+    struct MemoEntry_S *next;  //next entry in the same bucket
+    struct MemoEntry_S *newer; //neighbours in order of last use
+    struct MemoEntry_S *older;
+    unsigned int hash;
+    LispObject *value;
+    int argc;
+    LispObject *argv[];
+} MemoEntry;
+
+//a function whose results are cached by the structural value of its arguments
+//(see obj_hash). once max_size results are cached the least recently used one is dropped
+typedef struct {
+    LISP_OBJECT_HEADER
+    LispObject *function;
+    MemoEntry **buckets;
+    int nbuckets;
+    int size;
+    int max_size; //0 for no bound
+    MemoEntry *newest;
+    MemoEntry *oldest;
+} Memo;
+
+LispObject *new_memo(LispObject *function, int max_size);
+void memo_print(LispObject *obj, Printer *p);
+unsigned int hash_values(int argc, LispObject **argv);
+LispObject *memo_lookup(Memo *m, int argc, LispObject **argv, unsigned int hash);
+void memo_store(Memo *m, int argc, LispObject **argv, unsigned int hash, LispObject *value);
+void free_memo_entries(Memo *m);
+
+extern LispType MemoType;
+
+//=lazy-seq=====================================================================
+
+//kinds of lazy sequences
+#define LAZY_RANGE 0   //ints from start up to end (exclusive) by step
+#define LAZY_VECTOR 1  //the elements of the vector source from index start
+#define LAZY_ITERATE 2 //source, then fn applied to it over and over. start is 1 if fn
+                       //still has to be applied to source to get the first element
+#define LAZY_MAP 3     //fn applied to each element of source
+#define LAZY_FILTER 4  //the elements of source fn returns non-nil for
+#define LAZY_TAKE 5    //the first start elements of source
+
+//a sequence whose elements are worked out when they're needed. forcing it (see force_seq
+//in builtins.c) gives nil or a cons of the first element and a lazy sequence of the rest,
+//which is kept so it's only worked out once. fn and source are dropped once forced
+typedef struct {
+    LISP_OBJECT_HEADER
+    int kind;
+    bool forced;
+    LispObject *value;
+    LispObject *fn;
+    LispObject *source;
+    int start;
+    int end;
+    int step;
+} LazySeq;
+
+LazySeq *new_lazy_seq(int kind, LispObject *fn, LispObject *source, int start, int end, int step);
+void lazy_seq_print(LispObject *obj, Printer *p);
+
+extern LispType LazySeqType;
+
+//=structural-equality==========================================================
+
+unsigned int obj_hash(LispObject *obj);
+bool obj_equal(LispObject *a, LispObject *b);
+
 //=done=========================================================================
 
 #endif
@@ -3,82 +3,15 @@
 #include "error.h"
 #include "symboltable.h"
 #include "alloc.h"
-#include <ctype.h>
+#include "optimize.h"
+#include "reader.h"
+#include "runtime.h"
+#include "compiler.h"
+#include "safepoint.h"
+#include "fasl.h"
+#include "image.h"
 #include <string.h>
 
-LispObject *read(char **s) {
-    //segfaults if input starts with an open paren
-    while(isspace(**s))
-        (*s)++;
-
-    if(**s == ')')
-        return NULL;
-    else if(**s == '(') {
-        (*s)++;
-        ConsCell *out = nil;
-        ConsCell *node = nil;
-        for(;;) {
-            LispObject *x = read(s);
-            if(x == NULL && **s == ')') {
-                (*s)++;
-                return (LispObject*)out;
-            } else if(out == nil) {
-                out = new_cons_cell(x, (LispObject*)nil);
-                node = (ConsCell*)out;
-            } else {
-                node->cdr = (LispObject*)new_cons_cell(x, (LispObject*)nil);
-                node = (ConsCell*)node->cdr;
-            }
-        }
-    } else if(**s == '"') {
-        (*s)++;
-        Str *out = (Str*)new_str();
-        while(**s != '"') {
-            if(**s == '\\') {
-                (*s)++;
-                if(**s == 'n') {
-                    str_append(out, '\n');
-                    (*s)++;
-                } else if(**s == '\\' || **s == '"') {
-                    str_append(out, **s);
-                    (*s)++;
-                } else if(isdigit(**s)) {
-                    char buf[4];
-                    int i;
-                    int num;
-                    for(i = 0; i < 3 && isdigit(**s); i++) {
-                        buf[i] = **s;
-                        (*s)++;
-                    }
-                    buf[i] = '\0';
-                    sscanf(buf, "%o", &num);
-                    str_append(out, num);
-                }
-            } else {
-                str_append(out, **s);
-                (*s)++;
-            }
-        }
-        (*s)++;
-        return (LispObject*)out;
-    } else {
-        //can't handle symbols over 32 chars
-        char x[MAX_SYMBOL_LEN];
-        int i = 0;
-        while(!(**s == '\0' || isspace(**s) || **s == '(' || ** s == ')')) {
-            x[i] = **s;
-            i++;
-            (*s)++;
-        }
-        x[i] = '\0';
-
-        if(isdigit(x[0]))
-            return (LispObject*)new_lisp_int(atoi(x));
-        else
-            return (LispObject*)new_symbol(x);
-    }
-}
-
 void dumb_print(LispObject *obj) {
     if(obj == NULL)
         printf("NULL");
@@ -109,11 +42,15 @@ void repl() {
         if(VERBOSE)
             printf("reading...\n"); fflush(stdout);
         LispObject *r = read(&s);
+        if(r == NULL) {
+            printf("> ");
+            continue;
+        }
         if(VERBOSE) {
             obj_print(r);
             printf("\nevaluating...\n"); fflush(stdout);
         }
-        LispObject *e = eval_sub(r);
+        LispObject *e = eval_sub(optimize(r));
         if(VERBOSE)
             printf("printing...\n"); fflush(stdout);
         obj_print(e);
@@ -131,58 +68,160 @@ void repl() {
     }
 }
 
+//evaluates the forms in the fasl file read by r and closes it
+static void eval_fasl(FaslReader *r) {
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        fasl_close(r);
+        reraise_error();
+    }
+    LispObject *form;
+    while((form = fasl_read_form(r)) != NULL)
+        eval_sub(optimize(form));
+    pop_exception_point(&ep);
+    fasl_close(r);
+}
+
+//reads and evaluates the forms in the file filename one at a time, "-" is stdin
+//with FASL on, the forms are loaded from the file's fasl file if it's up to date,
+//otherwise the forms read are written to a new one, which replaces the old one once the
+//whole file was evaluated
 void eval_file(char *filename) {
-    FILE *f = (!strcmp(filename, "-")) ? stdin : fopen(filename, "r");
+    bool is_stdin = !strcmp(filename, "-");
+    FaslReader fasl;
+    if(FASL && !is_stdin && fasl_open(&fasl, filename)) {
+        eval_fasl(&fasl);
+        return;
+    }
+
+    FILE *f = is_stdin ? stdin : fopen(filename, "r");
     if(f == NULL)
         error("File %s does not exist", filename);
-    int size = 32000;
-    char *buf = malloc(size * sizeof(char));
-    int n = fread(buf, 1, size - 1, f);
-    buf[n] = '\0';
-    char *s = buf;
-    eval_sub(read(&s));
-    free(buf);
+    Reader r;
+    reader_from_file(&r, f);
+    FaslWriter writer;
+    bool write_fasl = FASL && !is_stdin && fasl_writer_open(&writer, filename, f);
+
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        reader_close(&r);
+        if(f != stdin)
+            fclose(f);
+        if(write_fasl)
+            fasl_writer_discard(&writer);
+        reraise_error();
+    }
+    LispObject *form;
+    while((form = read_form(&r)) != NULL) {
+        if(write_fasl)
+            fasl_write_form(&writer, form);
+        eval_sub(optimize(form));
+    }
+    pop_exception_point(&ep);
+
+    reader_close(&r);
+    if(f != stdin)
+        fclose(f);
+    if(write_fasl)
+        fasl_writer_finish(&writer, filename);
 }
 
 int main(int argc, char **argv) {
+    char stack_base;
     char *file_to_eval = NULL;
+    char *file_to_compile = NULL;
+    char *output_file = NULL;
+    char *image_file = NULL;
+    char *dump_file = NULL;
+    long print_buffer = 0;
+    long fuel = -1;
+    double timeout = -1;
     int replize = argc < 1;
     for(int i = 1; i < argc; i++) {
         if(!strcmp("-f", argv[i]))
             file_to_eval = argv[++i];
         else if(!strcmp("--verbose", argv[i]))
             VERBOSE = true;
+        else if(!strcmp("--no-optimize", argv[i]))
+            OPTIMIZE = false;
+        else if(!strcmp("--no-jit", argv[i]))
+            JIT = false;
+        else if(!strcmp("--no-fasl", argv[i]))
+            FASL = false;
+        else if(!strcmp("--no-simd", argv[i]))
+            SIMD = false;
+        else if(!strcmp("--compile-c", argv[i]))
+            file_to_compile = argv[++i];
+        else if(!strcmp("-o", argv[i]))
+            output_file = argv[++i];
+        else if(!strcmp("--fuel", argv[i]))
+            fuel = atol(argv[++i]);
+        else if(!strcmp("--timeout", argv[i]))
+            timeout = atof(argv[++i]);
+        else if(!strcmp("--image", argv[i]))
+            image_file = argv[++i];
+        else if(!strcmp("--dump-image", argv[i]))
+            dump_file = argv[++i];
+        else if(!strcmp("--print-buffer", argv[i]))
+            print_buffer = atol(argv[++i]);
         else if(!strcmp("-i", argv[i]))
             replize = true;
     }
 
-    init_alloc_system();
-    init_symboltable();
-    register_builtin_functions();
+    //print hands its output to stdio once per call, this sets how much stdio collects
+    //before it writes it out
+    if(print_buffer > 0)
+        setvbuf(stdout, NULL, _IOFBF, print_buffer);
 
-    new_var(new_symbol("nil"), (LispObject*)nil);
-    new_var(new_symbol("t"), (LispObject*)new_symbol("t"));
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        //an image replaces the builtins and the prelude, it's loaded before collections
+        //are turned on since the objects aren't reachable until it's done
+        if(image_file != NULL) {
+            init_runtime_memory(&stack_base);
+            load_image(image_file);
+        } else
+            init_runtime(&stack_base);
+        //the compiler keeps objects where the collector can't see them
+        set_automatic_gc(file_to_compile == NULL);
 
-    nexception_points++;
-    if(setjmp(exception_points[nexception_points - 1]) == 0) {
-        eval_file("prelude.l");
-        if(file_to_eval)
+        if(file_to_compile) {
+            //the prelude is compiled into the program instead of being loaded
+            char *files[] = {"prelude.l", file_to_compile};
+            FILE *out = output_file ? fopen(output_file, "w") : stdout;
+            if(out == NULL)
+                error("Can't open %s for writing", output_file);
+            compile_to_c(files, 2, out);
+            fclose(out);
+            pop_exception_point(&ep);
+            return 0;
+        }
+        if(image_file == NULL)
+            eval_file("prelude.l");
+        if(file_to_eval) {
+            //the limits only apply to the program, not the prelude
+            limit_evaluation(fuel, timeout);
             eval_file(file_to_eval);
-        else
+        }
+        else if(dump_file == NULL)
             repl();
+        if(dump_file != NULL)
+            save_image(dump_file);
+        pop_exception_point(&ep);
     } else {
-        fprintf(stderr, "%s", error_string);
-        printf("Stack trace:\n");
-        for(int i = 0; i < call_stack->size; i++) {
-            printf("  ");
-            obj_print(vector_getitem(call_stack, i));
-            printf("\n");
+        report_error();
+        //errors raised in the repl land here again
+        while(replize) {
+            push_exception_point(&ep);
+            if(setjmp(ep.jmp) == 0) {
+                repl();
+                pop_exception_point(&ep);
+                break;
+            }
+            report_error();
         }
-        while(scopes->size > 1)
-            pop_scope();
-        while(call_stack->size > 1)
-            vector_remove(call_stack, -1);
-        if(replize)
-            repl();
     }
 }
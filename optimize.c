@@ -0,0 +1,368 @@
+#include "optimize.h"
+#include "builtins.h"
+#include "symboltable.h"
+#include "error.h"
+
+//the optimizer rewrites forms in place before they are evaluated. calls to pure builtins
+//whose arguments are all constants are folded into their result, which is kept until a
+//builtin is rebound (see folded_value), and ifs with a literal constant condition are
+//replaced by the branch that would be taken.
+//a symbol is only assumed to refer to a builtin if its current binding is the global one,
+//it isn't an argument of an enclosing fn, and it isn't def'd or set anywhere in the form.
+//the head symbols of calls to builtins are replaced by the builtins themselves, so evaluating
+//the call doesn't look the symbol up. if the symbol is rebound later, the forms get it back.
+//other symbols that are evaluated become NODE_LOCAL_LOAD nodes (see eval_node in builtins.c)
+
+static LispObject *optimize_sub(LispObject *form, ConsCell *shadowed);
+
+//=folded calls=
+
+//a folded call becomes (node original), where node is a NODE_FOLDED node holding the
+//result and original is a copy of the call. the result is only good while no builtin
+//has been rebound, since the call or one of its arguments might have used it
+
+//returns true if form is a folded call
+static bool is_folded(LispObject *form) {
+    return form->type == &ConsCellType && form != (LispObject*)nil && form != tee &&
+        ((ConsCell*)form)->car->type == &NodeType && ((Node*)((ConsCell*)form)->car)->kind == NODE_FOLDED;
+}
+
+//replaces the call form with one folded into value
+static void fold_form(ConsCell *form, LispObject *value) {
+    Node *node = (Node*)new_node(NODE_FOLDED, value);
+    node->state = builtin_rebind_count;
+    ConsCell *original = new_cons_cell(form->car, form->cdr);
+    form->cdr = (LispObject*)new_cons_cell((LispObject*)original, (LispObject*)nil);
+    form->car = (LispObject*)node;
+}
+
+//puts the call back in the folded form
+static void unfold(ConsCell *form) {
+    ConsCell *original = (ConsCell*)((ConsCell*)form->cdr)->car;
+    form->car = original->car;
+    form->cdr = original->cdr;
+}
+
+//returns the result a folded call was folded into if no builtin has been rebound since,
+//otherwise puts the call back in form and returns NULL
+LispObject *folded_value(ConsCell *form) {
+    if(!is_folded((LispObject*)form))
+        return NULL;
+    Node *node = (Node*)form->car;
+    if(node->state == builtin_rebind_count)
+        return node->source;
+    if(VERBOSE)
+        printf("a builtin was rebound, unfolding call\n");
+    unfold(form);
+    return NULL;
+}
+
+//=resolved heads=
+
+//the forms whose head was resolved from one symbol
+typedef struct {
+    Symbol *sym;
+    ConsCell **forms;
+    int nforms;
+    int capacity;
+} ResolvedHeads;
+
+static ResolvedHeads *resolved_heads = NULL;
+static int nresolved_heads = 0;
+
+static ResolvedHeads *find_resolved_heads(Symbol *sym, bool create) {
+    for(int i = 0; i < nresolved_heads; i++)
+        if(resolved_heads[i].sym == sym)
+            return &resolved_heads[i];
+    if(!create)
+        return NULL;
+    resolved_heads = realloc(resolved_heads, (nresolved_heads + 1) * sizeof(ResolvedHeads));
+    ResolvedHeads *out = &resolved_heads[nresolved_heads++];
+    out->sym = sym;
+    out->forms = NULL;
+    out->nforms = 0;
+    out->capacity = 0;
+    return out;
+}
+
+//records that the head of form was resolved from sym, so it's put back if sym is rebound
+void add_resolved_head(Symbol *sym, ConsCell *form) {
+    ResolvedHeads *r = find_resolved_heads(sym, true);
+    if(r->nforms == r->capacity) {
+        r->capacity = 2 * r->capacity + 16;
+        r->forms = realloc(r->forms, r->capacity * sizeof(ConsCell*));
+    }
+    r->forms[r->nforms++] = form;
+}
+
+//calls f with each form whose head was resolved and the symbol it was resolved from
+void each_resolved_head(void (*f)(Symbol *sym, ConsCell *form, void *data), void *data) {
+    for(int i = 0; i < nresolved_heads; i++)
+        for(int j = 0; j < resolved_heads[i].nforms; j++)
+            f(resolved_heads[i].sym, resolved_heads[i].forms[j], data);
+}
+
+//replaces the head symbol of form with the builtin bf it's bound to, or with a node
+//that specializes on its argument types for 2 argument calls to +, - and =, or one
+//that saves counting the arguments of a special form on every call
+static void resolve_form_head(ConsCell *form, BuiltinFunction *bf) {
+    add_resolved_head((Symbol*)form->car, form);
+    form->car = (LispObject*)bf;
+    int argc = list_length(form) - 1;
+    if(bf->cfunc != NULL) {
+        if(argc >= bf->min_args && (bf->max_args == VARIADIC || argc <= bf->max_args))
+            form->car = new_node(NODE_SPECIAL_FORM, (LispObject*)bf);
+    } else if(argc == 2) {
+        if(bf->vfunc == plus)
+            form->car = new_node(NODE_ADD, (LispObject*)bf);
+        else if(bf->vfunc == minus)
+            form->car = new_node(NODE_SUB, (LispObject*)bf);
+        else if(bf->vfunc == equals)
+            form->car = new_node(NODE_EQUALS, (LispObject*)bf);
+    }
+}
+
+//puts sym back at the head of the forms it was resolved in, called when sym is rebound
+void unresolve_heads(Symbol *sym) {
+    ResolvedHeads *r = find_resolved_heads(sym, false);
+    if(r == NULL)
+        return;
+    if(VERBOSE && r->nforms > 0)
+        printf("unresolving %d calls to %s\n", r->nforms, sym->name);
+    for(int i = 0; i < r->nforms; i++) {
+        if(is_folded((LispObject*)r->forms[i]))
+            unfold(r->forms[i]);
+        if(r->forms[i]->car->type == &BuiltinFunctionType || r->forms[i]->car->type == &NodeType)
+            r->forms[i]->car = (LispObject*)sym;
+    }
+    r->nforms = 0;
+}
+
+//forgets the forms that the garbage collector found dead, called before they're freed
+void prune_resolved_heads(bool (*is_live)(void *)) {
+    for(int i = 0; i < nresolved_heads; i++) {
+        ResolvedHeads *r = &resolved_heads[i];
+        int n = 0;
+        for(int j = 0; j < r->nforms; j++)
+            if(is_live(r->forms[j]))
+                r->forms[n++] = r->forms[j];
+        r->nforms = n;
+    }
+}
+
+//returns true if sym is in the list of symbols shadowed
+static bool is_shadowed(Symbol *sym, ConsCell *shadowed) {
+    while(shadowed != nil) {
+        if(shadowed->car == (LispObject*)sym)
+            return true;
+        shadowed = (ConsCell*)shadowed->cdr;
+    }
+    return false;
+}
+
+//returns what the head of a form will evaluate to, or NULL if that can't be known yet
+static LispObject *resolve_head(LispObject *head, ConsCell *shadowed) {
+    if(head->type == &NodeType && ((Node*)head)->kind == NODE_SPECIAL_FORM)
+        return ((Node*)head)->source;
+    if(head->type == &BuiltinFunctionType || head->type == &MacroType)
+        return head;
+    if(head->type != &SymbolType)
+        return NULL;
+    Symbol *sym = (Symbol*)head;
+    if(is_shadowed(sym, shadowed) || !is_global_var(sym))
+        return NULL;
+    return lookup_var(sym);
+}
+
+//returns the builtin the head of form refers to, or NULL if it doesn't refer to one
+static BuiltinFunction *resolve_builtin(ConsCell *form, ConsCell *shadowed) {
+    LispObject *head = resolve_head(form->car, shadowed);
+    if(head == NULL || head->type != &BuiltinFunctionType)
+        return NULL;
+    return (BuiltinFunction*)head;
+}
+
+//returns true if con is a proper list
+static bool is_proper_list(ConsCell *con) {
+    while(con != nil) {
+        if(con->type != &ConsCellType)
+            return false;
+        con = (ConsCell*)con->cdr;
+    }
+    return true;
+}
+
+//adds every symbol that is def'd or set anywhere in form to shadowed and returns the result
+static ConsCell *collect_assigned(LispObject *form, ConsCell *shadowed) {
+    while(form->type == &ConsCellType && form != (LispObject*)nil && form != tee) {
+        ConsCell *con = (ConsCell*)form;
+        LispObject *head = con->car;
+        if(head->type == &SymbolType) {
+            LispObject *val = lookup_var((Symbol*)head);
+            head = val == NULL ? head : val;
+        } else if(head->type == &NodeType && ((Node*)head)->kind == NODE_SPECIAL_FORM)
+            head = ((Node*)head)->source;
+        if(head == (LispObject*)quote_builtin)
+            return shadowed;
+        if(head->type == &BuiltinFunctionType &&
+           (((BuiltinFunction*)head)->cfunc == def || ((BuiltinFunction*)head)->cfunc == set) &&
+           con->cdr->type == &ConsCellType && con->cdr != (LispObject*)nil &&
+           ((ConsCell*)con->cdr)->car->type == &SymbolType)
+            shadowed = new_cons_cell(((ConsCell*)con->cdr)->car, (LispObject*)shadowed);
+        shadowed = collect_assigned(con->car, shadowed);
+        form = con->cdr;
+    }
+    return shadowed;
+}
+
+//if form is a constant, puts its value into value_out and returns true
+static bool constant_value(LispObject *form, ConsCell *shadowed, LispObject **value_out) {
+    if(form->type == &LispIntType || form->type == &StrType ||
+       form->type == &BuiltinFunctionType || form == (LispObject*)nil) {
+        *value_out = form;
+        return true;
+    } else if(is_folded(form)) {
+        *value_out = folded_value((ConsCell*)form);
+        return *value_out != NULL;
+    } else if(form->type == &SymbolType) {
+        Symbol *sym = (Symbol*)form;
+        if(is_shadowed(sym, shadowed) || !is_global_var(sym))
+            return false;
+        LispObject *val = lookup_var(sym);
+        if((sym == new_symbol("nil") && val == (LispObject*)nil) ||
+           (sym == new_symbol("t") && val == form)) {
+            *value_out = val;
+            return true;
+        }
+        return false;
+    } else if(form->type == &ConsCellType && form != tee) {
+        ConsCell *con = (ConsCell*)form;
+        if(resolve_builtin(con, shadowed) != quote_builtin || !is_proper_list(con) || list_length(con) != 2)
+            return false;
+        *value_out = ((ConsCell*)con->cdr)->car;
+        return true;
+    }
+    return false;
+}
+
+//calls the pure builtin bf on argv and puts the result in out
+//returns false if it raised an exception, so the error is left to happen at runtime
+static bool fold(BuiltinFunction *bf, int argc, LispObject **argv, LispObject **out) {
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        *out = bf->vfunc(argc, argv);
+        pop_exception_point(&ep);
+        return true;
+    } else
+        return false;
+}
+
+//optimizes each form in the list forms in place
+static void optimize_list(ConsCell *forms, ConsCell *shadowed) {
+    while(forms != nil) {
+        forms->car = optimize_sub(forms->car, shadowed);
+        forms = (ConsCell*)forms->cdr;
+    }
+}
+
+//optimizes a call to the builtin bf that takes its arguments evaluated
+static LispObject *optimize_call(ConsCell *form, BuiltinFunction *bf, ConsCell *shadowed) {
+    ConsCell *args = (ConsCell*)form->cdr;
+    optimize_list(args, shadowed);
+
+    int argc = list_length(args);
+    if(!(bf->flags & BUILTIN_PURE) || argc < bf->min_args ||
+       (bf->max_args != VARIADIC && argc > bf->max_args))
+        return (LispObject*)form;
+
+    LispObject *argv[argc + 1];
+    for(int i = 0; i < argc; i++) {
+        if(!constant_value(args->car, shadowed, &argv[i]))
+            return (LispObject*)form;
+        args = (ConsCell*)args->cdr;
+    }
+
+    LispObject *out;
+    if(!fold(bf, argc, argv, &out))
+        return (LispObject*)form;
+    if(VERBOSE) {
+        printf("folded call to %s into ", bf->name); obj_print(out); printf("\n");
+    }
+    fold_form(form, out);
+    return (LispObject*)form;
+}
+
+//optimizes a call to the special form bf (a builtin that takes its arguments unevaluated)
+static LispObject *optimize_special_form(ConsCell *form, BuiltinFunction *bf, ConsCell *shadowed) {
+    ConsCell *args = (ConsCell*)form->cdr;
+    int argc = list_length(args);
+    if(argc < bf->min_args || (bf->max_args != VARIADIC && argc > bf->max_args))
+        return (LispObject*)form;
+
+    if(bf->cfunc == fn) {
+        if(args->car->type != &ConsCellType || !is_proper_list((ConsCell*)args->car))
+            return (LispObject*)form;
+        ConsCell *params = (ConsCell*)args->car;
+        while(params != nil) {
+            shadowed = new_cons_cell(params->car, (LispObject*)shadowed);
+            params = (ConsCell*)params->cdr;
+        }
+        optimize_list((ConsCell*)args->cdr, shadowed);
+    } else if(bf->cfunc == def || bf->cfunc == set) {
+        optimize_list((ConsCell*)args->cdr, shadowed);
+    } else if(bf->cfunc == if_) {
+        LispObject *cond;
+        args->car = optimize_sub(args->car, shadowed);
+        //a folded condition could change, so the if is only pruned for a literal one
+        if(!is_folded(args->car) && constant_value(args->car, shadowed, &cond)) {
+            if(VERBOSE)
+                printf("pruned if with constant condition\n");
+            return optimize_sub(nth_list(args, cond != (LispObject*)nil ? 1 : 2), shadowed);
+        }
+        optimize_list((ConsCell*)args->cdr, shadowed);
+    } else if(bf->cfunc == do_ || bf->cfunc == while_ || bf->cfunc == print ||
+              bf->cfunc == try_catch || bf->cfunc == apply) {
+        optimize_list(args, shadowed);
+    }
+    //quote and macro take data, and are left alone along with anything unknown
+    return (LispObject*)form;
+}
+
+static LispObject *optimize_sub(LispObject *form, ConsCell *shadowed) {
+    LispObject *value;
+    if(form->type == &SymbolType && !constant_value(form, shadowed, &value))
+        return new_node(NODE_LOCAL_LOAD, form);
+    if(form->type != &ConsCellType || form == (LispObject*)nil || form == tee)
+        return form;
+    ConsCell *con = (ConsCell*)form;
+    if(!is_proper_list(con))
+        return form;
+
+    LispObject *head = resolve_head(con->car, shadowed);
+    //unknown heads might turn out to be macros, whose arguments are data
+    if(head == NULL)
+        return form;
+    if(head->type == &MacroType) {
+        if(((Macro*)head)->is_function)
+            optimize_list((ConsCell*)con->cdr, shadowed);
+        return form;
+    }
+    if(head->type != &BuiltinFunctionType)
+        return form;
+
+    BuiltinFunction *bf = (BuiltinFunction*)head;
+    if(con->car->type == &SymbolType)
+        resolve_form_head(con, bf);
+    if(bf->vfunc != NULL)
+        return optimize_call(con, bf, shadowed);
+    return optimize_special_form(con, bf, shadowed);
+}
+
+//returns an optimized version of form, which may have been rewritten in place
+//does nothing if optimization was turned off with --no-optimize
+LispObject *optimize(LispObject *form) {
+    if(!OPTIMIZE || form == NULL)
+        return form;
+    return optimize_sub(form, collect_assigned(form, nil));
+}
@@ -0,0 +1,14 @@
+#ifndef _OPTIMIZE_H_
+#define _OPTIMIZE_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+LispObject *optimize(LispObject *form);
+LispObject *folded_value(ConsCell *form);
+void unresolve_heads(Symbol *sym);
+void add_resolved_head(Symbol *sym, ConsCell *form);
+void each_resolved_head(void (*f)(Symbol *sym, ConsCell *form, void *data), void *data);
+void prune_resolved_heads(bool (*is_live)(void *));
+
+#endif
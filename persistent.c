@@ -0,0 +1,558 @@
+#include "persistent.h"
+#include "alloc.h"
+#include "error.h"
+#include "printer.h"
+#include <string.h>
+
+LispType PMapType = {&TypeType, "hash-map", pmap_print, sizeof(PMap)};
+LispType TransientMapType = {&TypeType, "transient hash-map", pmap_print, sizeof(PMap)};
+LispType PVectorType = {&TypeType, "pvector", pvector_print, sizeof(PVector)};
+LispType TransientVectorType = {&TypeType, "transient pvector", pvector_print, sizeof(PVector)};
+LispType HamtNodeType = {&TypeType, "hamt node", hamt_node_print, sizeof(HamtNode)};
+LispType PVecNodeType = {&TypeType, "pvector node", pvec_node_print, sizeof(PVecNode)};
+
+//the edit of the next transient made, never 0
+static uint64_t next_edit = 1;
+
+//the last shift that still has hash bits left, nodes below it are collision nodes
+#define HAMT_MAX_SHIFT 30
+//spare room transients give the nodes they make, so a few inserts don't need a new node
+#define HAMT_SPARE 4
+
+//=hamt nodes=
+
+void hamt_node_print(LispObject *obj, Printer *p) {
+    printer_write(p, "<hamt node>", 11);
+}
+
+//returns the number of objects in the array of node
+int hamt_node_length(HamtNode *node) {
+    if(node->collision)
+        return 2 * node->count;
+    return 2 * __builtin_popcount(node->datamap) + __builtin_popcount(node->nodemap);
+}
+
+static HamtNode *new_hamt_node(uint64_t edit, int length) {
+    int capacity = edit == 0 ? length : length + HAMT_SPARE;
+    HamtNode *out = alloc(sizeof(HamtNode) + capacity * sizeof(LispObject*));
+    out->type = &HamtNodeType;
+    out->edit = edit;
+    out->capacity = capacity;
+    return out;
+}
+
+//returns node if it belongs to the transient edit and has room for length objects,
+//otherwise a copy of it that does
+static HamtNode *editable_hamt_node(HamtNode *node, uint64_t edit, int length) {
+    if(edit != 0 && node->edit == edit && node->capacity >= length)
+        return node;
+    HamtNode *out = new_hamt_node(edit, length);
+    out->datamap = node->datamap;
+    out->nodemap = node->nodemap;
+    out->collision = node->collision;
+    out->count = node->count;
+    int old_length = hamt_node_length(node);
+    memcpy(out->array, node->array, (old_length < length ? old_length : length) * sizeof(LispObject*));
+    return out;
+}
+
+//returns whether node holds a single key and value and nothing else, so its parent
+//can hold them itself
+static bool hamt_node_single(HamtNode *node) {
+    if(node->collision)
+        return node->count == 1;
+    return node->nodemap == 0 && __builtin_popcount(node->datamap) == 1;
+}
+
+//returns the index in datamap or nodemap of the item for bit
+static int bit_index(uint32_t map, uint32_t bit) {
+    return __builtin_popcount(map & (bit - 1));
+}
+
+//returns a node at shift holding the two keys, which have different hashes or are at
+//the bottom of the trie
+static HamtNode *hamt_pair(uint64_t edit, int shift,
+                           LispObject *key1, unsigned int hash1, LispObject *value1,
+                           LispObject *key2, unsigned int hash2, LispObject *value2) {
+    if(shift > HAMT_MAX_SHIFT) {
+        HamtNode *out = new_hamt_node(edit, 4);
+        out->collision = true;
+        out->count = 2;
+        out->array[0] = key1;
+        out->array[1] = value1;
+        out->array[2] = key2;
+        out->array[3] = value2;
+        return out;
+    }
+    uint32_t bit1 = 1u << ((hash1 >> shift) & TRIE_MASK);
+    uint32_t bit2 = 1u << ((hash2 >> shift) & TRIE_MASK);
+    if(bit1 == bit2) {
+        HamtNode *out = new_hamt_node(edit, 1);
+        out->nodemap = bit1;
+        out->array[0] = (LispObject*)hamt_pair(edit, shift + TRIE_BITS,
+                                               key1, hash1, value1, key2, hash2, value2);
+        return out;
+    }
+    HamtNode *out = new_hamt_node(edit, 4);
+    out->datamap = bit1 | bit2;
+    int first = bit1 < bit2 ? 0 : 2;
+    out->array[first] = key1;
+    out->array[first + 1] = value1;
+    out->array[2 - first] = key2;
+    out->array[3 - first] = value2;
+    return out;
+}
+
+//returns a top level node holding just key and value
+static HamtNode *hamt_single(uint64_t edit, LispObject *key, unsigned int hash, LispObject *value) {
+    HamtNode *out = new_hamt_node(edit, 2);
+    out->datamap = 1u << (hash & TRIE_MASK);
+    out->array[0] = key;
+    out->array[1] = value;
+    return out;
+}
+
+//returns the value of key in the trie under node, or NULL
+static LispObject *hamt_get(HamtNode *node, LispObject *key, unsigned int hash) {
+    for(int shift = 0; node != NULL; shift += TRIE_BITS) {
+        if(node->collision) {
+            for(int i = 0; i < node->count; i++)
+                if(dict_keys_equal(node->array[2 * i], key))
+                    return node->array[2 * i + 1];
+            return NULL;
+        }
+        uint32_t bit = 1u << ((hash >> shift) & TRIE_MASK);
+        if(node->datamap & bit) {
+            int i = 2 * bit_index(node->datamap, bit);
+            return dict_keys_equal(node->array[i], key) ? node->array[i + 1] : NULL;
+        }
+        if(!(node->nodemap & bit))
+            return NULL;
+        int ndata = __builtin_popcount(node->datamap);
+        node = (HamtNode*)node->array[2 * ndata + bit_index(node->nodemap, bit)];
+    }
+    return NULL;
+}
+
+//the items of node are rebuilt in a scratch array then copied into an editable node, which
+//keeps the moves between the key/value part and the child part in one place
+static HamtNode *hamt_rebuild(HamtNode *node, uint64_t edit, LispObject **items, int length,
+                              uint32_t datamap, uint32_t nodemap) {
+    HamtNode *out = editable_hamt_node(node, edit, length);
+    memcpy(out->array, items, length * sizeof(LispObject*));
+    out->datamap = datamap;
+    out->nodemap = nodemap;
+    return out;
+}
+
+static HamtNode *hamt_collision_assoc(HamtNode *node, uint64_t edit, LispObject *key,
+                                      LispObject *value, bool *added) {
+    for(int i = 0; i < node->count; i++)
+        if(dict_keys_equal(node->array[2 * i], key)) {
+            if(node->array[2 * i + 1] == value)
+                return node;
+            HamtNode *out = editable_hamt_node(node, edit, 2 * node->count);
+            out->array[2 * i + 1] = value;
+            return out;
+        }
+    HamtNode *out = editable_hamt_node(node, edit, 2 * node->count + 2);
+    out->array[2 * out->count] = key;
+    out->array[2 * out->count + 1] = value;
+    out->count++;
+    *added = true;
+    return out;
+}
+
+//returns the trie under node at shift with key set to value, sharing what didn't change
+//added is set if key wasn't there before
+static HamtNode *hamt_assoc(HamtNode *node, uint64_t edit, int shift, LispObject *key,
+                            unsigned int hash, LispObject *value, bool *added) {
+    if(node->collision)
+        return hamt_collision_assoc(node, edit, key, value, added);
+
+    uint32_t bit = 1u << ((hash >> shift) & TRIE_MASK);
+    int ndata = __builtin_popcount(node->datamap);
+    int length = hamt_node_length(node);
+    LispObject *items[2 * TRIE_WIDTH];
+
+    if(node->datamap & bit) {
+        int i = 2 * bit_index(node->datamap, bit);
+        LispObject *old_key = node->array[i];
+        if(dict_keys_equal(old_key, key)) {
+            if(node->array[i + 1] == value)
+                return node;
+            HamtNode *out = editable_hamt_node(node, edit, length);
+            out->array[i + 1] = value;
+            return out;
+        }
+        //the two keys move down into a new child
+        *added = true;
+        HamtNode *child = hamt_pair(edit, shift + TRIE_BITS,
+                                    old_key, dict_hash(old_key), node->array[i + 1],
+                                    key, hash, value);
+        int j = 2 * (ndata - 1) + bit_index(node->nodemap, bit);
+        memcpy(items, node->array, i * sizeof(LispObject*));
+        memcpy(items + i, node->array + i + 2, (j - i) * sizeof(LispObject*));
+        items[j] = (LispObject*)child;
+        memcpy(items + j + 1, node->array + j + 2, (length - j - 2) * sizeof(LispObject*));
+        return hamt_rebuild(node, edit, items, length - 1, node->datamap ^ bit, node->nodemap | bit);
+    }
+
+    if(node->nodemap & bit) {
+        int j = 2 * ndata + bit_index(node->nodemap, bit);
+        HamtNode *child = (HamtNode*)node->array[j];
+        HamtNode *new_child = hamt_assoc(child, edit, shift + TRIE_BITS, key, hash, value, added);
+        if(new_child == child)
+            return node;
+        HamtNode *out = editable_hamt_node(node, edit, length);
+        out->array[j] = (LispObject*)new_child;
+        return out;
+    }
+
+    *added = true;
+    int i = 2 * bit_index(node->datamap, bit);
+    memcpy(items, node->array, i * sizeof(LispObject*));
+    items[i] = key;
+    items[i + 1] = value;
+    memcpy(items + i + 2, node->array + i, (length - i) * sizeof(LispObject*));
+    return hamt_rebuild(node, edit, items, length + 2, node->datamap | bit, node->nodemap);
+}
+
+static HamtNode *hamt_collision_dissoc(HamtNode *node, uint64_t edit, LispObject *key,
+                                       bool *removed) {
+    for(int i = 0; i < node->count; i++)
+        if(dict_keys_equal(node->array[2 * i], key)) {
+            *removed = true;
+            if(node->count == 1)
+                return NULL;
+            HamtNode *out = editable_hamt_node(node, edit, 2 * node->count);
+            memmove(out->array + 2 * i, out->array + 2 * i + 2,
+                    2 * (out->count - i - 1) * sizeof(LispObject*));
+            out->count--;
+            return out;
+        }
+    return node;
+}
+
+//returns the trie under node at shift without key, or NULL if that leaves it empty
+//nodes left holding a single key and value are merged into their parents, so every
+//trie with the same keys has the same shape
+static HamtNode *hamt_dissoc(HamtNode *node, uint64_t edit, int shift, LispObject *key,
+                             unsigned int hash, bool *removed) {
+    if(node->collision)
+        return hamt_collision_dissoc(node, edit, key, removed);
+
+    uint32_t bit = 1u << ((hash >> shift) & TRIE_MASK);
+    int ndata = __builtin_popcount(node->datamap);
+    int length = hamt_node_length(node);
+    LispObject *items[2 * TRIE_WIDTH];
+
+    if(node->datamap & bit) {
+        int i = 2 * bit_index(node->datamap, bit);
+        if(!dict_keys_equal(node->array[i], key))
+            return node;
+        *removed = true;
+        if(length == 2)
+            return NULL;
+        memcpy(items, node->array, i * sizeof(LispObject*));
+        memcpy(items + i, node->array + i + 2, (length - i - 2) * sizeof(LispObject*));
+        return hamt_rebuild(node, edit, items, length - 2, node->datamap ^ bit, node->nodemap);
+    }
+
+    if(!(node->nodemap & bit))
+        return node;
+    int j = 2 * ndata + bit_index(node->nodemap, bit);
+    HamtNode *child = (HamtNode*)node->array[j];
+    HamtNode *new_child = hamt_dissoc(child, edit, shift + TRIE_BITS, key, hash, removed);
+    if(new_child == child)
+        return node;
+    if(new_child != NULL && !hamt_node_single(new_child)) {
+        HamtNode *out = editable_hamt_node(node, edit, length);
+        out->array[j] = (LispObject*)new_child;
+        return out;
+    }
+    //a node with nothing else passes the single key up for its own parent to merge
+    if(new_child != NULL && ndata == 0 && length == 1)
+        return new_child;
+
+    memcpy(items, node->array, j * sizeof(LispObject*));
+    memcpy(items + j, node->array + j + 1, (length - j - 1) * sizeof(LispObject*));
+    if(new_child == NULL)
+        return hamt_rebuild(node, edit, items, length - 1, node->datamap, node->nodemap ^ bit);
+    int i = 2 * bit_index(node->datamap, bit);
+    memmove(items + i + 2, items + i, (length - 1 - i) * sizeof(LispObject*));
+    items[i] = new_child->array[0];
+    items[i + 1] = new_child->array[1];
+    return hamt_rebuild(node, edit, items, length + 1, node->datamap | bit, node->nodemap ^ bit);
+}
+
+//=maps=
+
+static PMap *alloc_pmap(LispType *type, HamtNode *root, int size, uint64_t edit) {
+    PMap *out = alloc(sizeof(PMap));
+    out->type = type;
+    out->root = root;
+    out->size = size;
+    out->edit = edit;
+    return out;
+}
+
+//creates a new, empty map
+LispObject *new_pmap() {
+    return (LispObject*)alloc_pmap(&PMapType, NULL, 0, 0);
+}
+
+static void check_transient(uint64_t edit, LispObject *coll) {
+    if(edit == 0 && (coll->type == &TransientMapType || coll->type == &TransientVectorType))
+        error("Horrible error, transient used after persistent!\n");
+}
+
+//returns the value of key in m, or NULL if it's not there
+LispObject *pmap_get(PMap *m, LispObject *key) {
+    check_transient(m->edit, (LispObject*)m);
+    if(m->root == NULL)
+        return NULL;
+    return hamt_get(m->root, key, dict_hash(key));
+}
+
+//returns m with key set to value. transients change in place, otherwise a new map is made
+LispObject *pmap_assoc(PMap *m, LispObject *key, LispObject *value) {
+    check_transient(m->edit, (LispObject*)m);
+    bool added = false;
+    unsigned int hash = dict_hash(key);
+    HamtNode *root;
+    if(m->root == NULL) {
+        root = hamt_single(m->edit, key, hash, value);
+        added = true;
+    } else
+        root = hamt_assoc(m->root, m->edit, 0, key, hash, value, &added);
+    if(m->edit != 0) {
+        m->root = root;
+        m->size += added;
+        return (LispObject*)m;
+    }
+    if(root == m->root)
+        return (LispObject*)m;
+    return (LispObject*)alloc_pmap(&PMapType, root, m->size + added, 0);
+}
+
+//returns m without key, in place for transients
+LispObject *pmap_dissoc(PMap *m, LispObject *key) {
+    check_transient(m->edit, (LispObject*)m);
+    if(m->root == NULL)
+        return (LispObject*)m;
+    bool removed = false;
+    HamtNode *root = hamt_dissoc(m->root, m->edit, 0, key, dict_hash(key), &removed);
+    //a single key passed up from further down is put where the top level looks for it
+    if(root != NULL && root != m->root && hamt_node_single(root))
+        root = hamt_single(m->edit, root->array[0], dict_hash(root->array[0]), root->array[1]);
+    if(m->edit != 0) {
+        m->root = root;
+        m->size -= removed;
+        return (LispObject*)m;
+    }
+    if(!removed)
+        return (LispObject*)m;
+    return (LispObject*)alloc_pmap(&PMapType, root, m->size - 1, 0);
+}
+
+static void hamt_print(HamtNode *node, Printer *p) {
+    int ndata = node->collision ? node->count : __builtin_popcount(node->datamap);
+    for(int i = 0; i < ndata; i++) {
+        print_object(p, node->array[2 * i]);
+        printer_write(p, " : ", 3);
+        print_object(p, node->array[2 * i + 1]);
+        printer_write(p, ", ", 2);
+    }
+    int length = hamt_node_length(node);
+    for(int i = 2 * ndata; i < length; i++)
+        hamt_print((HamtNode*)node->array[i], p);
+}
+
+//print method for maps, in the same form as dicts
+void pmap_print(LispObject *obj, Printer *p) {
+    PMap *m = (PMap*)obj;
+    printer_write(p, "{", 1);
+    if(m->root != NULL)
+        hamt_print(m->root, p);
+    printer_write(p, "}", 1);
+}
+
+//=vector nodes=
+
+void pvec_node_print(LispObject *obj, Printer *p) {
+    printer_write(p, "<pvector node>", 14);
+}
+
+//returns node if it belongs to the transient edit, otherwise a copy that does
+//a NULL node gives a new empty one
+static PVecNode *editable_pvec_node(PVecNode *node, uint64_t edit) {
+    if(node != NULL && edit != 0 && node->edit == edit)
+        return node;
+    PVecNode *out = alloc(sizeof(PVecNode));
+    out->type = &PVecNodeType;
+    out->edit = edit;
+    if(node != NULL)
+        memcpy(out->array, node->array, sizeof(out->array));
+    return out;
+}
+
+//returns a chain of nodes from level down to node
+static PVecNode *new_path(uint64_t edit, int level, PVecNode *node) {
+    if(level == 0)
+        return node;
+    PVecNode *out = editable_pvec_node(NULL, edit);
+    out->array[0] = (LispObject*)new_path(edit, level - TRIE_BITS, node);
+    return out;
+}
+
+//returns the index of the first item in the tail of v
+static int tail_offset(PVector *v) {
+    if(v->size < TRIE_WIDTH)
+        return 0;
+    return ((v->size - 1) >> TRIE_BITS) << TRIE_BITS;
+}
+
+//=vectors=
+
+static PVector *alloc_pvector(LispType *type, PVector *from, uint64_t edit) {
+    PVector *out = alloc(sizeof(PVector));
+    out->type = type;
+    out->size = from ? from->size : 0;
+    out->shift = from ? from->shift : TRIE_BITS;
+    out->root = from ? from->root : NULL;
+    out->tail = from ? from->tail : NULL;
+    out->edit = edit;
+    return out;
+}
+
+//creates a new, empty vector
+LispObject *new_pvector() {
+    return (LispObject*)alloc_pvector(&PVectorType, NULL, 0);
+}
+
+static LispObject *pvector_item(PVector *v, int i) {
+    if(i >= tail_offset(v))
+        return v->tail->array[i & TRIE_MASK];
+    PVecNode *node = v->root;
+    for(int level = v->shift; level > 0; level -= TRIE_BITS)
+        node = (PVecNode*)node->array[(i >> level) & TRIE_MASK];
+    return node->array[i & TRIE_MASK];
+}
+
+//returns item i of v
+LispObject *pvector_nth(PVector *v, int i) {
+    check_transient(v->edit, (LispObject*)v);
+    if(i < 0 || i >= v->size)
+        error("index error in nth\n");
+    return pvector_item(v, i);
+}
+
+//returns the trie under parent at level with the full tail of v added at the end
+static PVecNode *push_tail(PVector *v, int level, PVecNode *parent, PVecNode *tail) {
+    PVecNode *out = editable_pvec_node(parent, v->edit);
+    int sub = ((v->size - 1) >> level) & TRIE_MASK;
+    PVecNode *child;
+    if(level == TRIE_BITS)
+        child = tail;
+    else if(parent != NULL && parent->array[sub] != NULL)
+        child = push_tail(v, level - TRIE_BITS, (PVecNode*)parent->array[sub], tail);
+    else
+        child = new_path(v->edit, level - TRIE_BITS, tail);
+    out->array[sub] = (LispObject*)child;
+    return out;
+}
+
+//appends value to v, which is a copy or a transient
+static void pvector_push(PVector *v, LispObject *value) {
+    if(v->size - tail_offset(v) < TRIE_WIDTH) {
+        v->tail = editable_pvec_node(v->tail, v->edit);
+        v->tail->array[v->size & TRIE_MASK] = value;
+        v->size++;
+        return;
+    }
+    //the tail is full, it goes into the trie, which gets a new level if that's full too
+    if((v->size >> TRIE_BITS) > (1 << v->shift)) {
+        PVecNode *root = editable_pvec_node(NULL, v->edit);
+        root->array[0] = (LispObject*)v->root;
+        root->array[1] = (LispObject*)new_path(v->edit, v->shift, v->tail);
+        v->root = root;
+        v->shift += TRIE_BITS;
+    } else
+        v->root = push_tail(v, v->shift, v->root, v->tail);
+    v->tail = editable_pvec_node(NULL, v->edit);
+    v->tail->array[0] = value;
+    v->size++;
+}
+
+static PVecNode *assoc_path(uint64_t edit, int level, PVecNode *node, int i, LispObject *value) {
+    PVecNode *out = editable_pvec_node(node, edit);
+    if(level == 0)
+        out->array[i & TRIE_MASK] = value;
+    else {
+        int sub = (i >> level) & TRIE_MASK;
+        out->array[sub] = (LispObject*)assoc_path(edit, level - TRIE_BITS,
+                                                  (PVecNode*)node->array[sub], i, value);
+    }
+    return out;
+}
+
+//returns v with item i set to value, or value appended if i is the size of v
+//transients change in place, otherwise a new vector is made
+LispObject *pvector_assoc(PVector *v, int i, LispObject *value) {
+    check_transient(v->edit, (LispObject*)v);
+    if(i < 0 || i > v->size)
+        error("index error in assoc\n");
+    PVector *out = v->edit != 0 ? v : alloc_pvector(&PVectorType, v, 0);
+    if(i == v->size)
+        pvector_push(out, value);
+    else if(i >= tail_offset(v)) {
+        out->tail = editable_pvec_node(v->tail, v->edit);
+        out->tail->array[i & TRIE_MASK] = value;
+    } else
+        out->root = assoc_path(v->edit, v->shift, v->root, i, value);
+    return (LispObject*)out;
+}
+
+//returns v with value appended, in place for transients
+LispObject *pvector_conj(PVector *v, LispObject *value) {
+    return pvector_assoc(v, v->size, value);
+}
+
+//print method for vectors, in the same form as mutable ones
+void pvector_print(LispObject *obj, Printer *p) {
+    PVector *v = (PVector*)obj;
+    printer_write(p, "[", 1);
+    for(int i = 0; i < v->size; i++) {
+        print_object(p, pvector_item(v, i));
+        printer_write(p, ", ", 2);
+    }
+    printer_write(p, "]", 1);
+}
+
+//=transients=
+
+//returns a transient version of the map or vector coll, which changes in place and
+//copies only the nodes it shares with coll, each once
+LispObject *transient(LispObject *coll) {
+    if(coll->type == &PMapType) {
+        PMap *m = (PMap*)coll;
+        return (LispObject*)alloc_pmap(&TransientMapType, m->root, m->size, next_edit++);
+    }
+    PVector *v = safe_cast(coll, &PVectorType);
+    return (LispObject*)alloc_pvector(&TransientVectorType, v, next_edit++);
+}
+
+//returns a persistent version of the transient coll, which can't be used after this
+LispObject *persistent(LispObject *coll) {
+    if(coll->type == &TransientMapType) {
+        PMap *m = (PMap*)coll;
+        check_transient(m->edit, coll);
+        m->edit = 0;
+        return (LispObject*)alloc_pmap(&PMapType, m->root, m->size, 0);
+    }
+    PVector *v = safe_cast(coll, &TransientVectorType);
+    check_transient(v->edit, coll);
+    v->edit = 0;
+    return (LispObject*)alloc_pvector(&PVectorType, v, 0);
+}
@@ -0,0 +1,84 @@
+#ifndef _PERSISTENT_H_
+#define _PERSISTENT_H_
+
+#include "common.h"
+#include "lisptype.h"
+#include <stdint.h>
+
+//bits of the hash, or of the index, used at each level of the tries
+#define TRIE_BITS 5
+#define TRIE_WIDTH (1 << TRIE_BITS)
+#define TRIE_MASK (TRIE_WIDTH - 1)
+
+//persistent collections never change once built, updates return new ones that share all
+//but the path to what changed. transients are the same structures made by one owner,
+//which changes the nodes it made itself in place. nodes remember the edit of the
+//transient that made them, persistent collections have edit 0
+
+//a node of a hash array mapped trie. array holds a key and value for each bit set in
+//datamap, then a child for each bit set in nodemap, in the order of the bits. nodes
+//below the last level of hash bits hold keys with the same hash, count pairs of them
+typedef struct {
+    LISP_OBJECT_HEADER
+    uint32_t datamap;
+    uint32_t nodemap;
+    uint64_t edit;
+    bool collision;
+    int count;
+    int capacity; //room in array, transients leave some spare to grow into
+    LispObject *array[];
+} HamtNode;
+
+//a map hashing ints and strs by value and everything else by identity, like dicts
+typedef struct {
+    LISP_OBJECT_HEADER
+    HamtNode *root; //NULL when empty
+    int size;
+    uint64_t edit;
+} PMap;
+
+//a node of a vector trie, holding children or, at the bottom level, the items
+typedef struct {
+    LISP_OBJECT_HEADER
+    uint64_t edit;
+    LispObject *array[TRIE_WIDTH];
+} PVecNode;
+
+//a vector trie of shift / TRIE_BITS levels, with the last up to TRIE_WIDTH items kept
+//in tail so appending doesn't touch the trie most of the time
+typedef struct {
+    LISP_OBJECT_HEADER
+    int size;
+    int shift;
+    PVecNode *root;
+    PVecNode *tail;
+    uint64_t edit;
+} PVector;
+
+LispObject *new_pmap();
+LispObject *pmap_get(PMap *m, LispObject *key);
+LispObject *pmap_assoc(PMap *m, LispObject *key, LispObject *value);
+LispObject *pmap_dissoc(PMap *m, LispObject *key);
+void pmap_print(LispObject *obj, Printer *p);
+
+LispObject *new_pvector();
+LispObject *pvector_nth(PVector *v, int i);
+LispObject *pvector_assoc(PVector *v, int i, LispObject *value);
+LispObject *pvector_conj(PVector *v, LispObject *value);
+void pvector_print(LispObject *obj, Printer *p);
+
+LispObject *transient(LispObject *coll);
+LispObject *persistent(LispObject *coll);
+
+void hamt_node_print(LispObject *obj, Printer *p);
+void pvec_node_print(LispObject *obj, Printer *p);
+int hamt_node_length(HamtNode *node);
+
+extern LispType PMapType;
+extern LispType TransientMapType;
+extern LispType PVectorType;
+extern LispType TransientVectorType;
+extern LispType HamtNodeType;
+extern LispType PVecNodeType;
+
+#endif
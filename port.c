@@ -0,0 +1,189 @@
+#define _POSIX_C_SOURCE 200809L
+#include "port.h"
+#include "alloc.h"
+#include "error.h"
+#include "printer.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+LispType PortType = {&TypeType, "port", port_print, sizeof(Port)};
+
+static int open_fd(char *filename, bool output, bool append) {
+    if(!strcmp(filename, "-")) {
+        //so whatever was printed before comes out first
+        if(output) {
+            printer_flush(stdout_printer);
+            fflush(stdout);
+        }
+        return dup(output ? STDOUT_FILENO : STDIN_FILENO);
+    }
+    if(output)
+        return open(filename, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC), 0666);
+    return open(filename, O_RDONLY);
+}
+
+//opens the file filename for reading, or for writing if output is set, in which case it's
+//emptied first unless append is set. "-" is stdin or stdout
+LispObject *open_port(char *filename, bool output, bool append) {
+    int fd = open_fd(filename, output, append);
+    //ports that were dropped without being closed hold on to their files until they're collected
+    if(fd < 0 && (errno == EMFILE || errno == ENFILE)) {
+        collect_garbage();
+        fd = open_fd(filename, output, append);
+    }
+    if(fd < 0)
+        error("Horrible error, can't open %s: %s\n", filename, strerror(errno));
+
+    Port *out = alloc(sizeof(Port));
+    out->type = &PortType;
+    out->fd = fd;
+    out->output = output;
+    out->eof = false;
+    out->buf = malloc(PORT_BUFFER_SIZE);
+    out->size = PORT_BUFFER_SIZE;
+    out->pos = 0;
+    out->len = 0;
+    return (LispObject*)out;
+}
+
+//print method for ports
+void port_print(LispObject *obj, Printer *p) {
+    Port *port = (Port*)obj;
+    printer_printf(p, "%s port at %p%s", port->output ? "output" : "input", port,
+                   port->fd < 0 ? " (closed)" : "");
+}
+
+static void check_open(Port *port, bool output) {
+    if(port->fd < 0)
+        error("Horrible error, port is closed\n");
+    if(port->output != output)
+        error("Horrible error, can't %s an %s port\n",
+              output ? "write to" : "read from", port->output ? "output" : "input");
+}
+
+//reads more of the file into the buffer of port, after what's there already
+//returns false at the end of the file
+static bool fill(Port *port) {
+    if(port->eof)
+        return false;
+    if(port->pos > 0) {
+        memmove(port->buf, port->buf + port->pos, port->len - port->pos);
+        port->len -= port->pos;
+        port->pos = 0;
+    }
+    //a line longer than the buffer makes it grow
+    if(port->len == port->size) {
+        port->size *= 2;
+        port->buf = realloc(port->buf, port->size);
+    }
+    //read from reader.c takes the place of the system call, so this goes through readv
+    struct iovec into = {port->buf + port->len, port->size - port->len};
+    ssize_t n;
+    do
+        n = readv(port->fd, &into, 1);
+    while(n < 0 && errno == EINTR);
+    if(n < 0)
+        error("Horrible error, reading from port failed: %s\n", strerror(errno));
+    if(n == 0) {
+        port->eof = true;
+        return false;
+    }
+    port->len += n;
+    return true;
+}
+
+//returns the next line of port as a str without its newline, or nil at the end of the file
+//the line is copied straight out of the buffer once its end was found
+LispObject *port_read_line(Port *port) {
+    check_open(port, false);
+    int searched = port->pos;
+    for(;;) {
+        char *newline = memchr(port->buf + searched, '\n', port->len - searched);
+        if(newline != NULL) {
+            char *start = port->buf + port->pos;
+            port->pos = newline - port->buf + 1;
+            return (LispObject*)new_str_from(start, newline - start);
+        }
+        searched = port->len - port->pos;
+        if(!fill(port))
+            break;
+    }
+    if(port->pos == port->len)
+        return (LispObject*)nil;
+    //the last line doesn't end in a newline
+    Str *out = new_str_from(port->buf + port->pos, port->len - port->pos);
+    port->pos = port->len;
+    return (LispObject*)out;
+}
+
+//returns a str of the next n bytes of port, or less at the end of the file,
+//or nil if there are none left
+LispObject *port_read_bytes(Port *port, int n) {
+    check_open(port, false);
+    if(n < 0)
+        error("Horrible error, can't read a negative number of bytes\n");
+    while(port->len - port->pos < n && fill(port))
+        ;
+    int available = port->len - port->pos;
+    if(available == 0 && n > 0)
+        return (LispObject*)nil;
+    if(n > available)
+        n = available;
+    Str *out = new_str_from(port->buf + port->pos, n);
+    port->pos += n;
+    return (LispObject*)out;
+}
+
+//writes the n chars at chars to fd, returns false if that failed
+static bool write_all(int fd, char *chars, int n) {
+    while(n > 0) {
+        ssize_t written = write(fd, chars, n);
+        if(written < 0 && errno == EINTR)
+            continue;
+        if(written < 0)
+            return false;
+        chars += written;
+        n -= written;
+    }
+    return true;
+}
+
+//writes out everything in the buffer of port
+void port_flush(Port *port) {
+    check_open(port, true);
+    int len = port->len;
+    port->len = 0;
+    if(!write_all(port->fd, port->buf, len))
+        error("Horrible error, writing to port failed: %s\n", strerror(errno));
+}
+
+//writes the n chars at chars to port, writes bigger than the buffer skip it
+void port_write(Port *port, char *chars, int n) {
+    check_open(port, true);
+    if(port->len + n > port->size)
+        port_flush(port);
+    if(n >= port->size) {
+        if(!write_all(port->fd, chars, n))
+            error("Horrible error, writing to port failed: %s\n", strerror(errno));
+        return;
+    }
+    memcpy(port->buf + port->len, chars, n);
+    port->len += n;
+}
+
+//flushes and closes port, does nothing if it's closed already
+//also called when a port is garbage collected, so it doesn't raise errors
+void port_close(Port *port) {
+    if(port->fd < 0)
+        return;
+    if(port->output)
+        write_all(port->fd, port->buf, port->len);
+    close(port->fd);
+    port->fd = -1;
+    free(port->buf);
+    port->buf = NULL;
+    port->len = port->pos = 0;
+}
@@ -0,0 +1,34 @@
+#ifndef _PORT_H_
+#define _PORT_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//size of the buffer of each port
+#define PORT_BUFFER_SIZE (256 * 1024)
+
+//a file opened for reading or writing, through a buffer of its own
+//reading ports hold the chars from pos to len of buf that haven't been read yet,
+//writing ports hold the len chars of buf that haven't been written yet
+typedef struct {
+    LISP_OBJECT_HEADER
+    int fd; //-1 once closed
+    bool output;
+    bool eof;
+    char *buf;
+    int size;
+    int pos;
+    int len;
+} Port;
+
+LispObject *open_port(char *filename, bool output, bool append);
+void port_print(LispObject *obj, Printer *p);
+LispObject *port_read_line(Port *port);
+LispObject *port_read_bytes(Port *port, int n);
+void port_write(Port *port, char *chars, int n);
+void port_flush(Port *port);
+void port_close(Port *port);
+
+extern LispType PortType;
+
+#endif
@@ -0,0 +1,97 @@
+#include "printer.h"
+#include "safepoint.h"
+#include <stdarg.h>
+#include <string.h>
+
+//what print writes to, set up by init_runtime
+static Printer stdout_printer_s;
+Printer *stdout_printer = &stdout_printer_s;
+
+//sets up p to print to file
+void printer_init_file(Printer *p, FILE *file) {
+    p->buf = malloc(PRINTER_BUFFER_SIZE);
+    p->len = 0;
+    p->size = PRINTER_BUFFER_SIZE;
+    p->file = file;
+}
+
+//sets up p to build a string, see printer_to_str
+void printer_init_string(Printer *p) {
+    p->buf = malloc(64);
+    p->len = 0;
+    p->size = 64;
+    p->file = NULL;
+}
+
+//hands what's in the buffer of p over to its file. stdio does its own buffering on top,
+//so this keeps the output in order with other writes to the file rather than forcing it out
+void printer_flush(Printer *p) {
+    if(p->file == NULL || p->len == 0)
+        return;
+    fwrite(p->buf, 1, p->len, p->file);
+    p->len = 0;
+}
+
+//makes room for n more chars in p
+static void reserve(Printer *p, int n) {
+    if(p->len + n <= p->size)
+        return;
+    if(p->file != NULL) {
+        printer_flush(p);
+        if(n <= p->size)
+            return;
+    }
+    while(p->len + n > p->size)
+        p->size *= 2;
+    p->buf = realloc(p->buf, p->size);
+}
+
+void printer_write(Printer *p, char *chars, int n) {
+    reserve(p, n);
+    memcpy(p->buf + p->len, chars, n);
+    p->len += n;
+}
+
+void printer_puts(Printer *p, char *s) {
+    printer_write(p, s, strlen(s));
+}
+
+void printer_printf(Printer *p, char *fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+    reserve(p, n + 1);
+    va_start(args, fmt);
+    vsnprintf(p->buf + p->len, n + 1, fmt, args);
+    va_end(args);
+    p->len += n;
+}
+
+//prints n in decimal, without going through printf
+void printer_int(Printer *p, int n) {
+    char digits[12];
+    int i = sizeof(digits);
+    unsigned int u = n < 0 ? -(unsigned int)n : n;
+    do {
+        digits[--i] = '0' + u % 10;
+        u /= 10;
+    } while(u != 0);
+    if(n < 0)
+        digits[--i] = '-';
+    printer_write(p, digits + i, sizeof(digits) - i);
+}
+
+//returns the string built by p as a str, and frees p's buffer
+Str *printer_to_str(Printer *p) {
+    Str *out = new_str_from(p->buf, p->len);
+    free(p->buf);
+    p->buf = NULL;
+    return out;
+}
+
+//prints obj to p with the print method of its type
+void print_object(Printer *p, LispObject *obj) {
+    CHECK_STACK();
+    obj->type->print(obj, p);
+}
@@ -0,0 +1,32 @@
+#ifndef _PRINTER_H_
+#define _PRINTER_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//size of the buffer of printers that write to a file
+#define PRINTER_BUFFER_SIZE 4096
+
+//somewhere to print objects to, either a file written to through a fixed size buffer or
+//a string that grows as it's printed to. the print methods of types write to one
+//(Printer is declared in lisptype.h)
+struct Printer_S {
+    char *buf;
+    int len;
+    int size;
+    FILE *file; //NULL when building a string
+};
+
+extern Printer *stdout_printer;
+
+void printer_init_file(Printer *p, FILE *file);
+void printer_init_string(Printer *p);
+void printer_write(Printer *p, char *chars, int n);
+void printer_puts(Printer *p, char *s);
+void printer_printf(Printer *p, char *fmt, ...);
+void printer_int(Printer *p, int n);
+void printer_flush(Printer *p);
+Str *printer_to_str(Printer *p);
+void print_object(Printer *p, LispObject *obj);
+
+#endif
@@ -0,0 +1,422 @@
+#include "reader.h"
+#include "error.h"
+#include "safepoint.h"
+#include <ctype.h>
+#include <string.h>
+#include <limits.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//=reader=
+
+//sets up r to read from file, which is left open by reader_close
+void reader_from_file(Reader *r, FILE *file) {
+    r->file = file;
+    r->buf = malloc(READER_BUFFER_SIZE);
+    r->len = 0;
+    r->pos = 0;
+}
+
+//sets up r to read from the null terminated string s, which isn't copied
+void reader_from_string(Reader *r, char *s) {
+    r->file = NULL;
+    r->buf = s;
+    r->len = strlen(s);
+    r->pos = 0;
+}
+
+//frees the buffer of r
+void reader_close(Reader *r) {
+    if(r->file != NULL)
+        free(r->buf);
+    r->buf = NULL;
+}
+
+//returns the next character of the input without consuming it, or EOF at the end
+//the buffer is only refilled once everything in it was consumed, so tokens are
+//copied out of it as they're read
+static int peek_char(Reader *r) {
+    if(r->pos == r->len) {
+        if(r->file == NULL)
+            return EOF;
+        r->len = fread(r->buf, 1, READER_BUFFER_SIZE, r->file);
+        r->pos = 0;
+        if(r->len <= 0) {
+            r->len = 0;
+            return EOF;
+        }
+    }
+    return (unsigned char)r->buf[r->pos];
+}
+
+//consumes and returns the next character of the input, or EOF at the end
+static int next_char(Reader *r) {
+    int c = peek_char(r);
+    if(c != EOF)
+        r->pos++;
+    return c;
+}
+
+static void skip_space(Reader *r) {
+    int c;
+    while((c = peek_char(r)) != EOF && isspace(c))
+        r->pos++;
+}
+
+static bool is_delimiter(int c) {
+    return c == EOF || isspace(c) || c == '(' || c == ')';
+}
+
+static LispObject *read_sub(Reader *r);
+
+//reads the rest of a list after its open paren
+static LispObject *read_list(Reader *r) {
+    CHECK_STACK();
+    ConsCell *out = nil;
+    ConsCell *node = nil;
+    for(;;) {
+        skip_space(r);
+        int c = peek_char(r);
+        if(c == EOF)
+            error("Horrible error, unexpected end of input in list\n");
+        if(c == ')') {
+            r->pos++;
+            return (LispObject*)out;
+        }
+        ConsCell *cell = new_cons_cell(read_sub(r), (LispObject*)nil);
+        if(out == nil)
+            out = cell;
+        else
+            node->cdr = (LispObject*)cell;
+        node = cell;
+    }
+}
+
+//reads the rest of a string after its open quote
+static LispObject *read_string(Reader *r) {
+    Str *out = (Str*)new_str();
+    for(;;) {
+        int c = next_char(r);
+        if(c == EOF)
+            error("Horrible error, unexpected end of input in string\n");
+        if(c == '"')
+            return (LispObject*)out;
+        if(c != '\\') {
+            str_append(out, c);
+            continue;
+        }
+        c = peek_char(r);
+        if(c == 'n') {
+            str_append(out, '\n');
+            r->pos++;
+        } else if(c == '\\' || c == '"') {
+            str_append(out, c);
+            r->pos++;
+        } else if(c != EOF && isdigit(c)) {
+            //up to 3 octal digits
+            int num = 0;
+            for(int i = 0; i < 3 && (c = peek_char(r)) != EOF && isdigit(c); i++) {
+                num = num * 8 + c - '0';
+                r->pos++;
+            }
+            str_append(out, num);
+        }
+    }
+}
+
+//reads a symbol or an int
+static LispObject *read_atom(Reader *r) {
+    char x[MAX_SYMBOL_LEN];
+    int i = 0;
+    while(!is_delimiter(peek_char(r))) {
+        if(i == MAX_SYMBOL_LEN - 1)
+            error("Horrible error, symbol names can have at most %d characters\n", MAX_SYMBOL_LEN - 1);
+        x[i++] = next_char(r);
+    }
+    x[i] = '\0';
+
+    if(isdigit(x[0]))
+        return (LispObject*)new_lisp_int(atoi(x));
+    else
+        return (LispObject*)new_symbol(x);
+}
+
+//reads a form, which must start at the next character
+static LispObject *read_sub(Reader *r) {
+    int c = peek_char(r);
+    if(c == ')')
+        error("Horrible error, unexpected )\n");
+    if(c == '(') {
+        r->pos++;
+        return read_list(r);
+    } else if(c == '"') {
+        r->pos++;
+        return read_string(r);
+    }
+    return read_atom(r);
+}
+
+//returns the next top level form in r, or NULL if only whitespace is left
+LispObject *read_form(Reader *r) {
+    skip_space(r);
+    if(peek_char(r) == EOF)
+        return NULL;
+    return read_sub(r);
+}
+
+//reads a form from the string *s and moves *s past it, returns NULL if there is none
+LispObject *read(char **s) {
+    Reader r;
+    reader_from_string(&r, *s);
+    LispObject *out = read_form(&r);
+    *s += r.pos;
+    return out;
+}
+
+//=data reader=
+
+//reads whole buffers of data at a time instead of going char by char: the buffer is
+//followed by DATA_PADDING zero bytes so blocks of 16 chars can be loaded anywhere in it,
+//and the zeros stop every scan at the end of the input
+
+#define DATA_PADDING 16
+
+#ifdef __SSE2__
+
+//returns a bit mask of the chars in the block at p that are space or \t\n\v\f\r
+static inline int space_mask(__m128i block) {
+    __m128i spaces = _mm_cmpeq_epi8(block, _mm_set1_epi8(' '));
+    //\t to \r are 9 to 13, anything else wraps past 4 when 9 is subtracted
+    __m128i shifted = _mm_sub_epi8(block, _mm_set1_epi8('\t'));
+    __m128i controls = _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(4)), shifted);
+    return _mm_movemask_epi8(_mm_or_si128(spaces, controls));
+}
+
+//returns the first char at or after p that isn't whitespace
+static char *skip_data_space(char *p) {
+    for(;;) {
+        int mask = ~space_mask(_mm_loadu_si128((__m128i*)p)) & 0xffff;
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
+
+//returns the first char at or after p that ends an atom
+static char *find_atom_end(char *p) {
+    for(;;) {
+        __m128i block = _mm_loadu_si128((__m128i*)p);
+        __m128i parens = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('(')),
+                                      _mm_cmpeq_epi8(block, _mm_set1_epi8(')')));
+        __m128i ends = _mm_or_si128(parens, _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+        int mask = _mm_movemask_epi8(ends) | space_mask(block);
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
+
+//returns the first quote, backslash or zero at or after p
+static char *find_string_special(char *p) {
+    for(;;) {
+        __m128i block = _mm_loadu_si128((__m128i*)p);
+        __m128i specials = _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('"')),
+                                        _mm_cmpeq_epi8(block, _mm_set1_epi8('\\')));
+        specials = _mm_or_si128(specials, _mm_cmpeq_epi8(block, _mm_setzero_si128()));
+        int mask = _mm_movemask_epi8(specials);
+        if(mask != 0)
+            return p + __builtin_ctz(mask);
+        p += 16;
+    }
+}
+
+#else
+
+static char *skip_data_space(char *p) {
+    while(isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static char *find_atom_end(char *p) {
+    while(*p != '\0' && *p != '(' && *p != ')' && !isspace((unsigned char)*p))
+        p++;
+    return p;
+}
+
+static char *find_string_special(char *p) {
+    while(*p != '\0' && *p != '"' && *p != '\\')
+        p++;
+    return p;
+}
+
+#endif
+
+typedef struct {
+    char *pos;
+    char *end;
+} DataReader;
+
+static LispObject *read_data_sub(DataReader *d);
+
+//reads the rest of a list after its open paren
+static LispObject *read_data_list(DataReader *d) {
+    CHECK_STACK();
+    ConsCell *out = nil;
+    ConsCell *node = nil;
+    for(;;) {
+        d->pos = skip_data_space(d->pos);
+        if(d->pos >= d->end)
+            error("Horrible error, unexpected end of input in list\n");
+        if(*d->pos == ')') {
+            d->pos++;
+            return (LispObject*)out;
+        }
+        ConsCell *cell = new_cons_cell(read_data_sub(d), (LispObject*)nil);
+        if(out == nil)
+            out = cell;
+        else
+            node->cdr = (LispObject*)cell;
+        node = cell;
+    }
+}
+
+//reads the rest of a string after its open quote, copying the runs between escapes in bulk
+static LispObject *read_data_string(DataReader *d) {
+    char *start = d->pos;
+    char *p = find_string_special(start);
+    if(p >= d->end)
+        error("Horrible error, unexpected end of input in string\n");
+    Str *out = new_str_from(start, p - start);
+    for(;;) {
+        if(*p == '"') {
+            d->pos = p + 1;
+            return (LispObject*)out;
+        }
+        //a backslash, with the same escapes as read
+        p++;
+        if(*p == 'n') {
+            str_append(out, '\n');
+            p++;
+        } else if(*p == '\\' || *p == '"') {
+            str_append(out, *p);
+            p++;
+        } else if(isdigit((unsigned char)*p)) {
+            int num = 0;
+            for(int i = 0; i < 3 && isdigit((unsigned char)*p); i++)
+                num = num * 8 + *p++ - '0';
+            str_append(out, num);
+        }
+        start = p;
+        p = find_string_special(start);
+        if(p >= d->end)
+            error("Horrible error, unexpected end of input in string\n");
+        str_append_chars(out, start, p - start);
+    }
+}
+
+//reads a symbol or an int, ints are parsed straight out of the buffer
+static LispObject *read_data_atom(DataReader *d) {
+    char *start = d->pos;
+    char *end = find_atom_end(start);
+    if(end == start)
+        error("Horrible error, unexpected character %d\n", *start);
+    d->pos = end;
+
+    if(isdigit((unsigned char)*start)) {
+        //like atoi, trailing non digits are ignored
+        unsigned int num = 0;
+        for(char *p = start; p < end && isdigit((unsigned char)*p); p++)
+            num = num * 10 + *p - '0';
+        return (LispObject*)new_lisp_int(num);
+    }
+
+    int len = end - start;
+    if(len >= MAX_SYMBOL_LEN)
+        error("Horrible error, symbol names can have at most %d characters\n", MAX_SYMBOL_LEN - 1);
+    char name[MAX_SYMBOL_LEN];
+    memcpy(name, start, len);
+    name[len] = '\0';
+    return (LispObject*)new_symbol(name);
+}
+
+//reads a form, which must start at d->pos
+static LispObject *read_data_sub(DataReader *d) {
+    char c = *d->pos;
+    if(c == ')')
+        error("Horrible error, unexpected )\n");
+    d->pos++;
+    if(c == '(')
+        return read_data_list(d);
+    if(c == '"')
+        return read_data_string(d);
+    d->pos--;
+    return read_data_atom(d);
+}
+
+//returns a list of all the forms in the len chars at buf, which must be followed by
+//DATA_PADDING zero bytes
+static LispObject *read_data_buffer(char *buf, int len) {
+    DataReader d = {buf, buf + len};
+    ConsCell *out = nil;
+    ConsCell *node = nil;
+    for(;;) {
+        d.pos = skip_data_space(d.pos);
+        if(d.pos >= d.end)
+            return (LispObject*)out;
+        ConsCell *cell = new_cons_cell(read_data_sub(&d), (LispObject*)nil);
+        if(out == nil)
+            out = cell;
+        else
+            node->cdr = (LispObject*)cell;
+        node = cell;
+    }
+}
+
+//reads the buffer, freeing it even if the data is malformed
+static LispObject *read_data_and_free(char *buf, int len) {
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        free(buf);
+        reraise_error();
+    }
+    LispObject *out = read_data_buffer(buf, len);
+    pop_exception_point(&ep);
+    free(buf);
+    return out;
+}
+
+//returns a list of all the forms in the len chars at s
+LispObject *read_all(char *s, int len) {
+    char *buf = malloc(len + DATA_PADDING);
+    memcpy(buf, s, len);
+    memset(buf + len, 0, DATA_PADDING);
+    return read_data_and_free(buf, len);
+}
+
+//returns a list of all the forms in the file f, which is read in whole
+LispObject *read_all_file(FILE *f) {
+    //the buffer starts at the size of the file when it has one, so it isn't regrown
+    int size = READER_BUFFER_SIZE;
+    long start = ftell(f);
+    if(start >= 0 && fseek(f, 0, SEEK_END) == 0) {
+        long end = ftell(f);
+        if(end > start && end - start < INT_MAX - DATA_PADDING)
+            size = end - start + 1;
+        fseek(f, start, SEEK_SET);
+    }
+    int len = 0;
+    char *buf = malloc(size + DATA_PADDING);
+    int n;
+    while((n = fread(buf + len, 1, size - len, f)) > 0) {
+        len += n;
+        if(len == size) {
+            size *= 2;
+            buf = realloc(buf, size + DATA_PADDING);
+        }
+    }
+    memset(buf + len, 0, DATA_PADDING);
+    return read_data_and_free(buf, len);
+}
@@ -0,0 +1,27 @@
+#ifndef _READER_H_
+#define _READER_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//size of the buffer files are read through
+#define READER_BUFFER_SIZE 65536
+
+//reads forms from a string, or from a file through a fixed size buffer that is refilled
+//as it's used up, so the whole file is never in memory at once
+typedef struct {
+    FILE *file; //NULL when reading a string
+    char *buf;
+    int len;
+    int pos;
+} Reader;
+
+void reader_from_file(Reader *r, FILE *file);
+void reader_from_string(Reader *r, char *s);
+void reader_close(Reader *r);
+LispObject *read_form(Reader *r);
+LispObject *read(char **s);
+LispObject *read_all(char *s, int len);
+LispObject *read_all_file(FILE *f);
+
+#endif
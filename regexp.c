@@ -0,0 +1,763 @@
+#include "regexp.h"
+#include "alloc.h"
+#include "error.h"
+#include "printer.h"
+#include <string.h>
+
+LispType RegexType = {&TypeType, "regex", regex_print, sizeof(Regex)};
+
+//=parsing=
+
+//most nfa states a pattern can compile to, counted repetitions copy their subpatterns
+#define NFA_MAX_STATES 65536
+//largest count allowed in {m,n}
+#define REGEX_MAX_REPEAT 1000
+
+//kinds of parsed pattern nodes
+#define RE_CLASS 0  //one char out of class
+#define RE_CAT 1    //left then right
+#define RE_ALT 2    //left or right
+#define RE_REPEAT 3 //left min to max times, max -1 is unbounded
+#define RE_EMPTY 4
+
+typedef struct RegexNode_S {
+    int kind;
+    int min;
+    int max;
+    uint32_t class[8];
+    struct RegexNode_S *left;
+    struct RegexNode_S *right;
+} RegexNode;
+
+//the parser keeps every node it makes in nodes, so they can all be freed at the end
+//whether or not parsing worked
+typedef struct {
+    char *pos;
+    char *end;
+    RegexNode **nodes;
+    int nnodes;
+} RegexParser;
+
+static RegexNode *parse_alt(RegexParser *p);
+
+static RegexNode *new_regex_node(RegexParser *p, int kind, RegexNode *left, RegexNode *right) {
+    if(p->nnodes % 64 == 0)
+        p->nodes = realloc(p->nodes, (p->nnodes + 64) * sizeof(RegexNode*));
+    RegexNode *out = calloc(1, sizeof(RegexNode));
+    out->kind = kind;
+    out->left = left;
+    out->right = right;
+    p->nodes[p->nnodes++] = out;
+    return out;
+}
+
+static void free_nodes(RegexParser *p) {
+    for(int i = 0; i < p->nnodes; i++)
+        free(p->nodes[i]);
+    free(p->nodes);
+}
+
+static void class_add(uint32_t *class, int c) {
+    class[c >> 5] |= 1u << (c & 31);
+}
+
+static bool class_has(uint32_t *class, int c) {
+    return class[c >> 5] & (1u << (c & 31));
+}
+
+static void class_add_range(uint32_t *class, int from, int to) {
+    for(int c = from; c <= to; c++)
+        class_add(class, c);
+}
+
+static void class_invert(uint32_t *class) {
+    for(int i = 0; i < 8; i++)
+        class[i] = ~class[i];
+}
+
+//adds the chars of the escape \c to class, for escapes that stand for sets of chars
+//returns false for escapes that are just the char after them
+static bool class_escape(uint32_t *class, char c) {
+    uint32_t set[8] = {0};
+    switch(c | 0x20) {
+    case 'd':
+        class_add_range(set, '0', '9');
+        break;
+    case 'w':
+        class_add_range(set, 'a', 'z');
+        class_add_range(set, 'A', 'Z');
+        class_add_range(set, '0', '9');
+        class_add(set, '_');
+        break;
+    case 's':
+        class_add_range(set, '\t', '\r');
+        class_add(set, ' ');
+        break;
+    default:
+        return false;
+    }
+    //the upper case escapes are the complements
+    if(c >= 'A' && c <= 'Z')
+        class_invert(set);
+    for(int i = 0; i < 8; i++)
+        class[i] |= set[i];
+    return true;
+}
+
+//returns the char that the escape \c stands for
+static int escaped_char(char c) {
+    switch(c) {
+    case 'n': return '\n';
+    case 't': return '\t';
+    case 'r': return '\r';
+    case 'f': return '\f';
+    case 'v': return '\v';
+    case '0': return '\0';
+    }
+    return (unsigned char)c;
+}
+
+//parses a [] class, after the [
+static RegexNode *parse_class(RegexParser *p) {
+    RegexNode *out = new_regex_node(p, RE_CLASS, NULL, NULL);
+    bool negated = p->pos < p->end && *p->pos == '^';
+    if(negated)
+        p->pos++;
+    bool first = true;
+    while(p->pos < p->end && (*p->pos != ']' || first)) {
+        first = false;
+        int c = (unsigned char)*p->pos++;
+        if(c == '\\' && p->pos < p->end) {
+            if(class_escape(out->class, *p->pos)) {
+                p->pos++;
+                continue;
+            }
+            c = escaped_char(*p->pos++);
+        }
+        if(p->pos + 1 < p->end && *p->pos == '-' && p->pos[1] != ']') {
+            int to = (unsigned char)p->pos[1];
+            p->pos += 2;
+            if(to == '\\' && p->pos < p->end)
+                to = escaped_char(*p->pos++);
+            if(to < c)
+                error("Horrible error, bad range in regex class\n");
+            class_add_range(out->class, c, to);
+        } else
+            class_add(out->class, c);
+    }
+    if(p->pos == p->end)
+        error("Horrible error, missing ] in regex\n");
+    p->pos++;
+    if(negated)
+        class_invert(out->class);
+    return out;
+}
+
+//parses a number in a {m,n} repetition, returns -1 if there isn't one
+static int parse_count(RegexParser *p) {
+    if(p->pos == p->end || *p->pos < '0' || *p->pos > '9')
+        return -1;
+    int n = 0;
+    while(p->pos < p->end && *p->pos >= '0' && *p->pos <= '9') {
+        n = 10 * n + (*p->pos++ - '0');
+        if(n > REGEX_MAX_REPEAT)
+            error("Horrible error, regex repetition counts can be at most %d\n", REGEX_MAX_REPEAT);
+    }
+    return n;
+}
+
+static RegexNode *parse_atom(RegexParser *p) {
+    char c = *p->pos++;
+    if(c == '(') {
+        //groups don't capture, so (?: is the same as (
+        if(p->end - p->pos >= 2 && p->pos[0] == '?' && p->pos[1] == ':')
+            p->pos += 2;
+        RegexNode *out = parse_alt(p);
+        if(p->pos == p->end || *p->pos != ')')
+            error("Horrible error, missing ) in regex\n");
+        p->pos++;
+        return out;
+    }
+    if(c == '[')
+        return parse_class(p);
+    RegexNode *out = new_regex_node(p, RE_CLASS, NULL, NULL);
+    if(c == '.') {
+        class_invert(out->class);
+        out->class['\n' >> 5] &= ~(1u << ('\n' & 31));
+    } else if(c == '\\') {
+        if(p->pos == p->end)
+            error("Horrible error, regex ends in \\\n");
+        c = *p->pos++;
+        if(!class_escape(out->class, c))
+            class_add(out->class, escaped_char(c));
+    } else if(c == '^' || c == '$') {
+        error("Horrible error, ^ and $ can only be at the start and end of a regex\n");
+    } else if(c == '*' || c == '+' || c == '?') {
+        error("Horrible error, nothing to repeat in regex\n");
+    } else
+        class_add(out->class, (unsigned char)c);
+    return out;
+}
+
+static RegexNode *parse_repeat(RegexParser *p) {
+    RegexNode *out = parse_atom(p);
+    while(p->pos < p->end) {
+        int min, max;
+        char c = *p->pos;
+        if(c == '*')
+            min = 0, max = -1;
+        else if(c == '+')
+            min = 1, max = -1;
+        else if(c == '?')
+            min = 0, max = 1;
+        else if(c == '{') {
+            char *brace = p->pos++;
+            min = parse_count(p);
+            max = min;
+            if(p->pos < p->end && *p->pos == ',') {
+                p->pos++;
+                max = parse_count(p);
+            }
+            if(min < 0 || p->pos == p->end || *p->pos != '}' || (max >= 0 && max < min)) {
+                //not a repetition, so the { is just a char
+                p->pos = brace;
+                break;
+            }
+        } else
+            break;
+        p->pos++;
+        out = new_regex_node(p, RE_REPEAT, out, NULL);
+        out->min = min;
+        out->max = max;
+    }
+    return out;
+}
+
+static RegexNode *parse_cat(RegexParser *p) {
+    RegexNode *out = NULL;
+    while(p->pos < p->end && *p->pos != '|' && *p->pos != ')') {
+        RegexNode *next = parse_repeat(p);
+        out = out == NULL ? next : new_regex_node(p, RE_CAT, out, next);
+    }
+    return out == NULL ? new_regex_node(p, RE_EMPTY, NULL, NULL) : out;
+}
+
+static RegexNode *parse_alt(RegexParser *p) {
+    RegexNode *out = parse_cat(p);
+    while(p->pos < p->end && *p->pos == '|') {
+        p->pos++;
+        out = new_regex_node(p, RE_ALT, out, parse_cat(p));
+    }
+    return out;
+}
+
+//=nfa=
+
+//kinds of nfa states
+#define NFA_CLASS 0
+#define NFA_SPLIT 1
+#define NFA_MATCH 2
+
+static int add_nfa_state(Nfa *nfa, int kind, int out, int out1) {
+    if(nfa->nstates % 64 == 0) {
+        if(nfa->nstates == NFA_MAX_STATES)
+            error("Horrible error, regex is too big\n");
+        nfa->states = realloc(nfa->states, (nfa->nstates + 64) * sizeof(NfaState));
+    }
+    NfaState *s = &nfa->states[nfa->nstates];
+    s->kind = kind;
+    s->out = out;
+    s->out1 = out1;
+    memset(s->class, 0, sizeof(s->class));
+    return nfa->nstates++;
+}
+
+//adds states for node to nfa, which go on to the state next after matching it, and
+//returns the first of them. reverse builds them to match the reverse of node
+static int build_nfa(Nfa *nfa, RegexNode *node, int next, bool reverse) {
+    switch(node->kind) {
+    case RE_CLASS: {
+        int out = add_nfa_state(nfa, NFA_CLASS, next, -1);
+        memcpy(nfa->states[out].class, node->class, sizeof(node->class));
+        return out;
+    }
+    case RE_CAT:
+        if(reverse)
+            return build_nfa(nfa, node->right, build_nfa(nfa, node->left, next, reverse), reverse);
+        return build_nfa(nfa, node->left, build_nfa(nfa, node->right, next, reverse), reverse);
+    case RE_ALT: {
+        int left = build_nfa(nfa, node->left, next, reverse);
+        int right = build_nfa(nfa, node->right, next, reverse);
+        return add_nfa_state(nfa, NFA_SPLIT, left, right);
+    }
+    case RE_REPEAT: {
+        //the copies past min are optional, or a loop when there's no max
+        int out = next;
+        if(node->max < 0) {
+            int loop = add_nfa_state(nfa, NFA_SPLIT, -1, next);
+            nfa->states[loop].out = build_nfa(nfa, node->left, loop, reverse);
+            out = loop;
+        } else
+            for(int i = node->min; i < node->max; i++)
+                out = add_nfa_state(nfa, NFA_SPLIT, build_nfa(nfa, node->left, out, reverse), next);
+        for(int i = 0; i < node->min; i++)
+            out = build_nfa(nfa, node->left, out, reverse);
+        return out;
+    }
+    }
+    return next;
+}
+
+static void compile_nfa(Nfa *nfa, RegexNode *node, bool reverse) {
+    nfa->states = NULL;
+    nfa->nstates = 0;
+    int match = add_nfa_state(nfa, NFA_MATCH, -1, -1);
+    nfa->start = build_nfa(nfa, node, match, reverse);
+}
+
+//=dfa=
+
+static Dfa *new_dfa(Nfa *nfa, bool unanchored) {
+    Dfa *out = malloc(sizeof(Dfa));
+    out->nfa = nfa;
+    out->unanchored = unanchored;
+    out->table_size = 2 * DFA_MAX_STATES;
+    out->table = calloc(out->table_size, sizeof(DfaState*));
+    out->nstates = 0;
+    out->generation = 0;
+    out->start = NULL;
+    out->marks = calloc(nfa->nstates, sizeof(int));
+    out->mark = 0;
+    out->stack = malloc((2 * nfa->nstates + 1) * sizeof(int));
+    out->set = malloc(nfa->nstates * sizeof(int));
+    return out;
+}
+
+static void clear_dfa(Dfa *dfa) {
+    for(int i = 0; i < dfa->table_size; i++) {
+        free(dfa->table[i]);
+        dfa->table[i] = NULL;
+    }
+    dfa->nstates = 0;
+    dfa->start = NULL;
+    dfa->generation++;
+}
+
+static void free_dfa(Dfa *dfa) {
+    if(dfa == NULL)
+        return;
+    clear_dfa(dfa);
+    free(dfa->table);
+    free(dfa->marks);
+    free(dfa->stack);
+    free(dfa->set);
+    free(dfa);
+}
+
+//adds state and everything it reaches through splits to dfa->set, returns the new size
+//of the set. states already marked with dfa->mark are in it already
+static int add_closure(Dfa *dfa, int state, int n) {
+    int top = 0;
+    dfa->stack[top++] = state;
+    while(top > 0) {
+        int s = dfa->stack[--top];
+        if(dfa->marks[s] == dfa->mark)
+            continue;
+        dfa->marks[s] = dfa->mark;
+        NfaState *ns = &dfa->nfa->states[s];
+        if(ns->kind == NFA_SPLIT) {
+            dfa->stack[top++] = ns->out1;
+            dfa->stack[top++] = ns->out;
+        } else
+            dfa->set[n++] = s;
+    }
+    return n;
+}
+
+static unsigned int set_hash(int *set, int n) {
+    unsigned int h = 2166136261u;
+    for(int i = 0; i < n; i++)
+        h = (h ^ set[i]) * 16777619u;
+    return h;
+}
+
+static int compare_ints(const void *a, const void *b) {
+    return *(int*)a - *(int*)b;
+}
+
+//returns the dfa state for the n nfa states in dfa->set, adding it if it's new
+//a full table of states is emptied first, so pointers to old states go stale
+static DfaState *find_dfa_state(Dfa *dfa, int n) {
+    qsort(dfa->set, n, sizeof(int), compare_ints);
+    unsigned int h = set_hash(dfa->set, n);
+    int i = h & (dfa->table_size - 1);
+    for(DfaState *s; (s = dfa->table[i]) != NULL; i = (i + 1) & (dfa->table_size - 1))
+        if(s->nstates == n && !memcmp(s->nfa_states, dfa->set, n * sizeof(int)))
+            return s;
+
+    if(dfa->nstates == DFA_MAX_STATES) {
+        clear_dfa(dfa);
+        i = h & (dfa->table_size - 1);
+    }
+    DfaState *s = calloc(1, sizeof(DfaState) + n * sizeof(int));
+    s->nstates = n;
+    memcpy(s->nfa_states, dfa->set, n * sizeof(int));
+    for(int j = 0; j < n; j++)
+        if(dfa->nfa->states[dfa->set[j]].kind == NFA_MATCH)
+            s->match = true;
+    dfa->table[i] = s;
+    dfa->nstates++;
+    return s;
+}
+
+static DfaState *dfa_start(Dfa *dfa) {
+    if(dfa->start == NULL) {
+        dfa->mark++;
+        dfa->start = find_dfa_state(dfa, add_closure(dfa, dfa->nfa->start, 0));
+    }
+    return dfa->start;
+}
+
+//returns the state dfa goes to from state on the char c, working it out if it's not known
+static DfaState *dfa_step(Dfa *dfa, DfaState *state, unsigned char c) {
+    if(state->next[c] != NULL)
+        return state->next[c];
+    dfa->mark++;
+    int n = 0;
+    for(int i = 0; i < state->nstates; i++) {
+        NfaState *ns = &dfa->nfa->states[state->nfa_states[i]];
+        if(ns->kind == NFA_CLASS && class_has(ns->class, c))
+            n = add_closure(dfa, ns->out, n);
+    }
+    if(dfa->unanchored)
+        n = add_closure(dfa, dfa->nfa->start, n);
+    int generation = dfa->generation;
+    DfaState *out = find_dfa_state(dfa, n);
+    //state is gone if the table was emptied
+    if(dfa->generation == generation)
+        state->next[c] = out;
+    return out;
+}
+
+//=matching=
+
+//the furthest match ends longest_match has found past (position, dfa state) pairs
+//what's left of a scan only depends on where it is and the state it's in, so a scan that
+//gets to a pair an earlier one went through can stop and take the end found then
+typedef struct {
+    int *positions;
+    DfaState **states;
+    int *ends;      //-1 if there's no match past the pair
+    int size;       //a power of 2
+    int count;
+    int generation; //of the dfa the states are from, they're stale once it changes
+    int *path_positions; //the pairs the current scan went through
+    DfaState **path_states;
+} MatchEnds;
+
+static void init_match_ends(MatchEnds *m, int len) {
+    m->size = 64;
+    m->count = 0;
+    m->positions = malloc(m->size * sizeof(int));
+    m->states = calloc(m->size, sizeof(DfaState*));
+    m->ends = malloc(m->size * sizeof(int));
+    m->generation = -1;
+    m->path_positions = malloc((len + 1) * sizeof(int));
+    m->path_states = malloc((len + 1) * sizeof(DfaState*));
+}
+
+static void free_match_ends(MatchEnds *m) {
+    free(m->positions);
+    free(m->states);
+    free(m->ends);
+    free(m->path_positions);
+    free(m->path_states);
+}
+
+static void clear_match_ends(MatchEnds *m, int generation) {
+    memset(m->states, 0, m->size * sizeof(DfaState*));
+    m->count = 0;
+    m->generation = generation;
+}
+
+static unsigned int match_end_hash(int position, DfaState *state) {
+    return ((unsigned int)position * 2654435761u) ^ (unsigned int)((uintptr_t)state >> 4);
+}
+
+//returns the slot of (position, state) in m, or the empty slot it would go in
+static int match_end_slot(MatchEnds *m, int position, DfaState *state) {
+    int i = match_end_hash(position, state) & (m->size - 1);
+    while(m->states[i] != NULL && (m->states[i] != state || m->positions[i] != position))
+        i = (i + 1) & (m->size - 1);
+    return i;
+}
+
+static void add_match_end(MatchEnds *m, int position, DfaState *state, int end) {
+    if(2 * (m->count + 1) > m->size) {
+        MatchEnds old = *m;
+        m->size *= 2;
+        m->positions = malloc(m->size * sizeof(int));
+        m->states = calloc(m->size, sizeof(DfaState*));
+        m->ends = malloc(m->size * sizeof(int));
+        for(int i = 0; i < old.size; i++)
+            if(old.states[i] != NULL) {
+                int j = match_end_slot(m, old.positions[i], old.states[i]);
+                m->positions[j] = old.positions[i];
+                m->states[j] = old.states[i];
+                m->ends[j] = old.ends[i];
+            }
+        free(old.positions);
+        free(old.states);
+        free(old.ends);
+    }
+    int i = match_end_slot(m, position, state);
+    if(m->states[i] == NULL)
+        m->count++;
+    m->positions[i] = position;
+    m->states[i] = state;
+    m->ends[i] = end;
+}
+
+//returns the end of the longest match of re starting at start in the len chars at s,
+//or -1 if there's none. known can be NULL, otherwise it's what earlier calls on the same
+//s found, so the scans of all the calls together take at most one step for each pair
+//of position and dfa state. that's linear in len for a given re, as long as its states
+//fit in the dfa table, each time the table is emptied known has to start over
+static int longest_match(Regex *re, char *s, int len, int start, MatchEnds *known) {
+    if(re->forward_dfa == NULL)
+        re->forward_dfa = new_dfa(&re->forward, false);
+    Dfa *dfa = re->forward_dfa;
+    DfaState *state = dfa_start(dfa);
+    int out = state->match ? start : -1;
+    int npath = 0;
+    int tail = -1; //the furthest end past the pair this scan stopped at
+    if(known != NULL && known->generation != dfa->generation)
+        clear_match_ends(known, dfa->generation);
+    for(int i = start; i < len; i++) {
+        state = dfa_step(dfa, state, s[i]);
+        if(state->nstates == 0)
+            break;
+        if(state->match)
+            out = i + 1;
+        if(known == NULL)
+            continue;
+        if(known->generation != dfa->generation) {
+            //the states this scan went through are gone
+            clear_match_ends(known, dfa->generation);
+            npath = 0;
+        }
+        int slot = match_end_slot(known, i + 1, state);
+        if(known->states[slot] != NULL) {
+            tail = known->ends[slot];
+            break;
+        }
+        known->path_positions[npath] = i + 1;
+        known->path_states[npath++] = state;
+    }
+    //each pair on the way gets the furthest end past it
+    for(int j = npath - 1; j >= 0; j--) {
+        if(tail < 0 && known->path_states[j]->match)
+            tail = known->path_positions[j];
+        add_match_end(known, known->path_positions[j], known->path_states[j], tail);
+    }
+    if(tail > out)
+        out = tail;
+    if(re->anchored_end)
+        return out == len ? len : -1;
+    return out;
+}
+
+//returns a bitmap of the positions in the len chars at s where a match of re starts,
+//found by running the reverse of re backwards over s
+static uint8_t *match_starts(Regex *re, char *s, int len) {
+    uint8_t *out = calloc(len / 8 + 1, 1);
+    if(re->reverse_dfa == NULL)
+        re->reverse_dfa = new_dfa(&re->reverse, !re->anchored_end);
+    Dfa *dfa = re->reverse_dfa;
+    DfaState *state = dfa_start(dfa);
+    if(state->match)
+        out[len / 8] |= 1 << (len % 8);
+    for(int i = len - 1; i >= 0; i--) {
+        state = dfa_step(dfa, state, s[i]);
+        if(state->nstates == 0)
+            break;
+        if(state->match)
+            out[i / 8] |= 1 << (i % 8);
+    }
+    return out;
+}
+
+static int next_start(uint8_t *starts, int len, int from) {
+    for(int i = from; i <= len; i++) {
+        if(starts[i / 8] == 0) {
+            i |= 7;
+            continue;
+        }
+        if(starts[i / 8] & (1 << (i % 8)))
+            return i;
+    }
+    return -1;
+}
+
+//returns whether re matches all of the len chars at s
+bool regex_match(Regex *re, char *s, int len) {
+    if(re->forward_dfa == NULL)
+        re->forward_dfa = new_dfa(&re->forward, false);
+    Dfa *dfa = re->forward_dfa;
+    DfaState *state = dfa_start(dfa);
+    for(int i = 0; i < len && state->nstates > 0; i++)
+        state = dfa_step(dfa, state, s[i]);
+    return state->match;
+}
+
+//finds the leftmost longest match of re in the len chars at s and puts where it starts
+//and ends into start_out and end_out. returns false if there's none
+bool regex_search(Regex *re, char *s, int len, int *start_out, int *end_out) {
+    if(re->anchored_start) {
+        *start_out = 0;
+        *end_out = longest_match(re, s, len, 0, NULL);
+        return *end_out >= 0;
+    }
+    uint8_t *starts = match_starts(re, s, len);
+    int start = next_start(starts, len, 0);
+    free(starts);
+    if(start < 0)
+        return false;
+    *start_out = start;
+    *end_out = longest_match(re, s, len, start, NULL);
+    return true;
+}
+
+//returns a list of strs of the leftmost longest matches of re in s that don't overlap
+LispObject *regex_find_all(Regex *re, Str *s) {
+    int start, end;
+    if(re->anchored_start) {
+        if(!regex_search(re, s->array, s->size, &start, &end))
+            return (LispObject*)nil;
+        return (LispObject*)new_cons_cell((LispObject*)new_str_from(s->array, end), (LispObject*)nil);
+    }
+    uint8_t *starts = match_starts(re, s->array, s->size);
+    MatchEnds known;
+    init_match_ends(&known, s->size);
+    ConsCell *out = nil;
+    ConsCell *last = NULL;
+    int pos = 0;
+    while(pos <= s->size && (start = next_start(starts, s->size, pos)) >= 0) {
+        end = longest_match(re, s->array, s->size, start, &known);
+        ConsCell *cell = new_cons_cell((LispObject*)new_str_from(s->array + start, end - start),
+                                       (LispObject*)nil);
+        if(last == NULL)
+            out = cell;
+        else
+            last->cdr = (LispObject*)cell;
+        last = cell;
+        //empty matches move on a char so they aren't found again
+        pos = end > start ? end : end + 1;
+    }
+    free(starts);
+    free_match_ends(&known);
+    return (LispObject*)out;
+}
+
+//=regex objects=
+
+//compiles the str pattern into re, which was allocated but not filled in
+//raises an exception if the pattern isn't valid, leaving re empty
+void regex_init(Regex *re, Str *pattern) {
+    RegexParser p = {pattern->array, pattern->array + pattern->size, NULL, 0};
+    bool anchored_start = p.pos < p.end && *p.pos == '^';
+    if(anchored_start)
+        p.pos++;
+    bool anchored_end = p.end > p.pos && p.end[-1] == '$' &&
+                        (p.end - 1 == p.pos || p.end[-2] != '\\');
+    if(anchored_end)
+        p.end--;
+    Nfa forward = {NULL, 0, 0};
+    Nfa reverse = {NULL, 0, 0};
+
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) != 0) {
+        free_nodes(&p);
+        free(forward.states);
+        free(reverse.states);
+        reraise_error();
+    }
+    RegexNode *node = parse_alt(&p);
+    if(p.pos != p.end)
+        error("Horrible error, unmatched ) in regex\n");
+    compile_nfa(&forward, node, false);
+    compile_nfa(&reverse, node, true);
+    pop_exception_point(&ep);
+    free_nodes(&p);
+
+    re->anchored_start = anchored_start;
+    re->anchored_end = anchored_end;
+    re->forward = forward;
+    re->reverse = reverse;
+    re->forward_dfa = NULL;
+    re->reverse_dfa = NULL;
+    //a copy, since strs can be changed
+    re->pattern = new_str_from(pattern->array, pattern->size);
+}
+
+//returns a regex with nothing in it, to be filled in by regex_init
+LispObject *new_empty_regex() {
+    Regex *out = alloc(sizeof(Regex));
+    out->type = &RegexType;
+    out->pattern = NULL;
+    out->forward = (Nfa){NULL, 0, 0};
+    out->reverse = (Nfa){NULL, 0, 0};
+    out->forward_dfa = NULL;
+    out->reverse_dfa = NULL;
+    return (LispObject*)out;
+}
+
+//compiles the str pattern into a new regex
+//raises an exception if the pattern isn't valid
+LispObject *new_regex(Str *pattern) {
+    Regex *out = (Regex*)new_empty_regex();
+    regex_init(out, pattern);
+    return (LispObject*)out;
+}
+
+//regexes compiled for patterns given as strs, by a hash of the pattern
+static LispObject *regex_cache[REGEX_CACHE_SIZE];
+static bool regex_cache_rooted = false;
+
+//returns obj if it's a regex, or a compiled regex for it if it's a str pattern
+//the last few patterns compiled are cached, so loops don't compile theirs every time
+Regex *cached_regex(LispObject *obj) {
+    if(obj->type == &RegexType)
+        return (Regex*)obj;
+    Str *pattern = safe_cast(obj, &StrType);
+    unsigned int h = 2166136261u;
+    for(int i = 0; i < pattern->size; i++)
+        h = (h ^ (unsigned char)pattern->array[i]) * 16777619u;
+    Regex **slot = (Regex**)&regex_cache[h % REGEX_CACHE_SIZE];
+    if(*slot != NULL && (*slot)->pattern->size == pattern->size &&
+       !memcmp((*slot)->pattern->array, pattern->array, pattern->size))
+        return *slot;
+    if(!regex_cache_rooted) {
+        gc_add_roots(regex_cache, REGEX_CACHE_SIZE);
+        regex_cache_rooted = true;
+    }
+    *slot = (Regex*)new_regex(pattern);
+    return *slot;
+}
+
+//frees the nfas and dfas of re, called when it's garbage collected
+void free_regex(Regex *re) {
+    free(re->forward.states);
+    free(re->reverse.states);
+    free_dfa(re->forward_dfa);
+    free_dfa(re->reverse_dfa);
+}
+
+//print method for regexes
+void regex_print(LispObject *obj, Printer *p) {
+    Str *pattern = ((Regex*)obj)->pattern;
+    printer_puts(p, "(regex \"");
+    printer_write(p, pattern->array, pattern->size);
+    printer_puts(p, "\")");
+}
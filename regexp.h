@@ -0,0 +1,74 @@
+#ifndef _REGEXP_H_
+#define _REGEXP_H_
+
+#include "common.h"
+#include "lisptype.h"
+#include <stdint.h>
+
+//most dfa states a regex keeps before its cache of them is thrown away and rebuilt
+#define DFA_MAX_STATES 1024
+//number of compiled regexes kept for patterns given as strs
+#define REGEX_CACHE_SIZE 64
+
+//a state of a thompson nfa, chars in class move to out, splits move to out and out1
+//without reading anything
+typedef struct {
+    int kind;
+    int out;
+    int out1;
+    uint32_t class[8];
+} NfaState;
+
+typedef struct {
+    NfaState *states;
+    int nstates;
+    int start;
+} Nfa;
+
+//a dfa state stands for a set of nfa states, its transitions are filled in as they're used
+typedef struct DfaState_S {
+    struct DfaState_S *next[256];
+    bool match;
+    int nstates;
+    int nfa_states[];
+} DfaState;
+
+//a dfa built lazily from an nfa. unanchored dfas also start a new match at every char
+typedef struct {
+    Nfa *nfa;
+    bool unanchored;
+    DfaState **table; //hash table of the states by their nfa state sets
+    int table_size;
+    int nstates;
+    int generation; //counts the times the table was emptied
+    DfaState *start;
+    int *marks; //scratch space for working out state sets
+    int mark;
+    int *stack;
+    int *set;
+} Dfa;
+
+typedef struct {
+    LISP_OBJECT_HEADER
+    Str *pattern;
+    bool anchored_start; //the pattern started with ^
+    bool anchored_end; //the pattern ended with $
+    Nfa forward;
+    Nfa reverse; //matches the reverse of what forward matches
+    Dfa *forward_dfa;
+    Dfa *reverse_dfa;
+} Regex;
+
+LispObject *new_regex(Str *pattern);
+LispObject *new_empty_regex();
+void regex_init(Regex *re, Str *pattern);
+Regex *cached_regex(LispObject *obj);
+bool regex_match(Regex *re, char *s, int len);
+bool regex_search(Regex *re, char *s, int len, int *start_out, int *end_out);
+LispObject *regex_find_all(Regex *re, Str *s);
+void free_regex(Regex *re);
+void regex_print(LispObject *obj, Printer *p);
+
+extern LispType RegexType;
+
+#endif
@@ -0,0 +1,245 @@
+#include "rope.h"
+#include "alloc.h"
+#include "error.h"
+#include "printer.h"
+#include <string.h>
+#include <limits.h>
+
+LispType StrBuilderType = {&TypeType, "string-builder", str_builder_print, sizeof(StrBuilder)};
+LispType RopeType = {&TypeType, "rope", rope_print, sizeof(Rope)};
+
+static void check_size(int a, int b) {
+    if(a > INT_MAX - 1 - b)
+        error("Horrible error, a string of %d and %d chars would be too long\n", a, b);
+}
+
+//calls f with ctx and the chars of each leaf of r in order
+static void each_leaf(Rope *r, void (*f)(void *ctx, char *chars, int len), void *ctx) {
+    while(r->left != NULL) {
+        each_leaf(r->left, f, ctx);
+        r = r->right;
+    }
+    if(r->size > 0)
+        f(ctx, r->str->array + r->offset, r->size);
+}
+
+//=string builder=
+
+//creates a new, empty string builder with room for capacity chars
+LispObject *new_str_builder(int capacity) {
+    if(capacity < 16)
+        capacity = 16;
+    StrBuilder *out = alloc(sizeof(*out));
+    out->type = &StrBuilderType;
+    out->array = malloc(capacity);
+    if(out->array == NULL)
+        error("out of memory\n");
+    out->array_size = capacity;
+    return (LispObject*)out;
+}
+
+static void append_chars(void *ctx, char *chars, int len) {
+    StrBuilder *b = ctx;
+    check_size(b->size, len);
+    if(b->size + len > b->array_size) {
+        int new_size = b->array_size;
+        while(new_size < b->size + len)
+            new_size = new_size > INT_MAX / 2 ? INT_MAX : new_size * 2;
+        char *new_array = realloc(b->array, new_size);
+        if(new_array == NULL)
+            error("out of memory\n");
+        b->array = new_array;
+        b->array_size = new_size;
+    }
+    memcpy(b->array + b->size, chars, len);
+    b->size += len;
+}
+
+//appends the len chars at chars to b
+void str_builder_append_chars(StrBuilder *b, char *chars, int len) {
+    append_chars(b, chars, len);
+}
+
+//appends the chars of obj, a str or rope, to b
+void str_builder_append(StrBuilder *b, LispObject *obj) {
+    if(obj->type == &RopeType) {
+        each_leaf((Rope*)obj, append_chars, b);
+        return;
+    }
+    Str *s = safe_cast(obj, &StrType);
+    append_chars(b, s->array, s->size);
+}
+
+//returns a new str of the chars appended to b so far
+Str *str_builder_build(StrBuilder *b) {
+    return new_str_from(b->array, b->size);
+}
+
+//print method for string builders
+void str_builder_print(LispObject *obj, Printer *p) {
+    StrBuilder *b = (StrBuilder*)obj;
+    printer_puts(p, "(string-builder \"");
+    printer_write(p, b->array, b->size);
+    printer_puts(p, "\")");
+}
+
+//=rope=
+
+static Rope *new_rope_leaf(Str *s, int offset, int size) {
+    Rope *out = alloc(sizeof(*out));
+    out->type = &RopeType;
+    out->str = size > 0 ? s : NULL;
+    out->offset = offset;
+    out->size = size;
+    return out;
+}
+
+static Rope *new_rope_node(Rope *left, Rope *right) {
+    check_size(left->size, right->size);
+    Rope *out = alloc(sizeof(*out));
+    out->type = &RopeType;
+    out->left = left;
+    out->right = right;
+    out->size = left->size + right->size;
+    out->depth = 1 + (left->depth > right->depth ? left->depth : right->depth);
+    return out;
+}
+
+//returns a node of left and right, rotated to be balanced if one is 2 deeper than the other
+static Rope *balanced_node(Rope *left, Rope *right) {
+    if(left->depth > right->depth + 1) {
+        if(left->left->depth >= left->right->depth)
+            return new_rope_node(left->left, new_rope_node(left->right, right));
+        Rope *middle = left->right;
+        return new_rope_node(new_rope_node(left->left, middle->left),
+                             new_rope_node(middle->right, right));
+    }
+    if(right->depth > left->depth + 1) {
+        if(right->right->depth >= right->left->depth)
+            return new_rope_node(new_rope_node(left, right->left), right->right);
+        Rope *middle = right->left;
+        return new_rope_node(new_rope_node(left, middle->left),
+                             new_rope_node(middle->right, right->right));
+    }
+    return new_rope_node(left, right);
+}
+
+static void copy_chars(void *ctx, char *chars, int len) {
+    char **out = ctx;
+    memcpy(*out, chars, len);
+    *out += len;
+}
+
+//returns a rope of the chars of left followed by those of right. the shallower one is
+//joined in down the side of the deeper one, so only nodes on that path are made
+static Rope *rope_join(Rope *left, Rope *right) {
+    if(left->size == 0)
+        return right;
+    if(right->size == 0)
+        return left;
+    if(left->left == NULL && right->left == NULL && left->size + right->size <= ROPE_LEAF_SIZE) {
+        Str *s = new_str_with_size(left->size + right->size + 1);
+        char *out = s->array;
+        copy_chars(&out, left->str->array + left->offset, left->size);
+        copy_chars(&out, right->str->array + right->offset, right->size);
+        *out = '\0';
+        s->size = left->size + right->size;
+        return new_rope_leaf(s, 0, s->size);
+    }
+    if(left->depth > right->depth + 1)
+        return balanced_node(left->left, rope_join(left->right, right));
+    if(right->depth > left->depth + 1)
+        return balanced_node(rope_join(left, right->left), right->right);
+    return new_rope_node(left, right);
+}
+
+//splits r into ropes of its chars before index i and of those from i on
+static void rope_split(Rope *r, int i, Rope **before, Rope **after) {
+    if(i == 0 || i == r->size) {
+        Rope *empty = new_rope_leaf(NULL, 0, 0);
+        *before = i == 0 ? empty : r;
+        *after = i == 0 ? r : empty;
+    } else if(r->left == NULL) {
+        *before = new_rope_leaf(r->str, r->offset, i);
+        *after = new_rope_leaf(r->str, r->offset + i, r->size - i);
+    } else if(i <= r->left->size) {
+        Rope *rest;
+        rope_split(r->left, i, before, &rest);
+        *after = rope_join(rest, r->right);
+    } else {
+        Rope *rest;
+        rope_split(r->right, i - r->left->size, &rest, after);
+        *before = rope_join(r->left, rest);
+    }
+}
+
+static Rope *as_rope(LispObject *obj) {
+    if(obj->type == &RopeType)
+        return (Rope*)obj;
+    Str *s = safe_cast(obj, &StrType);
+    return new_rope_leaf(s, 0, s->size);
+}
+
+//joins parts into a rope, half and half so every part is only joined in O(1) times
+static Rope *join_parts(LispObject **parts, int n) {
+    if(n == 0)
+        return new_rope_leaf(NULL, 0, 0);
+    if(n == 1)
+        return as_rope(parts[0]);
+    Rope *left = join_parts(parts, n / 2);
+    return rope_join(left, join_parts(parts + n / 2, n - n / 2));
+}
+
+//returns a rope of the chars of the strs and ropes in parts, sharing them
+//raises an exception if any part is something else
+LispObject *new_rope(int argc, LispObject **parts) {
+    return (LispObject*)join_parts(parts, argc);
+}
+
+static void check_range(Rope *r, int start, int len, char *builtin) {
+    if(start < 0 || len < 0 || start > r->size - len)
+        error("Horrible error, %s of %d chars from %d is out of range in a rope of %d chars\n",
+              builtin, len, start, r->size);
+}
+
+//returns a rope of the len chars of r from start, sharing them
+LispObject *rope_slice(Rope *r, int start, int len) {
+    check_range(r, start, len, "rope-slice");
+    Rope *before, *rest, *middle, *after;
+    rope_split(r, start, &before, &rest);
+    rope_split(rest, len, &middle, &after);
+    return (LispObject*)middle;
+}
+
+//returns a rope of r with the len chars from start replaced by insert, a str or rope,
+//or removed if insert is NULL
+LispObject *rope_splice(Rope *r, int start, int len, LispObject *insert) {
+    check_range(r, start, len, "rope-splice");
+    Rope *before, *rest, *middle, *after;
+    rope_split(r, start, &before, &rest);
+    rope_split(rest, len, &middle, &after);
+    if(insert != NULL)
+        before = rope_join(before, as_rope(insert));
+    return (LispObject*)rope_join(before, after);
+}
+
+//returns a new str of the chars of r
+Str *rope_build(Rope *r) {
+    Str *out = new_str_with_size(r->size + 1);
+    char *chars = out->array;
+    each_leaf(r, copy_chars, &chars);
+    *chars = '\0';
+    out->size = r->size;
+    return out;
+}
+
+static void print_chars(void *ctx, char *chars, int len) {
+    printer_write(ctx, chars, len);
+}
+
+//print method for ropes, which print like the strs they stand for
+void rope_print(LispObject *obj, Printer *p) {
+    printer_write(p, "\"", 1);
+    each_leaf((Rope*)obj, print_chars, p);
+    printer_write(p, "\"", 1);
+}
@@ -0,0 +1,48 @@
+#ifndef _ROPE_H_
+#define _ROPE_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//leaves shorter than this together are joined into one by copying their chars, so
+//ropes built from many small pieces don't end up with a node for each
+#define ROPE_LEAF_SIZE 512
+
+//a mutable buffer that strs and ropes are appended to, doubling when it's full
+typedef struct {
+    LISP_OBJECT_HEADER
+    char *array;
+    int array_size;
+    int size;
+} StrBuilder;
+
+//an immutable string kept as a balanced tree. leaves view size chars of str from
+//offset, nodes stand for the chars of left followed by those of right. the depths of
+//the two sides of a node differ by at most 1, so splitting and joining ropes only makes
+//O(log n) new nodes, sharing the rest with the ropes they came from
+typedef struct Rope_S {
+    LISP_OBJECT_HEADER
+    struct Rope_S *left; //NULL in leaves
+    struct Rope_S *right;
+    Str *str; //NULL in nodes and empty leaves
+    int offset;
+    int size;
+    int depth; //0 for leaves
+} Rope;
+
+LispObject *new_str_builder(int capacity);
+void str_builder_append(StrBuilder *b, LispObject *obj);
+void str_builder_append_chars(StrBuilder *b, char *chars, int len);
+Str *str_builder_build(StrBuilder *b);
+void str_builder_print(LispObject *obj, Printer *p);
+
+LispObject *new_rope(int argc, LispObject **parts);
+LispObject *rope_slice(Rope *r, int start, int len);
+LispObject *rope_splice(Rope *r, int start, int len, LispObject *insert);
+Str *rope_build(Rope *r);
+void rope_print(LispObject *obj, Printer *p);
+
+extern LispType StrBuilderType;
+extern LispType RopeType;
+
+#endif
@@ -0,0 +1,76 @@
+#include "runtime.h"
+#include "alloc.h"
+#include "builtins.h"
+#include "symboltable.h"
+#include "error.h"
+#include "safepoint.h"
+#include "printer.h"
+
+//sets up the allocator, the stack limit and stdout_printer, but not the symbol table,
+//which is either made by init_runtime or restored from an image (see image.c)
+//stack_base is the address of a local variable in main, or as close to it as possible
+void init_runtime_memory(void *stack_base) {
+    init_stack_limit(stack_base);
+    init_alloc_system(stack_base);
+    printer_init_file(stdout_printer, stdout);
+}
+
+//sets up the allocator, the symbol table and the builtin functions
+//shared by the interpreter and programs compiled with --compile-c
+void init_runtime(void *stack_base) {
+    init_runtime_memory(stack_base);
+    init_symboltable();
+    register_builtin_functions();
+
+    new_var(new_symbol("nil"), (LispObject*)nil);
+    new_var(new_symbol("t"), (LispObject*)new_symbol("t"));
+}
+
+//prints the error that was raised and the stack trace at the time, then unwinds
+//the scope and call stacks back to the global level
+void report_error() {
+    fprintf(stderr, "%s", error_message());
+    //errors can happen before there are stacks, while loading an image
+    if(call_stack == NULL || scopes == NULL)
+        return;
+    printf("Stack trace:\n");
+    for(int i = 0; i < call_stack->size; i++) {
+        printf("  ");
+        obj_print(vector_getitem(call_stack, i));
+        printf("\n");
+    }
+    while(scopes->size > 1)
+        pop_scope();
+    while(call_stack->size > 1)
+        vector_remove(call_stack, -1);
+}
+
+//returns the function fn_form evaluates to in the global scope, evaluating it the first
+//time and caching it in *cache. compiled code uses this to fall back on the interpreter
+LispObject *global_function(LispObject **cache, LispObject *fn_form) {
+    if(*cache == NULL) {
+        push_scope((ConsCell*)vector_getitem(scopes, 0));
+        *cache = eval_sub(fn_form);
+        pop_scope();
+    }
+    return *cache;
+}
+
+//entry point of a program compiled with --compile-c. init_constants builds the data
+//the program refers to, forms is a NULL terminated array of its top level forms
+void run_compiled_program(void (*init_constants)(), void (**forms)()) {
+    char stack_base;
+    init_runtime(&stack_base);
+    set_automatic_gc(true);
+
+    ExceptionPoint ep;
+    push_exception_point(&ep);
+    if(setjmp(ep.jmp) == 0) {
+        init_constants();
+        for(int i = 0; forms[i] != NULL; i++)
+            forms[i]();
+        pop_exception_point(&ep);
+    } else
+        report_error();
+    fflush(stdout);
+}
@@ -0,0 +1,24 @@
+#ifndef _RUNTIME_H_
+#define _RUNTIME_H_
+
+#include "common.h"
+#include "lisptype.h"
+#include "builtins.h"
+
+//record a call on the call stack and take it off again, for compiled code. the same as
+//vector_append(call_stack, f) and vector_remove(call_stack, -1) without the calls
+#define PUSH_FRAME(f) do { \
+        if(call_stack->size < call_stack->array_size) \
+            call_stack->array[(call_stack->start + call_stack->size++) & (call_stack->array_size - 1)] = (f); \
+        else \
+            vector_append(call_stack, (f)); \
+    } while(0)
+#define POP_FRAME() (call_stack->size--)
+
+void init_runtime_memory(void *stack_base);
+void init_runtime(void *stack_base);
+void report_error();
+LispObject *global_function(LispObject **cache, LispObject *fn_form);
+void run_compiled_program(void (*init_constants)(), void (**forms)());
+
+#endif
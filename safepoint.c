@@ -0,0 +1,81 @@
+#define _POSIX_C_SOURCE 199309L
+#include "safepoint.h"
+#include "error.h"
+#include <time.h>
+#include <sys/resource.h>
+
+//fuel_left doesn't include the steps handed out to safepoint_countdown
+long safepoint_countdown = SAFEPOINT_INTERVAL;
+static bool has_fuel = false;
+static long fuel_left = 0;
+static double deadline = 0;
+char *stack_limit = NULL;
+
+//returns the current time in seconds from some fixed point
+double now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//called by SAFEPOINT when the countdown runs out, checks the limits and restarts it
+void safepoint_poll() {
+    safepoint_countdown = 0;
+    if(has_fuel && fuel_left <= 0)
+        raise_error(ERROR_LIMIT, "evaluation ran out of fuel\n");
+    if(deadline != 0 && now() > deadline)
+        raise_error(ERROR_LIMIT, "evaluation ran past its deadline\n");
+
+    long steps = SAFEPOINT_INTERVAL;
+    if(has_fuel) {
+        if(fuel_left < steps)
+            steps = fuel_left;
+        fuel_left -= steps;
+    }
+    //the step that called this counts as one of them
+    safepoint_countdown = steps - 1;
+}
+
+//sets stack_limit from the size of the stack, which grows down from around stack_base
+void init_stack_limit(void *stack_base) {
+    struct rlimit rl;
+    size_t size = 8 * 1024 * 1024;
+    if(getrlimit(RLIMIT_STACK, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY)
+        size = rl.rlim_cur;
+    if(size <= 2 * STACK_MARGIN)
+        size = 2 * STACK_MARGIN;
+    stack_limit = (char*)stack_base - (size - STACK_MARGIN);
+}
+
+void stack_overflow() {
+    raise_error(ERROR_LIMIT, "Horrible error, recursion too deep\n");
+}
+
+//puts the limits currently in force into out
+void get_limits(EvalLimits *out) {
+    out->has_fuel = has_fuel;
+    out->fuel = fuel_left + (safepoint_countdown > 0 ? safepoint_countdown : 0);
+    out->deadline = deadline;
+}
+
+//replaces the limits in force with limits. they take effect at the next safepoint
+void set_limits(EvalLimits *limits) {
+    has_fuel = limits->has_fuel;
+    fuel_left = limits->fuel;
+    deadline = limits->deadline;
+    safepoint_countdown = 0;
+}
+
+//tightens the limits in force to at most fuel more steps and seconds more seconds
+//a negative fuel or seconds leaves that limit as it is
+void limit_evaluation(long fuel, double seconds) {
+    EvalLimits limits;
+    get_limits(&limits);
+    if(fuel >= 0 && (!limits.has_fuel || fuel < limits.fuel)) {
+        limits.has_fuel = true;
+        limits.fuel = fuel;
+    }
+    if(seconds >= 0 && (limits.deadline == 0 || now() + seconds < limits.deadline))
+        limits.deadline = now() + seconds;
+    set_limits(&limits);
+}
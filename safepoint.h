@@ -0,0 +1,38 @@
+#ifndef _SAFEPOINT_H_
+#define _SAFEPOINT_H_
+
+#include "common.h"
+
+//evaluation steps between checks of the deadline
+#define SAFEPOINT_INTERVAL 1024
+
+//limits on how long evaluation may run, checked at safepoints
+//fuel is a number of evaluation steps, deadline a time in seconds as given by now()
+typedef struct {
+    bool has_fuel;
+    long fuel;
+    double deadline; //0 for none
+} EvalLimits;
+
+//space left on the C stack below stack_limit, so deep recursion can be stopped with an error
+#define STACK_MARGIN (512 * 1024)
+
+extern long safepoint_countdown;
+extern char *stack_limit;
+
+//counts an evaluation step, raising an ERROR_LIMIT error once the fuel or the time
+//is used up. the limits are only looked at every SAFEPOINT_INTERVAL steps
+#define SAFEPOINT() do { if(safepoint_countdown-- <= 0) safepoint_poll(); } while(0)
+
+//raises an ERROR_LIMIT error if the C stack is nearly full, for places that recurse
+#define CHECK_STACK() do { char here; if(&here < stack_limit) stack_overflow(); } while(0)
+
+void safepoint_poll();
+void stack_overflow();
+void init_stack_limit(void *stack_base);
+double now();
+void get_limits(EvalLimits *out);
+void set_limits(EvalLimits *limits);
+void limit_evaluation(long fuel, double seconds);
+
+#endif
@@ -0,0 +1,247 @@
+#include "strops.h"
+#include "alloc.h"
+#include "error.h"
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+//avx2 versions are compiled for their own functions, and only called if the cpu has it
+#if defined(__GNUC__) && defined(__x86_64__)
+#define HAVE_AVX2_KERNELS
+#include <immintrin.h>
+#endif
+
+//=scalar kernels=
+
+static int find_scalar(char *s, int len, char *sub, int sublen) {
+    char *end = s + len - sublen + 1;
+    for(char *p = s; p < end; p++) {
+        p = memchr(p, sub[0], end - p);
+        if(p == NULL)
+            return -1;
+        if(!memcmp(p + 1, sub + 1, sublen - 1))
+            return p - s;
+    }
+    return -1;
+}
+
+static int find_any_scalar(char *s, int len, char *chars, int nchars) {
+    bool in_chars[256] = {false};
+    for(int i = 0; i < nchars; i++)
+        in_chars[(unsigned char)chars[i]] = true;
+    for(int i = 0; i < len; i++)
+        if(in_chars[(unsigned char)s[i]])
+            return i;
+    return -1;
+}
+
+static StrKernels scalar_kernels = {"scalar", find_scalar, find_any_scalar};
+
+//=sse2 kernels=
+
+#ifdef __SSE2__
+//compares a block of s with the first char of sub and the block sublen - 1 chars on with
+//its last char, and only checks the rest of sub where both match
+static int find_sse2(char *s, int len, char *sub, int sublen) {
+    __m128i first = _mm_set1_epi8(sub[0]);
+    __m128i last = _mm_set1_epi8(sub[sublen - 1]);
+    int i = 0;
+    for(; i + sublen - 1 + 16 <= len; i += 16) {
+        __m128i a = _mm_loadu_si128((__m128i*)(s + i));
+        __m128i b = _mm_loadu_si128((__m128i*)(s + i + sublen - 1));
+        unsigned int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                            _mm_cmpeq_epi8(b, last)));
+        while(mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if(sublen <= 2 || !memcmp(s + i + bit + 1, sub + 1, sublen - 2))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    int out = find_scalar(s + i, len - i, sub, sublen);
+    return out < 0 ? -1 : i + out;
+}
+
+static int find_any_sse2(char *s, int len, char *chars, int nchars) {
+    __m128i wanted[16];
+    for(int j = 0; j < nchars; j++)
+        wanted[j] = _mm_set1_epi8(chars[j]);
+    int i = 0;
+    for(; i + 16 <= len; i += 16) {
+        __m128i block = _mm_loadu_si128((__m128i*)(s + i));
+        __m128i hits = _mm_cmpeq_epi8(block, wanted[0]);
+        for(int j = 1; j < nchars; j++)
+            hits = _mm_or_si128(hits, _mm_cmpeq_epi8(block, wanted[j]));
+        unsigned int mask = _mm_movemask_epi8(hits);
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    int out = find_any_scalar(s + i, len - i, chars, nchars);
+    return out < 0 ? -1 : i + out;
+}
+
+static StrKernels sse2_kernels = {"sse2", find_sse2, find_any_sse2};
+#endif
+
+//=avx2 kernels=
+
+#ifdef HAVE_AVX2_KERNELS
+//the same as the sse2 versions, 32 chars at a time
+__attribute__((target("avx2"))) static int find_avx2(char *s, int len, char *sub, int sublen) {
+    __m256i first = _mm256_set1_epi8(sub[0]);
+    __m256i last = _mm256_set1_epi8(sub[sublen - 1]);
+    int i = 0;
+    for(; i + sublen - 1 + 32 <= len; i += 32) {
+        __m256i a = _mm256_loadu_si256((__m256i*)(s + i));
+        __m256i b = _mm256_loadu_si256((__m256i*)(s + i + sublen - 1));
+        unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                  _mm256_cmpeq_epi8(b, last)));
+        while(mask != 0) {
+            int bit = __builtin_ctz(mask);
+            if(sublen <= 2 || !memcmp(s + i + bit + 1, sub + 1, sublen - 2))
+                return i + bit;
+            mask &= mask - 1;
+        }
+    }
+    int out = find_scalar(s + i, len - i, sub, sublen);
+    return out < 0 ? -1 : i + out;
+}
+
+__attribute__((target("avx2"))) static int find_any_avx2(char *s, int len, char *chars, int nchars) {
+    __m256i wanted[16];
+    for(int j = 0; j < nchars; j++)
+        wanted[j] = _mm256_set1_epi8(chars[j]);
+    int i = 0;
+    for(; i + 32 <= len; i += 32) {
+        __m256i block = _mm256_loadu_si256((__m256i*)(s + i));
+        __m256i hits = _mm256_cmpeq_epi8(block, wanted[0]);
+        for(int j = 1; j < nchars; j++)
+            hits = _mm256_or_si256(hits, _mm256_cmpeq_epi8(block, wanted[j]));
+        unsigned int mask = _mm256_movemask_epi8(hits);
+        if(mask != 0)
+            return i + __builtin_ctz(mask);
+    }
+    int out = find_any_scalar(s + i, len - i, chars, nchars);
+    return out < 0 ? -1 : i + out;
+}
+
+static StrKernels avx2_kernels = {"avx2", find_avx2, find_any_avx2};
+#endif
+
+//returns the kernels to use, the fastest ones the cpu supports unless SIMD is off
+StrKernels *str_kernels() {
+    static StrKernels *kernels = NULL;
+    if(kernels != NULL)
+        return kernels;
+    kernels = &scalar_kernels;
+    if(!SIMD)
+        return kernels;
+#ifdef __SSE2__
+    kernels = &sse2_kernels;
+#endif
+#ifdef HAVE_AVX2_KERNELS
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+        kernels = &avx2_kernels;
+#endif
+    return kernels;
+}
+
+//=str operations=
+
+//returns the index of the first occurrence of sub in s at or after start, or -1
+//an empty sub is found at start
+int str_find(Str *s, Str *sub, int start) {
+    if(start < 0 || start > s->size)
+        error("index error in str-find\n");
+    if(sub->size == 0)
+        return start;
+    if(sub->size > s->size - start)
+        return -1;
+    int out = str_kernels()->find(s->array + start, s->size - start, sub->array, sub->size);
+    return out < 0 ? -1 : start + out;
+}
+
+//returns the index of the first char of s at or after start that's in chars, or -1
+int str_find_any(Str *s, Str *chars, int start) {
+    if(start < 0 || start > s->size)
+        error("index error in str-index-of-any\n");
+    if(chars->size == 0)
+        return -1;
+    int out;
+    if(chars->size <= 16)
+        out = str_kernels()->find_any(s->array + start, s->size - start, chars->array, chars->size);
+    else
+        out = find_any_scalar(s->array + start, s->size - start, chars->array, chars->size);
+    return out < 0 ? -1 : start + out;
+}
+
+static void check_not_empty(Str *sub, char *builtin) {
+    if(sub->size == 0)
+        error("Horrible error, %s needs a non empty str to look for\n", builtin);
+}
+
+//returns the number of occurrences of sub in s that don't overlap
+int str_count(Str *s, Str *sub) {
+    check_not_empty(sub, "str-count");
+    int out = 0;
+    for(int i = str_find(s, sub, 0); i >= 0; i = str_find(s, sub, i + sub->size))
+        out++;
+    return out;
+}
+
+//returns a list of the parts of s between occurrences of sep
+LispObject *str_split(Str *s, Str *sep) {
+    check_not_empty(sep, "str-split");
+    ConsCell *out = NULL;
+    ConsCell *last = NULL;
+    int start = 0;
+    for(;;) {
+        int end = str_find(s, sep, start);
+        int piece_end = end < 0 ? s->size : end;
+        ConsCell *cell = new_cons_cell((LispObject*)new_str_from(s->array + start, piece_end - start),
+                                       (LispObject*)nil);
+        if(last == NULL)
+            out = cell;
+        else
+            last->cdr = (LispObject*)cell;
+        last = cell;
+        if(end < 0)
+            return (LispObject*)out;
+        start = end + sep->size;
+    }
+}
+
+//returns a copy of s with every occurrence of old, that doesn't overlap an earlier one,
+//replaced by new. the occurrences are found first so the result is built in one go
+Str *str_replace(Str *s, Str *old, Str *new) {
+    check_not_empty(old, "str-replace");
+    int nfound = 0;
+    int found_size = 16;
+    int *found = malloc(found_size * sizeof(int));
+    for(int i = str_find(s, old, 0); i >= 0; i = str_find(s, old, i + old->size)) {
+        if(nfound == found_size) {
+            found_size *= 2;
+            found = realloc(found, found_size * sizeof(int));
+        }
+        found[nfound++] = i;
+    }
+
+    int size = s->size + nfound * (new->size - old->size);
+    Str *out = new_str_with_size(size + 1);
+    char *p = out->array;
+    int from = 0;
+    for(int i = 0; i < nfound; i++) {
+        memcpy(p, s->array + from, found[i] - from);
+        p += found[i] - from;
+        memcpy(p, new->array, new->size);
+        p += new->size;
+        from = found[i] + old->size;
+    }
+    memcpy(p, s->array + from, s->size - from);
+    out->array[size] = '\0';
+    out->size = size;
+    free(found);
+    return out;
+}
@@ -0,0 +1,26 @@
+#ifndef _STROPS_H_
+#define _STROPS_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//the byte scanning loops the str builtins are built on, in a version for each instruction
+//set. the best one the cpu supports is picked the first time they're used
+typedef struct {
+    char *name;
+    //returns the index of the first place the sublen chars at sub occur in the len chars at s,
+    //or -1. sublen is at least 1
+    int (*find)(char *s, int len, char *sub, int sublen);
+    //returns the index of the first of the len chars at s that's one of the nchars at chars,
+    //or -1. nchars is from 1 to 16
+    int (*find_any)(char *s, int len, char *chars, int nchars);
+} StrKernels;
+
+StrKernels *str_kernels();
+int str_find(Str *s, Str *sub, int start);
+int str_find_any(Str *s, Str *chars, int start);
+int str_count(Str *s, Str *sub);
+LispObject *str_split(Str *s, Str *sep);
+Str *str_replace(Str *s, Str *old, Str *new);
+
+#endif
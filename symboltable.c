@@ -1,7 +1,15 @@
 #include "symboltable.h"
 #include "error.h"
+#include "optimize.h"
 
 Vector *scopes;
+MacroExpansion *current_expansion = NULL;
+int builtin_rebind_count = 0;
+int expansion_rebind_count = 0;
+
+//the symbols that have been passed to watch_global, symbols are never freed
+static Symbol **watched_globals = NULL;
+static int nwatched_globals = 0;
 
 //pushes the scope s onto the top of the scope stack
 void push_scope(ConsCell *s) {
@@ -24,11 +32,18 @@ LispObject *get_var(Symbol *sym) {
     while(node != nil) {
         Dict *d = (Dict*)node->car;
         LispObject *out = dict_getitem(d, (LispObject*)sym);
-        if(out != NULL)
+        if(out != NULL) {
+            if(current_expansion != NULL) {
+                if(node->cdr == (LispObject*)nil)
+                    note_global_read(sym, out);
+                else
+                    note_scope_use(node);
+            }
             return out;
+        }
         node = (ConsCell*)node->cdr;
     }
-    error("Horrible error, can't find var named %s in scope #%d\n", sym->name, scopes->size - 1);
+    raise_error(ERROR_UNBOUND, "Horrible error, can't find var named %s in scope #%d\n", sym->name, scopes->size - 1);
     return NULL; //will never actually happen btw
 }
 
@@ -38,13 +53,22 @@ void set_var(Symbol *sym, LispObject *val) {
     ConsCell *node = (ConsCell*)vector_getitem(scopes, -1);
     while(node != nil) {
         Dict *d = (Dict*)node->car;
-        if(dict_getitem(d, (LispObject*)sym)) {
+        LispObject *old = dict_getitem(d, (LispObject*)sym);
+        if(old) {
+            if(old->type == &BuiltinFunctionType) {
+                builtin_rebind_count++;
+                unresolve_heads(sym);
+            }
+            if(current_expansion != NULL)
+                current_expansion->impure = true;
+            if(sym->watched && node->cdr == (LispObject*)nil)
+                expansion_rebind_count++;
             dict_setitem(d, (LispObject*)sym, val);
             return;
         }
         node = (ConsCell*)node->cdr;
     }
-    error("Horrible error, can't find var named %s\n", sym->name);
+    raise_error(ERROR_UNBOUND, "Horrible error, can't find var named %s\n", sym->name);
 }
 
 //creates a new entry in the top scope for symbol sym with value val
@@ -54,9 +78,113 @@ void new_var(Symbol *sym, LispObject *val) {
     Dict *d = (Dict*)con->car;
     if(dict_getitem(d, (LispObject*)sym) != NULL)
         error("Horrible error, var named %s already defined in current scope\n", sym->name - 1);
+    if(current_expansion != NULL)
+        note_scope_use(con);
+    LispObject *old = lookup_var(sym);
+    if(old != NULL && old->type == &BuiltinFunctionType) {
+        builtin_rebind_count++;
+        unresolve_heads(sym);
+    }
     dict_setitem(d, (LispObject*)sym, val);
 }
 
+//returns the value for the highest entry for symbol sym in the symbol table, or NULL if there is none
+LispObject *lookup_var(Symbol *sym) {
+    ConsCell *node = (ConsCell*)vector_getitem(scopes, -1);
+    while(node != nil) {
+        LispObject *out = dict_getitem((Dict*)node->car, (LispObject*)sym);
+        if(out != NULL)
+            return out;
+        node = (ConsCell*)node->cdr;
+    }
+    return NULL;
+}
+
+//returns the value for symbol sym in the global scope, or NULL if there is none
+LispObject *lookup_global_var(Symbol *sym) {
+    ConsCell *global = (ConsCell*)vector_getitem(scopes, 0);
+    return dict_getitem((Dict*)global->car, (LispObject*)sym);
+}
+
+//returns the value for symbol sym in the global scope
+//raises an exception if there is none
+LispObject *get_global_var(Symbol *sym) {
+    LispObject *out = lookup_global_var(sym);
+    if(out == NULL)
+        raise_error(ERROR_UNBOUND, "Horrible error, can't find var named %s in the global scope\n", sym->name);
+    if(current_expansion != NULL)
+        note_global_read(sym, out);
+    return out;
+}
+
+//sets the entry for sym in the global scope to value val
+//raises an exception if no entry exists
+void set_global_var(Symbol *sym, LispObject *val) {
+    Dict *d = (Dict*)((ConsCell*)vector_getitem(scopes, 0))->car;
+    LispObject *old = dict_getitem(d, (LispObject*)sym);
+    if(old == NULL)
+        raise_error(ERROR_UNBOUND, "Horrible error, can't find var named %s\n", sym->name);
+    if(old->type == &BuiltinFunctionType) {
+        builtin_rebind_count++;
+        unresolve_heads(sym);
+    }
+    if(sym->watched)
+        expansion_rebind_count++;
+    dict_setitem(d, (LispObject*)sym, val);
+}
+
+//returns true if the highest entry for symbol sym in the symbol table is in the global scope
+bool is_global_var(Symbol *sym) {
+    ConsCell *node = (ConsCell*)vector_getitem(scopes, -1);
+    while(node != nil) {
+        if(dict_getitem((Dict*)node->car, (LispObject*)sym) != NULL)
+            return node->cdr == (LispObject*)nil;
+        node = (ConsCell*)node->cdr;
+    }
+    return false;
+}
+
+//called when the scope cell node is used during a macro expansion
+//marks the expansion impure if node belongs to the (non-global) scope of the macro's caller
+void note_scope_use(ConsCell *node) {
+    if(node->cdr == (LispObject*)nil)
+        return;
+    ConsCell *c = current_expansion->caller_context;
+    while(c != nil) {
+        if(c == node) {
+            current_expansion->impure = true;
+            return;
+        }
+        c = (ConsCell*)c->cdr;
+    }
+}
+
+//called when the global sym is read as val during a macro expansion, so a cached
+//expansion is only used while sym still has that value
+void note_global_read(Symbol *sym, LispObject *val) {
+    ConsCell *read = current_expansion->globals_read;
+    for(ConsCell *c = read; c != nil; c = (ConsCell*)((ConsCell*)c->cdr)->cdr)
+        if(c->car == (LispObject*)sym)
+            return;
+    ConsCell *rest = new_cons_cell(val, (LispObject*)read);
+    current_expansion->globals_read = new_cons_cell((LispObject*)sym, (LispObject*)rest);
+}
+
+//makes rebinding the global sym increment expansion_rebind_count
+void watch_global(Symbol *sym) {
+    if(sym->watched)
+        return;
+    sym->watched = true;
+    watched_globals = realloc(watched_globals, (nwatched_globals + 1) * sizeof(Symbol*));
+    watched_globals[nwatched_globals++] = sym;
+}
+
+//calls f with each symbol that has been passed to watch_global
+void each_watched_global(void (*f)(Symbol *sym, void *data), void *data) {
+    for(int i = 0; i < nwatched_globals; i++)
+        f(watched_globals[i], data);
+}
+
 //writes the current symbol table to stdout
 void print_symbol_table() {
     printf("nscopes: %d\n", scopes->size);
@@ -6,12 +6,41 @@
 
 extern Vector *scopes;
 
+//bookkeeping for a macro expansion in progress, see expand_macro in builtins.c
+//impure is set if the expansion reads or writes the scope of the macro's caller
+//globals_read lists the globals the expansion read, each followed by the value it got
+typedef struct {
+    ConsCell *caller_context;
+    ConsCell *globals_read;
+    bool impure;
+} MacroExpansion;
+
+extern MacroExpansion *current_expansion;
+
+//incremented whenever a global that a cached macro expansion read is rebound with set,
+//so the expansions can check theirs haven't been (see watch_global)
+extern int expansion_rebind_count;
+
+//incremented whenever a symbol bound to a builtin function is rebound or shadowed
+//with def or set, so code that assumed the builtin can be invalidated
+//forms whose head was resolved to the builtin are reverted with unresolve_heads
+extern int builtin_rebind_count;
+
 void print_symbol_table();
 void push_scope(ConsCell *con);
 void pop_scope();
 LispObject *get_var(Symbol *sym);
 void set_var(Symbol *sym, LispObject *val);
 void new_var(Symbol *sym, LispObject *val);
+bool is_global_var(Symbol *sym);
+LispObject *lookup_var(Symbol *sym);
+LispObject *lookup_global_var(Symbol *sym);
+LispObject *get_global_var(Symbol *sym);
+void set_global_var(Symbol *sym, LispObject *val);
+void note_scope_use(ConsCell *node);
+void note_global_read(Symbol *sym, LispObject *val);
+void watch_global(Symbol *sym);
+void each_watched_global(void (*f)(Symbol *sym, void *data), void *data);
 void init_symboltable();
 
 #endif
@@ -1,10 +1,22 @@
 #!/bin/bash
+#usage: ./test.sh [--aot]
+#with --aot each program is compiled to C with --compile-c and linked against liblisp.a
 
 TESTSDIR=tests
+AOT=false
+if [ "$1" == "--aot" ]; then
+    AOT=true
+fi
 
 for DIR in $TESTSDIR/*; do
     echo "===testing $DIR==="
-    ./lisp -f $DIR/program > $TESTSDIR/actual_result
+    if $AOT; then
+        ./lisp --compile-c $DIR/program -o $TESTSDIR/program.c &&
+            cc --std=c99 -I. $TESTSDIR/program.c -L. -llisp -o $TESTSDIR/program &&
+            ./$TESTSDIR/program > $TESTSDIR/actual_result
+    else
+        ./lisp -f $DIR/program > $TESTSDIR/actual_result
+    fi
     DIFF=$(diff -w $DIR/output $TESTSDIR/actual_result)
     if (($? != 0)); then
         echo "  Test FAILURE! Diff:"
@@ -14,4 +26,89 @@ for DIR in $TESTSDIR/*; do
     fi
 done
 
-rm $TESTSDIR/actual_result
+#the fasl cache, run on a copy of tests/fasl/program in a temp dir. whether or not the
+#cache is used, the output has to be the one of the source as it is
+#check_output <what> <expected output file> <lisp args>...
+check_output() {
+    local WHAT=$1
+    local EXPECTED=$2
+    shift 2
+    ./lisp "$@" > $TESTSDIR/actual_result
+    DIFF=$(diff -w $EXPECTED $TESTSDIR/actual_result)
+    if (($? != 0)); then
+        echo "  Test FAILURE $WHAT! Diff:"
+        echo $DIFF
+        SECTION_OK=false
+    fi
+}
+
+section_failure() {
+    echo "  Test FAILURE, $1"
+    SECTION_OK=false
+}
+
+if ! $AOT; then
+    echo "===testing the fasl cache==="
+    SECTION_OK=true
+    FASLDIR=$(mktemp -d)
+    SOURCE=$FASLDIR/program.l
+    FASLFILE=$FASLDIR/program.lfasl
+    cp $TESTSDIR/fasl/program $SOURCE
+
+    check_output "with --no-fasl" $TESTSDIR/fasl/output --no-fasl -f $SOURCE
+    [ -e $FASLFILE ] && section_failure "--no-fasl wrote a fasl file"
+    check_output "writing the fasl file" $TESTSDIR/fasl/output -f $SOURCE
+    [ -e $FASLFILE ] || section_failure "no fasl file was written"
+    INODE=$(stat -c %i $FASLFILE 2>/dev/null)
+    check_output "loading the fasl file" $TESTSDIR/fasl/output -f $SOURCE
+    [ "$(stat -c %i $FASLFILE 2>/dev/null)" == "$INODE" ] || section_failure "the fasl file was written again"
+
+    #an edit that keeps the size, so only the mtime tells it apart
+    sed -i 's/(twice 21)/(twice 12)/' $SOURCE
+    sed 's/^42 *$/24/' $TESTSDIR/fasl/output > $FASLDIR/changed_output
+    check_output "after the source changed" $FASLDIR/changed_output -f $SOURCE
+    [ "$(stat -c %i $FASLFILE 2>/dev/null)" != "$INODE" ] || section_failure "the stale fasl file was kept"
+
+    #puts the old source back with the size and mtime of the changed one, so the fasl file
+    #of the changed one looks up to date. only --no-fasl gives the output of the source
+    cp $TESTSDIR/fasl/program $SOURCE.new
+    touch -r $SOURCE $SOURCE.new
+    mv $SOURCE.new $SOURCE
+    check_output "loading a fasl file that looks up to date" $FASLDIR/changed_output -f $SOURCE
+    check_output "with --no-fasl and a fasl file" $TESTSDIR/fasl/output --no-fasl -f $SOURCE
+
+    #a source that rewrites itself while it runs, the fasl file of what it read is stale
+    SELF=$FASLDIR/self.l
+    printf '(print 1)\n(def out (open-output "%s"))\n(write out "(print 2)\\n")\n(close out)\n' \
+        $SELF > $SELF
+    echo 1 > $FASLDIR/self_output
+    check_output "writing a fasl file while the source changes" $FASLDIR/self_output -f $SELF
+    echo 2 > $FASLDIR/self_output
+    check_output "after the source changed itself" $FASLDIR/self_output -f $SELF
+
+    [ -z "$(ls $FASLDIR | grep 'lfasl\.')" ] || section_failure "a temp file was left behind"
+    rm -rf $FASLDIR
+    if $SECTION_OK; then
+        echo "Test Success"
+    fi
+fi
+
+#images, the program in tests/image is run and dumped, then the one run from the image
+#has to see the state it left: macros, memos, dicts, resolved heads and the rest
+if ! $AOT; then
+    echo "===testing images==="
+    SECTION_OK=true
+    IMAGEDIR=$(mktemp -d)
+    IMAGE=$IMAGEDIR/image
+
+    check_output "dumping an image" $TESTSDIR/image/output -f $TESTSDIR/image/program --dump-image $IMAGE
+    [ -e $IMAGE ] || section_failure "no image was written"
+    check_output "running from the image" $TESTSDIR/image/restored_output --image $IMAGE -f $TESTSDIR/image/restored
+
+    rm -rf $IMAGEDIR
+    if $SECTION_OK; then
+        echo "Test Success"
+    fi
+fi
+
+rm -f $TESTSDIR/actual_result $TESTSDIR/program.c $TESTSDIR/program
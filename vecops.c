@@ -0,0 +1,300 @@
+#include "vecops.h"
+#include "alloc.h"
+#include "error.h"
+#include "builtins.h"
+#include "safepoint.h"
+#include <string.h>
+#include <stdint.h>
+
+//=comparing=
+
+static bool str_less(Str *a, Str *b) {
+    int n = a->size < b->size ? a->size : b->size;
+    int c = memcmp(a->array, b->array, n);
+    return c < 0 || (c == 0 && a->size < b->size);
+}
+
+//returns true if a goes before b, by calling less if there is one
+static bool item_less(LispObject *less, LispObject *a, LispObject *b) {
+    if(less != NULL) {
+        LispObject *args[2] = {a, b};
+        return apply_values(less, 2, args) != (LispObject*)nil;
+    }
+    if(a->type == &LispIntType && b->type == &LispIntType)
+        return ((LispInt*)a)->n < ((LispInt*)b)->n;
+    if(a->type == &StrType && b->type == &StrType)
+        return str_less((Str*)a, (Str*)b);
+    error("Horrible error, can't order a %s and a %s without a function to compare them\n",
+          a->type->name, b->type->name);
+    return false;
+}
+
+//=sorting=
+
+static inline void swap_items(LispObject **a, int i, int j) {
+    LispObject *tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+//items are only ever swapped, so a comparison raising an exception can't lose any
+static void insertion_sort(LispObject **a, int n, LispObject *less) {
+    for(int i = 1; i < n; i++)
+        for(int j = i; j > 0 && item_less(less, a[j], a[j - 1]); j--)
+            swap_items(a, j, j - 1);
+}
+
+static void sift_down(LispObject **a, int i, int n, LispObject *less) {
+    for(;;) {
+        int child = 2 * i + 1;
+        if(child >= n)
+            return;
+        if(child + 1 < n && item_less(less, a[child], a[child + 1]))
+            child++;
+        if(!item_less(less, a[i], a[child]))
+            return;
+        swap_items(a, i, child);
+        i = child;
+    }
+}
+
+static void heap_sort(LispObject **a, int n, LispObject *less) {
+    for(int i = n / 2 - 1; i >= 0; i--)
+        sift_down(a, i, n, less);
+    for(int end = n - 1; end > 0; end--) {
+        swap_items(a, 0, end);
+        sift_down(a, 0, end, less);
+    }
+}
+
+//quicksorts around the median of the first, middle and last items, switching to heap sort
+//once depth runs out so bad pivots can't make it quadratic. the scans are bounded so
+//a less that isn't consistent gives a wrong order rather than running off the ends
+static void intro_sort(LispObject **a, int n, int depth, LispObject *less) {
+    while(n > SORT_INSERTION_SIZE) {
+        if(depth-- == 0) {
+            heap_sort(a, n, less);
+            return;
+        }
+        int mid = n / 2;
+        if(item_less(less, a[mid], a[0]))
+            swap_items(a, mid, 0);
+        if(item_less(less, a[n - 1], a[mid])) {
+            swap_items(a, n - 1, mid);
+            if(item_less(less, a[mid], a[0]))
+                swap_items(a, mid, 0);
+        }
+        LispObject *pivot = a[mid];
+        int i = -1;
+        int j = n;
+        for(;;) {
+            do
+                i++;
+            while(i < n - 1 && item_less(less, a[i], pivot));
+            do
+                j--;
+            while(j > 0 && item_less(less, pivot, a[j]));
+            if(i >= j)
+                break;
+            swap_items(a, i, j);
+        }
+        if(j >= n - 1)
+            j = n - 2;
+        //recurses on the smaller side and loops on the bigger one
+        if(j + 1 < n - j - 1) {
+            intro_sort(a, j + 1, depth, less);
+            a += j + 1;
+            n -= j + 1;
+        } else {
+            intro_sort(a + j + 1, n - j - 1, depth, less);
+            n = j + 1;
+        }
+    }
+    insertion_sort(a, n, less);
+}
+
+//sorts runs of SORT_INSERTION_SIZE items then merges pairs of runs between a and buf
+//until there's one, returning whichever of them it ended up in
+static LispObject **merge_sort(LispObject **a, LispObject **buf, int n, LispObject *less) {
+    for(int i = 0; i < n; i += SORT_INSERTION_SIZE)
+        insertion_sort(a + i, n - i < SORT_INSERTION_SIZE ? n - i : SORT_INSERTION_SIZE, less);
+    for(long width = SORT_INSERTION_SIZE; width < n; width *= 2) {
+        for(long lo = 0; lo < n; lo += 2 * width) {
+            int mid = lo + width < n ? lo + width : n;
+            int hi = lo + 2 * width < n ? lo + 2 * width : n;
+            int i = lo;
+            int j = mid;
+            int k = lo;
+            //takes from the right run only if it's strictly less, so equal items keep their order
+            while(i < mid && j < hi)
+                buf[k++] = item_less(less, a[j], a[i]) ? a[j++] : a[i++];
+            while(i < mid)
+                buf[k++] = a[i++];
+            while(j < hi)
+                buf[k++] = a[j++];
+        }
+        LispObject **tmp = a;
+        a = buf;
+        buf = tmp;
+    }
+    return a;
+}
+
+typedef struct {
+    uint32_t key;
+    LispObject *obj;
+} IntItem;
+
+//sorts a vector of ints by their value with an lsd radix sort, a byte at a time, skipping
+//the bytes all the ints have the same. it's stable, and never calls back into lisp
+static void radix_sort_ints(LispObject **items, int n) {
+    if(n < 2)
+        return;
+    IntItem *a = malloc(2 * (size_t)n * sizeof(IntItem));
+    if(a == NULL)
+        error("out of memory\n");
+    IntItem *b = a + n;
+    IntItem *memory = a;
+    int counts[4][256] = {{0}};
+    for(int i = 0; i < n; i++) {
+        //flipping the sign bit orders negative ints before positive ones
+        uint32_t key = (uint32_t)((LispInt*)items[i])->n ^ 0x80000000u;
+        a[i].key = key;
+        a[i].obj = items[i];
+        for(int byte = 0; byte < 4; byte++)
+            counts[byte][(key >> (8 * byte)) & 255]++;
+    }
+    for(int byte = 0; byte < 4; byte++) {
+        int shift = 8 * byte;
+        int *count = counts[byte];
+        if(count[(a[0].key >> shift) & 255] == n)
+            continue;
+        int offset = 0;
+        for(int d = 0; d < 256; d++) {
+            int c = count[d];
+            count[d] = offset;
+            offset += c;
+        }
+        for(int i = 0; i < n; i++)
+            b[count[(a[i].key >> shift) & 255]++] = a[i];
+        IntItem *tmp = a;
+        a = b;
+        b = tmp;
+    }
+    for(int i = 0; i < n; i++)
+        items[i] = a[i].obj;
+    free(memory);
+}
+
+//returns a new vector of n items, all NULL, for sorting into. being a vector, the gc
+//sees whatever is put in it
+static Vector *scratch_vector(int n) {
+    Vector *out = (Vector*)new_vector();
+    vector_reserve(out, n);
+    memset(out->array, 0, out->array_size * sizeof(LispObject*));
+    out->size = n;
+    return out;
+}
+
+//sorts v in place with less, or by the values of its ints or strs if less is NULL
+//comparisons are done in a copy, so if one raises an exception v is left as it was
+//raises an exception if less changes the size of v
+void vector_sort(Vector *v, LispObject *less, bool stable) {
+    int n = v->size;
+    LispObject **items = vector_items(v);
+    if(less == NULL) {
+        int i = 0;
+        while(i < n && items[i]->type == &LispIntType)
+            i++;
+        if(i == n) {
+            radix_sort_ints(items, n);
+            return;
+        }
+    }
+
+    Vector *work = scratch_vector(n);
+    memcpy(work->array, items, n * sizeof(LispObject*));
+    LispObject **sorted;
+    if(stable) {
+        Vector *spare = scratch_vector(n);
+        sorted = merge_sort(work->array, spare->array, n, less);
+    } else {
+        int depth = 0;
+        for(int m = n; m > 1; m /= 2)
+            depth += 2;
+        intro_sort(work->array, n, depth, less);
+        sorted = work->array;
+    }
+    if(v->size != n)
+        error("Horrible error, vector changed size while it was being sorted\n");
+    memcpy(vector_items(v), sorted, n * sizeof(LispObject*));
+}
+
+//=searching=
+
+//returns the index of an item of the sorted vector v equal to x, or if there isn't one,
+//-1 - the index x would be inserted at to keep v sorted
+int vector_binary_search(Vector *v, LispObject *x, LispObject *less) {
+    int lo = 0;
+    int hi = v->size;
+    while(lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if(item_less(less, vector_getitem(v, mid), x))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if(lo < v->size && !item_less(less, x, vector_getitem(v, lo)))
+        return lo;
+    return -lo - 1;
+}
+
+//=bulk operations=
+
+//fn may change v, so the loops go by its size as it is at each step
+
+//returns a new vector of fn applied to each item of v
+LispObject *vector_map(LispObject *fn, Vector *v) {
+    Vector *out = (Vector*)new_vector();
+    vector_reserve(out, v->size);
+    for(int i = 0; i < v->size; i++) {
+        SAFEPOINT();
+        LispObject *x = vector_getitem(v, i);
+        vector_append(out, apply_values(fn, 1, &x));
+    }
+    return (LispObject*)out;
+}
+
+//returns a new vector of the items of v that fn returns non-nil for
+LispObject *vector_filter(LispObject *fn, Vector *v) {
+    Vector *out = (Vector*)new_vector();
+    for(int i = 0; i < v->size; i++) {
+        SAFEPOINT();
+        LispObject *x = vector_getitem(v, i);
+        if(apply_values(fn, 1, &x) != (LispObject*)nil)
+            vector_append(out, x);
+    }
+    return (LispObject*)out;
+}
+
+//applies fn to init and the first item of v, then to that result and the second, and
+//so on, returning the last result
+LispObject *vector_reduce(LispObject *fn, LispObject *init, Vector *v) {
+    LispObject *args[2] = {init, NULL};
+    for(int i = 0; i < v->size; i++) {
+        SAFEPOINT();
+        args[1] = vector_getitem(v, i);
+        args[0] = apply_values(fn, 2, args);
+    }
+    return args[0];
+}
+
+//sets items from to to - 1 of v to x
+//raises an exception unless 0 <= from <= to <= the size of v
+void vector_fill(Vector *v, LispObject *x, int from, int to) {
+    if(from < 0 || from > to || to > v->size)
+        error("Horrible error, can't fill %d to %d of a vector of size %d\n", from, to, v->size);
+    LispObject **items = vector_items(v);
+    for(int i = from; i < to; i++)
+        items[i] = x;
+}
@@ -0,0 +1,20 @@
+#ifndef _VECOPS_H_
+#define _VECOPS_H_
+
+#include "common.h"
+#include "lisptype.h"
+
+//runs of at most this many items are insertion sorted
+#define SORT_INSERTION_SIZE 16
+
+//without a function to compare them, ints and strs sort by value, and vectors of only
+//ints are radix sorted without calling anything. less is a function of two items
+//returning non-nil if the first goes before the second
+void vector_sort(Vector *v, LispObject *less, bool stable);
+int vector_binary_search(Vector *v, LispObject *x, LispObject *less);
+LispObject *vector_map(LispObject *fn, Vector *v);
+LispObject *vector_filter(LispObject *fn, Vector *v);
+LispObject *vector_reduce(LispObject *fn, LispObject *init, Vector *v);
+void vector_fill(Vector *v, LispObject *x, int from, int to);
+
+#endif